@@ -0,0 +1,326 @@
+/*
+ * Measures what zlib@openssh.com compression gains at different link
+ * bandwidths. Data is sent on a direct-tcpip channel to a stand-in server,
+ * which echoes it; the connection passes through a proxy that limits each
+ * direction to the given bandwidth, so no tc setup is needed.
+ *
+ * Text resembling log output and random data are each sent without
+ * compression, compressed at the default level and compressed with the
+ * level picked adaptively. Reported is the payload echoed per second,
+ * which exceeds the link bandwidth as long as compression keeps up with
+ * it, and for adaptive compression the level most of the data was
+ * compressed at. The stand-in server compresses its echo the same way, so
+ * its fixed level doesn't cap the adaptive echo. A bandwidth of 0 leaves
+ * the link unlimited.
+ *
+ * usage: compress-bench [-t seconds] [mbit_per_s ...]
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <err.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "callback.h"
+#include "numbers.h"
+#include "standin-server.h"
+#include "transport.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool WriteFully(int fd, const char* p, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+/*
+ * Forwards data from 'src' to 'dst' at no more than 'rate' bytes per
+ * second, or as fast as possible if it is 0. Once either side is closed,
+ * both are shut down, so the other direction stops as well.
+ */
+void Throttle(int src, int dst, double rate)
+{
+	// Small chunks keep slow links from being bursty
+	char buf[16384];
+	const size_t chunkSize = rate > 0 && rate < 1e6 ? 1500 : sizeof(buf);
+	Clock::time_point next = Clock::now();
+	while (true) {
+		ssize_t n = read(src, buf, chunkSize);
+		if (n <= 0 || !WriteFully(dst, buf, n))
+			break;
+		if (rate > 0) {
+			next = std::max(next, Clock::now()) + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(n / rate));
+			std::this_thread::sleep_until(next);
+		}
+	}
+	shutdown(src, SHUT_RDWR);
+	shutdown(dst, SHUT_RDWR);
+}
+
+//! Lines like a web server would log: repetitive in form, not in content
+std::string MakeText(size_t size)
+{
+	static const char* levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+	static const char* paths[] = { "/", "/index.html", "/api/v1/users", "/api/v1/orders", "/static/app.js", "/login" };
+	static const unsigned int statuses[] = { 200, 200, 200, 304, 404, 500 };
+	std::mt19937 rng(1);
+	std::string text;
+	unsigned int ms = 0;
+	while (text.size() < size) {
+		ms += rng() % 50;
+		char line[256];
+		snprintf(line, sizeof(line), "2026-10-18 12:%02u:%02u.%03u %-5s [worker-%u] GET %s from 10.%u.%u.%u: %u in %u ms\n",
+		 ms / 60000 % 60, ms / 1000 % 60, ms % 1000, levels[rng() % 6], static_cast<unsigned int>(rng() % 32), paths[rng() % 6],
+		 static_cast<unsigned int>(rng() % 4), static_cast<unsigned int>(rng() % 256), static_cast<unsigned int>(rng() % 256),
+		 statuses[rng() % 6], static_cast<unsigned int>(rng() % 500));
+		text += line;
+	}
+	text.resize(size);
+	return text;
+}
+
+std::string MakeRandom(size_t size)
+{
+	std::mt19937 rng(1);
+	std::string data(size, '\0');
+	for (char& c : data)
+		c = static_cast<char>(rng());
+	return data;
+}
+
+//! Authenticates, then keeps an echo channel filled with 'data' and counts what comes back
+class BenchCallback : public RSSH::Callback {
+public:
+	BenchCallback(const std::string& data)
+		: m_Transport(NULL), m_Data(data), m_Offset(0), m_Channel(-1), m_Sent(0), m_Received(0) { }
+
+	//! The transport needs us to be constructed, so it is only set afterwards
+	void SetTransport(RSSH::Transport& transport) { m_Transport = &transport; }
+
+	std::string GetUserName() override { return "bench"; }
+	bool OnVerifyHostKeySignature(const std::string& signature) override { return true; }
+	void OnTransportEstablished() override {
+		m_Transport->RequestService(RSSH::Numbers::ServiceNames::UserAuth);
+	}
+	void OnServiceAccepted(const std::string& serviceName) override {
+		if (serviceName == RSSH::Numbers::ServiceNames::UserAuth)
+			m_Transport->RequestUserAuth(RSSH::Numbers::ServiceNames::Connection, "bench");
+	}
+	void OnAuthenticationSuccess() override {
+		m_Channel = m_Transport->OpenDirectTcpIp("localhost", 7, "127.0.0.1", 40000);
+	}
+	void OnAuthenticationFailure(bool partial_success, const RSSH::Types::NameList& next_auths) override {
+		errx(1, "authentication failed");
+	}
+	void OnChannelOpened(int channelNumber) override { Send(); }
+	void OnChannelWritable(int channelNumber) override { Send(); }
+	void OnChannelData(int channelNumber, const uint8_t* data, size_t len) override {
+		m_Received += len;
+		m_Transport->ChannelDataConsumed(channelNumber, len);
+		Send();
+	}
+
+	uint64_t GetReceived() const { return m_Received; }
+
+private:
+	/*
+	 * Data still to be echoed is limited: if it piled up in front of the
+	 * link, our window adjusts would queue behind it, and the echo would
+	 * be held back by flow control rather than by the link.
+	 */
+	static const uint64_t maxInFlight = 256 * 1024;
+
+	void Send() {
+		size_t room;
+		while (m_Sent - m_Received < maxInFlight && (room = m_Transport->GetChannelSendRoom(m_Channel)) > 0) {
+			const size_t n = std::min(room, m_Data.size() - m_Offset);
+			m_Transport->TransmitChannelData(m_Channel, reinterpret_cast<const uint8_t*>(m_Data.data()) + m_Offset, n);
+			m_Offset = (m_Offset + n) % m_Data.size();
+			m_Sent += n;
+		}
+	}
+
+	RSSH::Transport* m_Transport;
+	const std::string& m_Data;
+	size_t m_Offset;
+	int m_Channel;
+	uint64_t m_Sent;
+	uint64_t m_Received;
+};
+
+int ConnectToServer(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		err(1, "socket");
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(port);
+	if (connect(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0)
+		err(1, "connect");
+	return fd;
+}
+
+enum class Mode { None, Fixed, Adaptive };
+
+struct Result {
+	//! Bytes echoed per second
+	double m_Rate;
+
+	//! Level at which most of the data was compressed while measuring, -1 if not compressed
+	int m_Level;
+};
+
+//! Input per level compressed so far
+std::vector<uint64_t> GetLevelInput(const RSSH::Transport& transport)
+{
+	std::vector<uint64_t> input(RSSH::Compressor::numLevels);
+	const RSSH::Compressor* compressor = transport.GetCompressor();
+	if (compressor != NULL)
+		for (int level = 0; level < RSSH::Compressor::numLevels; level++)
+			input[level] = compressor->GetStatistics(level).m_BytesIn;
+	return input;
+}
+
+//! Echoes 'data' for 'seconds' over a link of 'rate' bytes per second
+Result Measure(StandInServer& standIn, const std::string& data, Mode mode, double rate, double seconds)
+{
+	int client[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, client) < 0)
+		err(1, "socketpair");
+	standIn.SetAdaptiveCompression(mode == Mode::Adaptive);
+	const int server = ConnectToServer(standIn.GetPort());
+	std::thread upstream(Throttle, client[1], server, rate);
+	std::thread downstream(Throttle, server, client[1], rate);
+
+	// The transport points to the callback and vice versa
+	struct Client {
+		Client(const std::string& data) : m_Callback(data), m_Transport(m_Callback) { m_Callback.SetTransport(m_Transport); }
+		BenchCallback m_Callback;
+		RSSH::Transport m_Transport;
+	};
+	Result result;
+	{
+		Client c(data);
+		RSSH::Transport& transport = c.m_Transport;
+		transport.GetPreferences().SetCompression(mode != Mode::None ? "zlib@openssh.com" : "none");
+		transport.GetCompressionSettings().m_Adaptive = mode == Mode::Adaptive;
+		transport.Attach(client[0]);
+
+		// Give the link time to fill up before measuring
+		double start = 0, end = 0;
+		uint64_t startReceived = 0;
+		std::vector<uint64_t> startInput;
+		while (start == 0 || Now() < end) {
+			struct pollfd pfd;
+			pfd.fd = client[0];
+			pfd.events = POLLIN | (transport.HasPendingOutput() ? POLLOUT : 0);
+			if (poll(&pfd, 1, 100) < 0)
+				err(1, "poll");
+			if (pfd.revents & POLLOUT)
+				transport.Flush();
+			if (pfd.revents & POLLIN)
+				transport.Process();
+			if (start == 0 && c.m_Callback.GetReceived() > 0) {
+				start = Now() + 0.5;
+				end = start + seconds;
+			}
+			if (startReceived == 0 && start != 0 && Now() >= start) {
+				startReceived = c.m_Callback.GetReceived();
+				startInput = GetLevelInput(transport);
+			}
+		}
+		result.m_Rate = (c.m_Callback.GetReceived() - startReceived) / seconds;
+		result.m_Level = -1;
+		const std::vector<uint64_t> input = GetLevelInput(transport);
+		uint64_t most = 0;
+		for (int level = 0; level < RSSH::Compressor::numLevels; level++) {
+			if (input[level] - startInput[level] > most) {
+				most = input[level] - startInput[level];
+				result.m_Level = level;
+			}
+		}
+	}
+	// The transport closed client[0]; this unwinds the proxy and the server
+	upstream.join();
+	downstream.join();
+	close(client[1]);
+	close(server);
+	return result;
+}
+
+} // unnamed namespace
+
+int
+main(int argc, char* argv[])
+{
+	double seconds = 2;
+	int opt;
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch(opt) {
+			case 't':
+				seconds = atof(optarg);
+				break;
+			default:
+				errx(1, "usage: %s [-t seconds] [mbit_per_s ...]", argv[0]);
+		}
+	}
+	std::vector<double> bandwidths;
+	for (int n = optind; n < argc; n++)
+		bandwidths.push_back(atof(argv[n]));
+	if (bandwidths.empty())
+		bandwidths = { 1, 10, 100, 0 };
+	signal(SIGPIPE, SIG_IGN);
+
+	// Larger than the compression window, so it can't just refer back to the previous round
+	const std::string text = MakeText(1024 * 1024);
+	const std::string random = MakeRandom(1024 * 1024);
+
+	StandInServer server;
+	printf("%12s %12s %12s %12s %6s %12s %12s %12s %6s\n", "link Mbit/s", "text MB/s", "zlib MB/s", "adaptive", "level",
+	 "random MB/s", "zlib MB/s", "adaptive", "level");
+	for (double mbit : bandwidths) {
+		const double rate = mbit * 1e6 / 8;
+		printf("%12.0f", mbit);
+		for (const std::string* data : { &text, &random }) {
+			const Result plain = Measure(server, *data, Mode::None, rate, seconds);
+			const Result fixed = Measure(server, *data, Mode::Fixed, rate, seconds);
+			const Result adaptive = Measure(server, *data, Mode::Adaptive, rate, seconds);
+			printf(" %12.2f %12.2f %12.2f %6d", plain.m_Rate / 1e6, fixed.m_Rate / 1e6, adaptive.m_Rate / 1e6, adaptive.m_Level);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+	return 0;
+}
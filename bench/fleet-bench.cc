@@ -0,0 +1,99 @@
+/*
+ * Measures how many hosts per second the fleet engine gets through. Every
+ * "host" is a connection to a stand-in server on the loopback interface,
+ * so each one costs a full key exchange, authentication and an exec
+ * request. Output is discarded.
+ *
+ * The stand-in server uses a thread per connection and does its half of
+ * the key exchange there, so it competes with the client for the CPU;
+ * the numbers are a lower bound on what the client can do.
+ *
+ * Use -u to do socket I/O using io_uring.
+ *
+ * usage: fleet-bench [-u] [-n hosts] [-T threads] [concurrency ...]
+ */
+#include <err.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "fleet.h"
+#include "standin-server.h"
+
+namespace {
+
+double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+} // unnamed namespace
+
+int
+main(int argc, char* argv[])
+{
+	unsigned int numHosts = 500;
+	unsigned int numThreads = 1;
+	bool useRing = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:T:u")) != -1) {
+		switch(opt) {
+			case 'n':
+				numHosts = atoi(optarg);
+				break;
+			case 'T':
+				numThreads = atoi(optarg);
+				break;
+			case 'u':
+				useRing = true;
+				break;
+			default:
+				errx(1, "usage: %s [-u] [-n hosts] [-T threads] [concurrency ...]", argv[0]);
+		}
+	}
+	std::vector<unsigned int> concurrencies;
+	for (int n = optind; n < argc; n++)
+		concurrencies.push_back(atoi(argv[n]));
+	if (concurrencies.empty())
+		concurrencies = { 1, 8, 64, 256 };
+	signal(SIGPIPE, SIG_IGN);
+
+	StandInServer server;
+	std::vector<RSSH::Fleet::Host> hosts(numHosts);
+	for (unsigned int n = 0; n < numHosts; n++) {
+		hosts[n].m_UserName = "bench";
+		hosts[n].m_HostName = "127.0.0.1";
+		hosts[n].m_Port = server.GetPort();
+		hosts[n].m_Name = "host" + std::to_string(n);
+	}
+
+	printf("%12s %8s %12s %8s\n", "concurrency", "threads", "hosts/s", "failed");
+	for (unsigned int concurrency : concurrencies) {
+		RSSH::Fleet::Settings settings;
+		settings.m_Concurrency = concurrency;
+		settings.m_Threads = numThreads;
+		settings.m_UseRing = useRing;
+		settings.m_Command = "true";
+		settings.m_OutputFD = -1;
+		settings.m_ErrorFD = -1;
+		RSSH::Fleet fleet(settings);
+
+		double start = Now();
+		fleet.Run(hosts);
+		double elapsed = Now() - start;
+
+		unsigned int failed = 0;
+		for (const RSSH::Fleet::Result& result : fleet.GetResults()) {
+			if (result.m_Outcome != RSSH::Fleet::Result::Outcome::Exited || result.m_ExitStatus != 0)
+				failed++;
+		}
+		printf("%12u %8u %12.1f %8u\n", concurrency, numThreads, numHosts / elapsed, failed);
+	}
+	return 0;
+}
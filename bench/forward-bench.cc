@@ -0,0 +1,480 @@
+/*
+ * Measures local port forwarding: connections per second and aggregate
+ * throughput through a tunnel. A single client connection to a stand-in
+ * server on the loopback interface carries all forwarded connections;
+ * the server echoes whatever is sent on a direct-tcpip channel.
+ *
+ * For connections per second, every load thread repeatedly connects,
+ * sends a short message, reads the echo and closes. For throughput, every
+ * connection has a thread writing and one reading; the bytes echoed back
+ * are counted. For remote forwarding, the server keeps a number of
+ * forwarded-tcpip channels open at once; each is connected to a local
+ * echo server, sent a short message and closed once echoed. Connections
+ * per second are also measured through a SOCKS port, with every client
+ * sending its request and message at once, as browsers may.
+ *
+ * The stand-in server decrypts, echoes and encrypts everything on a
+ * single thread, which is usually what limits the throughput. With
+ * hundreds of connections, the data queued in socket buffers may exceed
+ * the kernel's TCP memory limits (net.ipv4.tcp_mem); the dropped
+ * segments and retransmission timeouts then dominate the result.
+ *
+ * Use -u to do socket I/O using io_uring.
+ *
+ * usage: forward-bench [-u] [-t seconds] [connections ...]
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "callback.h"
+#include "forwarder.h"
+#include "io-ring.h"
+#include "numbers.h"
+#include "reactor.h"
+#include "standin-server.h"
+#include "transport.h"
+
+namespace {
+
+double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//! Authenticates, then passes all channel callbacks on to the forwarder
+class BenchCallback : public RSSH::Callback {
+public:
+	BenchCallback(RSSH::Transport& transport, RSSH::Forwarder& forwarder)
+		: m_Transport(transport), m_Forwarder(forwarder), m_Ready(false), m_RemotePort(0) { }
+
+	std::string GetUserName() override { return "bench"; }
+	bool OnVerifyHostKeySignature(const std::string& signature) override { return true; }
+	void OnTransportEstablished() override {
+		m_Transport.RequestService(RSSH::Numbers::ServiceNames::UserAuth);
+	}
+	void OnServiceAccepted(const std::string& serviceName) override {
+		if (serviceName == RSSH::Numbers::ServiceNames::UserAuth)
+			m_Transport.RequestUserAuth(RSSH::Numbers::ServiceNames::Connection, "bench");
+	}
+	void OnAuthenticationSuccess() override {
+		m_Forwarder.Start();
+		m_Ready = true;
+	}
+	void OnAuthenticationFailure(bool partial_success, const RSSH::Types::NameList& next_auths) override {
+		errx(1, "authentication failed");
+	}
+	void OnChannelOpened(int channelNumber) override { m_Forwarder.OnChannelOpened(channelNumber); }
+	void OnChannelOpenFailure(int channelNumber, uint32_t reasonCode, const std::string& description) override {
+		m_Forwarder.OnChannelOpenFailure(channelNumber, reasonCode, description);
+	}
+	void OnChannelWritable(int channelNumber) override { m_Forwarder.OnChannelWritable(channelNumber); }
+	void OnChannelData(int channelNumber, const uint8_t* data, size_t len) override {
+		m_Forwarder.OnChannelData(channelNumber, data, len);
+	}
+	void OnChannelEOF(int channelNumber) override { m_Forwarder.OnChannelEOF(channelNumber); }
+	void OnChannelClosed(int channelNumber) override { m_Forwarder.OnChannelClosed(channelNumber); }
+	bool OnForwardedTcpIp(int channelNumber, const std::string& connectedAddress, uint32_t connectedPort, const std::string& originatorAddress, uint32_t originatorPort) override {
+		return m_Forwarder.OnForwardedTcpIp(channelNumber, connectedAddress, connectedPort, originatorAddress, originatorPort);
+	}
+	void OnTcpIpForwardSuccess(const std::string& address, uint32_t port, uint32_t boundPort) override {
+		m_RemotePort = boundPort;
+		m_Forwarder.OnTcpIpForwardSuccess(address, port, boundPort);
+	}
+	void OnTcpIpForwardFailure(const std::string& address, uint32_t port) override {
+		errx(1, "remote forwarding refused");
+	}
+
+	bool IsReady() const { return m_Ready; }
+
+	//! Port the server forwards to us, once it agreed to; 0 until then
+	uint32_t GetRemotePort() const { return m_RemotePort; }
+
+private:
+	RSSH::Transport& m_Transport;
+	RSSH::Forwarder& m_Forwarder;
+	bool m_Ready;
+	uint32_t m_RemotePort;
+};
+
+//! Returns a loopback port nobody is listening on right now
+int GetFreePort()
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		err(1, "socket");
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(sin);
+	if (bind(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0 || getsockname(fd, (struct sockaddr*)&sin, &len) < 0)
+		err(1, "bind");
+	close(fd);
+	return ntohs(sin.sin_port);
+}
+
+int Connect(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		err(1, "socket");
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(port);
+	if (connect(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0)
+		err(1, "connect");
+	return fd;
+}
+
+//! Echoes whatever is sent to it from a thread of its own; connections are closed after end-of-file
+class EchoServer {
+public:
+	EchoServer();
+	~EchoServer();
+
+	int GetPort() const { return m_Port; }
+
+private:
+	void Run();
+	void Accept();
+	void Echo(int fd);
+
+	int m_ListenFD;
+	int m_Port;
+	RSSH::Reactor m_Reactor;
+	std::set<int> m_Connections;
+	std::atomic<bool> m_Stop;
+	std::thread m_Thread;
+};
+
+EchoServer::EchoServer()
+	: m_Stop(false)
+{
+	m_ListenFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (m_ListenFD < 0)
+		err(1, "socket");
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(sin);
+	if (bind(m_ListenFD, (struct sockaddr*)&sin, sizeof(sin)) < 0 || listen(m_ListenFD, 1024) < 0 ||
+	    getsockname(m_ListenFD, (struct sockaddr*)&sin, &len) < 0)
+		err(1, "bind");
+	m_Port = ntohs(sin.sin_port);
+	m_Reactor.Add(m_ListenFD, [this](unsigned int events) { Accept(); });
+	m_Thread = std::thread(&EchoServer::Run, this);
+}
+
+EchoServer::~EchoServer()
+{
+	m_Stop = true;
+	m_Thread.join();
+	for (int fd : m_Connections) {
+		m_Reactor.Remove(fd);
+		close(fd);
+	}
+	m_Reactor.Remove(m_ListenFD);
+	close(m_ListenFD);
+}
+
+void EchoServer::Run()
+{
+	while (!m_Stop)
+		m_Reactor.RunOnce(100);
+}
+
+void EchoServer::Accept()
+{
+	while (true) {
+		int fd = accept4(m_ListenFD, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0)
+			return;
+		m_Connections.insert(fd);
+		m_Reactor.Add(fd, [this, fd](unsigned int events) { Echo(fd); });
+	}
+}
+
+void EchoServer::Echo(int fd)
+{
+	while (true) {
+		char buf[4096];
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n > 0) {
+			// The messages are short enough for the socket to always take them
+			if (write(fd, buf, n) != n)
+				err(1, "write");
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		m_Reactor.Remove(fd);
+		m_Connections.erase(fd);
+		close(fd);
+		return;
+	}
+}
+
+/*
+ * The client: a transport to the stand-in server forwarding a local port,
+ * and if 'echoPort' is given, a remote one to it. Everything runs on the
+ * calling thread; the load comes from others or the server.
+ */
+class Client {
+public:
+	Client(int serverPort, bool useRing, int echoPort = 0);
+
+	//! Local port being forwarded
+	int GetPort() const { return m_Port; }
+
+	//! Local SOCKS port
+	int GetSocksPort() const { return m_SocksPort; }
+
+	//! Runs the event loop until 'done' is set
+	void Run(const std::atomic<bool>& done);
+
+private:
+	RSSH::Reactor m_Reactor;
+	std::unique_ptr<RSSH::IoRing> m_Ring;
+	// The transport points to the callback and vice versa
+	RSSH::Transport m_Transport;
+	RSSH::Forwarder m_Forwarder;
+	BenchCallback m_Callback;
+	int m_Port;
+	int m_SocksPort;
+};
+
+Client::Client(int serverPort, bool useRing, int echoPort)
+	: m_Ring(useRing ? RSSH::IoRing::Create(m_Reactor) : nullptr), m_Transport(m_Callback),
+	  m_Forwarder(m_Transport, m_Reactor, m_Ring.get()), m_Callback(m_Transport, m_Forwarder),
+	  m_Port(GetFreePort()), m_SocksPort(GetFreePort())
+{
+	if (useRing && !m_Ring)
+		errx(1, "io_uring is not available");
+	RSSH::Forwarder::Spec spec;
+	spec.m_BindAddress = "127.0.0.1";
+	spec.m_ListenPort = m_Port;
+	spec.m_Host = "localhost";
+	spec.m_Port = 7;
+	if (!m_Forwarder.AddLocal(spec))
+		errx(1, "unable to listen on port %d", m_Port);
+	spec.m_ListenPort = m_SocksPort;
+	if (!m_Forwarder.AddDynamic(spec))
+		errx(1, "unable to listen on port %d", m_SocksPort);
+	if (echoPort != 0) {
+		// Have the server pick a port, as it would have to on a real one
+		spec.m_BindAddress = "";
+		spec.m_ListenPort = 0;
+		spec.m_Host = "127.0.0.1";
+		spec.m_Port = echoPort;
+		m_Forwarder.AddRemote(spec);
+	}
+
+	m_Transport.Connect("127.0.0.1", serverPort);
+	m_Transport.Register(m_Reactor, m_Ring.get());
+	while (!m_Callback.IsReady()) {
+		m_Reactor.RunOnce(100);
+		m_Transport.Flush();
+	}
+}
+
+void Client::Run(const std::atomic<bool>& done)
+{
+	while (!done) {
+		m_Reactor.RunOnce(100);
+		m_Transport.Flush();
+	}
+	// Have the server stop opening channels, and let the connections that are still open wind down
+	if (m_Callback.GetRemotePort() != 0)
+		m_Transport.CancelTcpIpForward("localhost", m_Callback.GetRemotePort());
+	while (m_Forwarder.GetConnectionCount() > 0) {
+		m_Reactor.RunOnce(100);
+		m_Transport.Flush();
+	}
+}
+
+//! Connects, sends a short message, waits for the echo and closes until 'stop' is set
+void Ping(int port, const std::atomic<bool>& stop, std::atomic<uint64_t>& count)
+{
+	static const char message[] = "ping";
+	while (!stop) {
+		int fd = Connect(port);
+		if (write(fd, message, sizeof(message)) != sizeof(message))
+			err(1, "write");
+		shutdown(fd, SHUT_WR);
+		char buf[sizeof(message)];
+		size_t got = 0;
+		while (true) {
+			ssize_t n = read(fd, buf, sizeof(buf));
+			if (n <= 0)
+				break;
+			got += n;
+		}
+		close(fd);
+		if (got != sizeof(message))
+			errx(1, "echo mismatch: got %zu bytes", got);
+		count++;
+	}
+}
+
+//! Like Ping(), using SOCKS5; the request and message are sent without waiting for any reply
+void SocksPing(int port, const std::atomic<bool>& stop, std::atomic<uint64_t>& count)
+{
+	// [RFC1928] no authentication; CONNECT to localhost port 7, followed by the message
+	static const char request[] = "\x05\x01\x00" "\x05\x01\x00\x03\x09" "localhost" "\x00\x07" "ping";
+	// Method selection, reply and echo
+	static const size_t expected = 2 + 10 + 4;
+	while (!stop) {
+		int fd = Connect(port);
+		if (write(fd, request, sizeof(request) - 1) != sizeof(request) - 1)
+			err(1, "write");
+		shutdown(fd, SHUT_WR);
+		char buf[expected + 1];
+		size_t got = 0;
+		while (got < sizeof(buf)) {
+			ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+			if (n <= 0)
+				break;
+			got += n;
+		}
+		close(fd);
+		if (got != expected || buf[1] != 0 || buf[3] != 0)
+			errx(1, "SOCKS echo mismatch: got %zu bytes", got);
+		count++;
+	}
+}
+
+//! Writes as fast as the tunnel allows until 'stop' is set, while another thread counts the echo
+void Stream(int port, const std::atomic<bool>& stop, std::atomic<uint64_t>& bytes)
+{
+	int fd = Connect(port);
+	std::thread writer([fd, &stop]() {
+		static const char data[65536] = { 0 };
+		while (!stop) {
+			if (write(fd, data, sizeof(data)) < 0)
+				err(1, "write");
+		}
+		shutdown(fd, SHUT_WR);
+	});
+	char buf[65536];
+	while (true) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n <= 0)
+			break;
+		bytes += n;
+	}
+	writer.join();
+	close(fd);
+}
+
+//! Generates load on a forwarded port until 'stop' is set, counting what it gets done in 'count'
+typedef void (*Load)(int port, const std::atomic<bool>& stop, std::atomic<uint64_t>& count);
+
+//! Runs 'load' on 'numThreads' threads for 'seconds' against a fresh client's forwarded or SOCKS port; returns the count per second
+double Measure(int serverPort, bool useRing, unsigned int numThreads, double seconds, Load load, bool socks = false)
+{
+	Client client(serverPort, useRing);
+	std::atomic<bool> stop(false), done(false);
+	std::atomic<uint64_t> count(0);
+	double rate = 0;
+	std::thread driver([&]() {
+		std::vector<std::thread> threads;
+		for (unsigned int n = 0; n < numThreads; n++)
+			threads.emplace_back(load, socks ? client.GetSocksPort() : client.GetPort(), std::cref(stop), std::ref(count));
+		// Let things get going before measuring
+		usleep(200000);
+		const double start = Now();
+		const uint64_t startCount = count;
+		usleep(static_cast<useconds_t>(seconds * 1e6));
+		rate = (count - startCount) / (Now() - start);
+		stop = true;
+		for (std::thread& thread : threads)
+			thread.join();
+		done = true;
+	});
+	client.Run(done);
+	driver.join();
+	return rate;
+}
+
+//! Has the server keep 'numChannels' forwarded-tcpip channels open for 'seconds'; returns the channels per second
+double MeasureRemote(StandInServer& server, const EchoServer& echoServer, bool useRing, unsigned int numChannels, double seconds)
+{
+	server.SetForwardedChannels(numChannels);
+	Client client(server.GetPort(), useRing, echoServer.GetPort());
+	server.SetForwardedChannels(0);
+	std::atomic<bool> done(false);
+	double rate = 0;
+	std::thread driver([&]() {
+		usleep(200000);
+		const double start = Now();
+		const unsigned long startCount = server.GetForwardedCount();
+		usleep(static_cast<useconds_t>(seconds * 1e6));
+		rate = (server.GetForwardedCount() - startCount) / (Now() - start);
+		done = true;
+	});
+	client.Run(done);
+	driver.join();
+	return rate;
+}
+
+} // unnamed namespace
+
+int
+main(int argc, char* argv[])
+{
+	double seconds = 2;
+	bool useRing = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "t:u")) != -1) {
+		switch(opt) {
+			case 't':
+				seconds = atof(optarg);
+				break;
+			case 'u':
+				useRing = true;
+				break;
+			default:
+				errx(1, "usage: %s [-u] [-t seconds] [connections ...]", argv[0]);
+		}
+	}
+	std::vector<unsigned int> connections;
+	for (int n = optind; n < argc; n++)
+		connections.push_back(atoi(argv[n]));
+	if (connections.empty())
+		connections = { 1, 8, 32 };
+	signal(SIGPIPE, SIG_IGN);
+
+	StandInServer server;
+	EchoServer echoServer;
+	printf("%12s %14s %12s %14s %14s\n", "connections", "connections/s", "MB/s", "remote conn/s", "SOCKS conn/s");
+	for (unsigned int n : connections) {
+		const double connectionRate = Measure(server.GetPort(), useRing, n, seconds, Ping);
+		const double byteRate = Measure(server.GetPort(), useRing, n, seconds, Stream);
+		const double remoteRate = MeasureRemote(server, echoServer, useRing, n, seconds);
+		const double socksRate = Measure(server.GetPort(), useRing, n, seconds, SocksPing, true);
+		printf("%12u %14.0f %12.2f %14.0f %14.0f\n", n, connectionRate, byteRate / 1e6, remoteRate, socksRate);
+	}
+	return 0;
+}
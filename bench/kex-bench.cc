@@ -0,0 +1,134 @@
+/*
+ * Measures how many key exchanges per second the client side of each
+ * supported method can do: generating the ephemeral key pair and computing
+ * the shared secret from the server's public key. The server side is
+ * simulated by a second instance of the same method and not timed.
+ *
+ * The Diffie-Hellman methods take their key pairs from a pool that is
+ * filled in the background; -p sets its capacity (0 disables it) and -i
+ * waits between handshakes to give the pool a chance to refill, as
+ * happens between real connections.
+ *
+ * usage: kex-bench [-t seconds] [-p pool_capacity] [-i interval_ms] [kex_algorithm ...]
+ */
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+#include "callback.h"
+#include "dh-keyexchange.h"
+#include "keyexchange.h"
+#include "keyexchange-factory.h"
+#include "transport.h"
+
+namespace {
+
+class BenchCallback : public RSSH::Callback {
+public:
+	std::string GetUserName() override { return "bench"; }
+};
+
+double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//! Performs one exchange, returning the time spent on the client side
+double Handshake(RSSH::Transport& transport, const char* kexName)
+{
+	RSSH::KeyExchange* client = RSSH::KeyExchangeFactory::Create(transport, kexName);
+	RSSH::KeyExchange* server = RSSH::KeyExchangeFactory::Create(transport, kexName);
+	if (client == NULL || server == NULL)
+		errx(1, "unsupported key exchange '%s'", kexName);
+
+	server->GenerateKeyPair();
+	RSSH::Buffer serverKey;
+	server->PutPublicKey(serverKey);
+
+	double start = Now();
+	client->GenerateKeyPair();
+	RSSH::Buffer clientKey;
+	client->PutPublicKey(clientKey);
+	client->ReadPeerPublicKey(serverKey);
+	CryptoPP::Integer k_client = client->ComputeSharedSecret();
+	double elapsed = Now() - start;
+
+	server->ReadPeerPublicKey(clientKey);
+	if (server->ComputeSharedSecret() != k_client)
+		errx(1, "%s: shared secrets differ", kexName);
+
+	delete server;
+	delete client;
+	return elapsed;
+}
+
+} // unnamed namespace
+
+int
+main(int argc, char* argv[])
+{
+	double duration = 2.0;
+	unsigned int interval = 0;
+	RSSH::DHKeyPairPool::Policy policy;
+	int opt;
+	while ((opt = getopt(argc, argv, "i:p:t:")) != -1) {
+		switch(opt) {
+			case 'i':
+				interval = atoi(optarg);
+				break;
+			case 'p':
+				policy.m_Capacity = atoi(optarg);
+				if (policy.m_RefillBelow > policy.m_Capacity)
+					policy.m_RefillBelow = policy.m_Capacity;
+				break;
+			case 't':
+				duration = atof(optarg);
+				break;
+			default:
+				errx(1, "usage: %s [-t seconds] [-p pool_capacity] [-i interval_ms] [kex_algorithm ...]", argv[0]);
+		}
+	}
+	RSSH::DHKeyExchange::SetPoolPolicy(policy);
+
+	std::vector<std::string> algorithms;
+	for (int n = optind; n < argc; n++)
+		algorithms.push_back(argv[n]);
+	if (algorithms.empty()) {
+		algorithms.push_back("curve25519-sha256");
+		algorithms.push_back("ecdh-sha2-nistp256");
+		algorithms.push_back("diffie-hellman-group14-sha256");
+		algorithms.push_back("diffie-hellman-group16-sha512");
+	}
+
+	BenchCallback callback;
+	RSSH::Transport transport(callback);
+	printf("%-32s %10s %14s %10s %10s\n", "algorithm", "ms/kex", "handshakes/s", "pool hits", "misses");
+	for (size_t n = 0; n < algorithms.size(); n++) {
+		const char* kexName = algorithms[n].c_str();
+		Handshake(transport, kexName); // warm up
+
+		unsigned long hits_before, misses_before;
+		RSSH::DHKeyExchange::GetPoolStatistics(hits_before, misses_before);
+
+		double clientTime = 0, start = Now();
+		unsigned int count = 0;
+		do {
+			if (interval > 0)
+				usleep(interval * 1000);
+			clientTime += Handshake(transport, kexName);
+			count++;
+		} while (Now() - start < duration);
+
+		unsigned long hits, misses;
+		RSSH::DHKeyExchange::GetPoolStatistics(hits, misses);
+		printf("%-32s %10.3f %14.1f %10lu %10lu\n", kexName, clientTime * 1000.0 / count, count / clientTime, hits - hits_before, misses - misses_before);
+	}
+	return 0;
+}
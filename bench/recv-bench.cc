@@ -0,0 +1,158 @@
+/*
+ * Measures how the receive path scales with the number of packets that
+ * arrive at once: batches of N small SSH_MSG_CHANNEL_DATA packets are
+ * written to a socket pair in one go and parsed by Transport::Process().
+ * The time per packet should not depend on N.
+ *
+ * usage: recv-bench [-r repetitions] [-s payload_size]
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+
+#include "buffer.h"
+#include "callback.h"
+#include "numbers.h"
+#include "transport.h"
+
+namespace {
+
+class BenchCallback : public RSSH::Callback {
+public:
+	BenchCallback() : m_Transport(NULL), m_Packets(0) { }
+
+	std::string GetUserName() override { return "bench"; }
+	void OnChannelData(int channelNumber, const uint8_t* data, size_t len) override {
+		m_Packets++;
+		m_Transport->ChannelDataConsumed(channelNumber, len);
+	}
+
+	RSSH::Transport* m_Transport;
+	unsigned int m_Packets;
+};
+
+double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//! Appends an unencrypted SSH_MSG_CHANNEL_DATA packet to 'b'
+void PutChannelData(RSSH::Buffer& b, size_t payloadSize)
+{
+	static const uint8_t data[256] = { 0 };
+	const size_t len = 1 + 4 + 4 + payloadSize; // type, channel, string
+	uint8_t padding_len = 8 - ((4 + 1 + len) % 8);
+	if (padding_len < 4)
+		padding_len += 8;
+
+	b << static_cast<uint32_t>(1 + len + padding_len);
+	b << padding_len;
+	b << static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_DATA);
+	b << static_cast<uint32_t>(0);
+	b.PutData(data, payloadSize);
+	b.PutBytes(data, padding_len);
+}
+
+//! Appends an unencrypted SSH_MSG_CHANNEL_OPEN_CONFIRMATION packet for channel 0 to 'b'
+void PutOpenConfirmation(RSSH::Buffer& b)
+{
+	static const uint8_t padding[10] = { 0 };
+	b << static_cast<uint32_t>(1 + 1 + 4 * 4 + sizeof(padding));
+	b << static_cast<uint8_t>(sizeof(padding));
+	b << static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_OPEN_CONFIRMATION);
+	b << static_cast<uint32_t>(0); // recipient channel
+	b << static_cast<uint32_t>(0); // sender channel
+	b << static_cast<uint32_t>(0); // window size
+	b << static_cast<uint32_t>(0); // max packet size
+	b.PutBytes(padding, sizeof(padding));
+}
+
+void WriteAll(int fd, const uint8_t* p, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n <= 0)
+			err(1, "write");
+		p += n;
+		len -= n;
+	}
+}
+
+} // unnamed namespace
+
+int
+main(int argc, char* argv[])
+{
+	unsigned int repetitions = 200;
+	size_t payloadSize = 16;
+	int opt;
+	while ((opt = getopt(argc, argv, "r:s:")) != -1) {
+		switch(opt) {
+			case 'r':
+				repetitions = atoi(optarg);
+				break;
+			case 's':
+				payloadSize = atoi(optarg);
+				if (payloadSize > 256)
+					errx(1, "payload size must be 256 bytes or less");
+				break;
+			default:
+				errx(1, "usage: %s [-r repetitions] [-s payload_size]", argv[0]);
+		}
+	}
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		err(1, "socketpair");
+	int bufSize = 1024 * 1024;
+	setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &bufSize, sizeof(bufSize));
+
+	// Play the server: send a greeter and swallow the client's
+	const char* greeter = "SSH-2.0-recv-bench\r\n";
+	WriteAll(fds[1], (const uint8_t*)greeter, strlen(greeter));
+	BenchCallback callback;
+	RSSH::Transport transport(callback);
+	callback.m_Transport = &transport;
+
+	// A window this large is never adjusted during the run
+	RSSH::ChannelWindow::Settings& settings = transport.GetChannelWindowSettings();
+	settings.m_InitialSize = settings.m_MaxSize = 1 << 30;
+	transport.Attach(fds[0]);
+	transport.OpenChannel(RSSH::Numbers::ConnectionProtocolAssignedNames::ChannelTypes::Session);
+	{
+		char buf[256];
+		if (read(fds[1], buf, sizeof(buf)) <= 0)
+			err(1, "read");
+
+		RSSH::Buffer b;
+		PutOpenConfirmation(b);
+		WriteAll(fds[1], b.GetReadPointer(), b.GetAvailableBytes());
+	}
+
+	printf("%8s %12s %12s\n", "packets", "bytes", "ns/packet");
+	for (unsigned int batch = 16; batch <= 4096; batch *= 2) {
+		RSSH::Buffer b(batch * (payloadSize + 32));
+		for (unsigned int n = 0; n < batch; n++)
+			PutChannelData(b, payloadSize);
+
+		double elapsed = 0;
+		for (unsigned int r = 0; r < repetitions; r++) {
+			WriteAll(fds[1], b.GetReadPointer(), b.GetAvailableBytes());
+			callback.m_Packets = 0;
+			double start = Now();
+			while (callback.m_Packets < batch)
+				transport.Process();
+			elapsed += Now() - start;
+		}
+		printf("%8u %12zu %12.1f\n", batch, (size_t)b.GetAvailableBytes(), elapsed * 1e9 / (batch * repetitions));
+	}
+	return 0;
+}
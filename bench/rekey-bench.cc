@@ -0,0 +1,290 @@
+/*
+ * Measures what exchanging keys again costs a bulk transfer. Data is sent
+ * on a direct-tcpip channel to a stand-in server, which echoes it; the
+ * connection passes through a proxy that delays each direction by half the
+ * round-trip time, so no tc/netem setup is needed.
+ *
+ * Keys are exchanged again every so many MB sent, once at the client's
+ * initiative and once at the server's; a limit of 0 means never. Reported
+ * is the payload echoed per second, the number of key exchanges and how
+ * long the client held back its data for each, on average and at most.
+ *
+ * usage: rekey-bench [-t seconds] [-r rtt_ms] [rekey_mb ...]
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <err.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "callback.h"
+#include "numbers.h"
+#include "standin-server.h"
+#include "transport.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int PollTimeout(Clock::time_point until)
+{
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(until - Clock::now()).count() + 1;
+	return ms < 0 ? 0 : static_cast<int>(ms);
+}
+
+/*
+ * Forwards data from 'src' to 'dst', each chunk no sooner than 'delay'
+ * after it was read. Once either side is closed, both are shut down, so
+ * the other direction stops as well.
+ */
+void Delay(int src, int dst, Clock::duration delay)
+{
+	struct Chunk {
+		Clock::time_point m_Release;
+		std::string m_Data;
+	};
+	std::deque<Chunk> queue;
+	size_t offset = 0; // of the first chunk, if partially written
+	bool eof = false;
+	while (!eof || !queue.empty()) {
+		const bool due = !queue.empty() && queue.front().m_Release <= Clock::now();
+		struct pollfd pfd[2];
+		pfd[0].fd = src; pfd[0].events = eof ? 0 : POLLIN;
+		pfd[1].fd = dst; pfd[1].events = due ? POLLOUT : 0;
+		int timeout = -1;
+		if (!queue.empty() && !due)
+			timeout = PollTimeout(queue.front().m_Release);
+		if (poll(pfd, 2, timeout) < 0)
+			err(1, "poll");
+
+		if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			char buf[65536];
+			ssize_t n = read(src, buf, sizeof(buf));
+			if (n <= 0)
+				eof = true;
+			else
+				queue.push_back({ Clock::now() + delay, std::string(buf, n) });
+		}
+		if (pfd[1].revents & (POLLERR | POLLHUP))
+			break;
+		if (pfd[1].revents & POLLOUT) {
+			const std::string& data = queue.front().m_Data;
+			ssize_t n = write(dst, data.data() + offset, data.size() - offset);
+			if (n < 0)
+				break;
+			offset += n;
+			if (offset == data.size()) {
+				queue.pop_front();
+				offset = 0;
+			}
+		}
+	}
+	shutdown(src, SHUT_RDWR);
+	shutdown(dst, SHUT_RDWR);
+}
+
+//! Authenticates, then keeps an echo channel filled and counts what comes back
+class BenchCallback : public RSSH::Callback {
+public:
+	BenchCallback() : m_Transport(NULL), m_Channel(-1), m_Sent(0), m_Received(0) { }
+
+	//! The transport needs us to be constructed, so it is only set afterwards
+	void SetTransport(RSSH::Transport& transport) { m_Transport = &transport; }
+
+	std::string GetUserName() override { return "bench"; }
+	bool OnVerifyHostKeySignature(const std::string& signature) override { return true; }
+	void OnTransportEstablished() override {
+		m_Transport->RequestService(RSSH::Numbers::ServiceNames::UserAuth);
+	}
+	void OnServiceAccepted(const std::string& serviceName) override {
+		if (serviceName == RSSH::Numbers::ServiceNames::UserAuth)
+			m_Transport->RequestUserAuth(RSSH::Numbers::ServiceNames::Connection, "bench");
+	}
+	void OnAuthenticationSuccess() override {
+		m_Channel = m_Transport->OpenDirectTcpIp("localhost", 7, "127.0.0.1", 40000);
+	}
+	void OnAuthenticationFailure(bool partial_success, const RSSH::Types::NameList& next_auths) override {
+		errx(1, "authentication failed");
+	}
+	void OnChannelOpened(int channelNumber) override { Send(); }
+	void OnChannelWritable(int channelNumber) override { Send(); }
+	void OnChannelData(int channelNumber, const uint8_t* data, size_t len) override {
+		m_Received += len;
+		m_Transport->ChannelDataConsumed(channelNumber, len);
+		Send();
+	}
+
+	uint64_t GetReceived() const { return m_Received; }
+
+private:
+	//! Data still to be echoed is limited, so our window adjusts don't queue behind it
+	static const uint64_t maxInFlight = 4 * 1024 * 1024;
+
+	void Send() {
+		static const uint8_t data[RSSH::Transport::maxChannelDataLength] = { 0 };
+		size_t room;
+		while (m_Sent - m_Received < maxInFlight && (room = m_Transport->GetChannelSendRoom(m_Channel)) > 0) {
+			m_Transport->TransmitChannelData(m_Channel, data, room);
+			m_Sent += room;
+		}
+	}
+
+	RSSH::Transport* m_Transport;
+	int m_Channel;
+	uint64_t m_Sent;
+	uint64_t m_Received;
+};
+
+int ConnectToServer(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		err(1, "socket");
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(port);
+	if (connect(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0)
+		err(1, "connect");
+	return fd;
+}
+
+struct Result {
+	//! Bytes echoed per second
+	double m_Rate;
+
+	//! Key exchanges after the first while measuring, and what they held back
+	unsigned int m_Rekeys;
+	double m_MeanStall;
+	double m_MaxStall;
+};
+
+double Milliseconds(Clock::duration d)
+{
+	return std::chrono::duration<double, std::milli>(d).count();
+}
+
+//! Echoes data for 'seconds', exchanging keys after 'rekeyBytes' at the client's or the server's initiative
+Result Measure(StandInServer& standIn, uint64_t rekeyBytes, bool byServer, Clock::duration rtt, double seconds)
+{
+	int client[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, client) < 0)
+		err(1, "socketpair");
+	standIn.SetRekeyBytes(byServer ? rekeyBytes : 0);
+	const int server = ConnectToServer(standIn.GetPort());
+	std::thread upstream(Delay, client[1], server, rtt / 2);
+	std::thread downstream(Delay, server, client[1], rtt / 2);
+
+	// The transport points to the callback and vice versa
+	struct Client {
+		Client() : m_Transport(m_Callback) { m_Callback.SetTransport(m_Transport); }
+		BenchCallback m_Callback;
+		RSSH::Transport m_Transport;
+	};
+	Result result;
+	{
+		Client c;
+		RSSH::Transport& transport = c.m_Transport;
+		// Only the limit being measured; the others are far off
+		transport.GetRekeySettings().m_Bytes = byServer ? 0 : rekeyBytes;
+		transport.Attach(client[0]);
+
+		// Give the link time to fill up before measuring
+		double start = 0, end = 0;
+		uint64_t startReceived = 0;
+		RSSH::Transport::RekeyStatistics startStats;
+		while (start == 0 || Now() < end) {
+			struct pollfd pfd;
+			pfd.fd = client[0];
+			pfd.events = POLLIN | (transport.HasPendingOutput() ? POLLOUT : 0);
+			if (poll(&pfd, 1, 100) < 0)
+				err(1, "poll");
+			if (pfd.revents & POLLOUT)
+				transport.Flush();
+			if (pfd.revents & POLLIN)
+				transport.Process();
+			if (start == 0 && c.m_Callback.GetReceived() > 0) {
+				start = Now() + 0.5;
+				end = start + seconds;
+			}
+			if (startReceived == 0 && start != 0 && Now() >= start) {
+				startReceived = c.m_Callback.GetReceived();
+				startStats = transport.GetRekeyStatistics();
+			}
+		}
+		const RSSH::Transport::RekeyStatistics& stats = transport.GetRekeyStatistics();
+		result.m_Rate = (c.m_Callback.GetReceived() - startReceived) / seconds;
+		result.m_Rekeys = stats.m_Count - startStats.m_Count;
+		result.m_MeanStall = result.m_Rekeys > 0 ? Milliseconds(stats.m_TotalStall - startStats.m_TotalStall) / result.m_Rekeys : 0;
+		result.m_MaxStall = Milliseconds(stats.m_MaxStall);
+	}
+	// The transport closed client[0]; this unwinds the proxy and the server
+	upstream.join();
+	downstream.join();
+	close(client[1]);
+	close(server);
+	return result;
+}
+
+} // unnamed namespace
+
+int
+main(int argc, char* argv[])
+{
+	double seconds = 2;
+	Clock::duration rtt = std::chrono::milliseconds(10);
+	int opt;
+	while ((opt = getopt(argc, argv, "r:t:")) != -1) {
+		switch(opt) {
+			case 'r':
+				rtt = std::chrono::milliseconds(atoi(optarg));
+				break;
+			case 't':
+				seconds = atof(optarg);
+				break;
+			default:
+				errx(1, "usage: %s [-t seconds] [-r rtt_ms] [rekey_mb ...]", argv[0]);
+		}
+	}
+	std::vector<double> limits;
+	for (int n = optind; n < argc; n++)
+		limits.push_back(atof(argv[n]));
+	if (limits.empty())
+		limits = { 0, 64, 16, 4 };
+	signal(SIGPIPE, SIG_IGN);
+
+	StandInServer server;
+	printf("%10s %10s %12s %8s %10s %10s\n", "rekey MB", "by", "MB/s", "rekeys", "stall ms", "max ms");
+	for (double mb : limits) {
+		const uint64_t bytes = static_cast<uint64_t>(mb * 1024 * 1024);
+		for (bool byServer : { false, true }) {
+			if (bytes == 0 && byServer)
+				continue;
+			const Result r = Measure(server, bytes, byServer, rtt, seconds);
+			printf("%10.0f %10s %12.2f %8u %10.2f %10.2f\n", mb, bytes == 0 ? "-" : byServer ? "server" : "client",
+			 r.m_Rate / 1e6, r.m_Rekeys, r.m_MeanStall, r.m_MaxStall);
+			fflush(stdout);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * Compares the epoll and io_uring socket backends: bulk channel throughput
+ * and system calls per MB received, over a number of loopback TCP
+ * connections driven by a single event loop. Every connection has a
+ * stand-in server thread sending SSH_MSG_CHANNEL_DATA as fast as the
+ * channel window allows.
+ *
+ * System calls counted are those made by the event loop: epoll_wait(2),
+ * read(2) and writev(2) for epoll, epoll_wait(2) and io_uring_enter(2)
+ * for io_uring. The transport is not encrypted: no key exchange takes
+ * place, which keeps the measurement about I/O only.
+ *
+ * usage: ring-bench [-t seconds] [connections ...]
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <err.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "callback.h"
+#include "io-ring.h"
+#include "numbers.h"
+#include "reactor.h"
+#include "transport.h"
+
+namespace {
+
+double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//! Appends an unencrypted packet holding 'payload' to 'out'
+void PutPacket(std::string& out, const RSSH::Buffer& payload)
+{
+	uint8_t padding_len = 8 - ((4 + 1 + payload.GetAvailableBytes()) % 8);
+	if (padding_len < 4)
+		padding_len += 8;
+
+	RSSH::Buffer b(payload.GetAvailableBytes() + 32);
+	b << static_cast<uint32_t>(1 + payload.GetAvailableBytes() + padding_len);
+	b << padding_len;
+	b.PutBytes(payload.GetReadPointer(), payload.GetAvailableBytes());
+	static const uint8_t padding[16] = { 0 };
+	b.PutBytes(padding, padding_len);
+	out.append((const char*)b.GetReadPointer(), b.GetAvailableBytes());
+}
+
+/*
+ * Plays the server: confirms the channel open and keeps sending channel
+ * data, never more than the window the client granted, until the client
+ * disconnects.
+ */
+void Serve(int fd)
+{
+	static const uint8_t data[32768] = { 0 };
+	const char* greeter = "SSH-2.0-ring-bench\r\n";
+	if (write(fd, greeter, strlen(greeter)) < 0)
+		err(1, "write");
+
+	std::string in, out;
+	bool gotGreeter = false;
+	bool open = false;
+	uint32_t clientChannel = 0, window = 0, maxPacket = 0;
+	while (true) {
+		while (open && out.size() < 262144 && window > 0) {
+			uint32_t len = window < maxPacket ? window : maxPacket;
+			if (len > sizeof(data))
+				len = sizeof(data);
+			RSSH::Buffer p(len + 16);
+			p << static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_DATA);
+			p << clientChannel;
+			p.PutData(data, len);
+			PutPacket(out, p);
+			window -= len;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN | (out.empty() ? 0 : POLLOUT);
+		if (poll(&pfd, 1, -1) < 0)
+			err(1, "poll");
+		if (pfd.revents & POLLOUT) {
+			ssize_t n = write(fd, out.data(), out.size());
+			if (n < 0)
+				break;
+			out.erase(0, n);
+		}
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+			char buf[4096];
+			ssize_t n = read(fd, buf, sizeof(buf));
+			if (n <= 0)
+				break;
+			in.append(buf, n);
+		}
+
+		if (!gotGreeter) {
+			size_t eol = in.find('\n');
+			if (eol == std::string::npos)
+				continue;
+			in.erase(0, eol + 1);
+			gotGreeter = true;
+		}
+		while (in.size() >= 4) {
+			RSSH::Buffer b((const uint8_t*)in.data(), in.size());
+			uint32_t packetLength;
+			uint8_t paddingLength, type;
+			b >> packetLength;
+			if (in.size() < 4 + packetLength)
+				break;
+			b >> paddingLength >> type;
+			if (type == static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_OPEN)) {
+				std::string channelType;
+				b >> channelType >> clientChannel >> window >> maxPacket;
+				RSSH::Buffer p;
+				p << static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_OPEN_CONFIRMATION);
+				p << clientChannel; // recipient channel
+				p << clientChannel; // sender channel
+				p << static_cast<uint32_t>(0); // window size
+				p << static_cast<uint32_t>(0); // max packet size
+				PutPacket(out, p);
+				open = true;
+			} else if (type == static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_WINDOW_ADJUST)) {
+				uint32_t channel, bytesToAdd;
+				b >> channel >> bytesToAdd;
+				window += bytesToAdd;
+			}
+			in.erase(0, 4 + packetLength);
+		}
+	}
+	close(fd);
+}
+
+class BenchCallback : public RSSH::Callback {
+public:
+	BenchCallback() : m_Transport(NULL), m_Opened(false), m_Bytes(0) { }
+
+	//! The transport needs us to be constructed, so it is only set afterwards
+	void SetTransport(RSSH::Transport& transport) { m_Transport = &transport; }
+
+	std::string GetUserName() override { return "bench"; }
+	void OnChannelOpened(int channelNumber) override { m_Opened = true; }
+	void OnChannelData(int channelNumber, const uint8_t* data, size_t len) override {
+		m_Bytes += len;
+		m_Transport->ChannelDataConsumed(channelNumber, len);
+	}
+
+	RSSH::Transport* m_Transport;
+	bool m_Opened;
+	uint64_t m_Bytes;
+};
+
+// The transport points to the callback and vice versa
+struct Client {
+	Client() : m_Transport(m_Callback) { m_Callback.SetTransport(m_Transport); }
+	BenchCallback m_Callback;
+	RSSH::Transport m_Transport;
+};
+
+struct Result {
+	//! Bytes per second received, over all connections
+	double m_Rate;
+
+	//! System calls made by the event loop per MB received
+	double m_SyscallsPerMB;
+};
+
+//! Returns a listening socket on a loopback port of the kernel's choosing
+int Listen(int& port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		err(1, "socket");
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(sin);
+	if (bind(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0 || listen(fd, 128) < 0 ||
+	    getsockname(fd, (struct sockaddr*)&sin, &len) < 0)
+		err(1, "listen");
+	port = ntohs(sin.sin_port);
+	return fd;
+}
+
+//! Receives for 'seconds' over 'numConnections' connections; 'ring' selects the backend
+Result Measure(unsigned int numConnections, bool useRing, double seconds)
+{
+	int port;
+	int listenFD = Listen(port);
+	std::vector<std::thread> servers;
+	Result result;
+	{
+		RSSH::Reactor reactor;
+		std::unique_ptr<RSSH::IoRing> ring;
+		if (useRing)
+			ring = RSSH::IoRing::Create(reactor);
+
+		std::vector<std::unique_ptr<Client>> clients;
+		for (unsigned int n = 0; n < numConnections; n++) {
+			clients.emplace_back(new Client);
+			RSSH::Transport& transport = clients.back()->m_Transport;
+			transport.Connect("127.0.0.1", port);
+			int fd = accept(listenFD, NULL, NULL);
+			if (fd < 0)
+				err(1, "accept");
+			servers.emplace_back(Serve, fd);
+			transport.Register(reactor, ring.get());
+			transport.OpenChannel(RSSH::Numbers::ConnectionProtocolAssignedNames::ChannelTypes::Session);
+		}
+
+		auto CountBytes = [&clients]() {
+			uint64_t bytes = 0;
+			for (auto& client : clients)
+				bytes += client->m_Callback.m_Bytes;
+			return bytes;
+		};
+		auto CountSyscalls = [&]() {
+			uint64_t syscalls = reactor.GetWaitCount();
+			if (ring)
+				syscalls += ring->GetEnterCount();
+			for (auto& client : clients)
+				syscalls += client->m_Transport.GetSocket().GetSyscallCount();
+			return syscalls;
+		};
+
+		// Let the windows open up before measuring
+		const double warmup = Now() + 0.2;
+		while (Now() < warmup)
+			reactor.RunOnce(100);
+
+		const uint64_t startBytes = CountBytes(), startSyscalls = CountSyscalls();
+		const double start = Now(), end = start + seconds;
+		while (Now() < end)
+			reactor.RunOnce(100);
+		const double elapsed = Now() - start;
+		const double bytes = CountBytes() - startBytes;
+		result.m_Rate = bytes / elapsed;
+		result.m_SyscallsPerMB = (CountSyscalls() - startSyscalls) / (bytes / 1e6);
+	}
+	// The clients are gone, so the servers see their connections close
+	for (std::thread& server : servers)
+		server.join();
+	close(listenFD);
+	return result;
+}
+
+} // unnamed namespace
+
+int
+main(int argc, char* argv[])
+{
+	double seconds = 2;
+	int opt;
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch(opt) {
+			case 't':
+				seconds = atof(optarg);
+				break;
+			default:
+				errx(1, "usage: %s [-t seconds] [connections ...]", argv[0]);
+		}
+	}
+	std::vector<unsigned int> connections;
+	for (int n = optind; n < argc; n++)
+		connections.push_back(atoi(argv[n]));
+	if (connections.empty())
+		connections = { 1, 8, 64 };
+	signal(SIGPIPE, SIG_IGN);
+
+	{
+		RSSH::Reactor reactor;
+		if (!RSSH::IoRing::Create(reactor))
+			errx(1, "io_uring is not available");
+	}
+
+	printf("%12s %14s %14s %14s %14s\n", "connections", "epoll (MB/s)", "syscalls/MB", "uring (MB/s)", "syscalls/MB");
+	for (unsigned int n : connections) {
+		Result epollResult = Measure(n, false, seconds);
+		Result ringResult = Measure(n, true, seconds);
+		printf("%12u %14.2f %14.1f %14.2f %14.1f\n", n, epollResult.m_Rate / 1e6, epollResult.m_SyscallsPerMB, ringResult.m_Rate / 1e6, ringResult.m_SyscallsPerMB);
+	}
+	return 0;
+}
@@ -0,0 +1,774 @@
+#include "standin-server.h"
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <err.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+
+#include "buffer.h"
+#include "compression.h"
+#include "curve25519.h"
+#include "ihmac.h"
+#include "keys.h"
+#include "mac-factory.h"
+#include "negotiation.h"
+#include "numbers.h"
+#include "types.h"
+
+#include "cryptopp/aes.h"
+#include "cryptopp/modes.h"
+#include "cryptopp/osrng.h"
+#include "cryptopp/rsa.h"
+#include "cryptopp/sha.h"
+
+using RSSH::Buffer;
+using RSSH::Numbers::MessageID;
+
+namespace {
+
+const char* serverGreeter = "SSH-2.0-standin";
+const size_t cipherBlockSize = 16;
+//! Longest MAC of any we offer
+const size_t maxMACSize = 20;
+
+//! MACs and compression methods we offer; the client's preference decides
+const char* macs = "umac-64-etm@openssh.com,hmac-sha1-etm@openssh.com,hmac-sha1";
+const char* compressionMethods = "none,zlib@openssh.com";
+
+struct HostKey {
+	HostKey() {
+		// Small, so signing doesn't take CPU time away from the client
+		CryptoPP::AutoSeededRandomPool rng;
+		m_Key.Initialize(rng, 1024);
+
+		// [RFC4253, 6.6] ssh-rsa public key format
+		Buffer b;
+		b << "ssh-rsa";
+		b << m_Key.GetPublicExponent();
+		b << m_Key.GetModulus();
+		m_Blob = std::string((const char*)b.GetReadPointer(), b.GetAvailableBytes());
+	}
+
+	CryptoPP::InvertibleRSAFunction m_Key;
+	std::string m_Blob;
+};
+
+//! One direction of the transport
+struct Direction {
+	Direction() : m_SequenceNumber(0), m_ETM(false) { }
+
+	std::unique_ptr<CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption> m_Cipher;
+	std::unique_ptr<RSSH::IHMAC> m_MAC;
+	uint32_t m_SequenceNumber;
+	//! [OPENSSH-PROTOCOL, 1.5] the length is in the clear and the MAC covers the ciphertext
+	bool m_ETM;
+
+	void Enable(const uint8_t* key, const uint8_t* iv, const std::string& mac, const uint8_t* macKey) {
+		m_Cipher.reset(new CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption(key, 16, iv));
+		m_MAC.reset(RSSH::MACFactory::Create(mac.c_str(), macKey));
+		m_ETM = RSSH::MACFactory::IsEncryptThenMAC(mac.c_str());
+	}
+
+	void ComputeMAC(const uint8_t* packet, size_t len, uint8_t* mac) {
+		m_MAC->Calculate(packet, len, m_SequenceNumber, mac);
+	}
+};
+
+//! Window we grant on echo channels; adjusted once half of it is echoed
+const uint32_t echoWindow = 2 * 1024 * 1024;
+
+//! A direct-tcpip channel echoing its data
+struct EchoChannel {
+	uint32_t m_Peer;
+	//! Bytes the client still accepts, and in a single packet
+	uint32_t m_Window;
+	uint32_t m_MaxPacket;
+	//! Received but not yet echoed, for lack of window, from m_PendingOffset on
+	std::string m_Pending;
+	size_t m_PendingOffset;
+	//! Echoed since we last adjusted our window
+	uint32_t m_Consumed;
+	bool m_EOF;
+	//! Set once our EOF and close are sent
+	bool m_Closed;
+};
+
+//! Sent on every forwarded-tcpip channel; the client is to echo it
+const char forwardedMessage[] = "ping";
+
+//! A forwarded-tcpip channel we opened
+struct ForwardedChannel {
+	uint32_t m_Peer;
+	//! Bytes of the echo received so far
+	size_t m_Received;
+};
+
+class Connection {
+public:
+	Connection(int fd, const HostKey& hostKey, unsigned int forwardedChannels, std::atomic<unsigned long>& forwardedCount, bool adaptiveCompression, uint64_t rekeyBytes)
+		: m_FD(fd), m_HostKey(hostKey), m_RekeyBytes(rekeyBytes), m_BytesSinceKex(0), m_NextChannel(1), m_ForwardedChannels(forwardedChannels),
+		  m_ForwardedCount(forwardedCount), m_ForwardPort(0), m_Forwarding(false),
+		  m_Zlib_C2S(false), m_Zlib_S2C(false), m_AdaptiveCompression(adaptiveCompression) { }
+	~Connection() { close(m_FD); }
+
+	void Run();
+
+private:
+	bool ReadFully(uint8_t* p, size_t len);
+	bool WriteFully(const uint8_t* p, size_t len);
+	bool ReadGreeter(std::string& greeter);
+
+	//! Reads a packet and returns its payload, starting with the message type
+	bool ReceivePacket(std::string& payload);
+
+	//! Sends a packet; during a key exchange, anything but its messages is held back until it's done
+	bool SendPacket(const Buffer& payload);
+
+	//! Sends our SSH_MSG_KEXINIT, keeping it in m_KexInit
+	bool SendKexInit();
+
+	//! Completes a key exchange, given the client's SSH_MSG_KEXINIT; ours must be sent already
+	bool KeyExchange(const std::string& clientKexInit);
+	bool Serve();
+
+	//! Echoes as much pending data as the window allows; closes the channel once it's all sent after EOF
+	bool Echo(uint32_t id);
+
+	//! Opens a forwarded-tcpip channel, as if a connection to the forwarded port was accepted
+	bool OpenForwarded();
+
+	int m_FD;
+	const HostKey& m_HostKey;
+	Direction m_Receive;
+	Direction m_Transmit;
+	std::string m_ClientGreeter;
+	std::string m_SessionID;
+
+	//! Our SSH_MSG_KEXINIT, while a key exchange is in progress
+	std::string m_KexInit;
+
+	//! Payloads held back while a key exchange is in progress
+	std::deque<std::string> m_Held;
+
+	//! We start a key exchange after sending this many bytes since the last one, unless it's 0
+	const uint64_t m_RekeyBytes;
+	uint64_t m_BytesSinceKex;
+
+	std::string m_ReadAhead;
+	std::map<uint32_t, EchoChannel> m_EchoChannels;
+	uint32_t m_NextChannel;
+
+	//! Forwarded-tcpip channels to keep open while forwarding
+	const unsigned int m_ForwardedChannels;
+	//! Incremented for every forwarded-tcpip channel that got its echo
+	std::atomic<unsigned long>& m_ForwardedCount;
+	std::map<uint32_t, ForwardedChannel> m_Forwarded;
+	std::string m_ForwardAddress;
+	uint32_t m_ForwardPort;
+	bool m_Forwarding;
+
+	//! zlib@openssh.com was negotiated; it starts once the user is authenticated
+	bool m_Zlib_C2S;
+	bool m_Zlib_S2C;
+	bool m_AdaptiveCompression;
+	std::unique_ptr<RSSH::Compressor> m_Compressor;
+	std::unique_ptr<RSSH::Decompressor> m_Decompressor;
+};
+
+bool Connection::ReadFully(uint8_t* p, size_t len)
+{
+	size_t n = std::min(len, m_ReadAhead.size());
+	memcpy(p, m_ReadAhead.data(), n);
+	m_ReadAhead.erase(0, n);
+	while (n < len) {
+		ssize_t r = read(m_FD, p + n, len - n);
+		if (r <= 0)
+			return false;
+		n += r;
+	}
+	return true;
+}
+
+bool Connection::WriteFully(const uint8_t* p, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(m_FD, p, len);
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool Connection::ReadGreeter(std::string& greeter)
+{
+	// The client may send its first packet along with the greeter; keep it
+	char buf[512];
+	while (m_ReadAhead.find('\n') == std::string::npos) {
+		ssize_t n = read(m_FD, buf, sizeof(buf));
+		if (n <= 0)
+			return false;
+		m_ReadAhead.append(buf, n);
+	}
+	size_t eol = m_ReadAhead.find('\n');
+	greeter = m_ReadAhead.substr(0, eol);
+	if (!greeter.empty() && greeter.back() == '\r')
+		greeter.pop_back();
+	m_ReadAhead.erase(0, eol + 1);
+	return true;
+}
+
+bool Connection::ReceivePacket(std::string& payload)
+{
+	// With encrypt-then-MAC, only the length is read up front; it isn't encrypted
+	const bool etm = m_Receive.m_Cipher && m_Receive.m_ETM;
+	uint8_t first[cipherBlockSize];
+	const size_t firstLength = etm ? 4 : sizeof(first);
+	if (!ReadFully(first, firstLength))
+		return false;
+	if (m_Receive.m_Cipher && !etm)
+		m_Receive.m_Cipher->ProcessData(first, first, sizeof(first));
+	uint32_t len = (uint32_t)first[0] << 24 | (uint32_t)first[1] << 16 | (uint32_t)first[2] << 8 | first[3];
+	if (len < sizeof(first) - 4 || len > 35000)
+		return false;
+
+	std::string packet((const char*)first, firstLength);
+	packet.resize(4 + len);
+	if (!ReadFully((uint8_t*)&packet[firstLength], packet.size() - firstLength))
+		return false;
+	if (m_Receive.m_Cipher) {
+		uint8_t* rest = (uint8_t*)&packet[firstLength];
+		if (!etm)
+			m_Receive.m_Cipher->ProcessData(rest, rest, packet.size() - firstLength);
+
+		const size_t macSize = m_Receive.m_MAC->GetLength();
+		uint8_t mac[maxMACSize], expected[maxMACSize];
+		if (!ReadFully(mac, macSize))
+			return false;
+		m_Receive.ComputeMAC((const uint8_t*)packet.data(), packet.size(), expected);
+		if (memcmp(mac, expected, macSize) != 0)
+			return false;
+		if (etm)
+			m_Receive.m_Cipher->ProcessData(rest, rest, packet.size() - firstLength);
+	}
+	m_Receive.m_SequenceNumber++;
+
+	uint8_t paddingLength = packet[4];
+	payload = packet.substr(5, len - paddingLength - 1);
+	if (m_Decompressor) {
+		Buffer decompressed(35000);
+		m_Decompressor->Decompress((const uint8_t*)payload.data(), payload.size(), decompressed);
+		payload.assign((const char*)decompressed.GetReadPointer(), decompressed.GetAvailableBytes());
+	}
+	return !payload.empty();
+}
+
+bool Connection::SendPacket(const Buffer& packetPayload)
+{
+	// [SSH-TRANS, 7.1] only messages 1 to 49 may be sent during a key exchange
+	const uint8_t type = packetPayload.GetReadPointer()[0];
+	if (!m_KexInit.empty() && type >= 50) {
+		m_Held.emplace_back((const char*)packetPayload.GetReadPointer(), packetPayload.GetAvailableBytes());
+		return true;
+	}
+
+	std::unique_ptr<Buffer> compressed;
+	if (m_Compressor) {
+		compressed.reset(new Buffer(packetPayload.GetAvailableBytes() + 64));
+		// Like the client, consider the link busy while the kernel holds on to data we wrote
+		int unsent = 0;
+		if (m_AdaptiveCompression)
+			ioctl(m_FD, SIOCOUTQNSD, &unsent);
+		m_Compressor->Compress(packetPayload.GetReadPointer(), packetPayload.GetAvailableBytes(), *compressed, unsent > 0);
+	}
+	const Buffer& payload = compressed ? *compressed : packetPayload;
+
+	// With encrypt-then-MAC, the length is not encrypted and thus not padded either
+	const bool etm = m_Transmit.m_Cipher && m_Transmit.m_ETM;
+	const size_t payloadLength = payload.GetAvailableBytes();
+	uint8_t paddingLength = cipherBlockSize - (((etm ? 1 : 5) + payloadLength) % cipherBlockSize);
+	if (paddingLength < 4)
+		paddingLength += cipherBlockSize;
+
+	Buffer b(payloadLength + 64);
+	b << static_cast<uint32_t>(1 + payloadLength + paddingLength);
+	b << paddingLength;
+	b.PutBytes(payload.GetReadPointer(), payloadLength);
+	static const uint8_t padding[32] = { 0 };
+	b.PutBytes(padding, paddingLength);
+	uint8_t* packet = const_cast<uint8_t*>(b.GetReadPointer());
+	const size_t packetLength = b.GetAvailableBytes();
+
+	uint8_t mac[maxMACSize];
+	if (etm) {
+		m_Transmit.m_Cipher->ProcessData(packet + 4, packet + 4, packetLength - 4);
+		m_Transmit.ComputeMAC(packet, packetLength, mac);
+		b.PutBytes(mac, m_Transmit.m_MAC->GetLength());
+	} else if (m_Transmit.m_Cipher) {
+		m_Transmit.ComputeMAC(packet, packetLength, mac);
+		m_Transmit.m_Cipher->ProcessData(packet, packet, packetLength);
+		b.PutBytes(mac, m_Transmit.m_MAC->GetLength());
+	}
+	m_Transmit.m_SequenceNumber++;
+	m_BytesSinceKex += b.GetAvailableBytes();
+	return WriteFully(b.GetReadPointer(), b.GetAvailableBytes());
+}
+
+bool Connection::SendKexInit()
+{
+	// [SSH-TRANS, 7.1] offering only what we implement
+	Buffer kexInit;
+	uint8_t cookie[16];
+	CryptoPP::AutoSeededRandomPool().GenerateBlock(cookie, sizeof(cookie));
+	kexInit << static_cast<uint8_t>(MessageID::SSH_MSG_KEXINIT);
+	kexInit.PutBytes(cookie, sizeof(cookie));
+	kexInit << "curve25519-sha256" << "rsa-sha2-256";
+	kexInit << "aes128-ctr" << "aes128-ctr" << macs << macs;
+	kexInit << compressionMethods << compressionMethods << "" << "";
+	kexInit << false << static_cast<uint32_t>(0);
+	m_KexInit.assign((const char*)kexInit.GetReadPointer(), kexInit.GetAvailableBytes());
+	return SendPacket(kexInit);
+}
+
+bool Connection::KeyExchange(const std::string& clientKexInit)
+{
+	// Whether or not the client guessed, its first key exchange packet comes next: there is only one method to pick
+	std::string payload;
+	if (!ReceivePacket(payload) || payload[0] != (char)MessageID::SSH_MSG_KEXDH_INIT)
+		return false;
+
+	// [SSH-TRANS, 7.1] everything but MACs and compression is what we offered only
+	std::string mac_C2S, mac_S2C;
+	{
+		Buffer in((const uint8_t*)clientKexInit.data() + 17 /* type, cookie */, clientKexInit.size() - 17);
+		RSSH::Types::NameList lists[8];
+		for (auto& list : lists)
+			in >> list;
+		const RSSH::Types::NameList ourMACs(macs);
+		if (!RSSH::Negotiation::Choose(lists[4], ourMACs, mac_C2S) || !RSSH::Negotiation::Choose(lists[5], ourMACs, mac_S2C))
+			return false;
+
+		const RSSH::Types::NameList ours(compressionMethods);
+		std::string c2s, s2c;
+		if (!RSSH::Negotiation::Choose(lists[6], ours, c2s) || !RSSH::Negotiation::Choose(lists[7], ours, s2c))
+			return false;
+		m_Zlib_C2S = c2s == "zlib@openssh.com";
+		m_Zlib_S2C = s2c == "zlib@openssh.com";
+	}
+
+	// [RFC5656, 4] Q_C, and our own ephemeral key pair
+	Buffer in((const uint8_t*)payload.data() + 1, payload.size() - 1);
+	std::string clientPublic;
+	in >> clientPublic;
+	if (clientPublic.size() != RSSH::Curve25519::keyLength)
+		return false;
+	uint8_t privateKey[RSSH::Curve25519::keyLength], publicKey[RSSH::Curve25519::keyLength], shared[RSSH::Curve25519::keyLength];
+	CryptoPP::AutoSeededRandomPool rng;
+	rng.GenerateBlock(privateKey, sizeof(privateKey));
+	RSSH::Curve25519::ScalarMultBase(publicKey, privateKey);
+	RSSH::Curve25519::ScalarMult(shared, privateKey, (const uint8_t*)clientPublic.data());
+	const CryptoPP::Integer k(shared, sizeof(shared));
+	const std::string serverPublic((const char*)publicKey, sizeof(publicKey));
+
+	// [RFC5656, 4] exchange hash
+	uint8_t h[CryptoPP::SHA256::DIGESTSIZE];
+	{
+		Buffer b;
+		b << m_ClientGreeter << std::string(serverGreeter);
+		b << clientKexInit << m_KexInit;
+		b << m_HostKey.m_Blob << clientPublic << serverPublic << k;
+		CryptoPP::SHA256().CalculateDigest(h, b.GetReadPointer(), b.GetAvailableBytes());
+	}
+	if (m_SessionID.empty())
+		m_SessionID = std::string((const char*)h, sizeof(h));
+
+	std::string signature;
+	{
+		CryptoPP::RSASS<CryptoPP::PKCS1v15, CryptoPP::SHA256>::Signer signer(m_HostKey.m_Key);
+		signature.resize(signer.MaxSignatureLength());
+		signature.resize(signer.SignMessage(rng, h, sizeof(h), (uint8_t*)&signature[0]));
+	}
+
+	Buffer reply;
+	reply << static_cast<uint8_t>(MessageID::SSH_MSG_KEXDH_REPLY);
+	reply << m_HostKey.m_Blob << serverPublic;
+	{
+		Buffer sig;
+		sig << "rsa-sha2-256" << signature;
+		reply << std::string((const char*)sig.GetReadPointer(), sig.GetAvailableBytes());
+	}
+	if (!SendPacket(reply))
+		return false;
+
+	Buffer newKeys;
+	newKeys << static_cast<uint8_t>(MessageID::SSH_MSG_NEWKEYS);
+	if (!SendPacket(newKeys))
+		return false;
+
+	CryptoPP::SHA256 sha256;
+	RSSH::Keys keys(RSSH::Keys::maxKeySize);
+	keys.Derive(sha256, k, h, m_SessionID);
+	m_Transmit.Enable(keys.GetEncryptionKey_S2C(), keys.GetInitialIV_S2C(), mac_S2C, keys.GetIntegrityKey_S2C());
+
+	if (!ReceivePacket(payload) || payload[0] != (char)MessageID::SSH_MSG_NEWKEYS)
+		return false;
+	m_Receive.Enable(keys.GetEncryptionKey_C2S(), keys.GetInitialIV_C2S(), mac_C2S, keys.GetIntegrityKey_C2S());
+
+	// The new keys are in effect both ways; send what had to wait for them
+	m_KexInit.clear();
+	m_BytesSinceKex = 0;
+	while (!m_Held.empty()) {
+		const std::string held = m_Held.front();
+		m_Held.pop_front();
+		if (!SendPacket(Buffer((const uint8_t*)held.data(), held.size())))
+			return false;
+	}
+	return true;
+}
+
+bool Connection::Serve()
+{
+	std::string payload;
+	while (ReceivePacket(payload)) {
+		if (m_RekeyBytes > 0 && m_BytesSinceKex >= m_RekeyBytes && m_KexInit.empty() && !SendKexInit())
+			return false;
+
+		Buffer in((const uint8_t*)payload.data() + 1, payload.size() - 1);
+		Buffer out;
+		switch(static_cast<MessageID>(payload[0])) {
+			case MessageID::SSH_MSG_KEXINIT:
+				// The client wants new keys, or agrees to our asking for them
+				if ((m_KexInit.empty() && !SendKexInit()) || !KeyExchange(payload))
+					return false;
+				continue;
+			case MessageID::SSH_MSG_SERVICE_REQUEST: {
+				std::string service;
+				in >> service;
+				out << static_cast<uint8_t>(MessageID::SSH_MSG_SERVICE_ACCEPT) << service;
+				break;
+			}
+			case MessageID::SSH_MSG_USERAUTH_REQUEST:
+				out << static_cast<uint8_t>(MessageID::SSH_MSG_USERAUTH_SUCCESS);
+				if (!SendPacket(out))
+					return false;
+				// [OPENSSH-PROTOCOL, 1.2] delayed compression starts right after this
+				if (m_Zlib_S2C) {
+					// A fixed level by default, like OpenSSH's
+					RSSH::Compressor::Settings settings;
+					settings.m_Adaptive = m_AdaptiveCompression;
+					m_Compressor.reset(new RSSH::Compressor(settings));
+				}
+				if (m_Zlib_C2S)
+					m_Decompressor.reset(new RSSH::Decompressor);
+				continue;
+			case MessageID::SSH_MSG_CHANNEL_OPEN: {
+				std::string type;
+				uint32_t sender, window, maxPacket;
+				in >> type >> sender >> window >> maxPacket;
+				if (type == RSSH::Numbers::ConnectionProtocolAssignedNames::ChannelTypes::DirectTcpIp) {
+					const uint32_t id = m_NextChannel++;
+					m_EchoChannels[id] = EchoChannel{ sender, window, maxPacket, std::string(), 0, 0, false, false };
+					out << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_OPEN_CONFIRMATION);
+					out << sender << id << echoWindow << static_cast<uint32_t>(32768);
+					break;
+				}
+				out << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_OPEN_CONFIRMATION);
+				out << sender << static_cast<uint32_t>(0); // recipient, sender channel
+				out << static_cast<uint32_t>(2 * 1024 * 1024) << static_cast<uint32_t>(32768);
+				break;
+			}
+			case MessageID::SSH_MSG_GLOBAL_REQUEST: {
+				std::string type;
+				bool wantReply;
+				in >> type >> wantReply;
+				if (type == RSSH::Numbers::ConnectionProtocolAssignedNames::RequestType::CancelTcpIpForward) {
+					m_Forwarding = false;
+					continue;
+				}
+				if (type != RSSH::Numbers::ConnectionProtocolAssignedNames::RequestType::TcpIpForward) {
+					if (wantReply) {
+						out << static_cast<uint8_t>(MessageID::SSH_MSG_REQUEST_FAILURE);
+						break;
+					}
+					continue;
+				}
+				// Nothing is listened on; connections are made up by OpenForwarded()
+				uint32_t port;
+				in >> m_ForwardAddress >> port;
+				m_ForwardPort = port != 0 ? port : 1;
+				m_Forwarding = true;
+				if (wantReply) {
+					Buffer success;
+					success << static_cast<uint8_t>(MessageID::SSH_MSG_REQUEST_SUCCESS);
+					if (port == 0)
+						success << m_ForwardPort;
+					if (!SendPacket(success))
+						return false;
+				}
+				for (unsigned int n = 0; n < m_ForwardedChannels; n++) {
+					if (!OpenForwarded())
+						return false;
+				}
+				continue;
+			}
+			case MessageID::SSH_MSG_CHANNEL_OPEN_CONFIRMATION: {
+				uint32_t id, sender;
+				in >> id >> sender;
+				auto it = m_Forwarded.find(id);
+				if (it == m_Forwarded.end())
+					continue;
+				it->second.m_Peer = sender;
+				Buffer data;
+				data << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_DATA) << sender << std::string(forwardedMessage);
+				Buffer eof;
+				eof << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_EOF) << sender;
+				if (!SendPacket(data) || !SendPacket(eof))
+					return false;
+				continue;
+			}
+			case MessageID::SSH_MSG_CHANNEL_OPEN_FAILURE: {
+				uint32_t id;
+				in >> id;
+				// Don't keep trying; the client is not going to change its mind
+				warnx("forwarded-tcpip channel refused");
+				m_Forwarded.erase(id);
+				m_Forwarding = false;
+				continue;
+			}
+			case MessageID::SSH_MSG_CHANNEL_REQUEST: {
+				uint32_t channel;
+				std::string type, command;
+				bool wantReply;
+				in >> channel >> type >> wantReply;
+				if (type != RSSH::Numbers::ConnectionProtocolAssignedNames::RequestType::Exec) {
+					if (wantReply) {
+						out << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_FAILURE) << channel;
+						break;
+					}
+					continue;
+				}
+				in >> command;
+				if (wantReply) {
+					Buffer success;
+					success << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_SUCCESS) << channel;
+					if (!SendPacket(success))
+						return false;
+				}
+				Buffer data;
+				data << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_DATA) << channel << command + "\n";
+				Buffer status;
+				status << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_REQUEST) << channel;
+				status << RSSH::Numbers::ConnectionProtocolAssignedNames::RequestType::ExitStatus << false << static_cast<uint32_t>(0);
+				Buffer eof;
+				eof << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_EOF) << channel;
+				if (!SendPacket(data) || !SendPacket(status) || !SendPacket(eof))
+					return false;
+				out << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_CLOSE) << channel;
+				break;
+			}
+			case MessageID::SSH_MSG_CHANNEL_DATA: {
+				uint32_t id;
+				std::string data;
+				in >> id >> data;
+				auto forwarded = m_Forwarded.find(id);
+				if (forwarded != m_Forwarded.end()) {
+					forwarded->second.m_Received += data.size();
+					continue;
+				}
+				auto it = m_EchoChannels.find(id);
+				if (it == m_EchoChannels.end())
+					continue;
+				it->second.m_Pending += data;
+				if (!Echo(id))
+					return false;
+				continue;
+			}
+			case MessageID::SSH_MSG_CHANNEL_WINDOW_ADJUST: {
+				uint32_t id, bytesToAdd;
+				in >> id >> bytesToAdd;
+				auto it = m_EchoChannels.find(id);
+				if (it == m_EchoChannels.end())
+					continue;
+				it->second.m_Window += bytesToAdd;
+				if (!Echo(id))
+					return false;
+				continue;
+			}
+			case MessageID::SSH_MSG_CHANNEL_EOF: {
+				uint32_t id;
+				in >> id;
+				auto it = m_EchoChannels.find(id);
+				if (it == m_EchoChannels.end())
+					continue;
+				it->second.m_EOF = true;
+				if (!Echo(id))
+					return false;
+				continue;
+			}
+			case MessageID::SSH_MSG_CHANNEL_CLOSE: {
+				uint32_t id;
+				in >> id;
+				auto forwarded = m_Forwarded.find(id);
+				if (forwarded != m_Forwarded.end()) {
+					// Our EOF was sent right away, so the client closes once it passed back the echo
+					if (forwarded->second.m_Received == sizeof(forwardedMessage) - 1)
+						m_ForwardedCount++;
+					out << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_CLOSE) << forwarded->second.m_Peer;
+					m_Forwarded.erase(forwarded);
+					if (!SendPacket(out) || (m_Forwarding && !OpenForwarded()))
+						return false;
+					continue;
+				}
+				auto it = m_EchoChannels.find(id);
+				if (it == m_EchoChannels.end())
+					return true; // the session channel; we're done
+				const bool closeSent = it->second.m_Closed;
+				const uint32_t peer = it->second.m_Peer;
+				m_EchoChannels.erase(it);
+				if (closeSent)
+					continue;
+				out << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_CLOSE) << peer;
+				break;
+			}
+			default:
+				continue;
+		}
+		if (!SendPacket(out))
+			return false;
+	}
+	return false;
+}
+
+bool Connection::Echo(uint32_t id)
+{
+	EchoChannel& channel = m_EchoChannels[id];
+	if (channel.m_Closed)
+		return true;
+	size_t& offset = channel.m_PendingOffset;
+	while (offset < channel.m_Pending.size() && channel.m_Window > 0) {
+		const size_t n = std::min<size_t>(std::min<size_t>(channel.m_Pending.size() - offset, channel.m_Window), channel.m_MaxPacket);
+		Buffer data(n + 16);
+		data << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_DATA) << channel.m_Peer;
+		data.PutData((const uint8_t*)channel.m_Pending.data() + offset, n);
+		if (!SendPacket(data))
+			return false;
+		channel.m_Window -= n;
+		channel.m_Consumed += n;
+		offset += n;
+	}
+	// Only compact once a good part is echoed; the client may take it in small pieces
+	if (offset == channel.m_Pending.size()) {
+		channel.m_Pending.clear();
+		offset = 0;
+	} else if (offset > channel.m_Pending.size() / 2) {
+		channel.m_Pending.erase(0, offset);
+		offset = 0;
+	}
+
+	// What we echoed can be sent again, so the client never gets too far ahead
+	if (channel.m_Consumed >= echoWindow / 2) {
+		Buffer adjust;
+		adjust << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_WINDOW_ADJUST) << channel.m_Peer << channel.m_Consumed;
+		if (!SendPacket(adjust))
+			return false;
+		channel.m_Consumed = 0;
+	}
+	if (!channel.m_EOF || !channel.m_Pending.empty())
+		return true;
+
+	// [SSH-CONNECT, 5.3] the client's EOF is passed back, after which we're done
+	Buffer eof;
+	eof << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_EOF) << channel.m_Peer;
+	Buffer close;
+	close << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_CLOSE) << channel.m_Peer;
+	channel.m_Closed = true;
+	return SendPacket(eof) && SendPacket(close);
+}
+
+bool Connection::OpenForwarded()
+{
+	const uint32_t id = m_NextChannel++;
+	m_Forwarded[id] = ForwardedChannel{ 0, 0 };
+	// [SSH-CONNECT, 7.2]
+	Buffer open;
+	open << static_cast<uint8_t>(MessageID::SSH_MSG_CHANNEL_OPEN);
+	open << RSSH::Numbers::ConnectionProtocolAssignedNames::ChannelTypes::ForwardedTcpIp;
+	open << id << echoWindow << static_cast<uint32_t>(32768);
+	open << m_ForwardAddress << m_ForwardPort;
+	open << "127.0.0.1" << static_cast<uint32_t>(40000 + id % 20000); // originator
+	return SendPacket(open);
+}
+
+void Connection::Run()
+{
+	std::string greeter = std::string(serverGreeter) + "\r\n";
+	if (!WriteFully((const uint8_t*)greeter.data(), greeter.size()))
+		return;
+
+	std::string clientKexInit;
+	if (!SendKexInit() || !ReadGreeter(m_ClientGreeter) || !ReceivePacket(clientKexInit) ||
+	    clientKexInit[0] != (char)MessageID::SSH_MSG_KEXINIT || !KeyExchange(clientKexInit))
+		return;
+	Serve();
+}
+
+} // unnamed namespace
+
+StandInServer::StandInServer()
+	: m_Connections(0), m_Active(0), m_ForwardedChannels(0), m_ForwardedCount(0), m_AdaptiveCompression(false), m_RekeyBytes(0)
+{
+	m_ListenFD = socket(AF_INET, SOCK_STREAM, 0);
+	if (m_ListenFD < 0)
+		err(1, "socket");
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(sin);
+	if (bind(m_ListenFD, (struct sockaddr*)&sin, sizeof(sin)) < 0 || listen(m_ListenFD, 1024) < 0 ||
+	    getsockname(m_ListenFD, (struct sockaddr*)&sin, &len) < 0)
+		err(1, "bind");
+	m_Port = ntohs(sin.sin_port);
+	m_Acceptor = std::thread(&StandInServer::Accept, this);
+}
+
+StandInServer::~StandInServer()
+{
+	shutdown(m_ListenFD, SHUT_RDWR);
+	m_Acceptor.join();
+	close(m_ListenFD);
+	while (m_Active > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+void StandInServer::Accept()
+{
+	static const HostKey hostKey;
+	while (true) {
+		int fd = accept(m_ListenFD, NULL, NULL);
+		if (fd < 0)
+			break;
+		// Packets are written one at a time; don't let Nagle hold them back
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		m_Connections++;
+		m_Active++;
+		const unsigned int forwardedChannels = m_ForwardedChannels;
+		const bool adaptiveCompression = m_AdaptiveCompression;
+		const uint64_t rekeyBytes = m_RekeyBytes;
+		std::thread([this, fd, forwardedChannels, adaptiveCompression, rekeyBytes] {
+			Connection(fd, hostKey, forwardedChannels, m_ForwardedCount, adaptiveCompression, rekeyBytes).Run();
+			m_Active--;
+		}).detach();
+	}
+}
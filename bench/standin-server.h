@@ -0,0 +1,69 @@
+#ifndef RSSH_BENCH_STANDIN_SERVER_H
+#define RSSH_BENCH_STANDIN_SERVER_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+/*! Minimal SSH server for benchmarks
+ *
+ *  Listens on the loopback interface and serves every connection from its
+ *  own thread. It only speaks what rssh needs by default: curve25519-sha256
+ *  with an rsa-sha2-256 host key, aes128-ctr with umac-64-etm, or with
+ *  hmac-sha1 (encrypt-then-MAC or not) if the client prefers, along with
+ *  zlib@openssh.com compression if the client prefers it, at a fixed level
+ *  unless asked to pick it adaptively. Key exchanges may be repeated, at
+ *  the client's request or after a given amount of data. Every user is
+ *  accepted without authentication; exec requests are answered with the
+ *  command followed by a newline, an exit status of 0 and a close.
+ *  direct-tcpip channels are not connected anywhere: they echo whatever
+ *  is sent on them, and are closed after end-of-file.
+ *
+ *  tcpip-forward requests are granted without listening anywhere either:
+ *  instead, a given number of forwarded-tcpip channels is kept open. Each
+ *  is sent a short message followed by end-of-file, and is expected to
+ *  echo it before the client closes it; another one is opened then, until
+ *  the forwarding is cancelled.
+ *
+ *  This is nowhere near a real server: it trusts its peer and performs
+ *  no checks beyond what is needed to keep the protocol going.
+ */
+class StandInServer {
+public:
+	StandInServer();
+	~StandInServer();
+
+	//! TCP port on 127.0.0.1 to connect to
+	int GetPort() const { return m_Port; }
+
+	//! Number of connections accepted so far
+	unsigned long GetConnectionCount() const { return m_Connections; }
+
+	//! Forwarded-tcpip channels kept open by connections accepted from now on
+	void SetForwardedChannels(unsigned int count) { m_ForwardedChannels = count; }
+
+	//! Number of forwarded-tcpip channels that got their echo so far
+	unsigned long GetForwardedCount() const { return m_ForwardedCount; }
+
+	//! Whether connections accepted from now on pick their compression level adaptively
+	void SetAdaptiveCompression(bool adaptive) { m_AdaptiveCompression = adaptive; }
+
+	//! Bytes after which connections accepted from now on exchange keys again; 0 leaves that to the client
+	void SetRekeyBytes(uint64_t bytes) { m_RekeyBytes = bytes; }
+
+private:
+	void Accept();
+
+	int m_ListenFD;
+	int m_Port;
+	std::thread m_Acceptor;
+	std::atomic<unsigned long> m_Connections;
+	std::atomic<int> m_Active;
+	std::atomic<unsigned int> m_ForwardedChannels;
+	std::atomic<unsigned long> m_ForwardedCount;
+	std::atomic<bool> m_AdaptiveCompression;
+	std::atomic<uint64_t> m_RekeyBytes;
+};
+
+#endif /* RSSH_BENCH_STANDIN_SERVER_H */
@@ -0,0 +1,330 @@
+/*
+ * Measures bulk channel throughput at different round-trip times. A
+ * stand-in server sends SSH_MSG_CHANNEL_DATA as fast as the channel window
+ * allows; everything passes through a proxy that delays each direction by
+ * half the round-trip time, so no tc/netem setup is needed. Both the fixed
+ * window rssh used to advertise and the autotuned window are measured.
+ *
+ * The transport is not encrypted: no key exchange takes place, which keeps
+ * the measurement about flow control only.
+ *
+ * usage: window-bench [-t seconds] [-m max_window_kb] [rtt_ms ...]
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <err.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "callback.h"
+#include "channel-window.h"
+#include "numbers.h"
+#include "transport.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int PollTimeout(Clock::time_point until)
+{
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(until - Clock::now()).count() + 1;
+	return ms < 0 ? 0 : static_cast<int>(ms);
+}
+
+/*
+ * Forwards data from 'src' to 'dst', each chunk no sooner than 'delay'
+ * after it was read. Stops once either side is closed.
+ */
+void Delay(int src, int dst, Clock::duration delay)
+{
+	struct Chunk {
+		Clock::time_point m_Release;
+		std::string m_Data;
+	};
+	std::deque<Chunk> queue;
+	size_t offset = 0; // of the first chunk, if partially written
+	bool eof = false;
+	while (!eof || !queue.empty()) {
+		const bool due = !queue.empty() && queue.front().m_Release <= Clock::now();
+		struct pollfd pfd[2];
+		pfd[0].fd = src; pfd[0].events = eof ? 0 : POLLIN;
+		pfd[1].fd = dst; pfd[1].events = due ? POLLOUT : 0;
+		int timeout = -1;
+		if (!queue.empty() && !due)
+			timeout = PollTimeout(queue.front().m_Release);
+		if (poll(pfd, 2, timeout) < 0)
+			err(1, "poll");
+
+		if (pfd[0].revents & (POLLIN | POLLHUP)) {
+			char buf[65536];
+			ssize_t n = read(src, buf, sizeof(buf));
+			if (n <= 0)
+				eof = true;
+			else
+				queue.push_back({ Clock::now() + delay, std::string(buf, n) });
+		}
+		if (pfd[1].revents & (POLLERR | POLLHUP))
+			break;
+		if (pfd[1].revents & POLLOUT) {
+			const std::string& data = queue.front().m_Data;
+			ssize_t n = write(dst, data.data() + offset, data.size() - offset);
+			if (n < 0)
+				break;
+			offset += n;
+			if (offset == data.size()) {
+				queue.pop_front();
+				offset = 0;
+			}
+		}
+	}
+	shutdown(dst, SHUT_WR);
+}
+
+//! Appends an unencrypted packet holding 'payload' to 'out'
+void PutPacket(std::string& out, const RSSH::Buffer& payload)
+{
+	uint8_t padding_len = 8 - ((4 + 1 + payload.GetAvailableBytes()) % 8);
+	if (padding_len < 4)
+		padding_len += 8;
+
+	RSSH::Buffer b(payload.GetAvailableBytes() + 32);
+	b << static_cast<uint32_t>(1 + payload.GetAvailableBytes() + padding_len);
+	b << padding_len;
+	b.PutBytes(payload.GetReadPointer(), payload.GetAvailableBytes());
+	static const uint8_t padding[16] = { 0 };
+	b.PutBytes(padding, padding_len);
+	out.append((const char*)b.GetReadPointer(), b.GetAvailableBytes());
+}
+
+/*
+ * Plays the server: confirms the channel open and keeps sending channel
+ * data, never more than the window the client granted, until the client
+ * disconnects.
+ */
+void Serve(int fd)
+{
+	static const uint8_t data[65536] = { 0 };
+	const char* greeter = "SSH-2.0-window-bench\r\n";
+	if (write(fd, greeter, strlen(greeter)) < 0)
+		err(1, "write");
+
+	std::string in, out;
+	bool gotGreeter = false;
+	bool open = false;
+	uint32_t clientChannel = 0, window = 0, maxPacket = 0;
+	while (true) {
+		if (open && out.size() < 65536 && window > 0) {
+			uint32_t len = window < maxPacket ? window : maxPacket;
+			if (len > sizeof(data))
+				len = sizeof(data);
+			RSSH::Buffer p(len + 16);
+			p << static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_DATA);
+			p << clientChannel;
+			p.PutData(data, len);
+			PutPacket(out, p);
+			window -= len;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN | (out.empty() ? 0 : POLLOUT);
+		if (poll(&pfd, 1, -1) < 0)
+			err(1, "poll");
+		if (pfd.revents & POLLOUT) {
+			ssize_t n = write(fd, out.data(), out.size());
+			if (n < 0)
+				break;
+			out.erase(0, n);
+		}
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+			char buf[4096];
+			ssize_t n = read(fd, buf, sizeof(buf));
+			if (n <= 0)
+				break;
+			in.append(buf, n);
+		}
+
+		if (!gotGreeter) {
+			size_t eol = in.find('\n');
+			if (eol == std::string::npos)
+				continue;
+			in.erase(0, eol + 1);
+			gotGreeter = true;
+		}
+		while (in.size() >= 4) {
+			RSSH::Buffer b((const uint8_t*)in.data(), in.size());
+			uint32_t packetLength;
+			uint8_t paddingLength, type;
+			b >> packetLength;
+			if (in.size() < 4 + packetLength)
+				break;
+			b >> paddingLength >> type;
+			if (type == static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_OPEN)) {
+				std::string channelType;
+				b >> channelType >> clientChannel >> window >> maxPacket;
+				RSSH::Buffer p;
+				p << static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_OPEN_CONFIRMATION);
+				p << clientChannel; // recipient channel
+				p << clientChannel; // sender channel
+				p << static_cast<uint32_t>(0); // window size
+				p << static_cast<uint32_t>(0); // max packet size
+				PutPacket(out, p);
+				open = true;
+			} else if (type == static_cast<uint8_t>(RSSH::Numbers::MessageID::SSH_MSG_CHANNEL_WINDOW_ADJUST)) {
+				uint32_t channel, bytesToAdd;
+				b >> channel >> bytesToAdd;
+				window += bytesToAdd;
+			}
+			in.erase(0, 4 + packetLength);
+		}
+	}
+	close(fd);
+}
+
+class BenchCallback : public RSSH::Callback {
+public:
+	BenchCallback() : m_Transport(NULL), m_Opened(false), m_Bytes(0), m_Packets(0) { }
+
+	//! The transport needs us to be constructed, so it is only set afterwards
+	void SetTransport(RSSH::Transport& transport) { m_Transport = &transport; }
+
+	std::string GetUserName() override { return "bench"; }
+	void OnChannelOpened(int channelNumber) override { m_Opened = true; }
+	void OnChannelData(int channelNumber, const uint8_t* data, size_t len) override {
+		m_Bytes += len;
+		m_Packets++;
+		m_Transport->ChannelDataConsumed(channelNumber, len);
+	}
+
+	RSSH::Transport* m_Transport;
+	bool m_Opened;
+	size_t m_Bytes;
+	uint64_t m_Packets;
+};
+
+struct Result {
+	//! Bytes per second received
+	double m_Rate;
+
+	//! Window adjusts sent per data packet received
+	double m_AdjustsPerPacket;
+};
+
+//! Receives for 'seconds' over a link with the given round-trip time
+Result Measure(const RSSH::ChannelWindow::Settings& settings, unsigned int rtt_ms, double seconds)
+{
+	int client[2], server[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, client) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, server) < 0)
+		err(1, "socketpair");
+	const Clock::duration delay = std::chrono::microseconds(rtt_ms * 500);
+	std::thread upstream(Delay, client[1], server[0], delay);
+	std::thread downstream(Delay, server[0], client[1], delay);
+	std::thread serve(Serve, server[1]);
+
+	// The transport points to the callback and vice versa
+	struct Client {
+		Client() : m_Transport(m_Callback) { m_Callback.SetTransport(m_Transport); }
+		BenchCallback m_Callback;
+		RSSH::Transport m_Transport;
+	};
+	Result result;
+	{
+		Client c;
+		RSSH::Transport& transport = c.m_Transport;
+		transport.GetChannelWindowSettings() = settings;
+		transport.Attach(client[0]);
+		transport.OpenChannel(RSSH::Numbers::ConnectionProtocolAssignedNames::ChannelTypes::Session);
+
+		double start = 0, end = 0;
+		uint64_t adjusts = 0;
+		while (start == 0 || Now() < end) {
+			struct pollfd pfd;
+			pfd.fd = client[0];
+			pfd.events = POLLIN | (transport.HasPendingOutput() ? POLLOUT : 0);
+			if (poll(&pfd, 1, 100) < 0)
+				err(1, "poll");
+			if (pfd.revents & POLLOUT)
+				transport.Flush();
+			if (pfd.revents & POLLIN)
+				transport.Process();
+			if (start == 0 && c.m_Callback.m_Opened) {
+				start = Now();
+				end = start + seconds;
+				c.m_Callback.m_Bytes = 0;
+				c.m_Callback.m_Packets = 0;
+				adjusts = transport.GetWindowAdjustCount();
+			}
+		}
+		result.m_Rate = c.m_Callback.m_Bytes / (Now() - start);
+		result.m_AdjustsPerPacket = (transport.GetWindowAdjustCount() - adjusts) / (double)c.m_Callback.m_Packets;
+	}
+	// The transport closed client[0]; this unwinds the proxy and the server
+	upstream.join();
+	downstream.join();
+	serve.join();
+	close(client[1]);
+	close(server[0]);
+	return result;
+}
+
+} // unnamed namespace
+
+int
+main(int argc, char* argv[])
+{
+	double seconds = 2;
+	uint32_t maxWindow = 16 * 1024 * 1024;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:t:")) != -1) {
+		switch(opt) {
+			case 'm':
+				maxWindow = atoi(optarg) * 1024;
+				break;
+			case 't':
+				seconds = atof(optarg);
+				break;
+			default:
+				errx(1, "usage: %s [-t seconds] [-m max_window_kb] [rtt_ms ...]", argv[0]);
+		}
+	}
+	std::vector<unsigned int> rtts;
+	for (int n = optind; n < argc; n++)
+		rtts.push_back(atoi(argv[n]));
+	if (rtts.empty())
+		rtts = { 0, 10, 50, 100 };
+	signal(SIGPIPE, SIG_IGN);
+
+	// What rssh used to advertise, without autotuning
+	RSSH::ChannelWindow::Settings fixed;
+	fixed.m_InitialSize = 4096;
+	fixed.m_MaxSize = 4096;
+	fixed.m_MaxPacketSize = 1024;
+	RSSH::ChannelWindow::Settings autotuned;
+	autotuned.m_MaxSize = maxWindow;
+
+	printf("%8s %14s %14s %14s\n", "rtt (ms)", "fixed (MB/s)", "auto (MB/s)", "adjust/packet");
+	for (unsigned int rtt : rtts) {
+		Result fixedResult = Measure(fixed, rtt, seconds);
+		Result autoResult = Measure(autotuned, rtt, seconds);
+		printf("%8u %14.2f %14.2f %14.3f\n", rtt, fixedResult.m_Rate / 1e6, autoResult.m_Rate / 1e6, autoResult.m_AdjustsPerPacket);
+	}
+	return 0;
+}
@@ -1,66 +1,161 @@
 #include "algorithm.h"
+#include "buffer.h"
 #include "cipher-factory.h"
 #include "exception.h"
-#include "hmac-sha1.h"
+#include "iaead.h"
 #include "icipher.h"
+#include "ihmac.h"
 #include "keys.h"
+#include "mac-factory.h"
+
+#include <algorithm>
 
 namespace RSSH {
 
+namespace {
+
+/*
+ * Number of bytes we MAC/encrypt at a time; this must be a multiple of any
+ * cipher block size and small enough to remain in the L1 cache between the
+ * cipher and the MAC touching it.
+ */
+const size_t chunkSize = 4096;
+
+} // unnamed namespace
+
 Algorithm::Algorithm(const char* cipher_c2s, const char* cipher_s2c, const char* hmac_c2s, const char* hmac_s2c, Keys& keys)
+	: m_Cipher_C2S(NULL), m_Cipher_S2C(NULL), m_MAC_C2S(NULL), m_MAC_S2C(NULL), m_AEAD_C2S(NULL), m_AEAD_S2C(NULL), m_ETM_C2S(false), m_ETM_S2C(false)
 {
-	m_Cipher_C2S = CipherFactory::Create(cipher_c2s, true, keys.GetInitialIV_C2S(), keys.GetEncryptionKey_C2S());
-	m_Cipher_S2C = CipherFactory::Create(cipher_s2c, false, keys.GetInitialIV_S2C(), keys.GetEncryptionKey_S2C());
-	m_MAC_C2S = new HMAC_SHA1(keys.GetIntegrityKey_C2S(), keys.GetKeySize());
-	m_MAC_S2C = new HMAC_SHA1(keys.GetIntegrityKey_S2C(), keys.GetKeySize());
+	m_AEAD_C2S = CipherFactory::CreateAEAD(cipher_c2s, true, keys.GetInitialIV_C2S(), keys.GetEncryptionKey_C2S());
+	if (m_AEAD_C2S == NULL) {
+		m_Cipher_C2S = CipherFactory::Create(cipher_c2s, true, keys.GetInitialIV_C2S(), keys.GetEncryptionKey_C2S());
+		m_MAC_C2S = MACFactory::Create(hmac_c2s, keys.GetIntegrityKey_C2S());
+		m_ETM_C2S = MACFactory::IsEncryptThenMAC(hmac_c2s);
+	}
+	m_AEAD_S2C = CipherFactory::CreateAEAD(cipher_s2c, false, keys.GetInitialIV_S2C(), keys.GetEncryptionKey_S2C());
+	if (m_AEAD_S2C == NULL) {
+		m_Cipher_S2C = CipherFactory::Create(cipher_s2c, false, keys.GetInitialIV_S2C(), keys.GetEncryptionKey_S2C());
+		m_MAC_S2C = MACFactory::Create(hmac_s2c, keys.GetIntegrityKey_S2C());
+		m_ETM_S2C = MACFactory::IsEncryptThenMAC(hmac_s2c);
+	}
 }
 
 Algorithm::~Algorithm()
 {
+	delete m_AEAD_S2C;
+	delete m_AEAD_C2S;
 	delete m_MAC_C2S;
 	delete m_MAC_S2C;
 	delete m_Cipher_S2C;
 	delete m_Cipher_C2S;
 }
 
-void Algorithm::Encrypt_C2S(uint8_t* buffer, size_t len)
+size_t Algorithm::DecryptLength_S2C(uint8_t* packet, uint32_t sequenceNumber)
 {
-	m_Cipher_C2S->Process(buffer, len);
+	if (m_AEAD_S2C != NULL)
+		return m_AEAD_S2C->DecryptLength(packet, sequenceNumber);
+	if (m_ETM_S2C)
+		return sizeof(uint32_t); // it's in the clear
+
+	// We can't blindly decrypt everything because the HMAC is not
+	// encrypted - just decrypt the first block, which holds the length
+	size_t len = m_Cipher_S2C->GetBlockSize();
+	m_Cipher_S2C->Process(packet, len);
+	return len;
 }
 
-void Algorithm::Decrypt_S2C(uint8_t* buffer, size_t len)
+void Algorithm::EncryptAndMAC_C2S(Buffer& buffer, uint32_t sequenceNumber)
 {
-	m_Cipher_S2C->Process(buffer, len);
+	if (m_AEAD_C2S != NULL) {
+		m_AEAD_C2S->Seal(const_cast<uint8_t*>(buffer.GetReadPointer()), buffer.GetAvailableBytes(), sequenceNumber);
+		buffer.SetWritePosition(buffer.GetWritePosition() + m_AEAD_C2S->GetTagLength());
+		return;
+	}
+
+	uint8_t* packet = const_cast<uint8_t*>(buffer.GetReadPointer());
+	size_t len = buffer.GetAvailableBytes();
+	m_MAC_C2S->Begin(sequenceNumber);
+	if (m_ETM_C2S) {
+		// [OPENSSH-PROTOCOL, 1.5] The MAC is calculated over the length, which is not encrypted, and the ciphertext
+		m_MAC_C2S->Update(packet, sizeof(uint32_t));
+		for (size_t offset = sizeof(uint32_t); offset < len; /* nothing */) {
+			size_t n = std::min(chunkSize, len - offset);
+			m_Cipher_C2S->Process(&packet[offset], n);
+			m_MAC_C2S->Update(&packet[offset], n);
+			offset += n;
+		}
+		m_MAC_C2S->Final(buffer.GetWritePointer());
+		buffer.SetWritePosition(buffer.GetWritePosition() + m_MAC_C2S->GetLength());
+		return;
+	}
+
+	// [SSH-TRANS, 6.4] The MAC is calculated over the unencrypted packet
+	for (size_t offset = 0; offset < len; /* nothing */) {
+		size_t n = std::min(chunkSize, len - offset);
+		m_MAC_C2S->Update(&packet[offset], n);
+		m_Cipher_C2S->Process(&packet[offset], n);
+		offset += n;
+	}
+	m_MAC_C2S->Final(buffer.GetWritePointer());
+	buffer.SetWritePosition(buffer.GetWritePosition() + m_MAC_C2S->GetLength());
 }
 
-void Algorithm::PerformHMAC_C2S(Buffer& buffer, uint32_t sequenceNumber)
+bool Algorithm::DecryptAndVerify_S2C(uint8_t* packet, size_t decrypted, size_t len, uint32_t sequenceNumber)
 {
-	m_MAC_C2S->Calculate(buffer.GetReadPointer(), buffer.GetAvailableBytes(), sequenceNumber, buffer.GetWritePointer());
-	buffer.SetWritePosition(buffer.GetWritePosition() + m_MAC_C2S->GetLength());
+	if (m_AEAD_S2C != NULL)
+		return m_AEAD_S2C->Open(packet, len, sequenceNumber);
+
+	if (m_ETM_S2C) {
+		// [OPENSSH-PROTOCOL, 1.5] Forged or corrupt packets are rejected without decrypting anything
+		if (!m_MAC_S2C->Verify(packet, len, sequenceNumber, &packet[len]))
+			return false;
+		m_Cipher_S2C->Process(&packet[decrypted], len - decrypted);
+		return true;
+	}
+
+	m_MAC_S2C->Begin(sequenceNumber);
+	m_MAC_S2C->Update(packet, decrypted);
+	for (size_t offset = decrypted; offset < len; /* nothing */) {
+		size_t n = std::min(chunkSize, len - offset);
+		m_Cipher_S2C->Process(&packet[offset], n);
+		m_MAC_S2C->Update(&packet[offset], n);
+		offset += n;
+	}
+	return m_MAC_S2C->VerifyFinal(&packet[len]);
 }
 
-bool Algorithm::CheckHMAC_S2C(const uint8_t* buffer, size_t len, uint32_t sequenceNumber)
+size_t Algorithm::GetLengthBlockSize_S2C() const
 {
-	return m_MAC_S2C->Verify(buffer, len, sequenceNumber, &buffer[len]);
+	if (m_AEAD_S2C != NULL || m_ETM_S2C)
+		return sizeof(uint32_t);
+	return m_Cipher_S2C->GetBlockSize();
 }
 
 size_t Algorithm::GetHMACSize_C2S() const
 {
+	if (m_AEAD_C2S != NULL)
+		return m_AEAD_C2S->GetTagLength();
 	return m_MAC_C2S->GetLength();
 }
 
 size_t Algorithm::GetHMACSize_S2C() const
 {
+	if (m_AEAD_S2C != NULL)
+		return m_AEAD_S2C->GetTagLength();
 	return m_MAC_S2C->GetLength();
 }
 
 size_t Algorithm::GetBlockSize_C2S() const
 {
+	if (m_AEAD_C2S != NULL)
+		return m_AEAD_C2S->GetBlockSize();
 	return m_Cipher_C2S->GetBlockSize();
 }
 
 size_t Algorithm::GetBlockSize_S2C() const
 {
+	if (m_AEAD_S2C != NULL)
+		return m_AEAD_S2C->GetBlockSize();
 	return m_Cipher_S2C->GetBlockSize();
 }
 
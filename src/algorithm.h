@@ -8,18 +8,53 @@ namespace RSSH {
 
 class Buffer;
 class Keys;
+class IAEAD;
 class ICipher;
 class IHMAC;
 
+/*! Packet protection for both directions
+ *
+ *  Each direction either uses a cipher combined with a MAC, or an AEAD
+ *  cipher which handles both by itself; in the latter case, the MAC names
+ *  are ignored. With an encrypt-then-MAC variant [OPENSSH-PROTOCOL, 1.5],
+ *  the packet length is sent in the clear and the MAC covers the
+ *  ciphertext, so incoming packets are verified before they're decrypted.
+ */
 class Algorithm {
 public:
 	Algorithm(const char* cipher_c2s, const char* cipher_s2c, const char* hmac_c2s, const char* hmac_s2c, Keys& keys);
 	~Algorithm();
 
-	void Encrypt_C2S(uint8_t* buffer, size_t len);
-	void Decrypt_S2C(uint8_t* buffer, size_t len);
-	void PerformHMAC_C2S(Buffer& buffer, uint32_t sequenceNumber);
-	bool CheckHMAC_S2C(const uint8_t* buffer, size_t len, uint32_t sequenceNumber);
+	/*! Makes the length of the incoming packet available
+	 *
+	 *  Returns the number of bytes at the start of the packet that are
+	 *  readable as plaintext; GetLengthBlockSize_S2C() bytes must be present.
+	 */
+	size_t DecryptLength_S2C(uint8_t* packet, uint32_t sequenceNumber);
+
+	/*! Calculates the MAC of the packet in the buffer, appends it and encrypts the packet
+	 *
+	 *  MAC and cipher are applied chunk-by-chunk, so every byte is only
+	 *  brought into the cache once.
+	 */
+	void EncryptAndMAC_C2S(Buffer& buffer, uint32_t sequenceNumber);
+
+	/*! Decrypts the remainder of a packet and verifies its MAC
+	 *
+	 *  The first 'decrypted' bytes of the 'len' byte packet must already
+	 *  be decrypted; the MAC is expected to follow the packet. Like
+	 *  EncryptAndMAC_C2S(), this works chunk-by-chunk, unless the MAC is
+	 *  encrypt-then-MAC: then nothing is decrypted until the MAC matches,
+	 *  which is done in one go. Returns false if the MAC does not match.
+	 */
+	bool DecryptAndVerify_S2C(uint8_t* packet, size_t decrypted, size_t len, uint32_t sequenceNumber);
+
+	//! Number of bytes needed before DecryptLength_S2C() can be used
+	size_t GetLengthBlockSize_S2C() const;
+
+	//! Is the packet length excluded from padding? This is the case for AEAD ciphers and encrypt-then-MAC
+	bool IsLengthExcluded_C2S() const { return m_AEAD_C2S != NULL || m_ETM_C2S; }
+	bool IsLengthExcluded_S2C() const { return m_AEAD_S2C != NULL || m_ETM_S2C; }
 
 	size_t GetBlockSize_C2S() const;
 	size_t GetBlockSize_S2C() const;
@@ -31,6 +66,12 @@ private:
 	ICipher* m_Cipher_S2C;
 	IHMAC* m_MAC_C2S;
 	IHMAC* m_MAC_S2C;
+	IAEAD* m_AEAD_C2S;
+	IAEAD* m_AEAD_S2C;
+
+	//! Set if the MAC is encrypt-then-MAC
+	bool m_ETM_C2S;
+	bool m_ETM_S2C;
 };
 
 } // namespace RSSH
@@ -21,6 +21,13 @@ Buffer::Buffer() {
 	m_WritePosition = 0;
 }
 
+Buffer::Buffer(size_t size) {
+	m_Size = size;
+	m_Data = new uint8_t[m_Size];
+	m_ReadPosition = 0;
+	m_WritePosition = 0;
+}
+
 Buffer::Buffer(const uint8_t* buffer, size_t len) {
 	m_Size = len;
 	m_Data = new uint8_t[len];
@@ -40,14 +47,14 @@ Buffer::Position Buffer::GetAvailableBytes() const
 
 void Buffer::SetReadPosition(Position p)
 {
-	if (p >= m_Size)
+	if (p > m_Size)
 		throw Exception(Exception::C_Buffer_Too_Short);
 	m_ReadPosition = p;
 }
 
 void Buffer::SetWritePosition(Position p)
 {
-	if (p >= m_Size)
+	if (p > m_Size)
 		throw Exception(Exception::C_Buffer_Too_Short);
 	m_WritePosition = p;
 }
@@ -60,6 +67,17 @@ void Buffer::GetBytes(uint8_t* bytes, size_t len)
 	SkipBytes(len);
 }
 
+void Buffer::GetDataView(const uint8_t*& data, size_t& len)
+{
+	uint32_t n;
+	*this >> n;
+	if (n > GetAvailableBytes())
+		throw Exception(Exception::C_Buffer_Out_Of_Data);
+	data = GetReadPointer();
+	len = n;
+	SkipBytes(n);
+}
+
 void Buffer::SkipBytes(size_t len)
 {
 	m_ReadPosition += len;
@@ -151,6 +169,12 @@ Buffer& Buffer::operator<<(const std::string& v)
 	return *this;
 }
 
+Buffer& Buffer::operator<<(const char* v)
+{
+	PutData((const uint8_t*)v, strlen(v));
+	return *this;
+}
+
 Buffer& Buffer::operator>>(CryptoPP::Integer& v)
 {
 	uint32_t len;
@@ -22,6 +22,7 @@ public:
 	typedef size_t Position;
 
 	Buffer();
+	explicit Buffer(size_t size);
 	Buffer(const uint8_t* buffer, size_t len);
 	~Buffer();
 
@@ -56,12 +57,25 @@ public:
 		return m_Size;
 	}
 
+	//! Discards all content
+	void Clear() {
+		m_ReadPosition = 0;
+		m_WritePosition = 0;
+	}
+
 	//! How many bytes are left to read?
 	Position GetAvailableBytes() const;
 
 	void SkipBytes(size_t len);
 	void GetBytes(uint8_t* bytes, size_t len);
 
+	/*! Reads a string without copying it
+	 *
+	 *  'data' will point into the buffer and remains valid until the
+	 *  buffer is modified.
+	 */
+	void GetDataView(const uint8_t*& data, size_t& len);
+
 	Buffer& operator>>(uint8_t& v);
 	Buffer& operator>>(bool& v);
 	Buffer& operator>>(uint32_t& v);
@@ -74,6 +88,7 @@ public:
 	Buffer& operator<<(bool v);
 	Buffer& operator<<(uint32_t v);
 	Buffer& operator<<(const std::string& v);
+	Buffer& operator<<(const char* v);
 	Buffer& operator<<(const CryptoPP::Integer& v);
 
 	void Shift();
@@ -1,6 +1,7 @@
 #ifndef RSSH_CALLBACK_H
 #define RSSH_CALLBACK_H
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -42,6 +43,33 @@ public:
 	//! Called once a channel is successfully opened
 	virtual void OnChannelOpened(int channelNumber) { }
 
+	//! Called if the server refuses to open a channel; its number is released afterwards
+	virtual void OnChannelOpenFailure(int channelNumber, uint32_t reasonCode, const std::string& description) { }
+
+	/*! Called once the server opens a channel for a connection to a port it forwards
+	 *
+	 *  See Transport::RequestTcpIpForward(). Return false to refuse the
+	 *  channel. Otherwise, the channel is Opening until it is passed to
+	 *  Transport::AcceptChannelOpen() or RejectChannelOpen(), which may be
+	 *  done later on, i.e. once the connection is made locally.
+	 */
+	virtual bool OnForwardedTcpIp(int channelNumber, const std::string& connectedAddress, uint32_t connectedPort, const std::string& originatorAddress, uint32_t originatorPort) { return false; }
+
+	//! Called once the server listens for a tcpip-forward request; 'boundPort' is the port it picked if 'port' is 0
+	virtual void OnTcpIpForwardSuccess(const std::string& address, uint32_t port, uint32_t boundPort) { }
+
+	//! Called if the server refuses a tcpip-forward request
+	virtual void OnTcpIpForwardFailure(const std::string& address, uint32_t port) { }
+
+	//! Called once the server's window opened up and no data is pending; see Transport::GetChannelSendRoom()
+	virtual void OnChannelWritable(int channelNumber) { }
+
+	//! Called once the server will send no more data on a channel
+	virtual void OnChannelEOF(int channelNumber) { }
+
+	//! Called once a channel is closed by both sides; its number may be reused afterwards
+	virtual void OnChannelClosed(int channelNumber) { }
+
 	//! Called once the server accepts a given service
 	virtual void OnServiceAccepted(const std::string& serviceName) { }
 
@@ -53,6 +81,30 @@ public:
 
 	//! Called once channel data arrives
 	virtual void OnChannelData(int channelNumber, const std::string& data) { }
+
+	/*! Called once channel data arrives, without copying it
+	 *
+	 *  'data' points into the receive buffer and is only valid during the
+	 *  call. The default implementation hands a copy to the std::string
+	 *  variant above.
+	 */
+	virtual void OnChannelData(int channelNumber, const uint8_t* data, size_t len) {
+		OnChannelData(channelNumber, std::string((const char*)data, len));
+	}
+
+	/*! Called once extended channel data, such as stderr output, arrives
+	 *
+	 *  'dataType' is the data_type_code, i.e. SSH_EXTENDED_DATA_STDERR.
+	 *  Like OnChannelData(), 'data' is only valid during the call and the
+	 *  data must be passed to Transport::ChannelDataConsumed() once done.
+	 */
+	virtual void OnChannelExtendedData(int channelNumber, uint32_t dataType, const uint8_t* data, size_t len) { }
+
+	//! Called once the command running on a channel exits
+	virtual void OnChannelExitStatus(int channelNumber, uint32_t exitStatus) { }
+
+	//! Called if the command running on a channel was terminated by a signal, i.e. "KILL"
+	virtual void OnChannelExitSignal(int channelNumber, const std::string& signalName, bool coreDumped, const std::string& errorMessage) { }
 };
 
 } // namespace RSSH
@@ -0,0 +1,275 @@
+#include "chacha20.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RSSH_CHACHA20_SSE2
+#endif
+
+// AVX2 code is compiled using a function attribute and only used if the CPU supports it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RSSH_CHACHA20_AVX2
+#endif
+
+namespace RSSH {
+
+namespace {
+
+// Number of double rounds; ChaCha20 has 20 rounds
+const int doubleRounds = 10;
+
+inline uint32_t Load32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+inline void Store32(uint8_t* p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+inline uint32_t Rotate(uint32_t v, int n)
+{
+	return (v << n) | (v >> (32 - n));
+}
+
+#define QUARTER_ROUND(a, b, c, d) \
+	a += b; d ^= a; d = Rotate(d, 16); \
+	c += d; b ^= c; b = Rotate(b, 12); \
+	a += b; d ^= a; d = Rotate(d, 8); \
+	c += d; b ^= c; b = Rotate(b, 7);
+
+//! Generates a single keystream block
+void Block(const uint32_t* state, uint64_t counter, uint8_t* out)
+{
+	uint32_t j[16];
+	memcpy(j, state, sizeof(j));
+	j[12] = static_cast<uint32_t>(counter);
+	j[13] = static_cast<uint32_t>(counter >> 32);
+
+	uint32_t x[16];
+	memcpy(x, j, sizeof(x));
+	for (int n = 0; n < doubleRounds; n++) {
+		QUARTER_ROUND(x[0], x[4], x[8], x[12])
+		QUARTER_ROUND(x[1], x[5], x[9], x[13])
+		QUARTER_ROUND(x[2], x[6], x[10], x[14])
+		QUARTER_ROUND(x[3], x[7], x[11], x[15])
+		QUARTER_ROUND(x[0], x[5], x[10], x[15])
+		QUARTER_ROUND(x[1], x[6], x[11], x[12])
+		QUARTER_ROUND(x[2], x[7], x[8], x[13])
+		QUARTER_ROUND(x[3], x[4], x[9], x[14])
+	}
+	for (int n = 0; n < 16; n++)
+		Store32(&out[n * 4], x[n] + j[n]);
+}
+
+#undef QUARTER_ROUND
+
+#ifdef RSSH_CHACHA20_SSE2
+#define ROTATE_SSE2(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - n))
+#define QUARTER_ROUND_SSE2(a, b, c, d) \
+	a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTATE_SSE2(d, 16); \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTATE_SSE2(b, 12); \
+	a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTATE_SSE2(d, 8); \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTATE_SSE2(b, 7);
+
+/*! XORs four keystream blocks into 'buffer'
+ *
+ *  Every vector holds the same state word of four consecutive blocks;
+ *  these are transposed back into block order afterwards.
+ */
+void Blocks4_SSE2(const uint32_t* state, uint64_t counter, uint8_t* buffer)
+{
+	__m128i j[16];
+	for (int n = 0; n < 16; n++)
+		j[n] = _mm_set1_epi32(static_cast<int>(state[n]));
+	{
+		uint32_t lo[4], hi[4];
+		for (int n = 0; n < 4; n++) {
+			lo[n] = static_cast<uint32_t>(counter + n);
+			hi[n] = static_cast<uint32_t>((counter + n) >> 32);
+		}
+		j[12] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo));
+		j[13] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi));
+	}
+
+	__m128i x[16];
+	for (int n = 0; n < 16; n++)
+		x[n] = j[n];
+	for (int n = 0; n < doubleRounds; n++) {
+		QUARTER_ROUND_SSE2(x[0], x[4], x[8], x[12])
+		QUARTER_ROUND_SSE2(x[1], x[5], x[9], x[13])
+		QUARTER_ROUND_SSE2(x[2], x[6], x[10], x[14])
+		QUARTER_ROUND_SSE2(x[3], x[7], x[11], x[15])
+		QUARTER_ROUND_SSE2(x[0], x[5], x[10], x[15])
+		QUARTER_ROUND_SSE2(x[1], x[6], x[11], x[12])
+		QUARTER_ROUND_SSE2(x[2], x[7], x[8], x[13])
+		QUARTER_ROUND_SSE2(x[3], x[4], x[9], x[14])
+	}
+
+	for (int g = 0; g < 16; g += 4) {
+		__m128i a0 = _mm_unpacklo_epi32(_mm_add_epi32(x[g + 0], j[g + 0]), _mm_add_epi32(x[g + 1], j[g + 1]));
+		__m128i a1 = _mm_unpacklo_epi32(_mm_add_epi32(x[g + 2], j[g + 2]), _mm_add_epi32(x[g + 3], j[g + 3]));
+		__m128i a2 = _mm_unpackhi_epi32(_mm_add_epi32(x[g + 0], j[g + 0]), _mm_add_epi32(x[g + 1], j[g + 1]));
+		__m128i a3 = _mm_unpackhi_epi32(_mm_add_epi32(x[g + 2], j[g + 2]), _mm_add_epi32(x[g + 3], j[g + 3]));
+		// Words g..g+3 of block 0, 1, 2 and 3
+		__m128i b[4] = {
+			_mm_unpacklo_epi64(a0, a1),
+			_mm_unpackhi_epi64(a0, a1),
+			_mm_unpacklo_epi64(a2, a3),
+			_mm_unpackhi_epi64(a2, a3)
+		};
+		for (int n = 0; n < 4; n++) {
+			__m128i* p = reinterpret_cast<__m128i*>(&buffer[n * 64 + g * 4]);
+			_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), b[n]));
+		}
+	}
+}
+
+#undef QUARTER_ROUND_SSE2
+#undef ROTATE_SSE2
+#endif /* RSSH_CHACHA20_SSE2 */
+
+#ifdef RSSH_CHACHA20_AVX2
+#define QUARTER_ROUND_AVX2(a, b, c, d) \
+	a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = _mm256_or_si256(_mm256_slli_epi32(b, 12), _mm256_srli_epi32(b, 20)); \
+	a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = _mm256_or_si256(_mm256_slli_epi32(b, 7), _mm256_srli_epi32(b, 25));
+
+//! Like Blocks4_SSE2(), but for eight blocks; the byte rotations use shuffles
+__attribute__((target("avx2"))) void Blocks8_AVX2(const uint32_t* state, uint64_t counter, uint8_t* buffer)
+{
+	const __m256i rot16 = _mm256_set_epi8(
+	 13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+	 13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+	const __m256i rot8 = _mm256_set_epi8(
+	 14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+	 14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+
+	__m256i j[16];
+	for (int n = 0; n < 16; n++)
+		j[n] = _mm256_set1_epi32(static_cast<int>(state[n]));
+	{
+		uint32_t lo[8], hi[8];
+		for (int n = 0; n < 8; n++) {
+			lo[n] = static_cast<uint32_t>(counter + n);
+			hi[n] = static_cast<uint32_t>((counter + n) >> 32);
+		}
+		j[12] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lo));
+		j[13] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hi));
+	}
+
+	__m256i x[16];
+	for (int n = 0; n < 16; n++)
+		x[n] = j[n];
+	for (int n = 0; n < doubleRounds; n++) {
+		QUARTER_ROUND_AVX2(x[0], x[4], x[8], x[12])
+		QUARTER_ROUND_AVX2(x[1], x[5], x[9], x[13])
+		QUARTER_ROUND_AVX2(x[2], x[6], x[10], x[14])
+		QUARTER_ROUND_AVX2(x[3], x[7], x[11], x[15])
+		QUARTER_ROUND_AVX2(x[0], x[5], x[10], x[15])
+		QUARTER_ROUND_AVX2(x[1], x[6], x[11], x[12])
+		QUARTER_ROUND_AVX2(x[2], x[7], x[8], x[13])
+		QUARTER_ROUND_AVX2(x[3], x[4], x[9], x[14])
+	}
+
+	// Transpose within each 128-bit lane; afterwards x[g + n] holds words
+	// g..g+3 of block n in the low lane and of block n + 4 in the high lane
+	for (int g = 0; g < 16; g += 4) {
+		__m256i v0 = _mm256_add_epi32(x[g + 0], j[g + 0]);
+		__m256i v1 = _mm256_add_epi32(x[g + 1], j[g + 1]);
+		__m256i v2 = _mm256_add_epi32(x[g + 2], j[g + 2]);
+		__m256i v3 = _mm256_add_epi32(x[g + 3], j[g + 3]);
+		__m256i a0 = _mm256_unpacklo_epi32(v0, v1);
+		__m256i a1 = _mm256_unpacklo_epi32(v2, v3);
+		__m256i a2 = _mm256_unpackhi_epi32(v0, v1);
+		__m256i a3 = _mm256_unpackhi_epi32(v2, v3);
+		x[g + 0] = _mm256_unpacklo_epi64(a0, a1);
+		x[g + 1] = _mm256_unpackhi_epi64(a0, a1);
+		x[g + 2] = _mm256_unpacklo_epi64(a2, a3);
+		x[g + 3] = _mm256_unpackhi_epi64(a2, a3);
+	}
+	for (int n = 0; n < 4; n++) {
+		__m256i* p = reinterpret_cast<__m256i*>(&buffer[n * 64]);
+		__m256i* q = reinterpret_cast<__m256i*>(&buffer[(n + 4) * 64]);
+		_mm256_storeu_si256(&p[0], _mm256_xor_si256(_mm256_loadu_si256(&p[0]), _mm256_permute2x128_si256(x[n], x[n + 4], 0x20)));
+		_mm256_storeu_si256(&p[1], _mm256_xor_si256(_mm256_loadu_si256(&p[1]), _mm256_permute2x128_si256(x[n + 8], x[n + 12], 0x20)));
+		_mm256_storeu_si256(&q[0], _mm256_xor_si256(_mm256_loadu_si256(&q[0]), _mm256_permute2x128_si256(x[n], x[n + 4], 0x31)));
+		_mm256_storeu_si256(&q[1], _mm256_xor_si256(_mm256_loadu_si256(&q[1]), _mm256_permute2x128_si256(x[n + 8], x[n + 12], 0x31)));
+	}
+}
+
+#undef QUARTER_ROUND_AVX2
+
+bool HasAVX2()
+{
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2;
+}
+#endif /* RSSH_CHACHA20_AVX2 */
+
+} // unnamed namespace
+
+ChaCha20::ChaCha20()
+{
+	// "expand 32-byte k"
+	m_State[0] = 0x61707865;
+	m_State[1] = 0x3320646e;
+	m_State[2] = 0x79622d32;
+	m_State[3] = 0x6b206574;
+	memset(&m_State[4], 0, sizeof(m_State) - 4 * sizeof(uint32_t));
+}
+
+ChaCha20::~ChaCha20()
+{
+	memset(m_State, 0, sizeof(m_State));
+}
+
+void ChaCha20::SetKey(const uint8_t* key)
+{
+	for (int n = 0; n < 8; n++)
+		m_State[4 + n] = Load32(&key[n * 4]);
+}
+
+void ChaCha20::SetIV(const uint8_t* iv)
+{
+	m_State[14] = Load32(&iv[0]);
+	m_State[15] = Load32(&iv[4]);
+}
+
+void ChaCha20::Process(uint8_t* buffer, size_t len, uint64_t counter)
+{
+#ifdef RSSH_CHACHA20_AVX2
+	if (HasAVX2()) {
+		for (/* nothing */; len >= 8 * blockSize; len -= 8 * blockSize) {
+			Blocks8_AVX2(m_State, counter, buffer);
+			buffer += 8 * blockSize;
+			counter += 8;
+		}
+	}
+#endif
+#ifdef RSSH_CHACHA20_SSE2
+	for (/* nothing */; len >= 4 * blockSize; len -= 4 * blockSize) {
+		Blocks4_SSE2(m_State, counter, buffer);
+		buffer += 4 * blockSize;
+		counter += 4;
+	}
+#endif
+	while (len > 0) {
+		uint8_t keystream[blockSize];
+		Block(m_State, counter, keystream);
+		size_t n = len < blockSize ? len : blockSize;
+		for (size_t i = 0; i < n; i++)
+			buffer[i] ^= keystream[i];
+		buffer += n;
+		len -= n;
+		counter++;
+	}
+}
+
+} // namespace RSSH
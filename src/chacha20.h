@@ -0,0 +1,38 @@
+#ifndef RSSH_CHACHA20_H
+#define RSSH_CHACHA20_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace RSSH {
+
+/*! ChaCha20 stream cipher, using the original 64-bit nonce and 64-bit block counter
+ *
+ *  Keystream generation uses SSE2 (4 blocks at a time) or AVX2 (8 blocks
+ *  at a time) when the compiler and CPU support it, falling back to plain C++.
+ */
+class ChaCha20 final {
+public:
+	static const size_t keyLength = 32;
+	static const size_t ivLength = 8;
+	static const size_t blockSize = 64;
+
+	ChaCha20();
+	~ChaCha20();
+
+	ChaCha20(const ChaCha20&) = delete;
+	ChaCha20& operator=(const ChaCha20&) = delete;
+
+	void SetKey(const uint8_t* key);
+	void SetIV(const uint8_t* iv);
+
+	//! XORs 'len' bytes of keystream, starting at block 'counter', into 'buffer'
+	void Process(uint8_t* buffer, size_t len, uint64_t counter);
+
+private:
+	uint32_t m_State[16];
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_CHACHA20_H */
@@ -0,0 +1,90 @@
+#include "channel-window.h"
+
+namespace RSSH {
+
+namespace {
+
+//! Measurement period to use while the round-trip time is unknown
+const ChannelWindow::Clock::duration defaultSampleTime = std::chrono::milliseconds(50);
+
+} // unnamed namespace
+
+ChannelWindow::ChannelWindow(const Settings& settings)
+	: m_Settings(settings), m_Size(settings.m_InitialSize), m_Available(settings.m_InitialSize),
+	  m_Unconsumed(0), m_Returnable(0), m_RoundTrip(Clock::duration::zero()),
+	  m_SampleStart(Clock::now()), m_SampleBytes(0)
+{
+	if (m_Settings.m_MaxSize < m_Settings.m_InitialSize)
+		m_Settings.m_MaxSize = m_Settings.m_InitialSize;
+}
+
+void ChannelWindow::OnOpenConfirmed()
+{
+	// The window is created as the channel open is sent
+	Clock::time_point now = Clock::now();
+	m_RoundTrip = now - m_SampleStart;
+	m_SampleStart = now;
+}
+
+bool ChannelWindow::OnReceived(size_t len)
+{
+	if (len > m_Available)
+		return false;
+	m_Available -= len;
+	m_Unconsumed += len;
+	m_SampleBytes += len;
+	return true;
+}
+
+uint32_t ChannelWindow::OnConsumed(size_t len)
+{
+	if (len > m_Unconsumed)
+		len = m_Unconsumed;
+	m_Unconsumed -= len;
+	m_Returnable += len;
+
+	// Hold back the adjust until the server is running low on window or a
+	// quarter of it can be returned at once; waiting for only the former
+	// would leave the server idle once it has sent the whole window
+	uint32_t growth = Autotune(Clock::now());
+	if (growth == 0 && m_Available >= m_Size / 2 && m_Returnable < m_Size / 4)
+		return 0;
+	m_Available += growth;
+	return growth + Acknowledge();
+}
+
+uint32_t ChannelWindow::Acknowledge()
+{
+	uint32_t adjust = m_Returnable;
+	m_Returnable = 0;
+	m_Available += adjust;
+	return adjust;
+}
+
+uint32_t ChannelWindow::Autotune(Clock::time_point now)
+{
+	// Measure over at least a round trip, as that is how long it takes
+	// for the server to see any window we grant
+	Clock::duration rtt = m_RoundTrip > Clock::duration::zero() ? m_RoundTrip : defaultSampleTime;
+	Clock::duration elapsed = now - m_SampleStart;
+	if (elapsed < rtt)
+		return 0;
+
+	// A quarter of the window may be held back until the next adjust, so
+	// if more than half of it arrived per round trip, the server was held
+	// back by the window. Growing it only helps if the application keeps up
+	const double seconds = std::chrono::duration<double>(elapsed).count();
+	const double bdp = m_SampleBytes / seconds * std::chrono::duration<double>(rtt).count();
+	uint32_t growth = 0;
+	if (bdp >= m_Size / 2 && m_Unconsumed < m_Size / 2) {
+		uint32_t target = m_Size < m_Settings.m_MaxSize / 2 ? 2 * m_Size : m_Settings.m_MaxSize;
+		growth = target - m_Size;
+		m_Size = target;
+	}
+
+	m_SampleStart = now;
+	m_SampleBytes = 0;
+	return growth;
+}
+
+} // namespace RSSH
@@ -0,0 +1,88 @@
+#ifndef RSSH_CHANNEL_WINDOW_H
+#define RSSH_CHANNEL_WINDOW_H
+
+#include <chrono>
+#include <cstddef>
+#include <stdint.h>
+
+namespace RSSH {
+
+/*! Receive window of a channel, as outlined in [SSH-CONNECT, 5.2]
+ *
+ *  The window starts out modest and doubles every round trip in which the
+ *  server was held back by it, until it covers the bandwidth-delay product.
+ *  It only grows while the application keeps up with the data; a slow
+ *  consumer never causes the window to grow.
+ */
+class ChannelWindow {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Settings {
+		Settings() : m_InitialSize(128 * 1024), m_MaxSize(16 * 1024 * 1024), m_MaxPacketSize(32768) { }
+
+		//! Window advertised when opening the channel
+		uint32_t m_InitialSize;
+
+		//! The window never grows beyond this; set to m_InitialSize to disable autotuning
+		uint32_t m_MaxSize;
+
+		//! Largest data packet the server may send us
+		uint32_t m_MaxPacketSize;
+	};
+
+	ChannelWindow(const Settings& settings);
+
+	uint32_t GetInitialSize() const { return m_Settings.m_InitialSize; }
+	uint32_t GetMaxPacketSize() const { return m_Settings.m_MaxPacketSize; }
+
+	//! Current window size we aim to keep available to the server
+	uint32_t GetSize() const { return m_Size; }
+
+	//! Called once the server confirms the channel; the time this took is our round-trip time
+	void OnOpenConfirmed();
+
+	//! Accounts for received data; returns false if the server exceeded the window
+	bool OnReceived(size_t len);
+
+	/*! Accounts for data consumed by the application
+	 *
+	 *  Returns the number of bytes by which to adjust the window of the
+	 *  server. This is zero until less than half of the window remains or
+	 *  a quarter of it has been consumed, so that a single adjust covers
+	 *  many data packets.
+	 */
+	uint32_t OnConsumed(size_t len);
+
+	//! Returns all consumed data to the server's window, regardless of the threshold
+	uint32_t Acknowledge();
+
+private:
+	//! Grows the window if the last measurement shows the server was limited by it
+	uint32_t Autotune(Clock::time_point now);
+
+	Settings m_Settings;
+
+	//! Window size we are aiming for
+	uint32_t m_Size;
+
+	//! Bytes the server may still send before running out of window
+	uint32_t m_Available;
+
+	//! Bytes received but not yet consumed by the application
+	uint32_t m_Unconsumed;
+
+	//! Received bytes we have yet to return to the server's window
+	uint32_t m_Returnable;
+
+	//! Estimated round-trip time, zero if unknown
+	Clock::duration m_RoundTrip;
+
+	//! Measurement period: start and bytes received since
+	Clock::time_point m_SampleStart;
+	size_t m_SampleBytes;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_CHANNEL_WINDOW_H */
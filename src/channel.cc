@@ -0,0 +1,52 @@
+#include "channel.h"
+
+namespace RSSH {
+
+Channel::Channel(uint32_t localId, const ChannelWindow::Settings& settings)
+	: m_LocalId(localId), m_RemoteId(0), m_State(State::Opening), m_ReceiveWindow(settings),
+	  m_SendWindow(0), m_RemoteMaxPacketSize(0), m_EOFPending(false), m_EOFSent(false),
+	  m_EOFReceived(false), m_CloseSent(false), m_CloseReceived(false)
+{
+}
+
+void Channel::OnOpenConfirmed(uint32_t remoteId, uint32_t windowSize, uint32_t maxPacketSize)
+{
+	OnOpenRequested(remoteId, windowSize, maxPacketSize);
+	OnOpenAccepted();
+}
+
+void Channel::OnOpenRequested(uint32_t remoteId, uint32_t windowSize, uint32_t maxPacketSize)
+{
+	m_RemoteId = remoteId;
+	m_SendWindow = windowSize;
+	m_RemoteMaxPacketSize = maxPacketSize;
+}
+
+void Channel::OnOpenAccepted()
+{
+	m_State = State::Open;
+	m_ReceiveWindow.OnOpenConfirmed();
+}
+
+bool Channel::OnWindowAdjust(uint32_t bytesToAdd)
+{
+	// [SSH-CONNECT, 5.2] the window must not exceed 2^32 - 1 bytes
+	if (bytesToAdd > UINT32_MAX - m_SendWindow)
+		return false;
+	m_SendWindow += bytesToAdd;
+	return true;
+}
+
+void Channel::SetCloseSent()
+{
+	m_CloseSent = true;
+	m_State = State::Closing;
+}
+
+void Channel::SetCloseReceived()
+{
+	m_CloseReceived = true;
+	m_State = State::Closing;
+}
+
+} // namespace RSSH
@@ -0,0 +1,96 @@
+#ifndef RSSH_CHANNEL_H
+#define RSSH_CHANNEL_H
+
+#include <stdint.h>
+#include <string>
+#include "channel-window.h"
+
+namespace RSSH {
+
+/*! A channel as outlined in [SSH-CONNECT, 5]
+ *
+ *  Both sides pick their own number for a channel; we address the server
+ *  using its number and it addresses us using ours. Each direction has its
+ *  own window: ours is managed by a ChannelWindow, the server's is simply
+ *  the number of bytes we may still send. Data that does not fit in the
+ *  server's window is kept here until it grows.
+ */
+class Channel {
+public:
+	enum class State {
+		//! SSH_MSG_CHANNEL_OPEN sent, awaiting confirmation; or received, awaiting ours
+		Opening,
+		//! Confirmed by the server
+		Open,
+		//! SSH_MSG_CHANNEL_CLOSE sent or received, but not both
+		Closing,
+	};
+
+	Channel(uint32_t localId, const ChannelWindow::Settings& settings);
+
+	uint32_t GetLocalId() const { return m_LocalId; }
+	uint32_t GetRemoteId() const { return m_RemoteId; }
+	State GetState() const { return m_State; }
+
+	ChannelWindow& GetReceiveWindow() { return m_ReceiveWindow; }
+
+	//! Bytes we may still send before the server must adjust its window
+	uint32_t GetSendWindow() const { return m_SendWindow; }
+
+	//! Largest data packet the server accepts
+	uint32_t GetRemoteMaxPacketSize() const { return m_RemoteMaxPacketSize; }
+
+	//! [SSH-CONNECT, 5.1] Handles SSH_MSG_CHANNEL_OPEN_CONFIRMATION
+	void OnOpenConfirmed(uint32_t remoteId, uint32_t windowSize, uint32_t maxPacketSize);
+
+	//! [SSH-CONNECT, 5.1] Handles SSH_MSG_CHANNEL_OPEN from the server; the channel stays Opening until OnOpenAccepted()
+	void OnOpenRequested(uint32_t remoteId, uint32_t windowSize, uint32_t maxPacketSize);
+
+	//! We confirmed a channel the server opened
+	void OnOpenAccepted();
+
+	//! [SSH-CONNECT, 5.2] Handles SSH_MSG_CHANNEL_WINDOW_ADJUST; returns false on overflow
+	bool OnWindowAdjust(uint32_t bytesToAdd);
+
+	//! Takes 'len' bytes out of the send window, which must have room for them
+	void OnSent(size_t len) { m_SendWindow -= len; }
+
+	//! Outbound data waiting for the send window to open up
+	std::string& GetPendingData() { return m_PendingData; }
+	const std::string& GetPendingData() const { return m_PendingData; }
+
+	//! [SSH-CONNECT, 5.3] EOF bookkeeping; EOF is only sent once all pending data is
+	bool IsEOFPending() const { return m_EOFPending; }
+	void SetEOFPending(bool pending) { m_EOFPending = pending; }
+	bool IsEOFSent() const { return m_EOFSent; }
+	void SetEOFSent() { m_EOFSent = true; }
+	bool IsEOFReceived() const { return m_EOFReceived; }
+	void SetEOFReceived() { m_EOFReceived = true; }
+
+	//! [SSH-CONNECT, 5.3] Close bookkeeping; the channel is gone once both are set
+	bool IsCloseSent() const { return m_CloseSent; }
+	void SetCloseSent();
+	bool IsCloseReceived() const { return m_CloseReceived; }
+	void SetCloseReceived();
+
+private:
+	uint32_t m_LocalId;
+	uint32_t m_RemoteId;
+	State m_State;
+
+	ChannelWindow m_ReceiveWindow;
+	uint32_t m_SendWindow;
+	uint32_t m_RemoteMaxPacketSize;
+
+	std::string m_PendingData;
+
+	bool m_EOFPending;
+	bool m_EOFSent;
+	bool m_EOFReceived;
+	bool m_CloseSent;
+	bool m_CloseReceived;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_CHANNEL_H */
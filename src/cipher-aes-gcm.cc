@@ -0,0 +1,73 @@
+#include "cipher-aes-gcm.h"
+#include <string.h>
+
+namespace RSSH {
+
+Cipher_AES_GCM::Cipher_AES_GCM(bool encrypt, const uint8_t* iv, const uint8_t* key, size_t keyLength)
+	: m_Encryption(NULL), m_Decryption(NULL)
+{
+	memcpy(m_IV, iv, ivLength);
+	if (encrypt) {
+		m_Encryption = new CryptoPP::GCM< CryptoPP::AES >::Encryption;
+		m_Encryption->SetKeyWithIV(key, keyLength, m_IV, ivLength);
+	} else {
+		m_Decryption = new CryptoPP::GCM< CryptoPP::AES >::Decryption;
+		m_Decryption->SetKeyWithIV(key, keyLength, m_IV, ivLength);
+	}
+}
+
+Cipher_AES_GCM::~Cipher_AES_GCM()
+{
+	delete m_Decryption;
+	delete m_Encryption;
+	memset(m_IV, 0, sizeof(m_IV));
+}
+
+void Cipher_AES_GCM::IncrementInvocationCounter()
+{
+	// [RFC5647, 7.1] The invocation counter is a 64-bit big-endian integer
+	// which is incremented after each packet
+	for (int n = ivLength - 1; n >= 4; n--) {
+		if (++m_IV[n] != 0)
+			break;
+	}
+}
+
+size_t Cipher_AES_GCM::DecryptLength(uint8_t* packet, uint32_t sequenceNumber)
+{
+	// The length is sent in the clear
+	return sizeof(uint32_t);
+}
+
+void Cipher_AES_GCM::Seal(uint8_t* packet, size_t len, uint32_t sequenceNumber)
+{
+	m_Encryption->EncryptAndAuthenticate(
+	 &packet[sizeof(uint32_t)], &packet[len], tagLength,
+	 m_IV, ivLength,
+	 packet, sizeof(uint32_t),
+	 &packet[sizeof(uint32_t)], len - sizeof(uint32_t));
+	IncrementInvocationCounter();
+}
+
+bool Cipher_AES_GCM::Open(uint8_t* packet, size_t len, uint32_t sequenceNumber)
+{
+	bool ok = m_Decryption->DecryptAndVerify(
+	 &packet[sizeof(uint32_t)], &packet[len], tagLength,
+	 m_IV, ivLength,
+	 packet, sizeof(uint32_t),
+	 &packet[sizeof(uint32_t)], len - sizeof(uint32_t));
+	IncrementInvocationCounter();
+	return ok;
+}
+
+size_t Cipher_AES_GCM::GetBlockSize() const
+{
+	return CryptoPP::AES::BLOCKSIZE;
+}
+
+size_t Cipher_AES_GCM::GetTagLength() const
+{
+	return tagLength;
+}
+
+} // namespace RSSH
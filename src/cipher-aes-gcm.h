@@ -0,0 +1,41 @@
+#ifndef RSSH_CIPHER_AES_GCM_H
+#define RSSH_CIPHER_AES_GCM_H
+
+#include "iaead.h"
+
+#include "cryptopp/aes.h"
+#include "cryptopp/gcm.h"
+
+namespace RSSH {
+
+/*! AES-GCM as specified in [RFC5647]
+ *
+ *  The packet length is sent unencrypted as associated data; everything
+ *  else is encrypted and authenticated in a single GCM pass.
+ */
+class Cipher_AES_GCM : public IAEAD {
+public:
+	Cipher_AES_GCM(bool encrypt, const uint8_t* iv, const uint8_t* key, size_t keyLength);
+	virtual ~Cipher_AES_GCM();
+
+	size_t DecryptLength(uint8_t* packet, uint32_t sequenceNumber) override;
+	void Seal(uint8_t* packet, size_t len, uint32_t sequenceNumber) override;
+	bool Open(uint8_t* packet, size_t len, uint32_t sequenceNumber) override;
+	size_t GetBlockSize() const override;
+	size_t GetTagLength() const override;
+
+private:
+	void IncrementInvocationCounter();
+
+	// [RFC5647, 7.1] 4-byte fixed field followed by the 8-byte invocation counter
+	static const size_t ivLength = 12;
+	static const size_t tagLength = 16;
+
+	CryptoPP::GCM< CryptoPP::AES >::Encryption* m_Encryption;
+	CryptoPP::GCM< CryptoPP::AES >::Decryption* m_Decryption;
+	uint8_t m_IV[ivLength];
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_CIPHER_AES_GCM_H */
@@ -37,12 +37,17 @@ template<class T, int KEYLENGTH> void Cipher_AES<T, KEYLENGTH>::Process(uint8_t*
 
 template<class T, int KEYLENGTH> size_t Cipher_AES<T, KEYLENGTH>::GetBlockSize() const
 {
-	return m_AES->MandatoryBlockSize();
+	// Not MandatoryBlockSize(): CTR mode would report 1 there, yet SSH pads to the AES block size
+	return CryptoPP::AES::BLOCKSIZE;
 }
 
 typedef Cipher_AES<CryptoPP::CBC_Mode< CryptoPP::AES >::Encryption, 16> Cipher_AES_128_CBC_Encrypt;
 typedef Cipher_AES<CryptoPP::CBC_Mode< CryptoPP::AES >::Decryption, 16> Cipher_AES_128_CBC_Decrypt;
 
+// CTR mode is symmetric, so the same transformation is used for both directions
+typedef Cipher_AES<CryptoPP::CTR_Mode< CryptoPP::AES >::Encryption, 16> Cipher_AES_128_CTR;
+typedef Cipher_AES<CryptoPP::CTR_Mode< CryptoPP::AES >::Encryption, 32> Cipher_AES_256_CTR;
+
 } // namespace RSSH
 
 #endif /* RSSH_CIPHER_AES_H */
@@ -0,0 +1,90 @@
+#include "cipher-chacha20-poly1305.h"
+#include "poly1305.h"
+#include <string.h>
+
+namespace RSSH {
+
+Cipher_ChaCha20_Poly1305::Cipher_ChaCha20_Poly1305(const uint8_t* key)
+{
+	m_Main.SetKey(&key[0]);
+	m_Header.SetKey(&key[ChaCha20::keyLength]);
+}
+
+Cipher_ChaCha20_Poly1305::~Cipher_ChaCha20_Poly1305()
+{
+}
+
+void Cipher_ChaCha20_Poly1305::SetSequenceNumber(uint32_t sequenceNumber)
+{
+	// The nonce is the sequence number as a 64-bit big-endian integer
+	uint8_t iv[ChaCha20::ivLength] = {
+		0, 0, 0, 0,
+		static_cast<uint8_t>((sequenceNumber >> 24) & 0xff),
+		static_cast<uint8_t>((sequenceNumber >> 16) & 0xff),
+		static_cast<uint8_t>((sequenceNumber >> 8) & 0xff),
+		static_cast<uint8_t>(sequenceNumber & 0xff)
+	};
+	m_Main.SetIV(iv);
+	m_Header.SetIV(iv);
+}
+
+void Cipher_ChaCha20_Poly1305::GeneratePolyKey(uint8_t* polyKey)
+{
+	// The Poly1305 key is the start of the first K_2 keystream block
+	memset(polyKey, 0, Poly1305::keyLength);
+	m_Main.Process(polyKey, Poly1305::keyLength, 0);
+}
+
+size_t Cipher_ChaCha20_Poly1305::DecryptLength(uint8_t* packet, uint32_t sequenceNumber)
+{
+	SetSequenceNumber(sequenceNumber);
+	memcpy(m_EncryptedLength, packet, sizeof(m_EncryptedLength));
+	m_Header.Process(packet, sizeof(uint32_t), 0);
+	return sizeof(uint32_t);
+}
+
+void Cipher_ChaCha20_Poly1305::Seal(uint8_t* packet, size_t len, uint32_t sequenceNumber)
+{
+	SetSequenceNumber(sequenceNumber);
+	m_Header.Process(packet, sizeof(uint32_t), 0);
+	m_Main.Process(&packet[sizeof(uint32_t)], len - sizeof(uint32_t), 1);
+
+	uint8_t polyKey[Poly1305::keyLength];
+	GeneratePolyKey(polyKey);
+	Poly1305::Calculate(polyKey, packet, len, &packet[len]);
+	memset(polyKey, 0, sizeof(polyKey));
+}
+
+bool Cipher_ChaCha20_Poly1305::Open(uint8_t* packet, size_t len, uint32_t sequenceNumber)
+{
+	// DecryptLength() has already set up the nonce for this sequence number
+
+	// Verify the tag over the packet as it was received, before decrypting anything
+	uint8_t length[sizeof(uint32_t)];
+	memcpy(length, packet, sizeof(length));
+	memcpy(packet, m_EncryptedLength, sizeof(m_EncryptedLength));
+
+	uint8_t polyKey[Poly1305::keyLength];
+	GeneratePolyKey(polyKey);
+	bool ok = Poly1305::Verify(polyKey, packet, len, &packet[len]);
+	memset(polyKey, 0, sizeof(polyKey));
+
+	memcpy(packet, length, sizeof(length));
+	if (!ok)
+		return false;
+
+	m_Main.Process(&packet[sizeof(uint32_t)], len - sizeof(uint32_t), 1);
+	return true;
+}
+
+size_t Cipher_ChaCha20_Poly1305::GetBlockSize() const
+{
+	return 8;
+}
+
+size_t Cipher_ChaCha20_Poly1305::GetTagLength() const
+{
+	return Poly1305::tagLength;
+}
+
+} // namespace RSSH
@@ -0,0 +1,45 @@
+#ifndef RSSH_CIPHER_CHACHA20_POLY1305_H
+#define RSSH_CIPHER_CHACHA20_POLY1305_H
+
+#include "iaead.h"
+#include "chacha20.h"
+
+namespace RSSH {
+
+/*! chacha20-poly1305@openssh.com as specified in [CHACHA20-POLY1305]
+ *
+ *  The 64 bytes of key material yield two ChaCha20 keys: K_2 (the first
+ *  32 bytes) encrypts the packet and generates the Poly1305 key, whereas
+ *  K_1 only encrypts the packet length. Both use the sequence number as
+ *  nonce. The tag covers the encrypted length and packet.
+ */
+class Cipher_ChaCha20_Poly1305 : public IAEAD {
+public:
+	static const size_t keyLength = 2 * ChaCha20::keyLength;
+
+	Cipher_ChaCha20_Poly1305(const uint8_t* key);
+	virtual ~Cipher_ChaCha20_Poly1305();
+
+	size_t DecryptLength(uint8_t* packet, uint32_t sequenceNumber) override;
+	void Seal(uint8_t* packet, size_t len, uint32_t sequenceNumber) override;
+	bool Open(uint8_t* packet, size_t len, uint32_t sequenceNumber) override;
+	size_t GetBlockSize() const override;
+	size_t GetTagLength() const override;
+
+private:
+	void SetSequenceNumber(uint32_t sequenceNumber);
+	void GeneratePolyKey(uint8_t* polyKey);
+
+	//! Key K_2, used for the packet and the Poly1305 key
+	ChaCha20 m_Main;
+
+	//! Key K_1, used for the packet length only
+	ChaCha20 m_Header;
+
+	//! Encrypted length of the packet being received; it is decrypted in-place but the tag covers it
+	uint8_t m_EncryptedLength[4];
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_CIPHER_CHACHA20_POLY1305_H */
@@ -1,6 +1,8 @@
 #include "cipher-factory.h"
 #include <string.h>
 #include "cipher-aes.h"
+#include "cipher-aes-gcm.h"
+#include "cipher-chacha20-poly1305.h"
 
 namespace RSSH {
 
@@ -14,9 +16,34 @@ ICipher* Create(const char* cipherName, bool encrypt, const uint8_t* iv, const u
 		else
 			return new Cipher_AES_128_CBC_Decrypt(iv, key);
 
+	// [RFC4344, 4] counter mode; the IV is the initial counter value
+	if (strcmp(cipherName, "aes128-ctr") == 0)
+		return new Cipher_AES_128_CTR(iv, key);
+	if (strcmp(cipherName, "aes256-ctr") == 0)
+		return new Cipher_AES_256_CTR(iv, key);
+
 	return NULL;
 }
 
+IAEAD* CreateAEAD(const char* cipherName, bool encrypt, const uint8_t* iv, const uint8_t* key)
+{
+	if (strcmp(cipherName, "aes128-gcm@openssh.com") == 0)
+		return new Cipher_AES_GCM(encrypt, iv, key, 16);
+	if (strcmp(cipherName, "aes256-gcm@openssh.com") == 0)
+		return new Cipher_AES_GCM(encrypt, iv, key, 32);
+	if (strcmp(cipherName, "chacha20-poly1305@openssh.com") == 0)
+		return new Cipher_ChaCha20_Poly1305(key);
+
+	return NULL;
+}
+
+bool IsAEAD(const char* cipherName)
+{
+	return strcmp(cipherName, "aes128-gcm@openssh.com") == 0 ||
+	       strcmp(cipherName, "aes256-gcm@openssh.com") == 0 ||
+	       strcmp(cipherName, "chacha20-poly1305@openssh.com") == 0;
+}
+
 
 } // namespace CipherFactory
 
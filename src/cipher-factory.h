@@ -5,12 +5,19 @@
 
 namespace RSSH {
 
+class IAEAD;
 class ICipher;
 
 namespace CipherFactory {
 
 ICipher* Create(const char* cipherName, bool encrypt, const uint8_t* iv, const uint8_t* key);
 
+//! Creates an authenticated cipher, these do not use a separate MAC - returns NULL if cipherName isn't one
+IAEAD* CreateAEAD(const char* cipherName, bool encrypt, const uint8_t* iv, const uint8_t* key);
+
+//! Is cipherName an authenticated cipher? If so, the negotiated MAC is not used
+bool IsAEAD(const char* cipherName);
+
 } // namespace CipherFactory
 
 } // namespace RSSH
@@ -0,0 +1,173 @@
+#include "compression.h"
+#include "buffer.h"
+#include "exception.h"
+
+#include "cryptopp/zdeflate.h"
+#include "cryptopp/zinflate.h"
+
+namespace RSSH {
+
+//! Appends whatever a Crypto++ filter outputs to a Buffer
+class BufferSink : public CryptoPP::Bufferless<CryptoPP::Sink> {
+public:
+	BufferSink() : m_Target(NULL) { }
+
+	void SetTarget(Buffer* target) { m_Target = target; }
+
+	size_t Put2(const uint8_t* data, size_t len, int messageEnd, bool blocking) override {
+		if (len > 0)
+			m_Target->PutBytes(data, len);
+		return 0;
+	}
+
+private:
+	Buffer* m_Target;
+};
+
+namespace {
+
+// [RFC1950, 2.2] deflate with a 32 KB window, default compression level
+const uint8_t zlibCMF = 0x78;
+const uint8_t zlibFLG = 0x9c;
+
+//! Above this, compression saves too little to be worth the CPU time
+const double incompressibleRatio = 0.9;
+
+//! Share of an epoch spent compressing above which the CPU has no time to spare
+const double cpuBusyFraction = 0.5;
+
+} // unnamed namespace
+
+/*
+ * The raw Deflator and Inflator are used rather than their zlib
+ * counterparts: those compute an Adler-32 checksum of everything, which
+ * only goes into the trailer of a stream that never ends. The header is
+ * simple enough to take care of ourselves.
+ */
+Compressor::Compressor(const Settings& settings)
+	: m_Sink(new BufferSink), m_HeaderWritten(false), m_Adaptive(settings.m_Adaptive), m_Level(settings.m_Level),
+	  m_CpuBoundEpochs(0), m_Probing(false), m_ProbeCountdown(minProbeInterval), m_ProbeInterval(minProbeInterval), m_EpochIn(0), m_EpochOut(0), m_EpochBusy(0), m_EpochPackets(0), m_EpochLinkBusy(0)
+{
+	// Crypto++'s own detection of incompressible data is left off; it never looks again once triggered
+	m_Deflator = new CryptoPP::Deflator(m_Sink, m_Level, CryptoPP::Deflator::DEFAULT_LOG2_WINDOW_SIZE, false);
+}
+
+Compressor::~Compressor()
+{
+	delete m_Deflator;
+}
+
+void Compressor::Compress(const uint8_t* data, size_t len, Buffer& out, bool linkBusy)
+{
+	if (!m_HeaderWritten) {
+		out << zlibCMF << zlibFLG;
+		m_HeaderWritten = true;
+	}
+	const size_t start = out.GetWritePosition();
+	const Clock::time_point before = m_Adaptive ? Clock::now() : Clock::time_point();
+	m_Sink->SetTarget(&out);
+	m_Deflator->Put(data, len);
+	// A hard flush ends the block and adds an empty stored one, like Z_SYNC_FLUSH
+	m_Deflator->Flush(true);
+	m_Sink->SetTarget(NULL);
+
+	const size_t written = out.GetWritePosition() - start;
+	m_Statistics[m_Level].m_BytesIn += len;
+	m_Statistics[m_Level].m_BytesOut += written;
+	if (!m_Adaptive)
+		return;
+
+	const Clock::time_point after = Clock::now();
+	if (m_EpochPackets == 0)
+		m_EpochStart = before;
+	m_EpochIn += len;
+	m_EpochOut += written;
+	m_EpochBusy += after - before;
+	m_EpochPackets++;
+	if (linkBusy)
+		m_EpochLinkBusy++;
+	if (m_EpochIn >= epochBytes)
+		Adapt(after);
+}
+
+void Compressor::Adapt(Clock::time_point now)
+{
+	const double ratio = static_cast<double>(m_EpochOut) / m_EpochIn;
+	const bool linkBusy = m_EpochLinkBusy * 2 > m_EpochPackets;
+	const bool cpuBusy = m_EpochBusy >= (now - m_EpochStart) * cpuBusyFraction;
+	m_EpochIn = 0;
+	m_EpochOut = 0;
+	m_EpochBusy = Clock::duration(0);
+	m_EpochPackets = 0;
+	m_EpochLinkBusy = 0;
+
+	m_CpuBoundEpochs = cpuBusy && !linkBusy ? m_CpuBoundEpochs + 1 : 0;
+
+	int level = m_Level;
+	const bool probed = m_Probing;
+	m_Probing = false;
+	if (level == 0) {
+		// Stored blocks tell nothing about the data, so compressing it again is the only way to find out
+		if (--m_ProbeCountdown == 0) {
+			m_Probing = true;
+			level = 1;
+		}
+	} else if (ratio > incompressibleRatio || (probed && m_CpuBoundEpochs > 0)) {
+		// Not worth the CPU time; the longer that stays so, the less often we look again
+		if (probed && m_ProbeInterval < maxProbeInterval)
+			m_ProbeInterval *= 2;
+		level = 0;
+	} else {
+		// Spend more CPU time while the link is behind, less while it's waiting for us; if both are busy, we're balanced
+		if (probed)
+			m_ProbeInterval = minProbeInterval;
+		if (linkBusy && !cpuBusy && level < CryptoPP::Deflator::MAX_DEFLATE_LEVEL)
+			level++;
+		else if (m_CpuBoundEpochs >= cpuBoundEpochs)
+			level--;
+	}
+	if (level != m_Level) {
+		if (level == 0)
+			m_ProbeCountdown = m_ProbeInterval;
+		m_CpuBoundEpochs = 0;
+		m_Deflator->SetDeflateLevel(level);
+		m_Level = level;
+	}
+}
+
+Decompressor::Decompressor()
+	: m_Sink(new BufferSink), m_HeaderLength(0)
+{
+	m_Inflator = new CryptoPP::Inflator(m_Sink);
+}
+
+Decompressor::~Decompressor()
+{
+	delete m_Inflator;
+}
+
+void Decompressor::Decompress(const uint8_t* data, size_t len, Buffer& out)
+{
+	while (m_HeaderLength < sizeof(m_Header) && len > 0) {
+		m_Header[m_HeaderLength++] = *data++;
+		len--;
+		if (m_HeaderLength < sizeof(m_Header))
+			continue;
+
+		// [RFC1950, 2.2] deflate, without a preset dictionary, and the check bits must add up
+		if ((m_Header[0] & 0x0f) != 8 || (m_Header[1] & 0x20) != 0 || (m_Header[0] << 8 | m_Header[1]) % 31 != 0)
+			throw Exception(Exception::C_Compression_Error, "bad zlib header");
+	}
+
+	m_Sink->SetTarget(&out);
+	try {
+		// The peer flushes after every payload, so all of it comes out
+		m_Inflator->Put(data, len);
+		m_Inflator->Flush(true);
+	} catch (CryptoPP::Exception& e) {
+		throw Exception(Exception::C_Compression_Error, e.what());
+	}
+	m_Sink->SetTarget(NULL);
+}
+
+} // namespace RSSH
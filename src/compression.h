@@ -0,0 +1,157 @@
+#ifndef RSSH_COMPRESSION_H
+#define RSSH_COMPRESSION_H
+
+#include <chrono>
+#include <cstddef>
+#include <stdint.h>
+
+namespace CryptoPP {
+class Deflator;
+class Inflator;
+} // namespace CryptoPP
+
+namespace RSSH {
+
+class Buffer;
+class BufferSink;
+
+/*! Compresses packet payloads for zlib@openssh.com [OPENSSH-PROTOCOL, 1.2]
+ *
+ *  A single zlib stream [RFC1950] carries every payload sent for the rest
+ *  of the connection, so earlier payloads serve as dictionary for later
+ *  ones. Each payload ends in a flush, allowing the peer to decompress it
+ *  without waiting for more.
+ *
+ *  In adaptive mode, the deflate level is reconsidered after every epoch
+ *  of input. It goes up while packets are waiting for the link and the
+ *  CPU has time to spare, and down while compressing keeps the CPU busy
+ *  without the link being so. Data that hardly compresses is sent in
+ *  stored blocks (level 0). As those tell nothing about the data, level 0
+ *  is left for an epoch at level 1 now and then, to see whether that is
+ *  still the right choice. The peer can't tell: the level only changes
+ *  at a flush, and any deflate stream decompresses the same way.
+ */
+class Compressor final {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Settings {
+		Settings() : m_Level(6), m_Adaptive(true) { }
+
+		//! Deflate level to use (0 = stored, 9 = best), or to start out with if adaptive
+		int m_Level;
+
+		//! Pick the level based on the data and on whether the link or the CPU holds us back
+		bool m_Adaptive;
+	};
+
+	//! What went into and came out of the compressor at a given level
+	struct LevelStatistics {
+		LevelStatistics() : m_BytesIn(0), m_BytesOut(0) { }
+
+		uint64_t m_BytesIn;
+		uint64_t m_BytesOut;
+	};
+
+	static const int numLevels = 10;
+
+	Compressor(const Settings& settings = Settings());
+	~Compressor();
+
+	Compressor(const Compressor&) = delete;
+	Compressor& operator=(const Compressor&) = delete;
+
+	/*! Compresses 'len' bytes and appends the result to 'out'
+	 *
+	 *  'linkBusy' tells whether data compressed earlier is still waiting
+	 *  to be sent; only adaptive mode uses it.
+	 */
+	void Compress(const uint8_t* data, size_t len, Buffer& out, bool linkBusy = false);
+
+	bool IsAdaptive() const { return m_Adaptive; }
+
+	//! Level the next payload will be compressed at
+	int GetLevel() const { return m_Level; }
+
+	const LevelStatistics& GetStatistics(int level) const { return m_Statistics[level]; }
+
+private:
+	//! Input after which the level is reconsidered
+	static const size_t epochBytes = 128 * 1024;
+
+	//! Consecutive epochs the CPU must be the bottleneck before the level goes down; a burst of input shouldn't do
+	static const unsigned int cpuBoundEpochs = 2;
+
+	/*! Epochs spent at level 0 before trying level 1 again
+	 *
+	 *  The interval doubles every time level 0 turns out to be still the
+	 *  right choice, up to the maximum.
+	 */
+	static const unsigned int minProbeInterval = 8;
+	static const unsigned int maxProbeInterval = 256;
+
+	//! Picks the level for the next epoch, based on how the last one went
+	void Adapt(Clock::time_point now);
+
+	CryptoPP::Deflator* m_Deflator;
+
+	//! Where m_Deflator writes to; owned by it
+	BufferSink* m_Sink;
+
+	//! Set once the [RFC1950, 2.2] header is written
+	bool m_HeaderWritten;
+
+	bool m_Adaptive;
+	int m_Level;
+
+	//! Bytes in and out per level, since the start
+	LevelStatistics m_Statistics[numLevels];
+
+	//! Consecutive epochs in which the CPU was the bottleneck
+	unsigned int m_CpuBoundEpochs;
+
+	//! Set while trying level 1 after a stretch at level 0
+	bool m_Probing;
+
+	//! Epochs to go at level 0 until the next probe, and what that was last time
+	unsigned int m_ProbeCountdown;
+	unsigned int m_ProbeInterval;
+
+	//! Current epoch: when it started, bytes in and out, time spent compressing, and payloads sent while the link was busy
+	Clock::time_point m_EpochStart;
+	size_t m_EpochIn;
+	size_t m_EpochOut;
+	Clock::duration m_EpochBusy;
+	unsigned int m_EpochPackets;
+	unsigned int m_EpochLinkBusy;
+};
+
+//! Decompresses packet payloads sent by a peer's Compressor
+class Decompressor final {
+public:
+	Decompressor();
+	~Decompressor();
+
+	Decompressor(const Decompressor&) = delete;
+	Decompressor& operator=(const Decompressor&) = delete;
+
+	/*! Decompresses 'len' bytes and appends the result to 'out'
+	 *
+	 *  Throws if the data is corrupt, or if it does not fit in 'out'.
+	 */
+	void Decompress(const uint8_t* data, size_t len, Buffer& out);
+
+private:
+	CryptoPP::Inflator* m_Inflator;
+
+	//! Where m_Inflator writes to; owned by it
+	BufferSink* m_Sink;
+
+	//! [RFC1950, 2.2] the header is checked by us, as it may arrive in pieces
+	uint8_t m_Header[2];
+	size_t m_HeaderLength;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_COMPRESSION_H */
@@ -0,0 +1,69 @@
+#include "curve25519-keyexchange.h"
+#include <string.h>
+#include "buffer.h"
+#include "exception.h"
+#include "random.h"
+
+#include "cryptopp/misc.h"
+#include "cryptopp/sha.h"
+
+namespace RSSH {
+
+Curve25519KeyExchange::Curve25519KeyExchange(Transport& transport)
+	: KeyExchange(transport)
+{
+	m_Hash = new CryptoPP::SHA256;
+	memset(m_PrivateKey, 0, sizeof(m_PrivateKey));
+	memset(m_PublicKey, 0, sizeof(m_PublicKey));
+}
+
+Curve25519KeyExchange::~Curve25519KeyExchange()
+{
+	CryptoPP::SecureWipeBuffer(m_PrivateKey, sizeof(m_PrivateKey));
+}
+
+void Curve25519KeyExchange::GenerateKeyPair()
+{
+	// [RFC7748, 6.1] the private key is 32 random bytes, clamped by X25519 itself
+	Random::GetInstance().Generate(m_PrivateKey, sizeof(m_PrivateKey));
+	Curve25519::ScalarMultBase(m_PublicKey, m_PrivateKey);
+}
+
+void Curve25519KeyExchange::PutPublicKey(Buffer& buffer) const
+{
+	buffer << std::string((const char*)m_PublicKey, sizeof(m_PublicKey));
+}
+
+void Curve25519KeyExchange::ReadPeerPublicKey(Buffer& buffer)
+{
+	buffer >> m_PeerPublicKey;
+}
+
+void Curve25519KeyExchange::PutPeerPublicKey(Buffer& buffer) const
+{
+	buffer << m_PeerPublicKey;
+}
+
+CryptoPP::Integer Curve25519KeyExchange::ComputeSharedSecret()
+{
+	// [RFC8731, 3] public keys must be exactly 32 bytes
+	if (m_PeerPublicKey.size() != Curve25519::keyLength)
+		throw Exception(Exception::C_KEX_Invalid_Public_Key);
+
+	uint8_t shared[Curve25519::keyLength];
+	Curve25519::ScalarMult(shared, m_PrivateKey, (const uint8_t*)m_PeerPublicKey.data());
+
+	// [RFC8731, 3] an all-zero shared secret (low order peer point) must be rejected
+	uint8_t acc = 0;
+	for (size_t n = 0; n < sizeof(shared); n++)
+		acc |= shared[n];
+	if (acc == 0)
+		throw Exception(Exception::C_KEX_Invalid_Public_Key);
+
+	// [RFC8731, 3.1] K is the shared secret interpreted as a big-endian unsigned integer
+	CryptoPP::Integer k(shared, sizeof(shared));
+	CryptoPP::SecureWipeBuffer(shared, sizeof(shared));
+	return k;
+}
+
+} // namespace RSSH
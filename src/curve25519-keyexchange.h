@@ -0,0 +1,35 @@
+#ifndef RSSH_CURVE25519_KEYEXCHANGE_H
+#define RSSH_CURVE25519_KEYEXCHANGE_H
+
+#include <stdint.h>
+#include <string>
+#include "curve25519.h"
+#include "keyexchange.h"
+
+namespace RSSH {
+
+//! [RFC8731] curve25519-sha256 key exchange
+class Curve25519KeyExchange : public KeyExchange {
+public:
+	Curve25519KeyExchange(Transport& transport);
+	~Curve25519KeyExchange();
+
+	void GenerateKeyPair() override;
+	void PutPublicKey(Buffer& buffer) const override;
+	void ReadPeerPublicKey(Buffer& buffer) override;
+	void PutPeerPublicKey(Buffer& buffer) const override;
+	CryptoPP::Integer ComputeSharedSecret() override;
+
+private:
+	uint8_t m_PrivateKey[Curve25519::keyLength];
+
+	//! Q_C
+	uint8_t m_PublicKey[Curve25519::keyLength];
+
+	//! Q_S
+	std::string m_PeerPublicKey;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_CURVE25519_KEYEXCHANGE_H */
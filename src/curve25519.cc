@@ -0,0 +1,257 @@
+#include "curve25519.h"
+#include <string.h>
+
+#ifndef __SIZEOF_INT128__
+#error "curve25519.cc needs a compiler with 128-bit integer support"
+#endif
+
+namespace RSSH {
+
+namespace Curve25519 {
+
+namespace {
+
+typedef unsigned __int128 uint128_t;
+
+/*
+ * Field elements modulo p = 2^255 - 19 are kept as five 51-bit limbs; the
+ * products of two limbs fit in 128 bits and since 2^255 = 19 mod p, the
+ * upper half of a product is folded back into the lower limbs times 19.
+ */
+typedef uint64_t FieldElement[5];
+
+const uint64_t mask51 = (static_cast<uint64_t>(1) << 51) - 1;
+
+inline uint64_t Load64(const uint8_t* p)
+{
+	uint64_t v = 0;
+	for (int n = 7; n >= 0; n--)
+		v = (v << 8) | p[n];
+	return v;
+}
+
+void FromBytes(FieldElement h, const uint8_t* s)
+{
+	// [RFC7748, 5] the most significant bit of the u-coordinate is ignored
+	h[0] = Load64(s) & mask51;
+	h[1] = (Load64(s + 6) >> 3) & mask51;
+	h[2] = (Load64(s + 12) >> 6) & mask51;
+	h[3] = (Load64(s + 19) >> 1) & mask51;
+	h[4] = (Load64(s + 24) >> 12) & mask51;
+}
+
+void Carry(FieldElement h)
+{
+	uint64_t c;
+	c = h[0] >> 51; h[0] &= mask51; h[1] += c;
+	c = h[1] >> 51; h[1] &= mask51; h[2] += c;
+	c = h[2] >> 51; h[2] &= mask51; h[3] += c;
+	c = h[3] >> 51; h[3] &= mask51; h[4] += c;
+	c = h[4] >> 51; h[4] &= mask51; h[0] += c * 19;
+}
+
+void ToBytes(uint8_t* s, const FieldElement f)
+{
+	FieldElement h;
+	memcpy(h, f, sizeof(h));
+	Carry(h);
+	Carry(h);
+
+	// h < 2^255 now; subtract p once if h >= p, which is the case if h + 19 overflows 2^255
+	uint64_t q = (h[0] + 19) >> 51;
+	q = (h[1] + q) >> 51;
+	q = (h[2] + q) >> 51;
+	q = (h[3] + q) >> 51;
+	q = (h[4] + q) >> 51;
+	h[0] += 19 * q;
+	uint64_t c;
+	c = h[0] >> 51; h[0] &= mask51; h[1] += c;
+	c = h[1] >> 51; h[1] &= mask51; h[2] += c;
+	c = h[2] >> 51; h[2] &= mask51; h[3] += c;
+	c = h[3] >> 51; h[3] &= mask51; h[4] += c;
+	h[4] &= mask51; // drops the 2^255 of the subtracted p
+
+	uint64_t w[4];
+	w[0] = h[0] | h[1] << 51;
+	w[1] = h[1] >> 13 | h[2] << 38;
+	w[2] = h[2] >> 26 | h[3] << 25;
+	w[3] = h[3] >> 39 | h[4] << 12;
+	for (int n = 0; n < 4; n++)
+		for (int m = 0; m < 8; m++)
+			s[n * 8 + m] = static_cast<uint8_t>(w[n] >> (m * 8));
+}
+
+inline void Add(FieldElement h, const FieldElement f, const FieldElement g)
+{
+	for (int n = 0; n < 5; n++)
+		h[n] = f[n] + g[n];
+}
+
+inline void Sub(FieldElement h, const FieldElement f, const FieldElement g)
+{
+	// Add 4p first so that no limb can underflow
+	h[0] = f[0] + 0x1fffffffffffb4 - g[0];
+	h[1] = f[1] + 0x1ffffffffffffc - g[1];
+	h[2] = f[2] + 0x1ffffffffffffc - g[2];
+	h[3] = f[3] + 0x1ffffffffffffc - g[3];
+	h[4] = f[4] + 0x1ffffffffffffc - g[4];
+}
+
+void CarryWide(FieldElement h, uint128_t r0, uint128_t r1, uint128_t r2, uint128_t r3, uint128_t r4)
+{
+	uint64_t c;
+	c = static_cast<uint64_t>(r0 >> 51); r1 += c; h[0] = static_cast<uint64_t>(r0) & mask51;
+	c = static_cast<uint64_t>(r1 >> 51); r2 += c; h[1] = static_cast<uint64_t>(r1) & mask51;
+	c = static_cast<uint64_t>(r2 >> 51); r3 += c; h[2] = static_cast<uint64_t>(r2) & mask51;
+	c = static_cast<uint64_t>(r3 >> 51); r4 += c; h[3] = static_cast<uint64_t>(r3) & mask51;
+	c = static_cast<uint64_t>(r4 >> 51); h[4] = static_cast<uint64_t>(r4) & mask51;
+	h[0] += c * 19;
+	c = h[0] >> 51; h[0] &= mask51; h[1] += c;
+}
+
+void Mul(FieldElement h, const FieldElement f, const FieldElement g)
+{
+	const uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+	const uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+	const uint64_t g1_19 = g1 * 19, g2_19 = g2 * 19, g3_19 = g3 * 19, g4_19 = g4 * 19;
+
+	uint128_t r0 = (uint128_t)f0 * g0 + (uint128_t)f1 * g4_19 + (uint128_t)f2 * g3_19 + (uint128_t)f3 * g2_19 + (uint128_t)f4 * g1_19;
+	uint128_t r1 = (uint128_t)f0 * g1 + (uint128_t)f1 * g0 + (uint128_t)f2 * g4_19 + (uint128_t)f3 * g3_19 + (uint128_t)f4 * g2_19;
+	uint128_t r2 = (uint128_t)f0 * g2 + (uint128_t)f1 * g1 + (uint128_t)f2 * g0 + (uint128_t)f3 * g4_19 + (uint128_t)f4 * g3_19;
+	uint128_t r3 = (uint128_t)f0 * g3 + (uint128_t)f1 * g2 + (uint128_t)f2 * g1 + (uint128_t)f3 * g0 + (uint128_t)f4 * g4_19;
+	uint128_t r4 = (uint128_t)f0 * g4 + (uint128_t)f1 * g3 + (uint128_t)f2 * g2 + (uint128_t)f3 * g1 + (uint128_t)f4 * g0;
+	CarryWide(h, r0, r1, r2, r3, r4);
+}
+
+void Square(FieldElement h, const FieldElement f)
+{
+	const uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+	const uint64_t f0_2 = f0 * 2, f1_2 = f1 * 2;
+	const uint64_t f1_38 = f1 * 38, f2_38 = f2 * 38, f3_38 = f3 * 38;
+	const uint64_t f3_19 = f3 * 19, f4_19 = f4 * 19;
+
+	uint128_t r0 = (uint128_t)f0 * f0 + (uint128_t)f1_38 * f4 + (uint128_t)f2_38 * f3;
+	uint128_t r1 = (uint128_t)f0_2 * f1 + (uint128_t)f2_38 * f4 + (uint128_t)f3_19 * f3;
+	uint128_t r2 = (uint128_t)f0_2 * f2 + (uint128_t)f1 * f1 + (uint128_t)f3_38 * f4;
+	uint128_t r3 = (uint128_t)f0_2 * f3 + (uint128_t)f1_2 * f2 + (uint128_t)f4_19 * f4;
+	uint128_t r4 = (uint128_t)f0_2 * f4 + (uint128_t)f1_2 * f3 + (uint128_t)f2 * f2;
+	CarryWide(h, r0, r1, r2, r3, r4);
+}
+
+void MulSmall(FieldElement h, const FieldElement f, uint64_t n)
+{
+	CarryWide(h, (uint128_t)f[0] * n, (uint128_t)f[1] * n, (uint128_t)f[2] * n, (uint128_t)f[3] * n, (uint128_t)f[4] * n);
+}
+
+//! Computes h = f^(p - 2) = 1 / f
+void Invert(FieldElement h, const FieldElement f)
+{
+	FieldElement t0, t1, t2, t3;
+	int n;
+
+	Square(t0, f);                                  // 2
+	Square(t1, t0); Square(t1, t1);                 // 8
+	Mul(t1, f, t1);                                 // 9
+	Mul(t0, t0, t1);                                // 11
+	Square(t2, t0);                                 // 22
+	Mul(t1, t1, t2);                                // 2^5 - 1
+	Square(t2, t1);
+	for (n = 1; n < 5; n++) Square(t2, t2);
+	Mul(t1, t2, t1);                                // 2^10 - 1
+	Square(t2, t1);
+	for (n = 1; n < 10; n++) Square(t2, t2);
+	Mul(t2, t2, t1);                                // 2^20 - 1
+	Square(t3, t2);
+	for (n = 1; n < 20; n++) Square(t3, t3);
+	Mul(t2, t3, t2);                                // 2^40 - 1
+	for (n = 0; n < 10; n++) Square(t2, t2);
+	Mul(t1, t2, t1);                                // 2^50 - 1
+	Square(t2, t1);
+	for (n = 1; n < 50; n++) Square(t2, t2);
+	Mul(t2, t2, t1);                                // 2^100 - 1
+	Square(t3, t2);
+	for (n = 1; n < 100; n++) Square(t3, t3);
+	Mul(t2, t3, t2);                                // 2^200 - 1
+	for (n = 0; n < 50; n++) Square(t2, t2);
+	Mul(t1, t2, t1);                                // 2^250 - 1
+	for (n = 0; n < 5; n++) Square(t1, t1);         // 2^255 - 2^5
+	Mul(h, t1, t0);                                 // 2^255 - 21
+}
+
+//! Swaps f and g if 'swap' is 1, without branching on it
+inline void ConditionalSwap(FieldElement f, FieldElement g, uint64_t swap)
+{
+	const uint64_t mask = 0 - swap;
+	for (int n = 0; n < 5; n++) {
+		uint64_t x = (f[n] ^ g[n]) & mask;
+		f[n] ^= x;
+		g[n] ^= x;
+	}
+}
+
+} // unnamed namespace
+
+void ScalarMult(uint8_t* out, const uint8_t* scalar, const uint8_t* point)
+{
+	// [RFC7748, 5] decodeScalar25519
+	uint8_t k[keyLength];
+	memcpy(k, scalar, keyLength);
+	k[0] &= 248;
+	k[31] &= 127;
+	k[31] |= 64;
+
+	// [RFC7748, 5] Montgomery ladder, in constant time
+	FieldElement x1, x2, z2, x3, z3;
+	FromBytes(x1, point);
+	memset(x2, 0, sizeof(x2)); x2[0] = 1;
+	memset(z2, 0, sizeof(z2));
+	memcpy(x3, x1, sizeof(x3));
+	memset(z3, 0, sizeof(z3)); z3[0] = 1;
+
+	uint64_t swap = 0;
+	for (int t = 254; t >= 0; t--) {
+		const uint64_t k_t = (k[t >> 3] >> (t & 7)) & 1;
+		swap ^= k_t;
+		ConditionalSwap(x2, x3, swap);
+		ConditionalSwap(z2, z3, swap);
+		swap = k_t;
+
+		FieldElement a, aa, b, bb, e, c, d, da, cb;
+		Add(a, x2, z2);
+		Square(aa, a);
+		Sub(b, x2, z2);
+		Square(bb, b);
+		Sub(e, aa, bb);
+		Add(c, x3, z3);
+		Sub(d, x3, z3);
+		Mul(da, d, a);
+		Mul(cb, c, b);
+
+		Add(x3, da, cb);
+		Square(x3, x3);
+		Sub(z3, da, cb);
+		Square(z3, z3);
+		Mul(z3, x1, z3);
+		Mul(x2, aa, bb);
+		MulSmall(z2, e, 121665);
+		Add(z2, aa, z2);
+		Mul(z2, e, z2);
+	}
+	ConditionalSwap(x2, x3, swap);
+	ConditionalSwap(z2, z3, swap);
+
+	Invert(z2, z2);
+	Mul(x2, x2, z2);
+	ToBytes(out, x2);
+	memset(k, 0, sizeof(k));
+}
+
+void ScalarMultBase(uint8_t* out, const uint8_t* scalar)
+{
+	static const uint8_t basePoint[keyLength] = { 9 };
+	ScalarMult(out, scalar, basePoint);
+}
+
+} // namespace Curve25519
+
+} // namespace RSSH
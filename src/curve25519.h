@@ -0,0 +1,24 @@
+#ifndef RSSH_CURVE25519_H
+#define RSSH_CURVE25519_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace RSSH {
+
+//! X25519 Diffie-Hellman function as specified in [RFC7748, 5]
+namespace Curve25519 {
+
+static const size_t keyLength = 32;
+
+//! Computes the u-coordinate 'out' of 'scalar' times the point with u-coordinate 'point'
+void ScalarMult(uint8_t* out, const uint8_t* scalar, const uint8_t* point);
+
+//! Computes the public key 'out' belonging to private key 'scalar'
+void ScalarMultBase(uint8_t* out, const uint8_t* scalar);
+
+} // namespace Curve25519
+
+} // namespace RSSH
+
+#endif /* RSSH_CURVE25519_H */
@@ -2,41 +2,43 @@
 #define RSSH_DH_KEYEXCHANGE_H
 
 #include "cryptopp/integer.h"
-#include "socket.h"
+#include "dh-keypair-pool.h"
+#include "keyexchange.h"
 
 namespace RSSH {
 
-class Buffer;
-class Keys;
-class Transport;
-
-class DHKeyExchange {
+//! [SSH-TRANS, 8] Diffie-Hellman key exchange over a MODP group
+class DHKeyExchange : public KeyExchange {
 public:
 	DHKeyExchange(Transport& transport, const char* algorithm);
-	~DHKeyExchange();
 
-	void SendExchange();
-	void OnReply(Buffer& buffer);
+	void GenerateKeyPair() override;
+	void PutPublicKey(Buffer& buffer) const override;
+	void ReadPeerPublicKey(Buffer& buffer) override;
+	void PutPeerPublicKey(Buffer& buffer) const override;
+	CryptoPP::Integer ComputeSharedSecret() override;
+
+	//! Sets the policy of the ephemeral key pair pools of all groups
+	static void SetPoolPolicy(const DHKeyPairPool::Policy& policy);
 
-	Keys* GetKeys() const {
-		return m_Keys;
-	}
+	//! Retrieves the pool hits and misses, summed over all groups
+	static void GetPoolStatistics(unsigned long& hits, unsigned long& misses);
 
 private:
-	//! Transport layer we belong to
-	Transport& m_Transport;
+	//! Diffie-Hellman prime
+	CryptoPP::Integer m_P;
 
-	//! Diffie-Hellman prime and generator values
-	CryptoPP::Integer m_P, m_G;
+	//! Source of our ephemeral key pairs for this group
+	DHKeyPairPool* m_Pool;
 
-	//
+	//! Our public value, e = g^x mod p
 	CryptoPP::Integer m_E;
 
-	//! Picked random number, 1 < m_X < m_G
+	//! Picked random number, 1 < m_X < q
 	CryptoPP::Integer m_X;
 
-	//! Derived keys
-	Keys* m_Keys;
+	//! The server's public value
+	CryptoPP::Integer m_F;
 };
 
 } // namespace RSSH
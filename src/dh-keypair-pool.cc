@@ -0,0 +1,110 @@
+#include "dh-keypair-pool.h"
+
+namespace RSSH {
+
+DHKeyPairPool::DHKeyPairPool(const CryptoPP::Integer& p, const CryptoPP::Integer& g, const Policy& policy)
+	: m_Policy(policy), m_Running(false), m_Stop(false), m_Refilling(false), m_Hits(0), m_Misses(0)
+{
+	m_Group.Initialize(p, g);
+	m_Group.Precompute();
+	if (m_Policy.m_Capacity > 0)
+		StartWorker();
+}
+
+DHKeyPairPool::~DHKeyPairPool()
+{
+	StopWorker();
+}
+
+void DHKeyPairPool::Generate(CryptoPP::Integer& x, CryptoPP::Integer& e)
+{
+	// [SSH-TRANS, 8] pick 1 < x < q, generate 'e = g^x mod p'
+	const CryptoPP::Integer& q = m_Group.GetSubgroupOrder();
+	x = CryptoPP::Integer(m_Rng, CryptoPP::Integer::Two(), q - CryptoPP::Integer::One());
+	e = m_Group.ExponentiateBase(x);
+}
+
+void DHKeyPairPool::Take(CryptoPP::Integer& x, CryptoPP::Integer& e)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	if (!m_Running) {
+		// No worker; it is safe to use the group parameters from here
+		m_Misses++;
+		Generate(x, e);
+		return;
+	}
+
+	if (m_Pairs.empty()) {
+		// The worker is always refilling an empty pool; the pair it is
+		// working on is ready sooner than a fresh one would be
+		m_Misses++;
+		m_Produced.wait(lock, [this] { return !m_Pairs.empty(); });
+	} else
+		m_Hits++;
+
+	x = m_Pairs.front().first;
+	e = m_Pairs.front().second;
+	m_Pairs.pop_front();
+	m_Consumed.notify_one();
+}
+
+void DHKeyPairPool::SetPolicy(const Policy& policy)
+{
+	StopWorker();
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Policy = policy;
+		while (m_Pairs.size() > m_Policy.m_Capacity)
+			m_Pairs.pop_back();
+	}
+	if (m_Policy.m_Capacity > 0)
+		StartWorker();
+}
+
+void DHKeyPairPool::StartWorker()
+{
+	m_Stop = false;
+	m_Refilling = false;
+	m_Running = true;
+	m_Thread = std::thread(&DHKeyPairPool::Worker, this);
+}
+
+void DHKeyPairPool::StopWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_Running)
+			return;
+		m_Stop = true;
+	}
+	m_Consumed.notify_one();
+	m_Thread.join();
+	m_Running = false;
+}
+
+void DHKeyPairPool::Worker()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (!m_Stop) {
+		// Refill to capacity once we drop below the threshold; an empty
+		// pool is always refilled as Take() may be waiting on it
+		if (m_Pairs.size() >= m_Policy.m_Capacity)
+			m_Refilling = false;
+		else if (m_Pairs.empty() || m_Pairs.size() < m_Policy.m_RefillBelow)
+			m_Refilling = true;
+		if (!m_Refilling) {
+			m_Consumed.wait(lock);
+			continue;
+		}
+
+		lock.unlock();
+		CryptoPP::Integer x, e;
+		Generate(x, e);
+		lock.lock();
+
+		m_Pairs.push_back(std::make_pair(x, e));
+		m_Produced.notify_all();
+	}
+}
+
+} // namespace RSSH
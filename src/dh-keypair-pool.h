@@ -0,0 +1,84 @@
+#ifndef RSSH_DH_KEYPAIR_POOL_H
+#define RSSH_DH_KEYPAIR_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "cryptopp/gfpcrypt.h"
+#include "cryptopp/osrng.h"
+
+namespace RSSH {
+
+/*! Ephemeral Diffie-Hellman key pairs for a single MODP group, generated ahead of time
+ *
+ *  A worker thread keeps pairs (x, e = g^x mod p) ready so that the
+ *  exponentiation is off the handshake's critical path. As the generator
+ *  never changes, the worker uses fixed-base precomputation tables for it.
+ */
+class DHKeyPairPool {
+public:
+	struct Policy {
+		Policy() : m_Capacity(4), m_RefillBelow(2) { }
+
+		//! Maximum number of ready pairs; 0 disables the worker, pairs are then generated on demand
+		size_t m_Capacity;
+
+		//! Once fewer pairs than this are left, the worker refills the pool to capacity
+		size_t m_RefillBelow;
+	};
+
+	DHKeyPairPool(const CryptoPP::Integer& p, const CryptoPP::Integer& g, const Policy& policy);
+	~DHKeyPairPool();
+
+	DHKeyPairPool(const DHKeyPairPool&) = delete;
+	DHKeyPairPool& operator=(const DHKeyPairPool&) = delete;
+
+	/*! Retrieves a key pair
+	 *
+	 *  If the pool is empty, this waits for the worker to produce the next
+	 *  pair, which is counted as a miss.
+	 */
+	void Take(CryptoPP::Integer& x, CryptoPP::Integer& e);
+
+	//! Changes the policy; the worker is started or stopped as needed
+	void SetPolicy(const Policy& policy);
+
+	//! Number of pairs that were taken from the pool without waiting
+	unsigned long GetHits() const { return m_Hits; }
+
+	//! Number of pairs that had to be waited for or generated on demand
+	unsigned long GetMisses() const { return m_Misses; }
+
+private:
+	void StartWorker();
+	void StopWorker();
+	void Worker();
+	void Generate(CryptoPP::Integer& x, CryptoPP::Integer& e);
+
+	//! Group parameters including the precomputed powers of g; only used by one thread at a time
+	CryptoPP::DL_GroupParameters_GFP m_Group;
+
+	//! Random source for the worker, as the global one is not thread-safe
+	CryptoPP::AutoSeededRandomPool m_Rng;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Produced;
+	std::condition_variable m_Consumed;
+	std::deque<std::pair<CryptoPP::Integer, CryptoPP::Integer> > m_Pairs;
+	Policy m_Policy;
+	std::thread m_Thread;
+	bool m_Running;
+	bool m_Stop;
+	bool m_Refilling;
+
+	std::atomic<unsigned long> m_Hits;
+	std::atomic<unsigned long> m_Misses;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_DH_KEYPAIR_POOL_H */
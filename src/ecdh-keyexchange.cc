@@ -0,0 +1,59 @@
+#include "ecdh-keyexchange.h"
+#include <string.h>
+#include "buffer.h"
+#include "exception.h"
+#include "random.h"
+
+#include "cryptopp/oids.h"
+#include "cryptopp/sha.h"
+
+namespace RSSH {
+
+ECDHKeyExchange::ECDHKeyExchange(Transport& transport, const char* algorithm)
+	: KeyExchange(transport)
+{
+	// [RFC5656, 6.2.1] the curve determines the hash function
+	if (strcmp(algorithm, "ecdh-sha2-nistp256") == 0) {
+		m_Domain.AccessGroupParameters().Initialize(CryptoPP::ASN1::secp256r1());
+		m_Hash = new CryptoPP::SHA256;
+	} else
+		throw Exception(Exception::C_DH_Unrecognized_Algorithm);
+}
+
+void ECDHKeyExchange::GenerateKeyPair()
+{
+	m_PrivateKey.New(m_Domain.PrivateKeyLength());
+	m_PublicKey.New(m_Domain.PublicKeyLength());
+	m_Domain.GenerateKeyPair(Random::GetInstance().GetRng(), m_PrivateKey, m_PublicKey);
+}
+
+void ECDHKeyExchange::PutPublicKey(Buffer& buffer) const
+{
+	buffer << std::string((const char*)m_PublicKey.data(), m_PublicKey.size());
+}
+
+void ECDHKeyExchange::ReadPeerPublicKey(Buffer& buffer)
+{
+	buffer >> m_PeerPublicKey;
+}
+
+void ECDHKeyExchange::PutPeerPublicKey(Buffer& buffer) const
+{
+	buffer << m_PeerPublicKey;
+}
+
+CryptoPP::Integer ECDHKeyExchange::ComputeSharedSecret()
+{
+	// [RFC5656, 4] Q_S must be a valid point on the curve; Agree() checks this
+	if (m_PeerPublicKey.size() != m_Domain.PublicKeyLength())
+		throw Exception(Exception::C_KEX_Invalid_Public_Key);
+
+	CryptoPP::SecByteBlock shared(m_Domain.AgreedValueLength());
+	if (!m_Domain.Agree(shared, m_PrivateKey, (const uint8_t*)m_PeerPublicKey.data(), true))
+		throw Exception(Exception::C_KEX_Invalid_Public_Key);
+
+	// [RFC5656, 4] K is the x-coordinate of the shared point
+	return CryptoPP::Integer(shared.data(), shared.size());
+}
+
+} // namespace RSSH
@@ -0,0 +1,32 @@
+#ifndef RSSH_ECDH_KEYEXCHANGE_H
+#define RSSH_ECDH_KEYEXCHANGE_H
+
+#include "cryptopp/eccrypto.h"
+#include "keyexchange.h"
+
+namespace RSSH {
+
+//! [RFC5656, 4] Elliptic curve Diffie-Hellman key exchange using NIST P-256
+class ECDHKeyExchange : public KeyExchange {
+public:
+	ECDHKeyExchange(Transport& transport, const char* algorithm);
+
+	void GenerateKeyPair() override;
+	void PutPublicKey(Buffer& buffer) const override;
+	void ReadPeerPublicKey(Buffer& buffer) override;
+	void PutPeerPublicKey(Buffer& buffer) const override;
+	CryptoPP::Integer ComputeSharedSecret() override;
+
+private:
+	CryptoPP::ECDH<CryptoPP::ECP>::Domain m_Domain;
+
+	//! Our ephemeral key pair; the public key is Q_C as an uncompressed point
+	CryptoPP::SecByteBlock m_PrivateKey, m_PublicKey;
+
+	//! Q_S
+	std::string m_PeerPublicKey;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_ECDH_KEYEXCHANGE_H */
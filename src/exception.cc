@@ -29,6 +29,18 @@ const char* Exception::what() const noexcept
 			return "version mismatch";
 		case C_HostKey_Signature_Rejected:
 			return "hostkey signature rejected";
+		case C_Transport_No_Common_Algorithm:
+			return "no common algorithm with server";
+		case C_KEX_Invalid_Public_Key:
+			return "invalid key exchange public key";
+		case C_Channel_Window_Exceeded:
+			return "channel data exceeds window";
+		case C_Channel_Unknown:
+			return "unknown channel";
+		case C_Reactor_Error:
+			return "event loop failure";
+		case C_Compression_Error:
+			return "corrupt compressed data";
 	}
 	return "?";
 }
@@ -21,6 +21,12 @@ public:
 		C_Transport_Version_Mismatch,
 		C_Transport_Invalid_Length,
 		C_HostKey_Signature_Rejected,
+		C_Transport_No_Common_Algorithm,
+		C_KEX_Invalid_Public_Key,
+		C_Channel_Window_Exceeded,
+		C_Channel_Unknown,
+		C_Reactor_Error,
+		C_Compression_Error,
 	};
 
 	Exception(Code code, const char* param = "")
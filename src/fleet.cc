@@ -0,0 +1,363 @@
+#include "fleet.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <memory>
+#include <thread>
+
+#include "callback.h"
+#include "exception.h"
+#include "io-ring.h"
+#include "numbers.h"
+#include "reactor.h"
+#include "transport.h"
+
+namespace RSSH {
+
+namespace {
+
+/*! A single host's connection, from connecting until the command is done
+ *
+ *  Besides the transport, only output that is not yet complete is kept
+ *  here: the last partial line in prefix mode, or everything in aggregate
+ *  mode.
+ */
+class Session : public Callback {
+public:
+	Session(Fleet& fleet, Reactor& reactor, IoRing* ring, const Fleet::Settings& settings, const Fleet::Host& host, Fleet::Result& result);
+	~Session();
+
+	//! Starts connecting; the session may already be done on return
+	void Start();
+
+	bool IsDone() const { return m_Done; }
+
+	void OnTransportEstablished() override;
+	std::string GetUserName() override { return m_Host.m_UserName; }
+	bool OnVerifyHostKeySignature(const std::string& signature) override { return true; }
+	bool OnAuthenticationPrompt(std::vector<AuthenticationPrompt>& prompts) override;
+	void OnAuthenticationSuccess() override;
+	void OnAuthenticationFailure(bool partial_success, const Types::NameList& next_auths) override;
+	void OnServiceAccepted(const std::string& serviceName) override;
+	void OnChannelOpened(int channelNumber) override;
+	void OnChannelOpenFailure(int channelNumber, uint32_t reasonCode, const std::string& description) override;
+	void OnChannelRequestFailure(int channelNumber) override;
+	void OnChannelData(int channelNumber, const uint8_t* data, size_t len) override;
+	void OnChannelExtendedData(int channelNumber, uint32_t dataType, const uint8_t* data, size_t len) override;
+	void OnChannelExitStatus(int channelNumber, uint32_t exitStatus) override;
+	void OnChannelExitSignal(int channelNumber, const std::string& signalName, bool coreDumped, const std::string& errorMessage) override;
+	void OnChannelClosed(int channelNumber) override;
+
+private:
+	enum Stream { Stdout, Stderr, NumStreams };
+
+	//! Handles Reactor events for our socket
+	void HandleEvents(unsigned int events);
+
+	//! Called once the host has used up its time
+	void OnTimeout();
+
+	//! Takes command output for the given stream
+	void Collect(Stream stream, const uint8_t* data, size_t len);
+
+	//! Records a failure, unless the command's outcome is already known
+	void Fail(const std::string& error);
+
+	//! Writes any remaining output; the session can be destroyed afterwards
+	void Finish();
+
+	int GetFD(Stream stream) const { return stream == Stdout ? m_Settings.m_OutputFD : m_Settings.m_ErrorFD; }
+
+	Fleet& m_Fleet;
+	Reactor& m_Reactor;
+	IoRing* m_Ring;
+	const Fleet::Settings& m_Settings;
+	const Fleet::Host& m_Host;
+	Fleet::Result& m_Result;
+	Transport m_Transport;
+	//! Set once the timer is running; the socket unregisters itself
+	bool m_Registered;
+	Reactor::TimerId m_Timer;
+	int m_Channel;
+	bool m_Done;
+	std::string m_Output[NumStreams];
+};
+
+Session::Session(Fleet& fleet, Reactor& reactor, IoRing* ring, const Fleet::Settings& settings, const Fleet::Host& host, Fleet::Result& result)
+	: m_Fleet(fleet), m_Reactor(reactor), m_Ring(ring), m_Settings(settings), m_Host(host), m_Result(result), m_Transport(*this),
+	  m_Registered(false), m_Timer(0), m_Channel(-1), m_Done(false)
+{
+	m_Result.m_Outcome = Fleet::Result::Outcome::Failed;
+	m_Result.m_ExitStatus = 0;
+	m_Result.m_Error = "connection closed";
+}
+
+Session::~Session()
+{
+	if (m_Registered)
+		m_Reactor.CancelTimer(m_Timer);
+}
+
+void Session::Start()
+{
+	m_Transport.GetPreferences() = m_Settings.m_Preferences;
+	try {
+		m_Transport.StartConnect(m_Host.m_HostName.c_str(), m_Host.m_Port);
+		m_Transport.Register(m_Reactor, m_Ring, [this](unsigned int events) { HandleEvents(events); });
+	} catch (Exception& e) {
+		Fail("unable to connect");
+		return;
+	}
+	m_Timer = m_Reactor.AddTimer(Reactor::Clock::now() + m_Settings.m_Timeout, [this]() { OnTimeout(); });
+	m_Registered = true;
+}
+
+void Session::HandleEvents(unsigned int events)
+{
+	if (m_Done)
+		return;
+	try {
+		m_Transport.HandleEvents(events);
+	} catch (Exception& e) {
+		// A failed connect is only noticed here; report why it failed
+		int error = 0;
+		socklen_t len = sizeof(error);
+		if (e.GetCode() == Exception::C_Socket_Error &&
+		    getsockopt(m_Transport.GetSocket().GetFD(), SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error != 0)
+			Fail(strerror(error));
+		else
+			Fail(e.what());
+	}
+}
+
+void Session::OnTimeout()
+{
+	if (m_Result.m_Outcome == Fleet::Result::Outcome::Failed)
+		m_Result.m_Outcome = Fleet::Result::Outcome::TimedOut;
+	Finish();
+}
+
+void Session::OnTransportEstablished()
+{
+	m_Transport.RequestService(Numbers::ServiceNames::UserAuth);
+}
+
+bool Session::OnAuthenticationPrompt(std::vector<AuthenticationPrompt>& prompts)
+{
+	if (m_Settings.m_Password.empty()) {
+		Fail("password required");
+		return false;
+	}
+	for(AuthenticationPrompt& prompt: prompts)
+		prompt.m_Reply = m_Settings.m_Password;
+	return true;
+}
+
+void Session::OnAuthenticationSuccess()
+{
+	m_Channel = m_Transport.OpenChannel(Numbers::ConnectionProtocolAssignedNames::ChannelTypes::Session);
+}
+
+void Session::OnAuthenticationFailure(bool partial_success, const Types::NameList& next_auths)
+{
+	Fail("authentication failed");
+}
+
+void Session::OnServiceAccepted(const std::string& serviceName)
+{
+	if (serviceName == Numbers::ServiceNames::UserAuth)
+		m_Transport.RequestUserAuth(Numbers::ServiceNames::Connection, m_Host.m_UserName);
+}
+
+void Session::OnChannelOpened(int channelNumber)
+{
+	m_Transport.RequestExec(m_Channel, m_Settings.m_Command);
+}
+
+void Session::OnChannelOpenFailure(int channelNumber, uint32_t reasonCode, const std::string& description)
+{
+	Fail("channel refused: " + description);
+}
+
+void Session::OnChannelRequestFailure(int channelNumber)
+{
+	Fail("command refused");
+}
+
+void Session::OnChannelData(int channelNumber, const uint8_t* data, size_t len)
+{
+	Collect(Stdout, data, len);
+	m_Transport.ChannelDataConsumed(channelNumber, len);
+}
+
+void Session::OnChannelExtendedData(int channelNumber, uint32_t dataType, const uint8_t* data, size_t len)
+{
+	if (dataType == static_cast<uint32_t>(Numbers::ExtendedChannelDataType::SSH_EXTENDED_DATA_STDERR))
+		Collect(Stderr, data, len);
+	m_Transport.ChannelDataConsumed(channelNumber, len);
+}
+
+void Session::OnChannelExitStatus(int channelNumber, uint32_t exitStatus)
+{
+	m_Result.m_Outcome = Fleet::Result::Outcome::Exited;
+	m_Result.m_ExitStatus = exitStatus;
+	m_Result.m_Error.clear();
+}
+
+void Session::OnChannelExitSignal(int channelNumber, const std::string& signalName, bool coreDumped, const std::string& errorMessage)
+{
+	m_Result.m_Outcome = Fleet::Result::Outcome::Signalled;
+	m_Result.m_Error = signalName;
+}
+
+void Session::OnChannelClosed(int channelNumber)
+{
+	if (m_Result.m_Outcome == Fleet::Result::Outcome::Failed)
+		m_Result.m_Error = "no exit status";
+	try {
+		m_Transport.SendDisconnect();
+		m_Transport.Flush();
+	} catch (Exception& e) {
+		// Only a courtesy; we're done either way
+	}
+	Finish();
+}
+
+void Session::Collect(Stream stream, const uint8_t* data, size_t len)
+{
+	if (GetFD(stream) < 0)
+		return;
+	std::string& output = m_Output[stream];
+	output.append((const char*)data, len);
+	if (m_Settings.m_Aggregate)
+		return;
+
+	// Write whatever complete lines we have, each with the host's name in front
+	size_t end = output.rfind('\n');
+	if (end == std::string::npos)
+		return;
+	std::string lines;
+	for (size_t pos = 0; pos <= end; ) {
+		size_t eol = output.find('\n', pos);
+		lines += m_Host.m_Name + ": ";
+		lines.append(output, pos, eol + 1 - pos);
+		pos = eol + 1;
+	}
+	output.erase(0, end + 1);
+	m_Fleet.Output(GetFD(stream), lines);
+}
+
+void Session::Fail(const std::string& error)
+{
+	if (m_Result.m_Outcome == Fleet::Result::Outcome::Failed)
+		m_Result.m_Error = error;
+	Finish();
+}
+
+void Session::Finish()
+{
+	if (m_Done)
+		return;
+	m_Done = true;
+
+	for (int stream = 0; stream < NumStreams; stream++) {
+		std::string& output = m_Output[stream];
+		if (output.empty())
+			continue;
+		if (output.back() != '\n')
+			output += '\n';
+		if (m_Settings.m_Aggregate)
+			m_Fleet.Output(GetFD(static_cast<Stream>(stream)), "--- " + m_Host.m_Name + " ---\n" + output);
+		else
+			m_Fleet.Output(GetFD(static_cast<Stream>(stream)), m_Host.m_Name + ": " + output);
+		output.clear();
+	}
+}
+
+} // unnamed namespace
+
+Fleet::Fleet(const Settings& settings)
+	: m_Settings(settings), m_NextHost(0)
+{
+}
+
+void Fleet::Run(const std::vector<Host>& hosts)
+{
+	m_Results.assign(hosts.size(), Result());
+	m_NextHost = 0;
+
+	// Spread the connections over the threads; surplus threads would idle
+	unsigned int concurrency = m_Settings.m_Concurrency > 0 ? m_Settings.m_Concurrency : 1;
+	unsigned int numThreads = m_Settings.m_Threads > 0 ? m_Settings.m_Threads : 1;
+	if (numThreads > concurrency)
+		numThreads = concurrency;
+	std::vector<std::thread> threads;
+	for (unsigned int n = 1; n < numThreads; n++)
+		threads.emplace_back(&Fleet::Worker, this, std::cref(hosts), concurrency / numThreads + (n < concurrency % numThreads ? 1 : 0));
+	Worker(hosts, concurrency / numThreads + (concurrency % numThreads > 0 ? 1 : 0));
+	for (std::thread& thread: threads)
+		thread.join();
+}
+
+void Fleet::Worker(const std::vector<Host>& hosts, unsigned int limit)
+{
+	Reactor reactor;
+	std::unique_ptr<IoRing> ring;
+	if (m_Settings.m_UseRing)
+		ring = IoRing::Create(reactor);
+	std::vector<std::unique_ptr<Session>> sessions;
+	while (true) {
+		while (sessions.size() < limit) {
+			const size_t n = m_NextHost++;
+			if (n >= hosts.size())
+				break;
+			std::unique_ptr<Session> session(new Session(*this, reactor, ring.get(), m_Settings, hosts[n], m_Results[n]));
+			session->Start();
+			if (!session->IsDone())
+				sessions.push_back(std::move(session));
+		}
+		if (sessions.empty())
+			break;
+
+		reactor.RunOnce();
+
+		// Sessions finish from within their handlers, so they're only destroyed here
+		for (size_t n = 0; n < sessions.size(); ) {
+			if (sessions[n]->IsDone()) {
+				sessions[n] = std::move(sessions.back());
+				sessions.pop_back();
+			} else {
+				n++;
+			}
+		}
+	}
+}
+
+void Fleet::Output(int fd, const std::string& data)
+{
+	if (fd < 0)
+		return;
+	std::lock_guard<std::mutex> lock(m_OutputMutex);
+	const char* p = data.data();
+	size_t len = data.size();
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				struct pollfd pfd = { fd, POLLOUT, 0 };
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			return;
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+} // namespace RSSH
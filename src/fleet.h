@@ -0,0 +1,112 @@
+#ifndef RSSH_FLEET_H
+#define RSSH_FLEET_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "negotiation.h"
+
+namespace RSSH {
+
+/*! Runs a single command on many hosts at once
+ *
+ *  Every host gets its own Transport, but they are all driven by a few
+ *  event loop threads rather than a thread or process per host. At most
+ *  a given number of connections is in progress at any time; the next
+ *  host is started as soon as one finishes.
+ *
+ *  Output is written as it arrives, each line prefixed with the host it
+ *  came from, or collected per host and written in one piece once the
+ *  host is done.
+ */
+class Fleet {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Settings {
+		Settings() : m_Concurrency(64), m_Threads(1), m_Timeout(std::chrono::seconds(30)), m_Aggregate(false), m_UseRing(false), m_OutputFD(1), m_ErrorFD(2) { }
+
+		//! Connections in progress at any time, over all threads
+		unsigned int m_Concurrency;
+
+		//! Event loop threads
+		unsigned int m_Threads;
+
+		//! Time a host gets from connecting until the command is done
+		Clock::duration m_Timeout;
+
+		//! Collect each host's output and write it once the host is done
+		bool m_Aggregate;
+
+		//! Do socket I/O using io_uring, if the kernel supports it
+		bool m_UseRing;
+
+		std::string m_Command;
+
+		//! Reply to authentication prompts
+		std::string m_Password;
+
+		Preferences m_Preferences;
+
+		//! Where the commands' stdout and stderr go; -1 to discard
+		int m_OutputFD;
+		int m_ErrorFD;
+	};
+
+	struct Host {
+		std::string m_UserName;
+		std::string m_HostName;
+		int m_Port;
+
+		//! How the host is referred to in output
+		std::string m_Name;
+	};
+
+	struct Result {
+		enum class Outcome {
+			//! The command exited; m_ExitStatus is its status
+			Exited,
+			//! The command was killed by signal m_Error
+			Signalled,
+			//! Something went wrong, as described by m_Error
+			Failed,
+			//! The host did not finish within the timeout
+			TimedOut,
+		};
+
+		Outcome m_Outcome;
+		uint32_t m_ExitStatus;
+		std::string m_Error;
+	};
+
+	Fleet(const Settings& settings);
+
+	//! Runs the command on all hosts; returns once every host is done
+	void Run(const std::vector<Host>& hosts);
+
+	//! Results of the last Run(), in the order of its hosts
+	const std::vector<Result>& GetResults() const { return m_Results; }
+
+	//! Writes output of a host; serialized as the event loop threads share the descriptors
+	void Output(int fd, const std::string& data);
+
+private:
+	//! Event loop thread: keeps starting hosts until there are none left
+	void Worker(const std::vector<Host>& hosts, unsigned int limit);
+
+	Settings m_Settings;
+	std::vector<Result> m_Results;
+
+	//! Index of the next host to start, shared by all threads
+	std::atomic<size_t> m_NextHost;
+
+	//! Serializes Output()
+	std::mutex m_OutputMutex;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_FLEET_H */
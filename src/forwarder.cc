@@ -0,0 +1,707 @@
+#include "forwarder.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <functional>
+
+#include "io-ring.h"
+#include "reactor.h"
+#include "socket.h"
+#include "socks.h"
+#include "trace.h"
+#include "transport.h"
+
+namespace RSSH {
+
+namespace {
+
+//! Splits 's' at colons, except within brackets, which are removed
+bool SplitFields(const std::string& s, std::vector<std::string>& fields)
+{
+	fields.assign(1, std::string());
+	bool bracketed = false;
+	for (char ch : s) {
+		if (ch == '[' && !bracketed && fields.back().empty())
+			bracketed = true;
+		else if (ch == ']' && bracketed)
+			bracketed = false;
+		else if (ch == ':' && !bracketed)
+			fields.emplace_back();
+		else
+			fields.back() += ch;
+	}
+	return !bracketed;
+}
+
+bool ParsePort(const std::string& s, int& port, int minimum = 1)
+{
+	char* end;
+	long n = strtol(s.c_str(), &end, 10);
+	if (s.empty() || *end != '\0' || n < minimum || n > 65535)
+		return false;
+	port = static_cast<int>(n);
+	return true;
+}
+
+//! [SSH-CONNECT, 7.2] the originator of a forwarded connection is its peer
+void GetOriginator(const struct sockaddr_storage& ss, socklen_t len, std::string& address, int& port)
+{
+	char host[NI_MAXHOST], service[NI_MAXSERV];
+	if (getnameinfo(reinterpret_cast<const struct sockaddr*>(&ss), len, host, sizeof(host), service, sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+		address.clear();
+		port = 0;
+		return;
+	}
+	address = host;
+	port = atoi(service);
+}
+
+} // unnamed namespace
+
+/*! A connection forwarded through a channel
+ *
+ *  Until the channel is open, nothing is read from the connection. For
+ *  remote forwarding, the connection is still being made at first; it is
+ *  watched using the reactor until then, as an IoRing doesn't tell. For
+ *  dynamic forwarding, the SOCKS client is told the outcome of its request
+ *  once the channel is opened or refused. Once
+ *  either side is out of data, the other is told so; the channel is
+ *  closed once both are, or as soon as the connection fails. Should the
+ *  server close the channel while the connection hasn't taken everything
+ *  it sent yet, the rest is still written before the connection is shut
+ *  down, like an EOF would.
+ */
+class Forwarder::Tunnel {
+public:
+	Tunnel(Transport& transport, int fd, int channel);
+	~Tunnel();
+
+	//! Has 'handler' called once the connection in progress is made or failed
+	void WatchConnect(Reactor& reactor, std::function<void()> handler);
+
+	//! Stops watching the connection in progress; returns 0 if it was made, the error otherwise
+	int FinishConnect();
+
+	//! Starts watching the connection
+	void Register(Reactor& reactor, IoRing* ring);
+
+	//! Replies to 'request' once the channel is opened or refused
+	void SetSocksRequest(std::unique_ptr<SocksRequest> request) { m_SocksRequest = std::move(request); }
+
+	void OnOpened();
+	void OnOpenFailure();
+	void OnWritable() { Pump(); }
+	void OnData(const uint8_t* data, size_t len);
+	void OnEOF();
+
+	/*! The server closed the channel; returns whether data it sent is still to be written
+	 *
+	 *  If so, 'drained' is called once it is, or once the connection
+	 *  fails; the channel is no longer used either way.
+	 */
+	bool Detach(std::function<void()> drained);
+
+private:
+	void HandleEvents(unsigned int events);
+
+	//! Moves data from the connection to the channel, as far as the window allows
+	void Pump();
+
+	//! Writes data the connection didn't take before
+	void WriteUnwritten();
+
+	//! Closes the channel once both sides are done
+	void CloseIfDone();
+	void Close();
+
+	Transport& m_Transport;
+	Socket m_Socket;
+	int m_Channel;
+	//! Watching the connection in progress, if any
+	Reactor* m_ConnectReactor;
+	//! Awaiting our reply, if any
+	std::unique_ptr<SocksRequest> m_SocksRequest;
+	bool m_Open;
+	//! Set until reading the connection tells us it has nothing more
+	bool m_Readable;
+	bool m_LocalEOF;
+	bool m_RemoteEOF;
+	bool m_Closing;
+	//! Set once the channel is gone
+	bool m_Detached;
+	std::function<void()> m_Drained;
+
+	//! Channel data the connection did not accept yet; its window is only handed back once it does
+	std::vector<uint8_t> m_Unwritten;
+	size_t m_UnwrittenOffset;
+};
+
+Forwarder::Tunnel::Tunnel(Transport& transport, int fd, int channel)
+	: m_Transport(transport), m_Channel(channel), m_ConnectReactor(NULL), m_Open(false), m_Readable(false),
+	  m_LocalEOF(false), m_RemoteEOF(false), m_Closing(false), m_Detached(false), m_UnwrittenOffset(0)
+{
+	m_Socket.Attach(fd);
+}
+
+Forwarder::Tunnel::~Tunnel()
+{
+	if (m_ConnectReactor != NULL)
+		m_ConnectReactor->Remove(m_Socket.GetFD());
+}
+
+void Forwarder::Tunnel::WatchConnect(Reactor& reactor, std::function<void()> handler)
+{
+	m_ConnectReactor = &reactor;
+	// Failures are reported as both events
+	reactor.Add(m_Socket.GetFD(), [handler](unsigned int events) {
+		if (events & Reactor::Writable)
+			handler();
+	});
+}
+
+int Forwarder::Tunnel::FinishConnect()
+{
+	if (m_ConnectReactor != NULL) {
+		m_ConnectReactor->Remove(m_Socket.GetFD());
+		m_ConnectReactor = NULL;
+	}
+	int error = 0;
+	socklen_t len = sizeof(error);
+	if (getsockopt(m_Socket.GetFD(), SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+		error = errno;
+	return error;
+}
+
+void Forwarder::Tunnel::Register(Reactor& reactor, IoRing* ring)
+{
+	// Without channel window, received data waits; the ring must not run out of buffers for it
+	m_Socket.Register(reactor, ring, [this](unsigned int events) { HandleEvents(events); }, true);
+}
+
+void Forwarder::Tunnel::HandleEvents(unsigned int events)
+{
+	if (events & Reactor::Readable)
+		m_Readable = true;
+	if (events & Reactor::Writable)
+		WriteUnwritten();
+	Pump();
+}
+
+void Forwarder::Tunnel::OnOpened()
+{
+	if (m_SocksRequest) {
+		// The reply is a few bytes, which a fresh connection always takes
+		const std::string reply = m_SocksRequest->MakeReply(true);
+		m_SocksRequest.reset();
+		struct iovec iov = { const_cast<char*>(reply.data()), reply.size() };
+		if (m_Socket.Transmit(&iov, 1) != static_cast<ssize_t>(reply.size())) {
+			Close();
+			return;
+		}
+	}
+	m_Open = true;
+	Pump();
+}
+
+void Forwarder::Tunnel::OnOpenFailure()
+{
+	if (!m_SocksRequest)
+		return;
+	const std::string reply = m_SocksRequest->MakeReply(false);
+	m_SocksRequest.reset();
+	struct iovec iov = { const_cast<char*>(reply.data()), reply.size() };
+	m_Socket.Transmit(&iov, 1);
+}
+
+void Forwarder::Tunnel::Pump()
+{
+	while (m_Open && m_Readable && !m_LocalEOF && !m_Closing && !m_Detached) {
+		// Without room, the rest stays in the socket until OnWritable()
+		if (m_Transport.GetChannelSendRoom(m_Channel) == 0)
+			return;
+		ssize_t n = m_Transport.TransmitChannelDataFrom(m_Channel, m_Socket);
+		if (n == 0) {
+			m_Readable = false;
+		} else if (n < 0) {
+			// [SSH-CONNECT, 5.3]
+			m_LocalEOF = true;
+			m_Transport.SendChannelEOF(m_Channel);
+			CloseIfDone();
+		}
+	}
+}
+
+void Forwarder::Tunnel::OnData(const uint8_t* data, size_t len)
+{
+	if (m_Closing)
+		return;
+	size_t written = 0;
+	if (m_Unwritten.empty()) {
+		struct iovec iov = { const_cast<uint8_t*>(data), len };
+		ssize_t n = m_Socket.Transmit(&iov, 1);
+		if (n < 0) {
+			Close();
+			return;
+		}
+		written = n;
+		m_Transport.ChannelDataConsumed(m_Channel, written);
+	}
+	m_Unwritten.insert(m_Unwritten.end(), data + written, data + len);
+}
+
+void Forwarder::Tunnel::WriteUnwritten()
+{
+	if (m_Unwritten.empty())
+		return;
+	while (m_UnwrittenOffset < m_Unwritten.size() && !m_Closing) {
+		struct iovec iov = { &m_Unwritten[m_UnwrittenOffset], m_Unwritten.size() - m_UnwrittenOffset };
+		ssize_t n = m_Socket.Transmit(&iov, 1);
+		if (n < 0) {
+			Close();
+			return;
+		}
+		if (n == 0)
+			return;
+		m_UnwrittenOffset += n;
+		if (!m_Detached)
+			m_Transport.ChannelDataConsumed(m_Channel, n);
+	}
+	m_Unwritten.clear();
+	m_UnwrittenOffset = 0;
+	if (m_RemoteEOF) {
+		m_Socket.Shutdown();
+		CloseIfDone();
+	}
+}
+
+void Forwarder::Tunnel::OnEOF()
+{
+	m_RemoteEOF = true;
+	if (m_Unwritten.empty()) {
+		m_Socket.Shutdown();
+		CloseIfDone();
+	}
+}
+
+bool Forwarder::Tunnel::Detach(std::function<void()> drained)
+{
+	// The close implies an EOF, should the server not have sent one
+	m_Detached = true;
+	m_RemoteEOF = true;
+	if (m_Closing || m_Unwritten.empty())
+		return false;
+	m_Drained = std::move(drained);
+	return true;
+}
+
+void Forwarder::Tunnel::CloseIfDone()
+{
+	if ((m_LocalEOF || m_Detached) && m_RemoteEOF && m_Unwritten.empty())
+		Close();
+}
+
+void Forwarder::Tunnel::Close()
+{
+	if (m_Closing)
+		return;
+	// We're destroyed once the server closed its side as well
+	m_Closing = true;
+	m_Unwritten.clear();
+	m_UnwrittenOffset = 0;
+	if (m_Detached)
+		m_Drained();
+	else
+		m_Transport.CloseChannel(m_Channel);
+}
+
+bool Forwarder::ParseSpec(const std::string& s, Spec& spec, bool remote)
+{
+	std::vector<std::string> fields;
+	if (!SplitFields(s, fields) || fields.size() < 3 || fields.size() > 4)
+		return false;
+	size_t n = 0;
+	spec.m_BindAddress = fields.size() == 4 ? fields[n++] : std::string();
+	if (!ParsePort(fields[n++], spec.m_ListenPort, remote ? 0 : 1))
+		return false;
+	spec.m_Host = fields[n++];
+	return !spec.m_Host.empty() && ParsePort(fields[n], spec.m_Port);
+}
+
+bool Forwarder::ParseDynamicSpec(const std::string& s, Spec& spec)
+{
+	std::vector<std::string> fields;
+	if (!SplitFields(s, fields) || fields.size() > 2)
+		return false;
+	spec.m_BindAddress = fields.size() == 2 ? fields[0] : std::string();
+	spec.m_Host.clear();
+	spec.m_Port = 0;
+	return ParsePort(fields.back(), spec.m_ListenPort);
+}
+
+Forwarder::Forwarder(Transport& transport, Reactor& reactor, IoRing* ring)
+	: m_Transport(transport), m_Reactor(reactor), m_Ring(ring), m_Started(false), m_Reaping(false), m_ReapTimer(0)
+{
+}
+
+Forwarder::~Forwarder()
+{
+	if (m_Reaping)
+		m_Reactor.CancelTimer(m_ReapTimer);
+	m_Tunnels.clear();
+	m_Draining.clear();
+	while (!m_SocksRequests.empty())
+		RemoveSocksRequest(m_SocksRequests.begin()->first, false);
+	for (const Listener& listener : m_Listeners) {
+		if (m_Started)
+			m_Reactor.Remove(listener.m_FD);
+		close(listener.m_FD);
+	}
+}
+
+bool Forwarder::AddLocal(const Spec& spec)
+{
+	return Listen(spec, false);
+}
+
+bool Forwarder::AddDynamic(const Spec& spec)
+{
+	return Listen(spec, true);
+}
+
+bool Forwarder::Listen(const Spec& spec, bool dynamic)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	// Like OpenSSH, only listen on the loopback interface unless told otherwise
+	const char* host = "localhost";
+	if (spec.m_BindAddress == "*")
+		host = NULL;
+	else if (!spec.m_BindAddress.empty())
+		host = spec.m_BindAddress.c_str();
+	char service[16];
+	snprintf(service, sizeof(service), "%d", spec.m_ListenPort);
+
+	struct addrinfo* result;
+	if (getaddrinfo(host, service, &hints, &result) != 0)
+		return false;
+	bool listening = false;
+	for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+		int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		// Keep IPv6 sockets from claiming the IPv4 port as well, which we may listen on separately
+		if (ai->ai_family == AF_INET6)
+			setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0) {
+			Trace::Warning("unable to listen on port %d: %s", spec.m_ListenPort, strerror(errno));
+			close(fd);
+			continue;
+		}
+		const Listener listener{ fd, spec, dynamic };
+		m_Listeners.push_back(listener);
+		if (m_Started)
+			m_Reactor.Add(fd, [this, listener](unsigned int events) { Accept(listener); });
+		listening = true;
+	}
+	freeaddrinfo(result);
+	return listening;
+}
+
+bool Forwarder::AddRemote(const Spec& spec)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	char service[16];
+	snprintf(service, sizeof(service), "%d", spec.m_Port);
+
+	struct addrinfo* result;
+	if (getaddrinfo(spec.m_Host.c_str(), service, &hints, &result) != 0)
+		return false;
+	Remote remote;
+	remote.m_Spec = spec;
+	// Like OpenSSH, have the server only listen on its loopback interface unless told otherwise
+	if (spec.m_BindAddress.empty())
+		remote.m_Address = "localhost";
+	else if (spec.m_BindAddress != "*")
+		remote.m_Address = spec.m_BindAddress;
+	remote.m_BoundPort = 0;
+	for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+		Target target;
+		memcpy(&target.m_Address, ai->ai_addr, ai->ai_addrlen);
+		target.m_Length = ai->ai_addrlen;
+		remote.m_Targets.push_back(target);
+	}
+	freeaddrinfo(result);
+
+	m_Remotes.push_back(remote);
+	if (m_Started)
+		RequestRemote(remote);
+	return true;
+}
+
+void Forwarder::Start()
+{
+	if (m_Started)
+		return;
+	m_Started = true;
+	for (const Listener& listener : m_Listeners)
+		m_Reactor.Add(listener.m_FD, [this, listener](unsigned int events) { Accept(listener); });
+	for (const Remote& remote : m_Remotes)
+		RequestRemote(remote);
+}
+
+void Forwarder::RequestRemote(const Remote& remote)
+{
+	m_Transport.RequestTcpIpForward(remote.m_Address, remote.m_Spec.m_ListenPort);
+}
+
+void Forwarder::Accept(const Listener& listener)
+{
+	while (true) {
+		struct sockaddr_storage ss;
+		socklen_t len = sizeof(ss);
+		int fd = accept4(listener.m_FD, reinterpret_cast<struct sockaddr*>(&ss), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			// Out of descriptors leaves the connection pending; it is retried once another one arrives
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				Trace::Warning("accept failed: %s", strerror(errno));
+			return;
+		}
+
+		// Where to go is up to the SOCKS client
+		if (listener.m_Dynamic) {
+			m_SocksRequests[fd].reset(new SocksRequest);
+			m_Reactor.Add(fd, [this, fd](unsigned int events) { ReadSocksRequest(fd); });
+			continue;
+		}
+
+		std::string address;
+		int port;
+		GetOriginator(ss, len, address, port);
+		const int channel = m_Transport.OpenDirectTcpIp(listener.m_Spec.m_Host, listener.m_Spec.m_Port, address, port);
+		Trace::Info("forwarding connection from %s port %d to %s port %d on channel %d",
+			address.c_str(), port, listener.m_Spec.m_Host.c_str(), listener.m_Spec.m_Port, channel);
+		std::unique_ptr<Tunnel>& tunnel = m_Tunnels[channel];
+		tunnel.reset(new Tunnel(m_Transport, fd, channel));
+		tunnel->Register(m_Reactor, m_Ring);
+	}
+}
+
+void Forwarder::ReadSocksRequest(int fd)
+{
+	SocksRequest::Status status = SocksRequest::Status::Incomplete;
+	while (status == SocksRequest::Status::Incomplete) {
+		uint8_t buf[4096];
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0) {
+			RemoveSocksRequest(fd, false);
+			return;
+		}
+		std::string reply;
+		status = m_SocksRequests[fd]->Receive(buf, n, reply);
+		// Like the final reply, these are a few bytes
+		if (!reply.empty() && write(fd, reply.data(), reply.size()) != static_cast<ssize_t>(reply.size()))
+			status = SocksRequest::Status::Refused;
+	}
+	if (status == SocksRequest::Status::Refused) {
+		Trace::Warning("SOCKS request refused");
+		RemoveSocksRequest(fd, false);
+		return;
+	}
+
+	// Open the channel right away; what the client sent after its request goes out once it is open
+	std::unique_ptr<SocksRequest> request = std::move(m_SocksRequests[fd]);
+	RemoveSocksRequest(fd, true);
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+	std::string address;
+	int port = 0;
+	if (getpeername(fd, reinterpret_cast<struct sockaddr*>(&ss), &len) == 0)
+		GetOriginator(ss, len, address, port);
+	const int channel = m_Transport.OpenDirectTcpIp(request->GetHost(), request->GetPort(), address, port);
+	Trace::Info("forwarding SOCKS connection from %s port %d to %s port %d on channel %d",
+		address.c_str(), port, request->GetHost().c_str(), request->GetPort(), channel);
+	const std::string earlyData = request->TakeEarlyData();
+	if (!earlyData.empty())
+		m_Transport.TransmitChannelData(channel, reinterpret_cast<const uint8_t*>(earlyData.data()), earlyData.size());
+
+	std::unique_ptr<Tunnel>& tunnel = m_Tunnels[channel];
+	tunnel.reset(new Tunnel(m_Transport, fd, channel));
+	tunnel->SetSocksRequest(std::move(request));
+	tunnel->Register(m_Reactor, m_Ring);
+}
+
+void Forwarder::RemoveSocksRequest(int fd, bool keep)
+{
+	m_Reactor.Remove(fd);
+	m_SocksRequests.erase(fd);
+	if (!keep)
+		close(fd);
+}
+
+void Forwarder::OnChannelOpened(int channelNumber)
+{
+	m_Tunnels[channelNumber]->OnOpened();
+}
+
+void Forwarder::OnChannelOpenFailure(int channelNumber, uint32_t reasonCode, const std::string& description)
+{
+	Trace::Warning("channel %d: open failed: %s", channelNumber, description.c_str());
+	m_Tunnels[channelNumber]->OnOpenFailure();
+	m_Tunnels.erase(channelNumber);
+}
+
+void Forwarder::OnChannelWritable(int channelNumber)
+{
+	m_Tunnels[channelNumber]->OnWritable();
+}
+
+void Forwarder::OnChannelData(int channelNumber, const uint8_t* data, size_t len)
+{
+	m_Tunnels[channelNumber]->OnData(data, len);
+}
+
+void Forwarder::OnChannelEOF(int channelNumber)
+{
+	m_Tunnels[channelNumber]->OnEOF();
+}
+
+void Forwarder::OnChannelClosed(int channelNumber)
+{
+	// The channel number may be reused right away, so a tunnel still writing is kept elsewhere
+	auto it = m_Tunnels.find(channelNumber);
+	if (it == m_Tunnels.end())
+		return;
+	Tunnel* tunnel = it->second.get();
+	if (tunnel->Detach([this, tunnel]() { OnDrained(tunnel); }))
+		m_Draining[tunnel] = std::move(it->second);
+	m_Tunnels.erase(it);
+}
+
+void Forwarder::OnDrained(Tunnel* tunnel)
+{
+	// This is called from within the tunnel's event handler, so it can't be destroyed just yet
+	m_Drained.push_back(tunnel);
+	if (m_Reaping)
+		return;
+	m_Reaping = true;
+	m_ReapTimer = m_Reactor.AddTimer(Reactor::Clock::now(), [this]() {
+		m_Reaping = false;
+		for (Tunnel* tunnel : m_Drained)
+			m_Draining.erase(tunnel);
+		m_Drained.clear();
+	});
+}
+
+const Forwarder::Remote* Forwarder::FindRemote(const std::string& address, uint32_t port) const
+{
+	// Servers may name the address they listen on rather than the one asked for; the port will do then
+	const Remote* match = NULL;
+	for (const Remote& remote : m_Remotes) {
+		if (remote.m_BoundPort != port)
+			continue;
+		if (remote.m_Address == address)
+			return &remote;
+		if (match == NULL)
+			match = &remote;
+	}
+	return match;
+}
+
+void Forwarder::OnTcpIpForwardSuccess(const std::string& address, uint32_t port, uint32_t boundPort)
+{
+	for (Remote& remote : m_Remotes) {
+		if (remote.m_BoundPort == 0 && remote.m_Address == address && static_cast<uint32_t>(remote.m_Spec.m_ListenPort) == port) {
+			remote.m_BoundPort = boundPort;
+			Trace::Info("server forwards port %u to %s port %d", boundPort, remote.m_Spec.m_Host.c_str(), remote.m_Spec.m_Port);
+			return;
+		}
+	}
+}
+
+void Forwarder::OnTcpIpForwardFailure(const std::string& address, uint32_t port)
+{
+	Trace::Warning("server refused to forward port %u", port);
+}
+
+bool Forwarder::OnForwardedTcpIp(int channelNumber, const std::string& connectedAddress, uint32_t connectedPort, const std::string& originatorAddress, uint32_t originatorPort)
+{
+	const Remote* remote = FindRemote(connectedAddress, connectedPort);
+	if (remote == NULL) {
+		Trace::Warning("channel %d: connection to unrequested port %u refused", channelNumber, connectedPort);
+		return false;
+	}
+
+	// Like Socket::StartConnect(), only the first address a connection can be started to is used
+	int fd = -1, error = EADDRNOTAVAIL;
+	bool connected = false;
+	for (const Target& target : remote->m_Targets) {
+		fd = socket(target.m_Address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			error = errno;
+			continue;
+		}
+		if (connect(fd, reinterpret_cast<const struct sockaddr*>(&target.m_Address), target.m_Length) == 0) {
+			connected = true;
+			break;
+		}
+		error = errno;
+		if (error == EINPROGRESS)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0) {
+		Trace::Warning("channel %d: unable to connect to %s port %d: %s", channelNumber, remote->m_Spec.m_Host.c_str(), remote->m_Spec.m_Port, strerror(error));
+		m_Transport.RejectChannelOpen(channelNumber, Numbers::ChannelReason::SSH_OPEN_CONNECT_FAILED, strerror(error));
+		return true;
+	}
+
+	Trace::Info("forwarding connection from %s port %u to %s port %d on channel %d",
+		originatorAddress.c_str(), originatorPort, remote->m_Spec.m_Host.c_str(), remote->m_Spec.m_Port, channelNumber);
+	std::unique_ptr<Tunnel>& tunnel = m_Tunnels[channelNumber];
+	tunnel.reset(new Tunnel(m_Transport, fd, channelNumber));
+	if (connected)
+		OnConnected(channelNumber);
+	else
+		tunnel->WatchConnect(m_Reactor, [this, channelNumber]() { OnConnected(channelNumber); });
+	return true;
+}
+
+void Forwarder::OnConnected(int channelNumber)
+{
+	Tunnel& tunnel = *m_Tunnels[channelNumber];
+	const int error = tunnel.FinishConnect();
+	if (error != 0) {
+		Trace::Warning("channel %d: connecting failed: %s", channelNumber, strerror(error));
+		m_Transport.RejectChannelOpen(channelNumber, Numbers::ChannelReason::SSH_OPEN_CONNECT_FAILED, strerror(error));
+		m_Tunnels.erase(channelNumber);
+		return;
+	}
+	tunnel.Register(m_Reactor, m_Ring);
+	m_Transport.AcceptChannelOpen(channelNumber);
+	tunnel.OnOpened();
+}
+
+} // namespace RSSH
@@ -0,0 +1,195 @@
+#ifndef RSSH_FORWARDER_H
+#define RSSH_FORWARDER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "reactor.h"
+
+namespace RSSH {
+
+class IoRing;
+class SocksRequest;
+class Transport;
+
+/*! Forwards TCP connections through channels, as in [SSH-CONNECT, 7]
+ *
+ *  For local forwarding, we listen on a local port and open a
+ *  direct-tcpip channel for every connection accepted; the server
+ *  connects it to a given host and port. Remote forwarding is the other
+ *  way around: the server listens and opens a forwarded-tcpip channel for
+ *  every connection, which we connect to a given host and port. The
+ *  channel is only confirmed once that connection is made, and refused if
+ *  it can't be. Dynamic forwarding is like local forwarding, except that
+ *  every connection tells where it is to go using SOCKS. All connections
+ *  are driven by the reactor, so any number of them can be forwarded, or
+ *  be in the process of connecting, at once.
+ *
+ *  Data read from a connection goes straight into a packet, never more
+ *  than the server's window allows; channel data is written to the
+ *  connection straight from the receive buffer. Only what the connection
+ *  does not take right away is kept, and that part of the window is not
+ *  handed back to the server until it is written. A slow reader on
+ *  either end thus slows down the other rather than piling up data.
+ *
+ *  The application's Callback must pass the channel callbacks for our
+ *  channels on to us; see OwnsChannel(). Packets are only queued, so the
+ *  transport must be flushed after every reactor iteration.
+ */
+class Forwarder {
+public:
+	//! What to forward: [bind_address:]port:host:hostport, as given to -L and -R
+	struct Spec {
+		//! Where to listen; empty for the loopback interface, "*" for all interfaces
+		std::string m_BindAddress;
+		int m_ListenPort;
+
+		//! Where the other side connects to
+		std::string m_Host;
+		int m_Port;
+	};
+
+	/*! Parses a specification; IPv6 addresses must be enclosed in brackets
+	 *
+	 *  For remote forwarding, the listen port may be 0 to let the server
+	 *  pick one.
+	 */
+	static bool ParseSpec(const std::string& s, Spec& spec, bool remote = false);
+
+	//! Parses [bind_address:]port, as given to -D; the host and port to connect to are left empty
+	static bool ParseDynamicSpec(const std::string& s, Spec& spec);
+
+	//! The reactor, ring and transport must outlive us
+	Forwarder(Transport& transport, Reactor& reactor, IoRing* ring);
+	~Forwarder();
+
+	Forwarder(const Forwarder&) = delete;
+	Forwarder& operator=(const Forwarder&) = delete;
+
+	/*! Listens for connections to forward as given by 'spec'
+	 *
+	 *  Connections are only accepted once Start() is called. Returns false
+	 *  if none of the addresses 'spec' refers to can be listened on.
+	 */
+	bool AddLocal(const Spec& spec);
+
+	/*! Listens for SOCKS connections to forward as given by 'spec'
+	 *
+	 *  A direct-tcpip channel is opened as soon as a request is read,
+	 *  without waiting for the client to see our reply; data that follows
+	 *  the request is sent once the channel is open. Like AddLocal()
+	 *  otherwise.
+	 */
+	bool AddDynamic(const Spec& spec);
+
+	/*! Has the server listen for connections to forward as given by 'spec'
+	 *
+	 *  The server is asked once Start() is called. Returns false if the
+	 *  host to connect to can't be resolved; this is done right away, so
+	 *  handling a connection never waits for name resolution.
+	 */
+	bool AddRemote(const Spec& spec);
+
+	//! Starts accepting connections and asks for remote ones; channels can only be opened once authenticated
+	void Start();
+
+	//! Is the channel one of ours? If so, the callbacks below are to be used for it
+	bool OwnsChannel(int channelNumber) const { return m_Tunnels.count(channelNumber) > 0; }
+
+	void OnChannelOpened(int channelNumber);
+	void OnChannelOpenFailure(int channelNumber, uint32_t reasonCode, const std::string& description);
+	void OnChannelWritable(int channelNumber);
+	void OnChannelData(int channelNumber, const uint8_t* data, size_t len);
+	void OnChannelEOF(int channelNumber);
+	void OnChannelClosed(int channelNumber);
+
+	//! Callbacks for remote forwarding, to be passed on by the application
+	bool OnForwardedTcpIp(int channelNumber, const std::string& connectedAddress, uint32_t connectedPort, const std::string& originatorAddress, uint32_t originatorPort);
+	void OnTcpIpForwardSuccess(const std::string& address, uint32_t port, uint32_t boundPort);
+	void OnTcpIpForwardFailure(const std::string& address, uint32_t port);
+
+	//! Number of connections being forwarded
+	size_t GetConnectionCount() const { return m_Tunnels.size() + m_Draining.size(); }
+
+private:
+	class Tunnel;
+
+	struct Listener {
+		int m_FD;
+		Spec m_Spec;
+		//! Set for SOCKS connections
+		bool m_Dynamic;
+	};
+
+	struct Target {
+		struct sockaddr_storage m_Address;
+		socklen_t m_Length;
+	};
+
+	//! A port the server forwards to us
+	struct Remote {
+		Spec m_Spec;
+
+		//! Address as sent in the tcpip-forward request
+		std::string m_Address;
+
+		//! Port the server listens on; 0 until it agreed to
+		uint32_t m_BoundPort;
+
+		//! Addresses m_Spec.m_Host resolved to
+		std::vector<Target> m_Targets;
+	};
+
+	//! Listens as given by 'spec'; see AddLocal()
+	bool Listen(const Spec& spec, bool dynamic);
+
+	//! Accepts all pending connections on a listening socket
+	void Accept(const Listener& listener);
+
+	//! Reads from a SOCKS connection until its request is complete, then forwards it
+	void ReadSocksRequest(int fd);
+
+	//! Stops waiting for the request of a SOCKS connection; it is closed unless 'keep' is set
+	void RemoveSocksRequest(int fd, bool keep);
+
+	//! Asks the server to listen as given by 'remote'
+	void RequestRemote(const Remote& remote);
+
+	//! Returns the remote forward a forwarded-tcpip channel is for, or NULL
+	const Remote* FindRemote(const std::string& address, uint32_t port) const;
+
+	//! Accepts or refuses a forwarded-tcpip channel once its connection is made or failed
+	void OnConnected(int channelNumber);
+
+	//! Destroys a tunnel taken from m_Draining once the current event is handled
+	void OnDrained(Tunnel* tunnel);
+
+	Transport& m_Transport;
+	Reactor& m_Reactor;
+	IoRing* m_Ring;
+	bool m_Started;
+
+	std::vector<Listener> m_Listeners;
+	std::vector<Remote> m_Remotes;
+
+	//! SOCKS connections we're reading the request of, by file descriptor
+	std::unordered_map<int, std::unique_ptr<SocksRequest>> m_SocksRequests;
+
+	//! Connections being forwarded, by channel number
+	std::unordered_map<int, std::unique_ptr<Tunnel>> m_Tunnels;
+
+	//! Connections whose channel the server closed, still writing what it sent
+	std::unordered_map<Tunnel*, std::unique_ptr<Tunnel>> m_Draining;
+
+	//! Drained connections, destroyed by the m_ReapTimer
+	std::vector<Tunnel*> m_Drained;
+	bool m_Reaping;
+	Reactor::TimerId m_ReapTimer;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_FORWARDER_H */
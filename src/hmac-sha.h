@@ -0,0 +1,96 @@
+#ifndef RSSH_HMAC_SHA_H
+#define RSSH_HMAC_SHA_H
+
+#include <cstddef>
+#include "ihmac.h"
+
+#include "cryptopp/sha.h"
+#include "cryptopp/hmac.h"
+
+namespace RSSH {
+
+template<class T> class HMAC_SHA : public IHMAC {
+public:
+	HMAC_SHA(const uint8_t* key, size_t keyLen);
+	virtual ~HMAC_SHA();
+
+	void Calculate(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, uint8_t* out) override;
+	bool Verify(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, const uint8_t* hmac) override;
+	size_t GetLength() const override;
+
+	void Begin(uint32_t sequenceNumber) override;
+	void Update(const uint8_t* buffer, size_t len) override;
+	void Final(uint8_t* out) override;
+	bool VerifyFinal(const uint8_t* hmac) override;
+
+private:
+	CryptoPP::HMAC< T >* m_HMAC;
+};
+
+template<class T> HMAC_SHA<T>::HMAC_SHA(const uint8_t* key, size_t keyLen)
+{
+	m_HMAC = new CryptoPP::HMAC< T >(key, keyLen);
+}
+
+template<class T> HMAC_SHA<T>::~HMAC_SHA()
+{
+	delete m_HMAC;
+}
+
+template<class T> void HMAC_SHA<T>::Calculate(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, uint8_t* out)
+{
+	Begin(sequenceNumber);
+	Update(buffer, len);
+	Final(out);
+}
+
+template<class T> bool HMAC_SHA<T>::Verify(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, const uint8_t* hmac)
+{
+	Begin(sequenceNumber);
+	Update(buffer, len);
+	return VerifyFinal(hmac);
+}
+
+template<class T> void HMAC_SHA<T>::Begin(uint32_t sequenceNumber)
+{
+	uint8_t seq_no[4] = {
+		static_cast<uint8_t>((sequenceNumber >> 24) & 0xff),
+		static_cast<uint8_t>((sequenceNumber >> 16) & 0xff),
+		static_cast<uint8_t>((sequenceNumber >> 8) & 0xff),
+		static_cast<uint8_t>(sequenceNumber & 0xff)
+	};
+
+	m_HMAC->Restart();
+	m_HMAC->Update(seq_no, 4);
+}
+
+template<class T> void HMAC_SHA<T>::Update(const uint8_t* buffer, size_t len)
+{
+	m_HMAC->Update(buffer, len);
+}
+
+template<class T> void HMAC_SHA<T>::Final(uint8_t* out)
+{
+	m_HMAC->Final(out);
+}
+
+template<class T> bool HMAC_SHA<T>::VerifyFinal(const uint8_t* hmac)
+{
+	// Constant-time comparison of the digest
+	return m_HMAC->Verify(hmac);
+}
+
+template<class T> size_t HMAC_SHA<T>::GetLength() const
+{
+	return m_HMAC->DigestSize();
+}
+
+typedef HMAC_SHA<CryptoPP::SHA1> HMAC_SHA1;
+
+// [RFC6668, 2]
+typedef HMAC_SHA<CryptoPP::SHA256> HMAC_SHA2_256;
+typedef HMAC_SHA<CryptoPP::SHA512> HMAC_SHA2_512;
+
+} // namespace RSSH
+
+#endif /* RSSH_HMAC_SHA_H */
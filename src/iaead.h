@@ -0,0 +1,44 @@
+#ifndef RSSH_IAEAD_H
+#define RSSH_IAEAD_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace RSSH {
+
+/*! Authenticated encryption with associated data
+ *
+ *  These ciphers take care of both encryption and integrity; no separate
+ *  MAC is used. The 4-byte packet length is never part of the encrypted
+ *  payload and is not included when padding to the block size.
+ */
+class IAEAD {
+public:
+	virtual ~IAEAD() { }
+
+	/*! Determines the length of an incoming packet
+	 *
+	 *  Returns the number of bytes at the start of the packet that can be
+	 *  read as plaintext afterwards, which is at least the length field.
+	 */
+	virtual size_t DecryptLength(uint8_t* packet, uint32_t sequenceNumber) = 0;
+
+	/*! Encrypts a 'len' byte packet in-place and places the tag at &packet[len]
+	 *
+	 *  This includes the length at the start of the packet.
+	 */
+	virtual void Seal(uint8_t* packet, size_t len, uint32_t sequenceNumber) = 0;
+
+	/*! Verifies the tag at &packet[len] and decrypts the packet in-place
+	 *
+	 *  Returns false if the packet is not authentic.
+	 */
+	virtual bool Open(uint8_t* packet, size_t len, uint32_t sequenceNumber) = 0;
+
+	virtual size_t GetBlockSize() const = 0;
+	virtual size_t GetTagLength() const = 0;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_IAEAD_H */
@@ -13,6 +13,18 @@ public:
 	virtual void Calculate(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, uint8_t* out) = 0;
 	virtual bool Verify(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, const uint8_t* hmac) = 0;
 	virtual size_t GetLength() const = 0;
+
+	/*! Incremental interface
+	 *
+	 *  Begin() starts a new MAC for the given sequence number; the packet
+	 *  is then fed using Update() and completed by either Final() or
+	 *  VerifyFinal(). This allows the MAC to be computed piece-by-piece
+	 *  while the cipher is working on the same bytes.
+	 */
+	virtual void Begin(uint32_t sequenceNumber) = 0;
+	virtual void Update(const uint8_t* buffer, size_t len) = 0;
+	virtual void Final(uint8_t* out) = 0;
+	virtual bool VerifyFinal(const uint8_t* hmac) = 0;
 };
 
 } // namespace RSSH
@@ -0,0 +1,554 @@
+#include "io-ring.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "exception.h"
+#include "trace.h"
+
+namespace RSSH {
+
+namespace {
+
+const unsigned int submissionQueueEntries = 256;
+const unsigned int completionQueueEntries = 4096;
+
+//! Receive buffers shared by all streams; must be a power of two
+const unsigned int numReceiveBuffers = 256;
+const size_t receiveBufferSize = 32768;
+const uint16_t receiveBufferGroup = 0;
+
+//! Outgoing data is staged in segments of this size, one send each
+const size_t sendSegmentSize = 65536;
+
+//! Low bits of user_data telling what a completion is for; the rest is the stream
+enum RequestKind : uint64_t {
+	R_Receive = 1,
+	R_Send = 2,
+	R_Cancel = 3,
+	R_Shutdown = 4,
+};
+const uint64_t requestKindMask = 7;
+
+uint64_t MakeUserData(IoRing::Stream* stream, RequestKind kind)
+{
+	return reinterpret_cast<uint64_t>(stream) | kind;
+}
+
+int SetupRing(unsigned int entries, struct io_uring_params* p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+int EnterRing(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+int RegisterRing(int fd, unsigned int opcode, void* arg, unsigned int nrArgs)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+void* MapAnonymous(size_t size)
+{
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+} // unnamed namespace
+
+IoRing::Stream::Stream(IoRing& ring, int fd, Reactor::Handler handler, bool paced)
+	: m_Ring(ring), m_FD(fd), m_Handler(std::move(handler)), m_Paced(paced), m_Receiving(false), m_Cancelling(false), m_EOF(false), m_Error(false),
+	  m_SendOffset(0), m_StagedBytes(0), m_SendsInFlight(0), m_SendBlocked(false), m_ShutdownPending(false), m_PendingEvents(0),
+	  m_Dirty(false), m_Starved(false), m_Detached(false), m_InFlight(0)
+{
+}
+
+void IoRing::Stream::PopReceived()
+{
+	m_Ring.ReturnBuffer(m_Received.front().m_BufferId);
+	m_Received.pop_front();
+	if (m_Paced)
+		m_Ring.m_PacedBuffers--;
+}
+
+ssize_t IoRing::Stream::Receive(uint8_t* data, size_t len)
+{
+	size_t copied = 0;
+	while (copied < len && !m_Received.empty()) {
+		Received& r = m_Received.front();
+		const size_t n = std::min(len - copied, static_cast<size_t>(r.m_Length - r.m_Offset));
+		memcpy(data + copied, m_Ring.m_Buffers + r.m_BufferId * receiveBufferSize + r.m_Offset, n);
+		copied += n;
+		r.m_Offset += n;
+		if (r.m_Offset == r.m_Length)
+			PopReceived();
+	}
+	if (copied == 0 && (m_EOF || m_Error))
+		return -1;
+	// Receiving may have stopped because we held too many buffers
+	if (copied > 0 && !m_Receiving)
+		m_Ring.MarkDirty(*this);
+	return copied;
+}
+
+ssize_t IoRing::Stream::Send(const struct iovec* iov, int count)
+{
+	if (m_Error)
+		return -1;
+
+	size_t taken = 0;
+	for (int n = 0; n < count; n++) {
+		const uint8_t* p = static_cast<const uint8_t*>(iov[n].iov_base);
+		size_t left = iov[n].iov_len;
+		while (left > 0 && m_StagedBytes < maxStagedBytes) {
+			// Append to the last segment, unless the kernel may be sending it already
+			if (m_SendQueue.size() <= m_SendsInFlight || m_SendQueue.back().size() >= sendSegmentSize) {
+				m_SendQueue.emplace_back();
+				m_SendQueue.back().reserve(sendSegmentSize);
+			}
+			std::vector<uint8_t>& segment = m_SendQueue.back();
+			const size_t chunk = std::min(left, std::min(sendSegmentSize - segment.size(), maxStagedBytes - m_StagedBytes));
+			segment.insert(segment.end(), p, p + chunk);
+			p += chunk;
+			left -= chunk;
+			taken += chunk;
+			m_StagedBytes += chunk;
+		}
+		if (left > 0) {
+			m_SendBlocked = true;
+			break;
+		}
+	}
+	if (taken > 0)
+		m_Ring.MarkDirty(*this);
+	return taken;
+}
+
+void IoRing::Stream::Shutdown()
+{
+	m_ShutdownPending = true;
+	m_Ring.MarkDirty(*this);
+}
+
+void IoRing::Stream::Detach()
+{
+	m_Detached = true;
+	m_Handler = nullptr;
+	// Closing the socket sends whatever is queued, followed by a FIN
+	m_ShutdownPending = false;
+	while (!m_Received.empty())
+		PopReceived();
+	m_Ring.MarkDirty(*this);
+}
+
+std::unique_ptr<IoRing> IoRing::Create(Reactor& reactor)
+{
+	std::unique_ptr<IoRing> ring(new IoRing(reactor));
+	if (!ring->Setup())
+		return NULL;
+	IoRing* r = ring.get();
+	reactor.Add(r->m_FD, [r](unsigned int events) { r->Reap(); });
+	reactor.SetPrepareHandler([r]() { r->Submit(); });
+	return ring;
+}
+
+IoRing::IoRing(Reactor& reactor)
+	: m_Reactor(reactor), m_FD(-1), m_SQRing(NULL), m_SQRingSize(0), m_SQEs(NULL), m_SQEsSize(0), m_SQLocalTail(0),
+	  m_BufferRing(NULL), m_BufferRingSize(0), m_Buffers(NULL), m_BufferRingTail(0), m_Multishot(true),
+	  m_PacedBuffers(0), m_InFlight(0), m_EnterCount(0)
+{
+}
+
+bool IoRing::Setup()
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = completionQueueEntries;
+	m_FD = SetupRing(submissionQueueEntries, &p);
+	if (m_FD < 0) {
+		Trace::Info("io_uring unavailable: %s", strerror(errno));
+		return false;
+	}
+	const unsigned int required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+	if ((p.features & required) != required) {
+		Trace::Info("io_uring lacks required features");
+		return false;
+	}
+
+	// Both rings share a single mapping
+	m_SQRingSize = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned), p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+	m_SQRing = mmap(NULL, m_SQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_FD, IORING_OFF_SQ_RING);
+	if (m_SQRing == MAP_FAILED) {
+		m_SQRing = NULL;
+		return false;
+	}
+	m_SQEsSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes = mmap(NULL, m_SQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_FD, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return false;
+	m_SQEs = static_cast<struct io_uring_sqe*>(sqes);
+
+	uint8_t* ring = static_cast<uint8_t*>(m_SQRing);
+	m_SQHead = reinterpret_cast<unsigned*>(ring + p.sq_off.head);
+	m_SQTail = reinterpret_cast<unsigned*>(ring + p.sq_off.tail);
+	m_SQFlags = reinterpret_cast<unsigned*>(ring + p.sq_off.flags);
+	m_SQArray = reinterpret_cast<unsigned*>(ring + p.sq_off.array);
+	m_SQMask = *reinterpret_cast<unsigned*>(ring + p.sq_off.ring_mask);
+	m_SQEntries = p.sq_entries;
+	m_SQLocalTail = *m_SQTail;
+	m_CQHead = reinterpret_cast<unsigned*>(ring + p.cq_off.head);
+	m_CQTail = reinterpret_cast<unsigned*>(ring + p.cq_off.tail);
+	m_CQMask = *reinterpret_cast<unsigned*>(ring + p.cq_off.ring_mask);
+	m_CQEs = reinterpret_cast<struct io_uring_cqe*>(ring + p.cq_off.cqes);
+
+	// Provided buffers for the multishot receives
+	m_BufferRingSize = numReceiveBuffers * sizeof(struct io_uring_buf);
+	m_BufferRing = static_cast<struct io_uring_buf_ring*>(MapAnonymous(m_BufferRingSize));
+	m_Buffers = static_cast<uint8_t*>(MapAnonymous(numReceiveBuffers * receiveBufferSize));
+	if (m_BufferRing == NULL || m_Buffers == NULL)
+		return false;
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<uint64_t>(m_BufferRing);
+	reg.ring_entries = numReceiveBuffers;
+	reg.bgid = receiveBufferGroup;
+	if (RegisterRing(m_FD, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		Trace::Info("io_uring lacks provided buffer rings: %s", strerror(errno));
+		return false;
+	}
+	for (unsigned int n = 0; n < numReceiveBuffers; n++)
+		ReturnBuffer(n);
+	return true;
+}
+
+IoRing::~IoRing()
+{
+	if (m_SQEs != NULL) {
+		m_Reactor.SetPrepareHandler(nullptr);
+		m_Reactor.Remove(m_FD);
+
+		// The kernel may still write to our buffers; wait until it no longer does
+		if (m_InFlight > 0) {
+			struct io_uring_sqe* sqe = GetSQE();
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+			Enter();
+		}
+		while (m_InFlight > 0) {
+			if (EnterRing(m_FD, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+				break;
+			Reap();
+		}
+		for (auto& stream : m_Streams)
+			close(stream->m_FD);
+		munmap(m_SQEs, m_SQEsSize);
+	}
+	if (m_SQRing != NULL)
+		munmap(m_SQRing, m_SQRingSize);
+	if (m_BufferRing != NULL)
+		munmap(m_BufferRing, m_BufferRingSize);
+	if (m_Buffers != NULL)
+		munmap(m_Buffers, numReceiveBuffers * receiveBufferSize);
+	if (m_FD >= 0)
+		close(m_FD);
+}
+
+IoRing::Stream* IoRing::Attach(int fd, Reactor::Handler handler, bool paced)
+{
+	m_Streams.emplace_back(new Stream(*this, fd, std::move(handler), paced));
+	Stream* stream = m_Streams.back().get();
+	MarkDirty(*stream);
+	return stream;
+}
+
+struct io_uring_sqe* IoRing::GetSQE()
+{
+	if (m_SQLocalTail - __atomic_load_n(m_SQHead, __ATOMIC_ACQUIRE) >= m_SQEntries)
+		Enter();
+	const unsigned int index = m_SQLocalTail & m_SQMask;
+	struct io_uring_sqe* sqe = &m_SQEs[index];
+	memset(sqe, 0, sizeof(*sqe));
+	m_SQArray[index] = index;
+	m_SQLocalTail++;
+	return sqe;
+}
+
+void IoRing::StartReceive(Stream& stream)
+{
+	struct io_uring_sqe* sqe = GetSQE();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = stream.m_FD;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = receiveBufferGroup;
+	if (stream.m_Paced)
+		m_PacedBuffers++;
+	else if (m_Multishot)
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->user_data = MakeUserData(&stream, R_Receive);
+	stream.m_Receiving = true;
+	stream.m_InFlight++;
+	m_InFlight++;
+}
+
+void IoRing::CancelReceive(Stream& stream)
+{
+	struct io_uring_sqe* sqe = GetSQE();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = MakeUserData(&stream, R_Receive);
+	sqe->user_data = MakeUserData(&stream, R_Cancel);
+	stream.m_Cancelling = true;
+	stream.m_InFlight++;
+	m_InFlight++;
+}
+
+void IoRing::StartShutdown(Stream& stream)
+{
+	struct io_uring_sqe* sqe = GetSQE();
+	sqe->opcode = IORING_OP_SHUTDOWN;
+	sqe->fd = stream.m_FD;
+	sqe->len = SHUT_WR;
+	sqe->user_data = MakeUserData(&stream, R_Shutdown);
+	stream.m_ShutdownPending = false;
+	stream.m_InFlight++;
+	m_InFlight++;
+}
+
+void IoRing::StartSend(Stream& stream)
+{
+	// A chain must be submitted in one go, so make sure it fits
+	unsigned int length = stream.m_SendQueue.size();
+	if (length > Stream::maxChainLength)
+		length = Stream::maxChainLength;
+	if (m_SQEntries - (m_SQLocalTail - __atomic_load_n(m_SQHead, __ATOMIC_ACQUIRE)) < length)
+		Enter();
+
+	for (unsigned int n = 0; n < length; n++) {
+		const std::vector<uint8_t>& segment = stream.m_SendQueue[n];
+		const size_t offset = n == 0 ? stream.m_SendOffset : 0;
+		struct io_uring_sqe* sqe = GetSQE();
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = stream.m_FD;
+		sqe->addr = reinterpret_cast<uint64_t>(segment.data() + offset);
+		sqe->len = segment.size() - offset;
+		// A short send must fail the chain, or the next segment would go out before the rest of this one
+		sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+		if (n + 1 < length)
+			sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = MakeUserData(&stream, R_Send);
+	}
+	stream.m_SendsInFlight = length;
+	stream.m_InFlight += length;
+	m_InFlight += length;
+}
+
+void IoRing::MarkDirty(Stream& stream)
+{
+	if (stream.m_Dirty)
+		return;
+	stream.m_Dirty = true;
+	m_Dirty.push_back(&stream);
+}
+
+void IoRing::Submit()
+{
+	// Starting requests may mark streams dirty again, so work on a copy
+	std::vector<Stream*> dirty;
+	dirty.swap(m_Dirty);
+	for (Stream* stream : dirty) {
+		stream->m_Dirty = false;
+		if (stream->m_Error) {
+			stream->m_ShutdownPending = false;
+			if (stream->m_Detached) {
+				stream->m_SendQueue.clear();
+				stream->m_StagedBytes = 0;
+			}
+		}
+		const bool wantReceive = !stream->m_Detached && !stream->m_EOF && !stream->m_Error &&
+		                         stream->m_Received.size() < Stream::maxHeldBuffers;
+		if (wantReceive && !stream->m_Receiving && !stream->m_Cancelling) {
+			if (stream->m_Paced && m_PacedBuffers >= numReceiveBuffers / 2)
+				Starve(*stream);
+			else
+				StartReceive(*stream);
+		} else if (!wantReceive && stream->m_Receiving && !stream->m_Cancelling)
+			CancelReceive(*stream);
+		if (stream->m_SendsInFlight == 0 && !stream->m_SendQueue.empty() && !stream->m_Error)
+			StartSend(*stream);
+		if (stream->m_ShutdownPending && stream->m_SendsInFlight == 0 && stream->m_SendQueue.empty())
+			StartShutdown(*stream);
+		if (stream->m_Detached && stream->m_InFlight == 0 && stream->m_SendQueue.empty())
+			Release(*stream);
+	}
+	Enter();
+}
+
+void IoRing::Enter()
+{
+	const unsigned int toSubmit = m_SQLocalTail - *m_SQTail;
+	if (toSubmit == 0)
+		return;
+	__atomic_store_n(m_SQTail, m_SQLocalTail, __ATOMIC_RELEASE);
+	while (EnterRing(m_FD, toSubmit, 0, 0) < 0) {
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			throw Exception(Exception::C_Reactor_Error);
+		// Out of resources; make room by taking completions
+		EnterRing(m_FD, 0, 1, IORING_ENTER_GETEVENTS);
+		Reap();
+	}
+	m_EnterCount++;
+}
+
+void IoRing::Reap()
+{
+	std::vector<Stream*> notify;
+	while (true) {
+		unsigned int head = *m_CQHead;
+		const unsigned int tail = __atomic_load_n(m_CQTail, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			// Completions that didn't fit are only posted once we ask for them
+			if ((__atomic_load_n(m_SQFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) == 0)
+				break;
+			EnterRing(m_FD, 0, 0, IORING_ENTER_GETEVENTS);
+			m_EnterCount++;
+			continue;
+		}
+		for (; head != tail; head++) {
+			const struct io_uring_cqe cqe = m_CQEs[head & m_CQMask];
+			Stream* stream = reinterpret_cast<Stream*>(cqe.user_data & ~requestKindMask);
+			if (stream == NULL)
+				continue; // our own cancellation on shutdown
+			unsigned int events = 0;
+			const bool finished = (cqe.flags & IORING_CQE_F_MORE) == 0;
+			switch(cqe.user_data & requestKindMask) {
+				case R_Receive:
+					// A paced stream's receive was counted as holding a buffer; it still does if it got one
+					if (stream->m_Paced && (stream->m_Detached || cqe.res <= 0 || (cqe.flags & IORING_CQE_F_BUFFER) == 0))
+						m_PacedBuffers--;
+					if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+						const uint16_t bufferId = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+						if (stream->m_Detached) {
+							ReturnBuffer(bufferId);
+						} else {
+							stream->m_Received.push_back(Stream::Received{ bufferId, 0, static_cast<uint32_t>(cqe.res) });
+							if (stream->m_Received.size() >= Stream::maxHeldBuffers)
+								MarkDirty(*stream);
+						}
+						events |= Reactor::Readable;
+					} else if (cqe.res == 0) {
+						stream->m_EOF = true;
+						events |= Reactor::Readable;
+					} else if (cqe.res == -EINVAL && m_Multishot) {
+						// Multishot receives need a newer kernel; re-arm after every completion instead
+						Trace::Info("io_uring lacks multishot receive");
+						m_Multishot = false;
+					} else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+						stream->m_Error = true;
+						events |= Reactor::Readable | Reactor::Writable;
+					}
+					if (finished) {
+						stream->m_Receiving = false;
+						// Re-arming without buffers would just fail again
+						if (cqe.res == -ENOBUFS)
+							Starve(*stream);
+						else
+							MarkDirty(*stream);
+					}
+					break;
+				case R_Send:
+					stream->m_SendsInFlight--;
+					if (cqe.res >= 0) {
+						// A short send fails the rest of the chain; we'll continue where it stopped
+						stream->m_SendOffset += cqe.res;
+						if (stream->m_SendOffset == stream->m_SendQueue.front().size()) {
+							stream->m_StagedBytes -= stream->m_SendQueue.front().size();
+							stream->m_SendQueue.pop_front();
+							stream->m_SendOffset = 0;
+						}
+					} else if (cqe.res != -ECANCELED) {
+						stream->m_Error = true;
+						events |= Reactor::Readable | Reactor::Writable;
+					}
+					if (stream->m_SendsInFlight == 0)
+						MarkDirty(*stream);
+					if (stream->m_SendBlocked && stream->m_StagedBytes < Stream::maxStagedBytes) {
+						stream->m_SendBlocked = false;
+						events |= Reactor::Writable;
+					}
+					break;
+				case R_Cancel:
+					stream->m_Cancelling = false;
+					MarkDirty(*stream);
+					break;
+				case R_Shutdown:
+					MarkDirty(*stream);
+					break;
+			}
+			if (finished) {
+				stream->m_InFlight--;
+				m_InFlight--;
+			}
+
+			// Handlers are called once all completions are in, so each is called once
+			if (events != 0 && !stream->m_Detached) {
+				if (stream->m_PendingEvents == 0)
+					notify.push_back(stream);
+				stream->m_PendingEvents |= events;
+			}
+		}
+		__atomic_store_n(m_CQHead, head, __ATOMIC_RELEASE);
+	}
+
+	// Streams are only released by Submit(), so these are all still around
+	for (Stream* stream : notify) {
+		const unsigned int events = stream->m_PendingEvents;
+		stream->m_PendingEvents = 0;
+		if (!stream->m_Detached)
+			stream->m_Handler(events);
+	}
+}
+
+void IoRing::ReturnBuffer(uint16_t bufferId)
+{
+	// Not using 'bufs': C++ compilers place the flexible array after an empty struct
+	struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(m_BufferRing) + (m_BufferRingTail & (numReceiveBuffers - 1));
+	buf->addr = reinterpret_cast<uint64_t>(m_Buffers + bufferId * receiveBufferSize);
+	buf->len = receiveBufferSize;
+	buf->bid = bufferId;
+	m_BufferRingTail++;
+	__atomic_store_n(&m_BufferRing->tail, m_BufferRingTail, __ATOMIC_RELEASE);
+
+	for (Stream* stream : m_Starved) {
+		stream->m_Starved = false;
+		MarkDirty(*stream);
+	}
+	m_Starved.clear();
+}
+
+void IoRing::Starve(Stream& stream)
+{
+	if (stream.m_Starved)
+		return;
+	stream.m_Starved = true;
+	m_Starved.push_back(&stream);
+}
+
+void IoRing::Release(Stream& stream)
+{
+	close(stream.m_FD);
+	m_Starved.erase(std::remove(m_Starved.begin(), m_Starved.end(), &stream), m_Starved.end());
+	auto it = std::find_if(m_Streams.begin(), m_Streams.end(), [&stream](const std::unique_ptr<Stream>& s) { return s.get() == &stream; });
+	*it = std::move(m_Streams.back());
+	m_Streams.pop_back();
+}
+
+} // namespace RSSH
@@ -0,0 +1,225 @@
+#ifndef RSSH_IO_RING_H
+#define RSSH_IO_RING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "reactor.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+struct iovec;
+
+namespace RSSH {
+
+/*! Socket I/O using io_uring, as an alternative to read(2)/writev(2)
+ *
+ *  Every socket gets a multishot receive: the kernel keeps receiving into
+ *  buffers from a ring shared by all sockets, without a system call per
+ *  read. Outgoing data is copied to per-socket staging buffers, which are
+ *  sent as a chain of linked requests so they go out in order. Requests
+ *  made while handling events are submitted with a single system call
+ *  before the reactor waits again.
+ *
+ *  The ring registers itself with a Reactor, which wakes up once
+ *  completions arrive; sockets using the ring are not registered with the
+ *  reactor themselves. The io_uring system calls are used directly, so no
+ *  library is needed. Create() returns NULL if the kernel lacks io_uring or
+ *  a feature we need; callers then stay with the reactor alone.
+ */
+class IoRing {
+public:
+	class Stream;
+
+	static std::unique_ptr<IoRing> Create(Reactor& reactor);
+	~IoRing();
+
+	IoRing(const IoRing&) = delete;
+	IoRing& operator=(const IoRing&) = delete;
+
+	/*! Hands the socket 'fd' to the ring
+	 *
+	 *  'handler' is called like a Reactor handler: Readable once data or
+	 *  end-of-file arrives, Writable once staging room frees up after
+	 *  Stream::Send() took less than offered.
+	 *
+	 *  Set 'paced' if received data may be left unread for a while, such
+	 *  as that of a forwarded connection waiting for a channel window. A
+	 *  multishot receive takes buffers for as long as there is data, so
+	 *  paced streams receive one buffer at a time instead. Together they
+	 *  never hold more than half the buffers, leaving the rest to streams
+	 *  that are always read, like the one carrying the channel windows.
+	 */
+	Stream* Attach(int fd, Reactor::Handler handler, bool paced = false);
+
+	//! Number of io_uring_enter(2) calls made
+	uint64_t GetEnterCount() const { return m_EnterCount; }
+
+private:
+	IoRing(Reactor& reactor);
+	bool Setup();
+
+	//! Returns a cleared submission queue entry, submitting if the queue is full
+	struct io_uring_sqe* GetSQE();
+
+	//! Submits everything queued, including sends and receives that need (re)starting
+	void Submit();
+
+	//! Passes queued submission queue entries to the kernel
+	void Enter();
+
+	//! Handles all completions
+	void Reap();
+
+	//! Hands a receive buffer back to the kernel
+	void ReturnBuffer(uint16_t bufferId);
+
+	//! Restarts the stream's receive once a buffer is returned
+	void Starve(Stream& stream);
+
+	void StartReceive(Stream& stream);
+	void CancelReceive(Stream& stream);
+	void StartSend(Stream& stream);
+	void StartShutdown(Stream& stream);
+
+	//! Queues the stream for Submit()
+	void MarkDirty(Stream& stream);
+
+	//! Frees a detached stream once the kernel is done with it
+	void Release(Stream& stream);
+
+	Reactor& m_Reactor;
+	int m_FD;
+
+	// Submission queue, shared with the kernel
+	void* m_SQRing;
+	size_t m_SQRingSize;
+	unsigned* m_SQHead;
+	unsigned* m_SQTail;
+	unsigned* m_SQFlags;
+	unsigned* m_SQArray;
+	unsigned m_SQMask;
+	unsigned m_SQEntries;
+	struct io_uring_sqe* m_SQEs;
+	size_t m_SQEsSize;
+	//! Our copy of the tail, published by Enter()
+	unsigned m_SQLocalTail;
+
+	// Completion queue, shared with the kernel; in the same mapping as the submission queue
+	unsigned* m_CQHead;
+	unsigned* m_CQTail;
+	unsigned m_CQMask;
+	struct io_uring_cqe* m_CQEs;
+
+	//! Receive buffers provided to the kernel; it picks one per completion
+	struct io_uring_buf_ring* m_BufferRing;
+	size_t m_BufferRingSize;
+	uint8_t* m_Buffers;
+	uint16_t m_BufferRingTail;
+
+	//! Cleared if the kernel lacks multishot receive; each completion is then re-armed
+	bool m_Multishot;
+
+	std::vector<std::unique_ptr<Stream>> m_Streams;
+	std::vector<Stream*> m_Dirty;
+
+	//! Streams whose receive stopped for lack of buffers; restarted once one is returned
+	std::vector<Stream*> m_Starved;
+
+	//! Buffers held by paced streams, plus one for every receive they have in flight
+	unsigned int m_PacedBuffers;
+
+	//! Requests the kernel hasn't completed yet
+	size_t m_InFlight;
+
+	uint64_t m_EnterCount;
+};
+
+//! A socket handed to an IoRing
+class IoRing::Stream {
+public:
+	/*! Copies received data to 'data'
+	 *
+	 *  Returns the number of bytes copied, 0 if there's nothing yet; -1 on
+	 *  errors or end-of-file, once all data before it was taken.
+	 */
+	ssize_t Receive(uint8_t* data, size_t len);
+
+	/*! Queues data to be sent
+	 *
+	 *  Returns how much was taken, which is less than offered once the
+	 *  staging buffers fill up; -1 on errors.
+	 */
+	ssize_t Send(const struct iovec* iov, int count);
+
+	//! Shuts down the sending side of the socket once all queued data is sent
+	void Shutdown();
+
+	/*! Gives the stream back to the ring, which closes the socket
+	 *
+	 *  Data already queued is still sent; the handler is not called anymore.
+	 */
+	void Detach();
+
+private:
+	friend class IoRing;
+
+	//! Staged outgoing data at which Send() stops taking more
+	static const size_t maxStagedBytes = 256 * 1024;
+
+	//! Sends in a single chain at most
+	static const unsigned int maxChainLength = 16;
+
+	//! Received buffers held before receiving stops, so a stream that isn't read can't take them all
+	static const size_t maxHeldBuffers = 8;
+
+	struct Received {
+		uint16_t m_BufferId;
+		uint32_t m_Offset;
+		uint32_t m_Length;
+	};
+
+	Stream(IoRing& ring, int fd, Reactor::Handler handler, bool paced);
+
+	//! Hands the first received buffer back
+	void PopReceived();
+
+	IoRing& m_Ring;
+	int m_FD;
+	Reactor::Handler m_Handler;
+	const bool m_Paced;
+
+	std::deque<Received> m_Received;
+	bool m_Receiving;
+	//! Set while a cancellation of our receive is in flight
+	bool m_Cancelling;
+	bool m_EOF;
+	bool m_Error;
+
+	std::deque<std::vector<uint8_t>> m_SendQueue;
+	//! Bytes of the first queued segment that were already sent
+	size_t m_SendOffset;
+	size_t m_StagedBytes;
+	//! Sends submitted but not completed
+	unsigned int m_SendsInFlight;
+	//! Set once Send() took less than offered
+	bool m_SendBlocked;
+	bool m_ShutdownPending;
+
+	//! Events to pass to the handler once all completions are in
+	unsigned int m_PendingEvents;
+
+	bool m_Dirty;
+	//! Set while on the ring's list of starved streams
+	bool m_Starved;
+	bool m_Detached;
+	//! Requests of any kind the kernel hasn't completed yet
+	unsigned int m_InFlight;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_IO_RING_H */
@@ -0,0 +1,30 @@
+#include "keyexchange-factory.h"
+#include <string.h>
+#include "curve25519-keyexchange.h"
+#include "dh-keyexchange.h"
+#include "ecdh-keyexchange.h"
+
+namespace RSSH {
+
+namespace KeyExchangeFactory {
+
+KeyExchange* Create(Transport& transport, const char* kexName)
+{
+	// [RFC8731, 3] the @libssh.org name predates the standardized one
+	if (strcmp(kexName, "curve25519-sha256") == 0 || strcmp(kexName, "curve25519-sha256@libssh.org") == 0)
+		return new Curve25519KeyExchange(transport);
+
+	if (strcmp(kexName, "ecdh-sha2-nistp256") == 0)
+		return new ECDHKeyExchange(transport, kexName);
+
+	if (strcmp(kexName, "diffie-hellman-group14-sha1") == 0 ||
+	    strcmp(kexName, "diffie-hellman-group14-sha256") == 0 ||
+	    strcmp(kexName, "diffie-hellman-group16-sha512") == 0)
+		return new DHKeyExchange(transport, kexName);
+
+	return NULL;
+}
+
+} // namespace KeyExchangeFactory
+
+} // namespace RSSH
@@ -0,0 +1,18 @@
+#ifndef RSSH_KEYEXCHANGE_FACTORY_H
+#define RSSH_KEYEXCHANGE_FACTORY_H
+
+namespace RSSH {
+
+class KeyExchange;
+class Transport;
+
+namespace KeyExchangeFactory {
+
+//! Creates the key exchange for kexName - returns NULL if it isn't supported
+KeyExchange* Create(Transport& transport, const char* kexName);
+
+} // namespace KeyExchangeFactory
+
+} // namespace RSSH
+
+#endif /* RSSH_KEYEXCHANGE_FACTORY_H */
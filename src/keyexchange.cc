@@ -0,0 +1,108 @@
+#include "keyexchange.h"
+#include "callback.h"
+#include "exception.h"
+#include "keys.h"
+#include "numbers.h"
+#include "rsa-publickey.h"
+#include "trace.h"
+#include "transport.h"
+
+#include "cryptopp/base64.h"
+#include "cryptopp/sha.h"
+
+namespace RSSH {
+
+KeyExchange::KeyExchange(Transport& transport)
+	: m_Transport(transport), m_Hash(NULL), m_Keys(NULL)
+{
+}
+
+KeyExchange::~KeyExchange()
+{
+	delete m_Keys;
+	delete m_Hash;
+}
+
+void KeyExchange::SendExchange()
+{
+	GenerateKeyPair();
+
+	// Send our public key to S; SSH_MSG_KEX_ECDH_INIT shares its number with SSH_MSG_KEXDH_INIT
+	Buffer& b = m_Transport.BeginPacket(Numbers::MessageID::SSH_MSG_KEXDH_INIT);
+	PutPublicKey(b);
+	m_Transport.TransmitPacket(b);
+}
+
+void KeyExchange::OnReply(Buffer& buffer)
+{
+	std::string publickey, signature;
+	buffer >> publickey;
+	ReadPeerPublicKey(buffer);
+	buffer >> signature;
+
+	CryptoPP::Integer val_K = ComputeSharedSecret();
+
+	// [SSH-TRANS, 8] calculate 'H = hash(V_C || V_S || I_C || I_S || K_S || e || f || K)'
+	unsigned char hash_H[CryptoPP::SHA512::DIGESTSIZE];
+	const size_t hash_H_len = m_Hash->DigestSize();
+	{
+		Buffer h;
+		h << std::string(Numbers::ourGreeter); // V_C
+		h << std::string(m_Transport.GetGreeter()); // V_S
+		h.PutData((const uint8_t*)m_Transport.GetMyKexPayload(), m_Transport.GetMyKexPayloadLength()); // I_C
+		h.PutData((const uint8_t*)m_Transport.GetServerKexPayload(), m_Transport.GetServerKexPayloadLength()); // I_S
+		h << publickey; // K_S
+		PutPublicKey(h); // e
+		PutPeerPublicKey(h); // f
+		h << val_K; // k
+
+		// Compute hash_H = hash(h)
+		m_Hash->Update((const unsigned char*)h.GetReadPointer(), h.GetAvailableBytes());
+		m_Hash->Final(hash_H);
+	}
+
+	// [SSH-TRANS, 8] Verify that K_S really is the host key for S
+	{
+		/*
+		 * Even if not in the SSH specification, OpenSSH seems to
+		 * take the SHA256 hash of the public key and Base64 encode
+		 * it as an identifier. This seems sensible enough, so we
+		 * just do the same.
+		 */
+		std::string pk_hash_base64;
+		{
+			uint8_t pk_hash[CryptoPP::SHA256::DIGESTSIZE];
+			CryptoPP::SHA256 sha256;
+			sha256.Update((const uint8_t*)publickey.c_str(), publickey.size());
+			sha256.Final(pk_hash);
+
+			CryptoPP::Base64Encoder encoder;
+			encoder.Attach(new CryptoPP::StringSink(pk_hash_base64));
+			encoder.Put(pk_hash, sizeof(pk_hash));
+			encoder.MessageEnd();
+		}
+		Trace::Info("public key signature: %s", pk_hash_base64.c_str());
+
+		if (!m_Transport.GetCallback().OnVerifyHostKeySignature(pk_hash_base64))
+			throw Exception(Exception::C_HostKey_Signature_Rejected);
+	}
+
+	// [SSH-TRANS, 8] Verify the RSA signature
+	{
+		RSAPublicKey pk((const uint8_t*)publickey.c_str(), publickey.size());
+		if (!pk.Verify(m_Transport.GetNegotiatedAlgorithms().m_HostKey, (const uint8_t*)signature.c_str(), signature.size(), hash_H, hash_H_len))
+			throw Exception(Exception::C_PK_Signature_Mismatch);
+
+	}
+
+	// [SSH-TRANS, 7.2] Derive keys
+	if (m_Transport.SessionIdentifier().empty()) {
+		// First exchange hash H is the session identifier
+		m_Transport.SessionIdentifier() = std::string((const char*)hash_H, hash_H_len);
+	}
+
+	m_Keys = new Keys(Keys::maxKeySize);
+	m_Keys->Derive(*m_Hash, val_K, hash_H, m_Transport.SessionIdentifier());
+}
+
+} // namespace RSSH
@@ -0,0 +1,69 @@
+#ifndef RSSH_KEYEXCHANGE_H
+#define RSSH_KEYEXCHANGE_H
+
+#include "cryptopp/integer.h"
+
+namespace CryptoPP {
+class HashTransformation;
+} // namespace CryptoPP
+
+namespace RSSH {
+
+class Buffer;
+class Keys;
+class Transport;
+
+/*! Ephemeral key exchange, as outlined in [SSH-TRANS, 8]
+ *
+ *  All supported methods share the same message flow: the client sends its
+ *  ephemeral public key, the server replies with its host key, its own
+ *  ephemeral public key and a signature over the exchange hash. Only the
+ *  encoding of the ephemeral keys and the computation of the shared secret
+ *  differ, which is up to the derived classes.
+ */
+class KeyExchange {
+public:
+	virtual ~KeyExchange();
+
+	//! Generates our ephemeral key pair and sends it to the server
+	void SendExchange();
+
+	//! Handles the server reply; verifies the host key and derives the keys
+	void OnReply(Buffer& buffer);
+
+	Keys* GetKeys() const {
+		return m_Keys;
+	}
+
+	//! Generates a new ephemeral key pair
+	virtual void GenerateKeyPair() = 0;
+
+	//! Writes our ephemeral public key (e or Q_C) as it is sent and hashed
+	virtual void PutPublicKey(Buffer& buffer) const = 0;
+
+	//! Reads the peer's ephemeral public key (f or Q_S)
+	virtual void ReadPeerPublicKey(Buffer& buffer) = 0;
+
+	//! Writes the peer's ephemeral public key as it is hashed
+	virtual void PutPeerPublicKey(Buffer& buffer) const = 0;
+
+	//! Computes the shared secret K; throws if the peer's public key is unacceptable
+	virtual CryptoPP::Integer ComputeSharedSecret() = 0;
+
+protected:
+	KeyExchange(Transport& transport);
+
+	//! Transport layer we belong to
+	Transport& m_Transport;
+
+	//! Hash used for the exchange hash and key derivation, set by the derived class
+	CryptoPP::HashTransformation* m_Hash;
+
+private:
+	//! Derived keys
+	Keys* m_Keys;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_KEYEXCHANGE_H */
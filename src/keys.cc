@@ -1,8 +1,15 @@
 #include "keys.h"
+#include <algorithm>
 #include <string.h>
 
+#include "cryptopp/cryptlib.h"
+#include "cryptopp/integer.h"
+
 namespace {
 
+// Largest digest of any hash used by a key exchange (SHA-512)
+const size_t maxDigestSize = 64;
+
 } // unnamed namespace
 
 namespace RSSH {
@@ -41,4 +48,52 @@ Keys::~Keys()
 	delete[] m_InitialIV_C2S;
 }
 
+void Keys::DeriveKey(CryptoPP::HashTransformation& hashFunction, const CryptoPP::Integer& k, const uint8_t* hash, char p, const std::string& sessionId, uint8_t* output)
+{
+	const size_t digestSize = hashFunction.DigestSize();
+	uint8_t digest[maxDigestSize];
+
+	// key = HASH(K || H || "..." || session_id)
+	{
+		Buffer b;
+		b << k;
+		b.PutBytes(hash, digestSize);
+		b.PutBytes((const uint8_t*)&p, 1);
+		b.PutBytes((const uint8_t*)sessionId.c_str(), sessionId.size());
+
+		// Hash the value to obtain the key
+		hashFunction.Update((const unsigned char*)b.GetReadPointer(), b.GetAvailableBytes());
+		hashFunction.Final(digest);
+	}
+	size_t produced = std::min(m_KeySize, digestSize);
+	memcpy(output, digest, produced);
+
+	// [SSH-TRANS, 7.2] If we need more key material than the hash yields,
+	// extend it using K2 = HASH(K || H || K1), K3 = HASH(K || H || K1 || K2), ...
+	while (produced < m_KeySize) {
+		Buffer b;
+		b << k;
+		b.PutBytes(hash, digestSize);
+		b.PutBytes(output, produced);
+
+		hashFunction.Update((const unsigned char*)b.GetReadPointer(), b.GetAvailableBytes());
+		hashFunction.Final(digest);
+
+		size_t n = std::min(m_KeySize - produced, digestSize);
+		memcpy(output + produced, digest, n);
+		produced += n;
+	}
+	memset(digest, 0, sizeof(digest));
+}
+
+void Keys::Derive(CryptoPP::HashTransformation& hashFunction, const CryptoPP::Integer& k, const uint8_t* hash, const std::string& sessionId)
+{
+	DeriveKey(hashFunction, k, hash, 'A', sessionId, m_InitialIV_C2S);
+	DeriveKey(hashFunction, k, hash, 'B', sessionId, m_InitialIV_S2C);
+	DeriveKey(hashFunction, k, hash, 'C', sessionId, m_EncryptionKey_C2S);
+	DeriveKey(hashFunction, k, hash, 'D', sessionId, m_EncryptionKey_S2C);
+	DeriveKey(hashFunction, k, hash, 'E', sessionId, m_IntegrityKey_C2S);
+	DeriveKey(hashFunction, k, hash, 'F', sessionId, m_IntegrityKey_S2C);
+}
+
 } // namespace RSSH
@@ -0,0 +1,64 @@
+#include "mac-factory.h"
+#include <string.h>
+#include <string>
+#include "hmac-sha.h"
+#include "umac.h"
+
+namespace RSSH {
+
+namespace MACFactory {
+
+namespace {
+
+// [OPENSSH-PROTOCOL, 1.5] encrypt-then-MAC variants are named after the MAC they use
+const char etmSuffix[] = "-etm@openssh.com";
+const char openSSHSuffix[] = "@openssh.com";
+
+bool EndsWith(const char* s, const char* suffix)
+{
+	const size_t len = strlen(s), suffixLen = strlen(suffix);
+	return len > suffixLen && strcmp(s + len - suffixLen, suffix) == 0;
+}
+
+//! Name of the MAC used, i.e. "umac-64" for both umac-64@openssh.com and umac-64-etm@openssh.com
+std::string GetBaseName(const char* macName)
+{
+	size_t len = strlen(macName);
+	if (EndsWith(macName, etmSuffix))
+		len -= strlen(etmSuffix);
+	else if (EndsWith(macName, openSSHSuffix))
+		len -= strlen(openSSHSuffix);
+	return std::string(macName, len);
+}
+
+} // unnamed namespace
+
+IHMAC* Create(const char* macName, const uint8_t* key)
+{
+	const std::string name = GetBaseName(macName);
+
+	// [SSH-TRANS, 6.4] [RFC6668, 2] HMAC keys are as long as the digest
+	if (name == "hmac-sha1")
+		return new HMAC_SHA1(key, CryptoPP::SHA1::DIGESTSIZE);
+	if (name == "hmac-sha2-256")
+		return new HMAC_SHA2_256(key, CryptoPP::SHA256::DIGESTSIZE);
+	if (name == "hmac-sha2-512")
+		return new HMAC_SHA2_512(key, CryptoPP::SHA512::DIGESTSIZE);
+
+	// [OPENSSH-PROTOCOL, 1.1] UMAC with a 64 or 128-bit tag
+	if (name == "umac-64")
+		return new UMAC(key, 8);
+	if (name == "umac-128")
+		return new UMAC(key, 16);
+
+	return NULL;
+}
+
+bool IsEncryptThenMAC(const char* macName)
+{
+	return EndsWith(macName, etmSuffix);
+}
+
+} // namespace MACFactory
+
+} // namespace RSSH
@@ -0,0 +1,21 @@
+#ifndef RSSH_MAC_FACTORY_H
+#define RSSH_MAC_FACTORY_H
+
+#include <stdint.h>
+
+namespace RSSH {
+
+class IHMAC;
+
+namespace MACFactory {
+
+IHMAC* Create(const char* macName, const uint8_t* key);
+
+//! Is macName an encrypt-then-MAC variant? If so, the packet length is sent in the clear and the MAC covers the ciphertext
+bool IsEncryptThenMAC(const char* macName);
+
+} // namespace MACFactory
+
+} // namespace RSSH
+
+#endif /* RSSH_MAC_FACTORY_H */
@@ -1,15 +1,23 @@
 #include <sys/types.h>
+#include <sys/select.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
 
 #include "callback.h"
 #include "exception.h"
+#include "fleet.h"
+#include "forwarder.h"
+#include "io-ring.h"
 #include "numbers.h"
+#include "reactor.h"
 #include "trace.h"
 #include "transport.h"
 #include "types.h"
@@ -29,8 +37,8 @@ bool AskForPassword(RSSH::AuthenticationPrompt& prompt)
 		tcsetattr(fd, TCSAFLUSH, &tios);
 	}
 
-	printf("%s", prompt.m_Prompt.c_str());
-	fflush(stdout);
+	// Use the terminal, as stdout may well be redirected
+	dprintf(fd, "%s", prompt.m_Prompt.c_str());
 	char password[256]; // XXX some arbitrary limit
 	int n = read(fd, password, sizeof(password) - 1);
 	if (n >= 0) {
@@ -40,7 +48,7 @@ bool AskForPassword(RSSH::AuthenticationPrompt& prompt)
 		password[n] = '\0';
 		prompt.m_Reply = password;
 	}
-	printf("\n");
+	dprintf(fd, "\n");
 
 	if (!prompt.m_Echo) {
 		tcgetattr(fd, &tios);
@@ -77,6 +85,134 @@ bool ParseConnectionSpecifier(const char* arg, std::string& username, std::strin
 	return !username.empty() && !host.empty() && port != 0;
 }
 
+//! Parses size[K|M|G][:seconds] into rekey limits; a value of 0 means there is no such limit
+bool ParseRekeyLimit(const char* arg, RSSH::Transport::RekeySettings& settings)
+{
+	char* end;
+	unsigned long long bytes = strtoull(arg, &end, 10);
+	if (end == arg)
+		return false;
+	const char* units = "KMG";
+	const char* unit = *end != '\0' ? strchr(units, *end) : NULL;
+	if (unit != NULL) {
+		bytes <<= 10 * (unit - units + 1);
+		end++;
+	}
+	settings.m_Bytes = bytes;
+	if (*end == ':') {
+		arg = end + 1;
+		settings.m_Interval = std::chrono::seconds(strtoul(arg, &end, 10));
+		if (end == arg)
+			return false;
+	}
+	return *end == '\0';
+}
+
+//! Writes all of 'data' to 'fd', which may be blocking or not
+bool WriteAll(int fd, const uint8_t* data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				fd_set wfds;
+				FD_ZERO(&wfds);
+				FD_SET(fd, &wfds);
+				select(fd + 1, NULL, &wfds, NULL, NULL);
+				continue;
+			}
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+//! Stop reading stdin while this much of it awaits the server's window
+const size_t maxPendingInput = 1024 * 1024;
+
+//! Exit code if the remote command did not report an exit status, as OpenSSH does
+const int exitCodeUnknown = 255;
+
+void usage(const char* progname)
+{
+	fprintf(stderr, "usage: %s [-CdNu] [-c ciphers] [-D [bind_address:]port] [-K kex_algorithms] [-L [bind_address:]port:host:hostport] [-m macs] [-R [bind_address:]port:host:hostport] [-r size[:seconds]] [user@]host[:port] [-- command ...]\n", progname);
+	fprintf(stderr, "       %s [-ACdu] [-c ciphers] [-K kex_algorithms] [-m macs] -f hosts_file [-p concurrency] [-T threads] [-t timeout] [--] command ...\n", progname);
+	exit(1);
+}
+
+//! Reads [user@]host[:port] lines; blank lines and those starting with '#' are skipped
+std::vector<RSSH::Fleet::Host> ReadHostsFile(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		err(1, "unable to open '%s'", path);
+
+	std::vector<RSSH::Fleet::Host> hosts;
+	char line[512];
+	for (unsigned int lineNumber = 1; fgets(line, sizeof(line), f) != NULL; lineNumber++) {
+		char* spec = line + strspn(line, " \t");
+		spec[strcspn(spec, " \t\r\n")] = '\0';
+		if (*spec == '\0' || *spec == '#')
+			continue;
+		RSSH::Fleet::Host host;
+		if (!ParseConnectionSpecifier(spec, host.m_UserName, host.m_HostName, host.m_Port))
+			errx(1, "%s:%u: unable to parse connection specifier", path, lineNumber);
+		host.m_Name = spec;
+		hosts.push_back(host);
+	}
+	fclose(f);
+	return hosts;
+}
+
+//! Runs the command on every host in the file; returns 0 only if it succeeded everywhere
+int RunFleet(const char* hostsFile, RSSH::Fleet::Settings& settings)
+{
+	std::vector<RSSH::Fleet::Host> hosts = ReadHostsFile(hostsFile);
+
+	// Asked once up front, as the same password is used for every host
+	RSSH::AuthenticationPrompt prompt;
+	prompt.m_Prompt = "Password: ";
+	prompt.m_Echo = false;
+	if (AskForPassword(prompt))
+		settings.m_Password = prompt.m_Reply;
+
+	// A host may well disconnect while we're writing to it
+	signal(SIGPIPE, SIG_IGN);
+
+	RSSH::Fleet fleet(settings);
+	fleet.Run(hosts);
+
+	unsigned int failed = 0;
+	const std::vector<RSSH::Fleet::Result>& results = fleet.GetResults();
+	for (size_t n = 0; n < hosts.size(); n++) {
+		const RSSH::Fleet::Result& result = results[n];
+		const char* name = hosts[n].m_Name.c_str();
+		switch(result.m_Outcome) {
+			case RSSH::Fleet::Result::Outcome::Exited:
+				if (result.m_ExitStatus == 0)
+					continue;
+				fprintf(stderr, "%s: exit status %u\n", name, result.m_ExitStatus);
+				break;
+			case RSSH::Fleet::Result::Outcome::Signalled:
+				fprintf(stderr, "%s: killed by signal %s\n", name, result.m_Error.c_str());
+				break;
+			case RSSH::Fleet::Result::Outcome::Failed:
+				fprintf(stderr, "%s: %s\n", name, result.m_Error.c_str());
+				break;
+			case RSSH::Fleet::Result::Outcome::TimedOut:
+				fprintf(stderr, "%s: timed out\n", name);
+				break;
+		}
+		failed++;
+	}
+	fprintf(stderr, "%zu hosts, %zu succeeded, %u failed\n", hosts.size(), hosts.size() - failed, failed);
+	return failed == 0 ? 0 : exitCodeUnknown;
+}
+
 } // unnamed namespace
 
 int
@@ -84,13 +220,23 @@ main(int argc, char* argv[])
 {
 	class Callback : public RSSH::Callback {
 	public:
-		Callback() : m_Transport(NULL) { }
+		Callback() : m_Transport(NULL), m_Forwarder(NULL), m_OpenSession(true), m_Channel(-1), m_ChannelOpen(false), m_ShellRequested(false), m_Done(false), m_ExitStatus(exitCodeUnknown) { }
 		void SetTransport(RSSH::Transport& transport) {
 			m_Transport = &transport;
 		}
 
+		//! Forwarded connections are handled by 'forwarder' once authenticated
+		void SetForwarder(RSSH::Forwarder& forwarder) {
+			m_Forwarder = &forwarder;
+		}
+
+		//! Only forward connections, without a shell or command
+		void SetNoSession() {
+			m_OpenSession = false;
+		}
+
 		void OnGreeter(const std::string& greeter) override {
-			printf("Got server greeter [%s]\n", greeter.c_str());
+			fprintf(stderr, "Got server greeter [%s]\n", greeter.c_str());
 		}
 
 		void OnTransportEstablished() override {
@@ -110,21 +256,57 @@ main(int argc, char* argv[])
 		}
 
 		bool OnVerifyHostKeySignature(const std::string& signature) override {
-			printf("Accepting server hostkey signature: %s\n", signature.c_str());
+			fprintf(stderr, "Accepting server hostkey signature: %s\n", signature.c_str());
 			return true;
 		}
 
 		void OnAuthenticationFailure(bool partial_success, const RSSH::Types::NameList& next_auths) override {
-			printf("authentication failed, partial success = %s, next %s\n", partial_success ? "yes" : "no", next_auths.ToString().c_str());
+			fprintf(stderr, "authentication failed, partial success = %s, next %s\n", partial_success ? "yes" : "no", next_auths.ToString().c_str());
 		}
 
 		void OnAuthenticationSuccess() override {
-			m_Transport->OpenChannel(0, RSSH::Numbers::ConnectionProtocolAssignedNames::ChannelTypes::Session);
+			if (m_Forwarder != NULL)
+				m_Forwarder->Start();
+			if (m_OpenSession)
+				m_Channel = m_Transport->OpenChannel(RSSH::Numbers::ConnectionProtocolAssignedNames::ChannelTypes::Session);
+		}
+
+		bool IsForwarded(int channelNumber) const {
+			return m_Forwarder != NULL && m_Forwarder->OwnsChannel(channelNumber);
+		}
+
+		bool OnForwardedTcpIp(int channelNumber, const std::string& connectedAddress, uint32_t connectedPort, const std::string& originatorAddress, uint32_t originatorPort) override {
+			return m_Forwarder != NULL && m_Forwarder->OnForwardedTcpIp(channelNumber, connectedAddress, connectedPort, originatorAddress, originatorPort);
+		}
+
+		void OnTcpIpForwardSuccess(const std::string& address, uint32_t port, uint32_t boundPort) override {
+			if (port == 0)
+				fprintf(stderr, "Allocated port %u for remote forward\n", boundPort);
+			if (m_Forwarder != NULL)
+				m_Forwarder->OnTcpIpForwardSuccess(address, port, boundPort);
+		}
+
+		void OnTcpIpForwardFailure(const std::string& address, uint32_t port) override {
+			fprintf(stderr, "remote port forwarding failed for listen port %u\n", port);
+			if (m_Forwarder != NULL)
+				m_Forwarder->OnTcpIpForwardFailure(address, port);
 		}
 
 		void OnChannelOpened(int channelNumber) override {
-			if (channelNumber == 0)
-				m_Transport->RequestPty(0, "xterm");
+			if (IsForwarded(channelNumber)) {
+				m_Forwarder->OnChannelOpened(channelNumber);
+				return;
+			}
+			if (channelNumber != m_Channel)
+				return;
+			m_ChannelOpen = true;
+			if (!m_Command.empty()) {
+				// Non-interactive: no PTY, so stdout and stderr stay apart
+				m_Transport->RequestExec(m_Channel, m_Command);
+				m_ShellRequested = true;
+			} else {
+				m_Transport->RequestPty(m_Channel, "xterm");
+			}
 		}
 
 		void OnServiceAccepted(const std::string& serviceName) override {
@@ -134,8 +316,9 @@ main(int argc, char* argv[])
 		}
 
 		void OnChannelRequestSuccess(int channelNumber) override {
-			if (channelNumber == 0) /* PTY */ {
-				m_Transport->RequestChannel(0, RSSH::Numbers::ConnectionProtocolAssignedNames::RequestType::Shell);
+			if (channelNumber == m_Channel && !m_ShellRequested) /* PTY */ {
+				m_Transport->RequestChannel(m_Channel, RSSH::Numbers::ConnectionProtocolAssignedNames::RequestType::Shell);
+				m_ShellRequested = true;
 			}
 		}
 
@@ -143,64 +326,276 @@ main(int argc, char* argv[])
 			fprintf(stderr, "unable to open channel %d\n", channelNumber);
 		}
 
-		void OnChannelData(int channelNumber, const std::string& data) override {
-			write(STDOUT_FILENO, data.c_str(), data.length());
-			m_Transport->AdjustChannelWindow(channelNumber, data.size()); // XXX should we immediately do this?
+		void OnChannelOpenFailure(int channelNumber, uint32_t reasonCode, const std::string& description) override {
+			if (IsForwarded(channelNumber))
+				m_Forwarder->OnChannelOpenFailure(channelNumber, reasonCode, description);
+		}
+
+		void OnChannelWritable(int channelNumber) override {
+			if (IsForwarded(channelNumber))
+				m_Forwarder->OnChannelWritable(channelNumber);
+		}
+
+		void OnChannelEOF(int channelNumber) override {
+			if (IsForwarded(channelNumber))
+				m_Forwarder->OnChannelEOF(channelNumber);
+		}
+
+		void OnChannelData(int channelNumber, const uint8_t* data, size_t len) override {
+			if (IsForwarded(channelNumber)) {
+				m_Forwarder->OnChannelData(channelNumber, data, len);
+				return;
+			}
+			WriteAll(STDOUT_FILENO, data, len);
+			m_Transport->ChannelDataConsumed(channelNumber, len);
+		}
+
+		void OnChannelExtendedData(int channelNumber, uint32_t dataType, const uint8_t* data, size_t len) override {
+			if (dataType == static_cast<uint32_t>(RSSH::Numbers::ExtendedChannelDataType::SSH_EXTENDED_DATA_STDERR))
+				WriteAll(STDERR_FILENO, data, len);
+			m_Transport->ChannelDataConsumed(channelNumber, len);
+		}
+
+		void OnChannelExitStatus(int channelNumber, uint32_t exitStatus) override {
+			if (channelNumber == m_Channel)
+				m_ExitStatus = exitStatus;
+		}
+
+		void OnChannelExitSignal(int channelNumber, const std::string& signalName, bool coreDumped, const std::string& errorMessage) override {
+			if (channelNumber == m_Channel)
+				fprintf(stderr, "remote command killed by signal %s%s\n", signalName.c_str(), coreDumped ? " (core dumped)" : "");
+		}
+
+		void OnChannelClosed(int channelNumber) override {
+			if (IsForwarded(channelNumber))
+				m_Forwarder->OnChannelClosed(channelNumber);
+			if (channelNumber == m_Channel) {
+				m_ChannelOpen = false;
+				m_Done = true;
+			}
 		}
 
 		void SetUsername(const std::string& username) {
 			m_Username = username;
 		}
 
+		//! Command to execute instead of starting an interactive shell
+		void SetCommand(const std::string& command) {
+			m_Command = command;
+		}
+
+		//! Our session channel, or -1 if not yet opened
+		int GetChannel() const { return m_Channel; }
+
+		//! Is our session channel open, i.e. can it take input?
+		bool IsChannelOpen() const { return m_ChannelOpen; }
+
+		bool IsDone() const { return m_Done; }
+
+		//! The remote command's exit status, if it reported one
+		int GetExitStatus() const { return m_ExitStatus; }
+
 	private:
 		RSSH::Transport* m_Transport;
+		RSSH::Forwarder* m_Forwarder;
+		bool m_OpenSession;
 		std::string m_Username;
+		std::string m_Command;
+		int m_Channel;
+		bool m_ChannelOpen;
+		bool m_ShellRequested;
+		bool m_Done;
+		int m_ExitStatus;
 	} callback;
 
-	if (argc != 2 && argc != 3)
-		errx(1, "usage: %s [-d] [user@]host[:port]", argv[0]);
-
-    if (argc == 3) {
-        if (std::string(argv[1]) != "-d")
-		    errx(1, "usage: %s [-d] [user@]host[:port]", argv[0]);
-        RSSH::Trace::EnableAll();
-    }
+	// Declared first, as the transport's socket must be gone before they are
+	std::unique_ptr<RSSH::Reactor> reactor;
+	std::unique_ptr<RSSH::IoRing> ring;
+	bool useRing = false;
 
+	RSSH::Transport t(callback);
+	// Declared after the transport, as its tunnels use the transport
+	std::unique_ptr<RSSH::Forwarder> forwarder;
+	std::vector<RSSH::Forwarder::Spec> localForwards, remoteForwards, dynamicForwards;
+	bool noSession = false;
+	RSSH::Preferences& prefs = t.GetPreferences();
+	const char* hostsFile = NULL;
+	RSSH::Fleet::Settings fleetSettings;
+	int opt;
+	// Stop at the host, as anything after it belongs to the command
+	while ((opt = getopt(argc, argv, "+ACc:D:df:K:L:m:Np:R:r:T:t:u")) != -1) {
+		switch(opt) {
+			case 'A':
+				fleetSettings.m_Aggregate = true;
+				break;
+			case 'f':
+				hostsFile = optarg;
+				break;
+			case 'p':
+				fleetSettings.m_Concurrency = atoi(optarg);
+				if (fleetSettings.m_Concurrency == 0)
+					errx(1, "concurrency must be at least 1");
+				break;
+			case 'T':
+				fleetSettings.m_Threads = atoi(optarg);
+				if (fleetSettings.m_Threads == 0)
+					errx(1, "at least one thread is needed");
+				break;
+			case 't':
+				fleetSettings.m_Timeout = std::chrono::seconds(atoi(optarg));
+				break;
+			case 'u':
+				useRing = true;
+				fleetSettings.m_UseRing = true;
+				break;
+			case 'C':
+				prefs.SetCompression("zlib@openssh.com,none");
+				break;
+			case 'c':
+				if (!prefs.SetCiphers(optarg))
+					errx(1, "unsupported cipher in '%s', supported are: %s", optarg, RSSH::Preferences().GetCiphers().ToString().c_str());
+				break;
+			case 'd':
+				RSSH::Trace::EnableAll();
+				break;
+			case 'K':
+				if (!prefs.SetKexAlgorithms(optarg))
+					errx(1, "unsupported key exchange in '%s', supported are: %s", optarg, RSSH::Preferences().GetKexAlgorithms().ToString().c_str());
+				break;
+			case 'L': {
+				RSSH::Forwarder::Spec spec;
+				if (!RSSH::Forwarder::ParseSpec(optarg, spec))
+					errx(1, "bad local forwarding specification '%s'", optarg);
+				localForwards.push_back(spec);
+				break;
+			}
+			case 'D': {
+				RSSH::Forwarder::Spec spec;
+				if (!RSSH::Forwarder::ParseDynamicSpec(optarg, spec))
+					errx(1, "bad dynamic forwarding specification '%s'", optarg);
+				dynamicForwards.push_back(spec);
+				break;
+			}
+			case 'R': {
+				RSSH::Forwarder::Spec spec;
+				if (!RSSH::Forwarder::ParseSpec(optarg, spec, true))
+					errx(1, "bad remote forwarding specification '%s'", optarg);
+				remoteForwards.push_back(spec);
+				break;
+			}
+			case 'N':
+				noSession = true;
+				break;
+			case 'r':
+				if (!ParseRekeyLimit(optarg, t.GetRekeySettings()))
+					errx(1, "bad rekey limit '%s'", optarg);
+				break;
+			case 'm':
+				if (!prefs.SetMACs(optarg))
+					errx(1, "unsupported MAC in '%s', supported are: %s", optarg, RSSH::Preferences().GetMACs().ToString().c_str());
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	// In fleet mode, the hosts come from a file; all arguments are the command
+	int arg = optind;
 	std::string username, host;
 	int port;
-    {
-        int connect_arg = argc == 2 ? 1 : 2;
-        if (!ParseConnectionSpecifier(argv[connect_arg], username, host, port))
-            errx(1, "unable to parse connection specifier");
-    }
+	if (hostsFile == NULL) {
+		if (arg >= argc)
+			usage(argv[0]);
+		if (!ParseConnectionSpecifier(argv[arg], username, host, port))
+			errx(1, "unable to parse connection specifier");
+		arg++;
+	}
+
+	// [SSH-CONNECT, 6.5] the command is a single string, interpreted by the remote shell
+	std::string command;
+	if (arg < argc && strcmp(argv[arg], "--") == 0)
+		arg++;
+	for (; arg < argc; arg++) {
+		if (!command.empty())
+			command += ' ';
+		command += argv[arg];
+	}
+
+	if (hostsFile != NULL) {
+		if (command.empty())
+			usage(argv[0]);
+		fleetSettings.m_Command = command;
+		fleetSettings.m_Preferences = prefs;
+		return RunFleet(hostsFile, fleetSettings);
+	}
 
-	RSSH::Transport t(callback);
 	callback.SetTransport(t);
 	callback.SetUsername(username);
+	callback.SetCommand(command);
+	if (noSession)
+		callback.SetNoSession();
+
+	// Readiness is edge-triggered, so stdin must be non-blocking; it's restored on exit
+	const int stdinFlags = fcntl(STDIN_FILENO, F_GETFL);
+	bool stdinOpen = !noSession && stdinFlags >= 0 && fcntl(STDIN_FILENO, F_SETFL, stdinFlags | O_NONBLOCK) == 0;
+
+	//! Set once stdin is readable, until a read() tells us otherwise
+	bool stdinReadable = false;
+	int result = exitCodeUnknown;
 	try {
+		reactor.reset(new RSSH::Reactor);
+		if (useRing) {
+			ring = RSSH::IoRing::Create(*reactor);
+			if (!ring)
+				fprintf(stderr, "io_uring unavailable, using epoll\n");
+		}
+		if (!localForwards.empty() || !remoteForwards.empty() || !dynamicForwards.empty()) {
+			forwarder.reset(new RSSH::Forwarder(t, *reactor, ring.get()));
+			for (const RSSH::Forwarder::Spec& spec : localForwards) {
+				if (!forwarder->AddLocal(spec))
+					errx(1, "unable to listen on port %d for forwarding", spec.m_ListenPort);
+			}
+			for (const RSSH::Forwarder::Spec& spec : dynamicForwards) {
+				if (!forwarder->AddDynamic(spec))
+					errx(1, "unable to listen on port %d for forwarding", spec.m_ListenPort);
+			}
+			for (const RSSH::Forwarder::Spec& spec : remoteForwards) {
+				if (!forwarder->AddRemote(spec))
+					errx(1, "unable to resolve '%s' for forwarding", spec.m_Host.c_str());
+			}
+			callback.SetForwarder(*forwarder);
+		}
 		t.Connect(host.c_str(), port);
-		int socketFd = t.GetSocket().GetFD();
-		for(;;) {
-			fd_set fds;
-			FD_ZERO(&fds);
-			FD_SET(STDIN_FILENO, &fds);
-			FD_SET(socketFd, &fds);
-
-			int n = select(socketFd + 1, &fds, NULL, NULL, NULL);
-			if (n < 0)
-				break;
-			if (FD_ISSET(socketFd, &fds))
-				t.Process();
-			if (FD_ISSET(STDIN_FILENO, &fds)) {
-				char buf[1024];
-				int n = read(STDIN_FILENO, buf, sizeof(buf));
-				if (n > 0)
-					t.TransmitChannelData(0, std::string(buf, n));
+		t.Register(*reactor, ring.get());
+		if (stdinOpen)
+			reactor->Add(STDIN_FILENO, [&stdinReadable](unsigned int events) { stdinReadable = true; });
+
+		while (!callback.IsDone()) {
+			reactor->RunOnce();
+
+			// Read until stdin runs dry or the server's window fills up; we continue once it opens
+			const int channel = callback.GetChannel();
+			while (stdinOpen && stdinReadable && callback.IsChannelOpen() && t.GetChannelPendingBytes(channel) < maxPendingInput) {
+				uint8_t buf[RSSH::Transport::maxChannelDataLength];
+				ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+				if (n > 0) {
+					t.TransmitChannelData(channel, buf, n);
+				} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					stdinReadable = false;
+				} else if (n == 0 || errno != EINTR) {
+					// [SSH-CONNECT, 5.3] let the remote side know there's no more input
+					t.SendChannelEOF(channel);
+					reactor->Remove(STDIN_FILENO);
+					stdinOpen = false;
+				}
 			}
+			t.Flush();
 		}
+		result = callback.GetExitStatus();
 	} catch (RSSH::Exception& e) {
 		fprintf(stderr, "exception: %s\n", e.what());
 	}
 
-	return 0;
+	if (stdinFlags >= 0)
+		fcntl(STDIN_FILENO, F_SETFL, stdinFlags);
+	return result;
 }
@@ -0,0 +1,96 @@
+#include "negotiation.h"
+
+#include "cryptopp/cpu.h"
+
+namespace RSSH {
+
+namespace {
+
+/*
+ * With AES-NI, AES-GCM is the fastest cipher by far; without it, ChaCha20
+ * wins. CTR mode is preferred over CBC as decryption isn't serial.
+ */
+const char* ciphersAESNI = "aes128-gcm@openssh.com,aes256-gcm@openssh.com,chacha20-poly1305@openssh.com,aes128-ctr,aes256-ctr,aes128-cbc";
+const char* ciphersNoAESNI = "chacha20-poly1305@openssh.com,aes128-gcm@openssh.com,aes256-gcm@openssh.com,aes128-ctr,aes256-ctr,aes128-cbc";
+
+/*
+ * Encrypt-then-MAC is preferred, as it rejects forged packets without
+ * decrypting them; so is UMAC, which costs a fraction of the CPU time of
+ * any HMAC.
+ */
+const char* macs = "umac-64-etm@openssh.com,umac-128-etm@openssh.com,hmac-sha2-256-etm@openssh.com,hmac-sha2-512-etm@openssh.com,"
+                   "hmac-sha1-etm@openssh.com,umac-64@openssh.com,umac-128@openssh.com,hmac-sha2-256,hmac-sha2-512,hmac-sha1";
+
+bool HasAESNI()
+{
+#if CRYPTOPP_BOOL_X86 || CRYPTOPP_BOOL_X32 || CRYPTOPP_BOOL_X64
+	return CryptoPP::HasAESNI();
+#else
+	return false;
+#endif
+}
+
+//! Replaces 'list' by 'names' if every name is present in 'supported'
+bool SetRestricted(Types::NameList& list, const std::string& names, const Types::NameList& supported)
+{
+	Types::NameList nl(names);
+	for(auto& name: nl.GetNames()) {
+		if (!supported.Contains(name))
+			return false;
+	}
+	list = nl;
+	return true;
+}
+
+} // unnamed namespace
+
+Preferences::Preferences()
+	: m_KexAlgorithms("curve25519-sha256,curve25519-sha256@libssh.org,ecdh-sha2-nistp256,diffie-hellman-group14-sha256,diffie-hellman-group16-sha512,diffie-hellman-group14-sha1"),
+	  m_HostKeyAlgorithms("rsa-sha2-512,rsa-sha2-256,ssh-rsa"),
+	  m_Ciphers(HasAESNI() ? ciphersAESNI : ciphersNoAESNI),
+	  m_MACs(macs),
+	  m_Compression("none,zlib@openssh.com")
+{
+}
+
+bool Preferences::SetKexAlgorithms(const std::string& names)
+{
+	return SetRestricted(m_KexAlgorithms, names, Preferences().m_KexAlgorithms);
+}
+
+bool Preferences::SetHostKeyAlgorithms(const std::string& names)
+{
+	return SetRestricted(m_HostKeyAlgorithms, names, Preferences().m_HostKeyAlgorithms);
+}
+
+bool Preferences::SetCiphers(const std::string& names)
+{
+	return SetRestricted(m_Ciphers, names, Preferences().m_Ciphers);
+}
+
+bool Preferences::SetMACs(const std::string& names)
+{
+	return SetRestricted(m_MACs, names, Preferences().m_MACs);
+}
+
+bool Preferences::SetCompression(const std::string& names)
+{
+	return SetRestricted(m_Compression, names, Preferences().m_Compression);
+}
+
+namespace Negotiation {
+
+bool Choose(const Types::NameList& client, const Types::NameList& server, std::string& result)
+{
+	for(auto& name: client.GetNames()) {
+		if (server.Contains(name)) {
+			result = name;
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace Negotiation
+
+} // namespace RSSH
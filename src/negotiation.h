@@ -0,0 +1,65 @@
+#ifndef RSSH_NEGOTIATION_H
+#define RSSH_NEGOTIATION_H
+
+#include <string>
+#include "types.h"
+
+namespace RSSH {
+
+/*! Algorithms we are willing to use, most preferred first
+ *
+ *  These are sent in our KEXINIT and drive the negotiation of
+ *  [SSH-TRANS, 7.1]. The defaults contain every algorithm we support,
+ *  ordered so that the fastest ones are picked when the server allows; the
+ *  lists may be reordered and restricted, but never extended.
+ */
+class Preferences {
+public:
+	Preferences();
+
+	//! Replace the list by a comma-separated one; returns false if it contains unsupported names
+	bool SetKexAlgorithms(const std::string& names);
+	bool SetHostKeyAlgorithms(const std::string& names);
+	bool SetCiphers(const std::string& names);
+	bool SetMACs(const std::string& names);
+	bool SetCompression(const std::string& names);
+
+	const Types::NameList& GetKexAlgorithms() const { return m_KexAlgorithms; }
+	const Types::NameList& GetHostKeyAlgorithms() const { return m_HostKeyAlgorithms; }
+	const Types::NameList& GetCiphers() const { return m_Ciphers; }
+	const Types::NameList& GetMACs() const { return m_MACs; }
+	const Types::NameList& GetCompression() const { return m_Compression; }
+
+private:
+	Types::NameList m_KexAlgorithms;
+	Types::NameList m_HostKeyAlgorithms;
+	Types::NameList m_Ciphers;
+	Types::NameList m_MACs;
+	Types::NameList m_Compression;
+};
+
+//! Outcome of the negotiation; the MACs are empty if the cipher is an AEAD cipher
+struct NegotiatedAlgorithms {
+	std::string m_Kex;
+	std::string m_HostKey;
+	std::string m_Cipher_C2S;
+	std::string m_Cipher_S2C;
+	std::string m_MAC_C2S;
+	std::string m_MAC_S2C;
+	std::string m_Compression_C2S;
+	std::string m_Compression_S2C;
+};
+
+namespace Negotiation {
+
+/*! [SSH-TRANS, 7.1] Picks the first algorithm on the client's list that is also on the server's
+ *
+ *  Returns false if there is no such algorithm.
+ */
+bool Choose(const Types::NameList& client, const Types::NameList& server, std::string& result);
+
+} // namespace Negotiation
+
+} // namespace RSSH
+
+#endif /* RSSH_NEGOTIATION_H */
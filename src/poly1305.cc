@@ -0,0 +1,166 @@
+#include "poly1305.h"
+#include <string.h>
+
+#include "cryptopp/misc.h"
+
+namespace RSSH {
+
+namespace Poly1305 {
+
+namespace {
+
+const uint32_t mask26 = 0x3ffffff;
+
+inline uint32_t Load32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+inline void Store32(uint8_t* p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+/*
+ * The accumulator h and the key r are kept as five 26-bit limbs so that
+ * all products fit in 64 bits; s = r * 5 is used to fold the reduction
+ * modulo 2^130 - 5 into the multiplication.
+ */
+struct State {
+	uint32_t r[5];
+	uint32_t s[5];
+	uint32_t h[5];
+	uint32_t pad[4];
+};
+
+void ProcessBlocks(State& st, const uint8_t* m, size_t len, uint32_t hibit)
+{
+	const uint32_t r0 = st.r[0], r1 = st.r[1], r2 = st.r[2], r3 = st.r[3], r4 = st.r[4];
+	const uint32_t s1 = st.s[1], s2 = st.s[2], s3 = st.s[3], s4 = st.s[4];
+	uint32_t h0 = st.h[0], h1 = st.h[1], h2 = st.h[2], h3 = st.h[3], h4 = st.h[4];
+
+	for (/* nothing */; len >= 16; m += 16, len -= 16) {
+		// h += m
+		h0 += (Load32(&m[0])) & mask26;
+		h1 += (Load32(&m[3]) >> 2) & mask26;
+		h2 += (Load32(&m[6]) >> 4) & mask26;
+		h3 += (Load32(&m[9]) >> 6) & mask26;
+		h4 += (Load32(&m[12]) >> 8) | hibit;
+
+		// h *= r (mod 2^130 - 5)
+		uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+		uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+		uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+		uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+		uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+		// Partial carry propagation
+		uint32_t c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & mask26;
+		d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & mask26;
+		d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & mask26;
+		d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & mask26;
+		d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & mask26;
+		h0 += c * 5; c = h0 >> 26; h0 &= mask26;
+		h1 += c;
+	}
+
+	st.h[0] = h0; st.h[1] = h1; st.h[2] = h2; st.h[3] = h3; st.h[4] = h4;
+}
+
+void Finish(State& st, uint8_t* tag)
+{
+	uint32_t h0 = st.h[0], h1 = st.h[1], h2 = st.h[2], h3 = st.h[3], h4 = st.h[4];
+
+	// Fully carry h
+	uint32_t c = h1 >> 26; h1 &= mask26;
+	h2 += c; c = h2 >> 26; h2 &= mask26;
+	h3 += c; c = h3 >> 26; h3 &= mask26;
+	h4 += c; c = h4 >> 26; h4 &= mask26;
+	h0 += c * 5; c = h0 >> 26; h0 &= mask26;
+	h1 += c;
+
+	// Compute g = h + -p = h - (2^130 - 5)
+	uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= mask26;
+	uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= mask26;
+	uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= mask26;
+	uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= mask26;
+	uint32_t g4 = h4 + c - (1UL << 26);
+
+	// Select h if h < p, or g if h >= p - without branching
+	uint32_t mask = (g4 >> 31) - 1;
+	g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+	mask = ~mask;
+	h0 = (h0 & mask) | g0;
+	h1 = (h1 & mask) | g1;
+	h2 = (h2 & mask) | g2;
+	h3 = (h3 & mask) | g3;
+	h4 = (h4 & mask) | g4;
+
+	// h = h % 2^128
+	h0 = (h0 | (h1 << 26)) & 0xffffffff;
+	h1 = ((h1 >> 6) | (h2 << 20)) & 0xffffffff;
+	h2 = ((h2 >> 12) | (h3 << 14)) & 0xffffffff;
+	h3 = ((h3 >> 18) | (h4 << 8)) & 0xffffffff;
+
+	// tag = (h + pad) % 2^128
+	uint64_t f = (uint64_t)h0 + st.pad[0]; h0 = (uint32_t)f;
+	f = (uint64_t)h1 + st.pad[1] + (f >> 32); h1 = (uint32_t)f;
+	f = (uint64_t)h2 + st.pad[2] + (f >> 32); h2 = (uint32_t)f;
+	f = (uint64_t)h3 + st.pad[3] + (f >> 32); h3 = (uint32_t)f;
+
+	Store32(&tag[0], h0);
+	Store32(&tag[4], h1);
+	Store32(&tag[8], h2);
+	Store32(&tag[12], h3);
+}
+
+} // unnamed namespace
+
+void Calculate(const uint8_t* key, const uint8_t* buffer, size_t len, uint8_t* tag)
+{
+	State st;
+
+	// r &= 0xffffffc0ffffffc0ffffffc0fffffff
+	st.r[0] = (Load32(&key[0])) & 0x3ffffff;
+	st.r[1] = (Load32(&key[3]) >> 2) & 0x3ffff03;
+	st.r[2] = (Load32(&key[6]) >> 4) & 0x3ffc0ff;
+	st.r[3] = (Load32(&key[9]) >> 6) & 0x3f03fff;
+	st.r[4] = (Load32(&key[12]) >> 8) & 0x00fffff;
+	for (int n = 0; n < 5; n++) {
+		st.s[n] = st.r[n] * 5;
+		st.h[n] = 0;
+	}
+	for (int n = 0; n < 4; n++)
+		st.pad[n] = Load32(&key[16 + n * 4]);
+
+	// Full blocks get a 2^128 bit added
+	size_t full = len & ~static_cast<size_t>(15);
+	ProcessBlocks(st, buffer, full, 1 << 24);
+
+	// The final partial block is padded with a single 1 byte and zeroes instead
+	if (full != len) {
+		uint8_t block[16];
+		size_t left = len - full;
+		memcpy(block, &buffer[full], left);
+		block[left] = 1;
+		memset(&block[left + 1], 0, sizeof(block) - left - 1);
+		ProcessBlocks(st, block, sizeof(block), 0);
+	}
+
+	Finish(st, tag);
+	memset(&st, 0, sizeof(st));
+}
+
+bool Verify(const uint8_t* key, const uint8_t* buffer, size_t len, const uint8_t* tag)
+{
+	uint8_t calculated[tagLength];
+	Calculate(key, buffer, len, calculated);
+	return CryptoPP::VerifyBufsEqual(calculated, tag, tagLength);
+}
+
+} // namespace Poly1305
+
+} // namespace RSSH
@@ -0,0 +1,25 @@
+#ifndef RSSH_POLY1305_H
+#define RSSH_POLY1305_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace RSSH {
+
+//! Poly1305 one-time authenticator, as used in [CHACHA20-POLY1305]
+namespace Poly1305 {
+
+static const size_t keyLength = 32;
+static const size_t tagLength = 16;
+
+//! Calculates the tag of 'len' bytes of 'buffer' using a 32-byte one-time key
+void Calculate(const uint8_t* key, const uint8_t* buffer, size_t len, uint8_t* tag);
+
+//! Verifies the tag of 'len' bytes of 'buffer' in constant time
+bool Verify(const uint8_t* key, const uint8_t* buffer, size_t len, const uint8_t* tag);
+
+} // namespace Poly1305
+
+} // namespace RSSH
+
+#endif /* RSSH_POLY1305_H */
@@ -3,7 +3,8 @@
 namespace RSSH {
 
 namespace {
-Random s_Random;
+// CryptoPP::AutoSeededRandomPool is not thread-safe, so each thread gets its own
+thread_local Random s_Random;
 } // unnamed namespace
 
 Random& Random::GetInstance()
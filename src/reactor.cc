@@ -0,0 +1,140 @@
+#include "reactor.h"
+#include <sys/epoll.h>
+#include <errno.h>
+#include <unistd.h>
+#include "exception.h"
+
+namespace RSSH {
+
+namespace {
+
+//! Events fetched per epoll_wait() call
+const int maxEvents = 64;
+
+//! epoll_event data identifying a registration
+uint64_t MakeKey(int fd, uint32_t generation)
+{
+	return static_cast<uint64_t>(generation) << 32 | static_cast<uint32_t>(fd);
+}
+
+} // unnamed namespace
+
+Reactor::Reactor()
+	: m_NextGeneration(0), m_NextTimerId(0), m_WaitCount(0)
+{
+	m_EpollFD = epoll_create1(EPOLL_CLOEXEC);
+	if (m_EpollFD < 0)
+		throw Exception(Exception::C_Reactor_Error);
+}
+
+Reactor::~Reactor()
+{
+	close(m_EpollFD);
+}
+
+void Reactor::Add(int fd, Handler handler)
+{
+	std::shared_ptr<Descriptor> descriptor(new Descriptor);
+	descriptor->m_Handler = std::move(handler);
+	descriptor->m_Generation = m_NextGeneration++;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.u64 = MakeKey(fd, descriptor->m_Generation);
+	if (epoll_ctl(m_EpollFD, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		if (errno != EPERM)
+			throw Exception(Exception::C_Reactor_Error);
+		m_AlwaysReady.push_back(ev.data.u64);
+	}
+	m_Descriptors[fd] = descriptor;
+}
+
+void Reactor::Remove(int fd)
+{
+	// Fails for descriptors that are always ready, which is fine
+	epoll_ctl(m_EpollFD, EPOLL_CTL_DEL, fd, NULL);
+	m_Descriptors.erase(fd);
+}
+
+Reactor::TimerId Reactor::AddTimer(Clock::time_point when, std::function<void()> handler)
+{
+	const TimerId id = m_NextTimerId++;
+	m_TimerIndex[id] = m_Timers.insert(std::make_pair(when, Timer{ id, std::move(handler) }));
+	return id;
+}
+
+void Reactor::CancelTimer(TimerId id)
+{
+	auto it = m_TimerIndex.find(id);
+	if (it == m_TimerIndex.end())
+		return;
+	m_Timers.erase(it->second);
+	m_TimerIndex.erase(it);
+}
+
+void Reactor::Dispatch(uint64_t key, unsigned int events)
+{
+	auto it = m_Descriptors.find(static_cast<int>(key & 0xffffffff));
+	if (it == m_Descriptors.end() || it->second->m_Generation != key >> 32)
+		return;
+
+	// Keep the handler alive should it remove its own descriptor
+	std::shared_ptr<Descriptor> descriptor = it->second;
+	descriptor->m_Handler(events);
+}
+
+void Reactor::RunTimers()
+{
+	const Clock::time_point now = Clock::now();
+	while (!m_Timers.empty() && m_Timers.begin()->first <= now) {
+		// Take the timer out first; the handler may add or cancel timers
+		Timer timer = std::move(m_Timers.begin()->second);
+		m_Timers.erase(m_Timers.begin());
+		m_TimerIndex.erase(timer.m_Id);
+		timer.m_Handler();
+	}
+}
+
+void Reactor::RunOnce(int timeout)
+{
+	if (m_PrepareHandler)
+		m_PrepareHandler();
+	if (!m_AlwaysReady.empty())
+		timeout = 0;
+	if (!m_Timers.empty()) {
+		// Round up, so we don't wake up just before the timer is due
+		auto untilTimer = std::chrono::duration_cast<std::chrono::milliseconds>(m_Timers.begin()->first - Clock::now()).count() + 1;
+		if (untilTimer < 0)
+			untilTimer = 0;
+		if (timeout < 0 || untilTimer < timeout)
+			timeout = static_cast<int>(untilTimer);
+	}
+
+	struct epoll_event events[maxEvents];
+	int n = epoll_wait(m_EpollFD, events, maxEvents, timeout);
+	m_WaitCount++;
+	if (n < 0) {
+		if (errno != EINTR)
+			throw Exception(Exception::C_Reactor_Error);
+		n = 0;
+	}
+	for (int i = 0; i < n; i++) {
+		unsigned int ev = 0;
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+			ev |= Readable;
+		if (events[i].events & EPOLLOUT)
+			ev |= Writable;
+		if (events[i].events & (EPOLLERR | EPOLLHUP))
+			ev |= Readable | Writable;
+		Dispatch(events[i].data.u64, ev);
+	}
+
+	std::vector<uint64_t> alwaysReady;
+	alwaysReady.swap(m_AlwaysReady);
+	for (uint64_t key : alwaysReady)
+		Dispatch(key, Readable | Writable);
+
+	RunTimers();
+}
+
+} // namespace RSSH
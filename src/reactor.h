@@ -0,0 +1,115 @@
+#ifndef RSSH_REACTOR_H
+#define RSSH_REACTOR_H
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace RSSH {
+
+/*! Event loop dispatching descriptor readiness and timers to handlers
+ *
+ *  Descriptors are watched using epoll in edge-triggered mode, so the cost
+ *  of a wakeup depends on the number of ready descriptors rather than the
+ *  number registered. A handler is only called again once the descriptor
+ *  turned unready, i.e. read() or write() returned EAGAIN; handlers must
+ *  therefore keep going until that happens, or remember that there's more
+ *  to do. Registered descriptors must be non-blocking.
+ *
+ *  A reactor is meant to be used by a single thread.
+ */
+class Reactor {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	//! Bits passed to handlers; errors and hangups are reported as both
+	enum Event : unsigned int {
+		Readable = 1,
+		Writable = 2,
+	};
+
+	typedef std::function<void(unsigned int events)> Handler;
+
+	typedef uint64_t TimerId;
+
+	Reactor();
+	~Reactor();
+
+	Reactor(const Reactor&) = delete;
+	Reactor& operator=(const Reactor&) = delete;
+
+	/*! Watches a descriptor for both reading and writing
+	 *
+	 *  Descriptors that epoll can't watch, such as regular files, are
+	 *  always ready: their handler is called once, with both events.
+	 */
+	void Add(int fd, Handler handler);
+
+	//! Stops watching a descriptor; must be called before closing it
+	void Remove(int fd);
+
+	//! Calls 'handler' once 'when' has passed; returns an identifier for CancelTimer()
+	TimerId AddTimer(Clock::time_point when, std::function<void()> handler);
+
+	//! Cancels a timer that has not yet fired; ignored otherwise
+	void CancelTimer(TimerId id);
+
+	//! Sets a handler called before every wait, i.e. to submit I/O queued by other handlers
+	void SetPrepareHandler(std::function<void()> handler) { m_PrepareHandler = std::move(handler); }
+
+	/*! Waits for descriptors or timers and calls their handlers
+	 *
+	 *  Waits at most 'timeout' milliseconds, or until something happens if
+	 *  negative. Handlers may add and remove descriptors and timers.
+	 */
+	void RunOnce(int timeout = -1);
+
+	//! Number of descriptors being watched
+	size_t GetDescriptorCount() const { return m_Descriptors.size(); }
+
+	//! Number of epoll_wait(2) calls made
+	uint64_t GetWaitCount() const { return m_WaitCount; }
+
+private:
+	struct Descriptor {
+		Handler m_Handler;
+
+		//! Distinguishes this registration from earlier ones of the same descriptor
+		uint32_t m_Generation;
+	};
+
+	struct Timer {
+		TimerId m_Id;
+		std::function<void()> m_Handler;
+	};
+	typedef std::multimap<Clock::time_point, Timer> TimerMap;
+
+	//! Calls the handler of a descriptor, unless it was removed or re-added meanwhile
+	void Dispatch(uint64_t key, unsigned int events);
+
+	//! Calls the handlers of all timers that are due
+	void RunTimers();
+
+	int m_EpollFD;
+
+	std::unordered_map<int, std::shared_ptr<Descriptor>> m_Descriptors;
+	uint32_t m_NextGeneration;
+
+	//! Descriptors epoll can't watch, awaiting their one call
+	std::vector<uint64_t> m_AlwaysReady;
+
+	TimerMap m_Timers;
+	std::unordered_map<TimerId, TimerMap::iterator> m_TimerIndex;
+	TimerId m_NextTimerId;
+
+	std::function<void()> m_PrepareHandler;
+	uint64_t m_WaitCount;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_REACTOR_H */
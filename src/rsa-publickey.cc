@@ -4,6 +4,7 @@
 #include "trace.h"
 
 #include "cryptopp/rsa.h"
+#include "cryptopp/sha.h"
 
 namespace RSSH {
 
@@ -18,18 +19,31 @@ RSAPublicKey::RSAPublicKey(const uint8_t* buffer, size_t len)
 	b >> m_E >> m_N;
 }
 
-bool RSAPublicKey::Verify(const uint8_t* signature, size_t sig_len, const uint8_t* data, size_t data_len) const
+bool RSAPublicKey::Verify(const std::string& algorithm, const uint8_t* signature, size_t sig_len, const uint8_t* data, size_t data_len) const
 {
 	// Parse signature
 	Buffer b(signature, sig_len);
 	std::string sig_type, sig_data;
 	b >> sig_type;
-	if (sig_type != "ssh-rsa")
+	if (sig_type != algorithm)
 		throw Exception(Exception::C_PK_Unrecognized_Algorithm);
 	b >> sig_data;
 
-	CryptoPP::RSASSA_PKCS1v15_SHA_Verifier verifier(m_N, m_E);
-	return verifier.VerifyMessage(data, data_len, (const unsigned char*)sig_data.c_str(), sig_data.size());
+	// [RFC8332, 3] The key is the same for all of these, only the hash differs
+	const uint8_t* sig = (const uint8_t*)sig_data.c_str();
+	if (sig_type == "ssh-rsa") {
+		CryptoPP::RSASSA_PKCS1v15_SHA_Verifier verifier(m_N, m_E);
+		return verifier.VerifyMessage(data, data_len, sig, sig_data.size());
+	}
+	if (sig_type == "rsa-sha2-256") {
+		CryptoPP::RSASS<CryptoPP::PKCS1v15, CryptoPP::SHA256>::Verifier verifier(m_N, m_E);
+		return verifier.VerifyMessage(data, data_len, sig, sig_data.size());
+	}
+	if (sig_type == "rsa-sha2-512") {
+		CryptoPP::RSASS<CryptoPP::PKCS1v15, CryptoPP::SHA512>::Verifier verifier(m_N, m_E);
+		return verifier.VerifyMessage(data, data_len, sig, sig_data.size());
+	}
+	throw Exception(Exception::C_PK_Unrecognized_Algorithm);
 }
 
 } // namespace RSSH
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <cstddef>
+#include <string>
 #include "cryptopp/integer.h"
 
 namespace RSSH {
@@ -10,7 +11,8 @@ namespace RSSH {
 class RSAPublicKey {
 public:
 	RSAPublicKey(const uint8_t* buffer, size_t len);
-	bool Verify(const uint8_t* signature, size_t sig_len, const uint8_t* data, size_t data_len) const;
+	//! Verifies a signature made using signature algorithm 'algorithm' (ssh-rsa, rsa-sha2-256 or rsa-sha2-512)
+	bool Verify(const std::string& algorithm, const uint8_t* signature, size_t sig_len, const uint8_t* data, size_t data_len) const;
 
 private:
 	CryptoPP::Integer m_E, m_N;
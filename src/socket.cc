@@ -1,7 +1,14 @@
 #include "socket.h"
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <string.h>
@@ -11,17 +18,44 @@
 namespace RSSH {
 
 Socket::Socket()
-	: m_FD(-1)
+	: m_FD(-1), m_Reactor(NULL), m_Stream(NULL), m_SyscallCount(0)
 {
 }
 
 Socket::~Socket()
 {
+	if (m_Stream != NULL) {
+		m_Stream->Detach();
+		return;
+	}
+	if (m_Reactor != NULL)
+		m_Reactor->Remove(m_FD);
 	if (m_FD >= 0)
 		close(m_FD);
 }
 
+void Socket::Register(Reactor& reactor, IoRing* ring, Reactor::Handler handler, bool paced)
+{
+	assert(m_FD >= 0 && m_Reactor == NULL && m_Stream == NULL);
+	if (ring != NULL)
+		m_Stream = ring->Attach(m_FD, std::move(handler), paced);
+	else {
+		reactor.Add(m_FD, std::move(handler));
+		m_Reactor = &reactor;
+	}
+}
+
 bool Socket::Connect(const char* hostname, int port)
+{
+	return Connect(hostname, port, true);
+}
+
+bool Socket::StartConnect(const char* hostname, int port)
+{
+	return Connect(hostname, port, false);
+}
+
+bool Socket::Connect(const char* hostname, int port, bool blocking)
 {
 	assert(m_FD < 0); // don't be already connected
 	struct addrinfo hints;
@@ -45,7 +79,12 @@ bool Socket::Connect(const char* hostname, int port)
 		if (fd < 0)
 			continue;
 
-		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+		if (!blocking) {
+			int flags = fcntl(fd, F_GETFL);
+			if (flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 &&
+			    (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS))
+				break; // connection underway
+		} else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
 			break; // got a connection
 
 		close(fd);
@@ -55,48 +94,74 @@ bool Socket::Connect(const char* hostname, int port)
 	if (fd < 0)
 		return false; // nothing worked
 
+	// Whatever is queued is written at once by the transport; holding back small writes only adds latency
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
 	m_FD = fd;
 	return true;
 }
 
-bool Socket::ReceiveGreeter(char* greeter, size_t max_length)
+void Socket::Attach(int fd)
+{
+	assert(m_FD < 0); // don't be already connected
+	m_FD = fd;
+}
+
+bool Socket::SetNonBlocking()
 {
-	assert(m_FD >= 0); // be connected
+	int flags = fcntl(m_FD, F_GETFL);
+	return flags >= 0 && fcntl(m_FD, F_SETFL, flags | O_NONBLOCK) == 0;
+}
 
-	int s = read(m_FD, greeter, max_length - 1 /* terminating \0 */);
-	if (s <= 0)
-		return false;
+ssize_t Socket::Fill(Buffer& buffer)
+{
+	ssize_t n = Receive(buffer.GetWritePointer(), buffer.GetSize() - buffer.GetWritePosition());
+	if (n > 0)
+		buffer.SetWritePosition(buffer.GetWritePosition() + n);
+	return n;
+}
 
-	greeter[s] = '\0';
-	return true;
+ssize_t Socket::Receive(uint8_t* data, size_t len)
+{
+	if (m_Stream != NULL)
+		return m_Stream->Receive(data, len);
+
+	m_SyscallCount++;
+	ssize_t n = read(m_FD, data, len);
+	if (n < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	if (n == 0)
+		return -1;
+	return n;
 }
 
-bool Socket::TransmitGreeter(const char* greeter)
+ssize_t Socket::Transmit(const struct iovec* iov, int count)
 {
-	int n = strlen(greeter) + 2;
-	char* s = new char[n + 1];
-	strcpy(s, greeter);
-	strcat(s, "\r\n"); 
-	bool ok = write(m_FD, s, n) == n;
-	delete[] s;
-	return ok;
+	if (m_Stream != NULL)
+		return m_Stream->Send(iov, count);
+
+	m_SyscallCount++;
+	ssize_t n = writev(m_FD, iov, count);
+	if (n < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	return n;
 }
 
-bool Socket::Fill(Buffer& buffer)
+void Socket::Shutdown()
 {
-	int left = buffer.GetSize() - buffer.GetWritePosition();
-	int n = read(m_FD, buffer.GetWritePointer(), left);
-	if (n <= 0)
-		return false;
-	buffer.SetWritePosition(buffer.GetWritePosition() + n);
-	return true;
+	if (m_Stream != NULL)
+		m_Stream->Shutdown();
+	else
+		shutdown(m_FD, SHUT_WR);
 }
 
-bool Socket::Transmit(Buffer& buffer)
+size_t Socket::GetUnsentBytes() const
 {
-	int len = buffer.GetWritePosition();
-	int n = write(m_FD, static_cast<const void*>(buffer.GetReadPointer()), len);
-	return n == len;
+	// For TCP, SIOCOUTQ includes data sent but not yet acknowledged; SIOCOUTQNSD leaves that out
+	int n;
+	if (ioctl(m_FD, SIOCOUTQNSD, &n) < 0 && ioctl(m_FD, SIOCOUTQ, &n) < 0)
+		return 0;
+	return n;
 }
 
 } // namespace RSSH
@@ -2,6 +2,12 @@
 #define RSSH_SOCKET_H
 
 #include <cstddef>
+#include <stdint.h>
+#include <sys/types.h>
+#include "io-ring.h"
+#include "reactor.h"
+
+struct iovec;
 
 namespace RSSH {
 
@@ -17,31 +23,77 @@ public:
 	 */
 	bool Connect(const char* hostname, int port);
 
-	/*! Receives the SSH greeting
+	/*! Starts connecting to a remote host, without waiting for it
+	 *
+	 *  Only the first address that a connection can be started to is
+	 *  used. The socket is writable once the connection is made; if this
+	 *  fails, the next write reports the error.
+	 */
+	bool StartConnect(const char* hostname, int port);
+
+	//! Uses an already connected file descriptor, which will be closed by us
+	void Attach(int fd);
+
+	//! Switches the socket to non-blocking mode
+	bool SetNonBlocking();
+
+	/*! Has 'handler' called on events for this socket until it's destroyed
+	 *
+	 *  If 'ring' is given, the socket's I/O goes through it; the reactor
+	 *  is not involved then; see IoRing::Attach() for 'paced'. The socket
+	 *  must be non-blocking.
+	 */
+	void Register(Reactor& reactor, IoRing* ring, Reactor::Handler handler, bool paced = false);
+
+	//! Is our I/O done by an IoRing?
+	bool UsesRing() const { return m_Stream != NULL; }
+
+	/*! Attempts to fill the buffer
 	 *
-	 *  May not truely belong here, yet the greeter has nothing in common
-	 *  with the rest of the protocol...
+	 *  Returns the number of bytes read, or 0 if no data is available
+	 *  yet; -1 on errors or end-of-file.
 	 */
-	bool ReceiveGreeter(char* greeter, size_t max_length);
+	ssize_t Fill(Buffer& buffer);
 
-	//! Transmit our greeter
-	bool TransmitGreeter(const char* greeter);
+	//! Like Fill(), but reads at most 'len' bytes to 'data'
+	ssize_t Receive(uint8_t* data, size_t len);
 
-	//! Attempt to fill the buffer
-	bool Fill(Buffer& buffer);
+	/*! Writes the given buffers in a single call
+	 *
+	 *  Returns the number of bytes written, which may be less than
+	 *  requested or 0 if the socket can't accept data right now; -1 on error.
+	 */
+	ssize_t Transmit(const struct iovec* iov, int count);
 
-	//! Send the buffer
-	bool Transmit(Buffer& buffer);
+	//! Signals end-of-file to the peer once everything transmitted is sent
+	void Shutdown();
+
+	//! Number of bytes written to the socket that the kernel has yet to send; 0 if it can't tell
+	size_t GetUnsentBytes() const;
 
 	/*! \brief Retrieve the socket's file descriptor
 	 *
-	 *  This is intended for use in things like select(2).
+	 *  This is intended for registering with a Reactor.
 	 */
 	int GetFD() const { return m_FD; }
 
+	//! Number of read(2) and writev(2) calls made; these are not needed with an IoRing
+	uint64_t GetSyscallCount() const { return m_SyscallCount; }
+
 private:
+	//! Connects to the first address of 'hostname' that works; 'blocking' decides whether to wait for it
+	bool Connect(const char* hostname, int port, bool blocking);
+
 	//! File descriptor
 	int m_FD;
+
+	//! Reactor we're registered with, if any
+	Reactor* m_Reactor;
+
+	//! Set if our I/O is done by an IoRing, which then owns the descriptor
+	IoRing::Stream* m_Stream;
+
+	uint64_t m_SyscallCount;
 };
 
 } // namespace RSSH
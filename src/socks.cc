@@ -0,0 +1,196 @@
+#include "socks.h"
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+namespace RSSH {
+
+namespace {
+
+//! No request is longer than this; the user id of SOCKS4 is the only thing that could make it so
+const size_t maxRequestLength = 1024;
+
+// [RFC1928, 3] methods
+const uint8_t methodNoAuthentication = 0x00;
+const uint8_t methodNoneAcceptable = 0xff;
+
+// [RFC1928, 4] commands and address types
+const uint8_t commandConnect = 1;
+const uint8_t addressIPv4 = 1;
+const uint8_t addressDomainName = 3;
+const uint8_t addressIPv6 = 4;
+
+// [RFC1928, 6] replies
+const uint8_t replySucceeded = 0;
+const uint8_t replyGeneralFailure = 1;
+const uint8_t replyCommandNotSupported = 7;
+const uint8_t replyAddressTypeNotSupported = 8;
+
+// [SOCKS4] replies
+const uint8_t socks4Granted = 90;
+const uint8_t socks4Rejected = 91;
+
+uint16_t ReadPort(const std::string& s, size_t offset)
+{
+	return static_cast<uint8_t>(s[offset]) << 8 | static_cast<uint8_t>(s[offset + 1]);
+}
+
+} // unnamed namespace
+
+SocksRequest::SocksRequest()
+	: m_Offset(0), m_Version(0), m_MethodSelected(false), m_Port(0)
+{
+}
+
+SocksRequest::Status SocksRequest::Receive(const uint8_t* data, size_t len, std::string& reply)
+{
+	m_Received.append(reinterpret_cast<const char*>(data), len);
+	if (m_Received.empty())
+		return Status::Incomplete;
+
+	m_Version = m_Received[0];
+	Status status;
+	switch(m_Version) {
+		case 4:
+			status = ParseSocks4(reply);
+			break;
+		case 5:
+			status = ParseSocks5(reply);
+			break;
+		default:
+			return Status::Refused;
+	}
+	if (status == Status::Incomplete && m_Received.size() > maxRequestLength)
+		return Status::Refused;
+	return status;
+}
+
+SocksRequest::Status SocksRequest::ParseSocks4(std::string& reply)
+{
+	// [SOCKS4] VN CD DSTPORT DSTIP USERID NULL
+	const std::string& r = m_Received;
+	if (r.size() < 8)
+		return Status::Incomplete;
+	if (r[1] != commandConnect) {
+		reply += MakeReply(false);
+		return Status::Refused;
+	}
+	size_t end = r.find('\0', 8);
+	if (end == std::string::npos)
+		return Status::Incomplete;
+
+	const uint8_t* ip = reinterpret_cast<const uint8_t*>(&r[4]);
+	if (ip[0] == 0 && ip[1] == 0 && ip[2] == 0 && ip[3] != 0) {
+		// [SOCKS4A] an address of 0.0.0.x means the host name follows the user id
+		const size_t hostEnd = r.find('\0', end + 1);
+		if (hostEnd == std::string::npos)
+			return Status::Incomplete;
+		m_Host = r.substr(end + 1, hostEnd - end - 1);
+		end = hostEnd;
+	} else {
+		char address[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, ip, address, sizeof(address));
+		m_Host = address;
+	}
+	m_Port = ReadPort(r, 2);
+	m_Offset = end + 1;
+	if (m_Host.empty()) {
+		reply += MakeReply(false);
+		return Status::Refused;
+	}
+	return Status::Complete;
+}
+
+SocksRequest::Status SocksRequest::ParseSocks5(std::string& reply)
+{
+	// [RFC1928, 3] VER NMETHODS METHODS
+	const std::string& r = m_Received;
+	if (r.size() < 2)
+		return Status::Incomplete;
+	const size_t numMethods = static_cast<uint8_t>(r[1]);
+	const size_t pos = 2 + numMethods;
+	if (r.size() < pos)
+		return Status::Incomplete;
+	if (!m_MethodSelected) {
+		reply += static_cast<char>(5);
+		if (r.find(static_cast<char>(methodNoAuthentication), 2) >= pos) {
+			reply += static_cast<char>(methodNoneAcceptable);
+			return Status::Refused;
+		}
+		reply += static_cast<char>(methodNoAuthentication);
+		m_MethodSelected = true;
+	}
+
+	// [RFC1928, 4] VER CMD RSV ATYP DST.ADDR DST.PORT
+	if (r.size() < pos + 5)
+		return Status::Incomplete;
+	if (r[pos] != 5)
+		return Status::Refused;
+	size_t addressLength;
+	switch(static_cast<uint8_t>(r[pos + 3])) {
+		case addressIPv4:
+			addressLength = 4;
+			break;
+		case addressDomainName:
+			addressLength = 1 + static_cast<uint8_t>(r[pos + 4]);
+			break;
+		case addressIPv6:
+			addressLength = 16;
+			break;
+		default:
+			reply += MakeSocks5Reply(replyAddressTypeNotSupported);
+			return Status::Refused;
+	}
+	const size_t end = pos + 4 + addressLength + 2;
+	if (r.size() < end)
+		return Status::Incomplete;
+	if (r[pos + 1] != commandConnect) {
+		reply += MakeSocks5Reply(replyCommandNotSupported);
+		return Status::Refused;
+	}
+
+	const char* address = &r[pos + 4];
+	if (r[pos + 3] == addressDomainName) {
+		m_Host.assign(address + 1, addressLength - 1);
+	} else {
+		char s[INET6_ADDRSTRLEN];
+		inet_ntop(r[pos + 3] == addressIPv4 ? AF_INET : AF_INET6, address, s, sizeof(s));
+		m_Host = s;
+	}
+	m_Port = ReadPort(r, end - 2);
+	m_Offset = end;
+	if (m_Host.empty()) {
+		reply += MakeSocks5Reply(replyGeneralFailure);
+		return Status::Refused;
+	}
+	return Status::Complete;
+}
+
+std::string SocksRequest::TakeEarlyData()
+{
+	std::string data = m_Received.substr(m_Offset);
+	m_Received.erase(m_Offset);
+	return data;
+}
+
+std::string SocksRequest::MakeReply(bool success) const
+{
+	if (m_Version == 5)
+		return MakeSocks5Reply(success ? replySucceeded : replyGeneralFailure);
+
+	// [SOCKS4] VN CD DSTPORT DSTIP; the port and address are ignored
+	std::string reply(8, '\0');
+	reply[1] = static_cast<char>(success ? socks4Granted : socks4Rejected);
+	return reply;
+}
+
+std::string SocksRequest::MakeSocks5Reply(uint8_t code)
+{
+	// VER REP RSV ATYP BND.ADDR BND.PORT; we don't know the address the server bound to
+	std::string reply(10, '\0');
+	reply[0] = 5;
+	reply[1] = static_cast<char>(code);
+	reply[3] = addressIPv4;
+	return reply;
+}
+
+} // namespace RSSH
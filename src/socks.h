@@ -0,0 +1,71 @@
+#ifndef RSSH_SOCKS_H
+#define RSSH_SOCKS_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+namespace RSSH {
+
+/*! The request of a SOCKS client, as used for dynamic forwarding
+ *
+ *  CONNECT requests of SOCKS4 [SOCKS4], SOCKS4A [SOCKS4A] and SOCKS5
+ *  [RFC1928] without authentication are understood. Host names are kept
+ *  as given, so the server resolves them rather than us.
+ *
+ *  Clients may send their request, and even the data following it,
+ *  without waiting for our replies; whatever arrives is parsed as far as
+ *  it goes.
+ */
+class SocksRequest {
+public:
+	enum class Status {
+		//! More data is needed
+		Incomplete,
+		//! The request is complete; GetHost() and GetPort() tell where to connect to
+		Complete,
+		//! Not a request we understand; the connection is to be closed
+		Refused,
+	};
+
+	SocksRequest();
+
+	/*! Takes data received from the client
+	 *
+	 *  Anything to be sent back right away, such as the SOCKS5 method
+	 *  selection or why the request is refused, is appended to 'reply'.
+	 */
+	Status Receive(const uint8_t* data, size_t len, std::string& reply);
+
+	const std::string& GetHost() const { return m_Host; }
+	uint16_t GetPort() const { return m_Port; }
+
+	//! Data the client sent after a complete request, without waiting for our reply
+	std::string TakeEarlyData();
+
+	//! Reply telling the client whether its connection is made
+	std::string MakeReply(bool success) const;
+
+private:
+	Status ParseSocks4(std::string& reply);
+	Status ParseSocks5(std::string& reply);
+
+	//! [RFC1928, 6] reply with the given REP field
+	static std::string MakeSocks5Reply(uint8_t code);
+
+	//! Received so far; m_Offset points past what is parsed
+	std::string m_Received;
+	size_t m_Offset;
+
+	uint8_t m_Version;
+
+	//! [RFC1928, 3] set once we replied to the method selection
+	bool m_MethodSelected;
+
+	std::string m_Host;
+	uint16_t m_Port;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_SOCKS_H */
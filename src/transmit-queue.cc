@@ -0,0 +1,106 @@
+#include "transmit-queue.h"
+#include <sys/uio.h>
+#include <assert.h>
+#include <utility>
+#include "buffer.h"
+#include "socket.h"
+
+namespace RSSH {
+
+TransmitQueue::TransmitQueue()
+	: m_Current(NULL), m_Spare(NULL)
+{
+}
+
+TransmitQueue::~TransmitQueue()
+{
+	delete m_Current;
+	delete m_Spare;
+	for (size_t n = 0; n < m_Queue.size(); n++)
+		delete m_Queue[n];
+	for (size_t n = 0; n < m_Free.size(); n++)
+		delete m_Free[n];
+}
+
+Buffer& TransmitQueue::Allocate()
+{
+	if (m_Current == NULL) {
+		if (!m_Free.empty()) {
+			m_Current = m_Free.back();
+			m_Free.pop_back();
+		} else
+			m_Current = new Buffer;
+	}
+	m_Current->Clear();
+	return *m_Current;
+}
+
+Buffer& TransmitQueue::Replace()
+{
+	assert(m_Current != NULL);
+	if (m_Spare == NULL)
+		m_Spare = new Buffer;
+	std::swap(m_Current, m_Spare);
+	m_Current->Clear();
+	return *m_Current;
+}
+
+void TransmitQueue::Enqueue(Buffer& buffer)
+{
+	assert(&buffer == m_Current);
+	m_Queue.push_back(m_Current);
+	m_Current = NULL;
+}
+
+void TransmitQueue::Release(Buffer* buffer)
+{
+	if (m_Free.size() < maxFreeBuffers)
+		m_Free.push_back(buffer);
+	else
+		delete buffer;
+}
+
+size_t TransmitQueue::GetPendingBytes() const
+{
+	size_t pending = 0;
+	for (size_t n = 0; n < m_Queue.size(); n++)
+		pending += m_Queue[n]->GetAvailableBytes();
+	return pending;
+}
+
+bool TransmitQueue::Flush(Socket& socket)
+{
+	while (!m_Queue.empty()) {
+		struct iovec iov[maxBuffersPerWrite];
+		int count = 0;
+		for (/* nothing */; count < maxBuffersPerWrite && count < (int)m_Queue.size(); count++) {
+			Buffer* b = m_Queue[count];
+			iov[count].iov_base = const_cast<uint8_t*>(b->GetReadPointer());
+			iov[count].iov_len = b->GetAvailableBytes();
+		}
+
+		ssize_t written = socket.Transmit(iov, count);
+		if (written < 0)
+			return false;
+		if (written == 0)
+			break; // socket is full; retry once it is writable
+
+		// Release whatever was completely written; a partially written
+		// buffer continues where it left off
+		size_t left = written;
+		while (left > 0) {
+			Buffer* b = m_Queue.front();
+			size_t n = b->GetAvailableBytes();
+			if (left < n) {
+				b->SkipBytes(left);
+				break;
+			}
+			left -= n;
+			m_Queue.pop_front();
+			Release(b);
+		}
+	}
+	return true;
+}
+
+} // namespace RSSH
@@ -0,0 +1,77 @@
+#ifndef RSSH_TRANSMIT_QUEUE_H
+#define RSSH_TRANSMIT_QUEUE_H
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+namespace RSSH {
+
+class Buffer;
+class Socket;
+
+/*! Outgoing packets waiting to be written to the socket
+ *
+ *  Packets are built, encrypted and queued in buffers handed out by the
+ *  queue itself; Flush() writes as many of them as the socket accepts
+ *  using a single writev(2) call. Buffers that have been written are kept
+ *  for reuse, so no allocations are needed in steady state.
+ */
+class TransmitQueue final {
+public:
+	TransmitQueue();
+	~TransmitQueue();
+
+	TransmitQueue(const TransmitQueue&) = delete;
+	TransmitQueue& operator=(const TransmitQueue&) = delete;
+
+	/*! Retrieves an empty buffer to build the next packet in
+	 *
+	 *  Until it is passed to Enqueue(), subsequent calls return the same buffer.
+	 */
+	Buffer& Allocate();
+
+	/*! Swaps the buffer returned by Allocate() for an empty one
+	 *
+	 *  This is for packets that are transformed into another buffer rather
+	 *  than in place: the returned buffer is the one to enqueue. The
+	 *  previous one keeps its contents until the next call.
+	 */
+	Buffer& Replace();
+
+	//! Queues the buffer returned by Allocate(); its unread bytes will be sent
+	void Enqueue(Buffer& buffer);
+
+	/*! Writes queued data until everything is written or the socket would block
+	 *
+	 *  Returns false on a socket error.
+	 */
+	bool Flush(Socket& socket);
+
+	bool IsEmpty() const {
+		return m_Queue.empty();
+	}
+
+	//! Number of bytes waiting to be written
+	size_t GetPendingBytes() const;
+
+private:
+	//! Maximum number of buffers passed to a single writev(2)
+	static const int maxBuffersPerWrite = 64;
+
+	//! Maximum number of unused buffers we hold on to
+	static const size_t maxFreeBuffers = 16;
+
+	void Release(Buffer* buffer);
+
+	std::deque<Buffer*> m_Queue;
+	std::vector<Buffer*> m_Free;
+	Buffer* m_Current;
+
+	//! The buffer last swapped out by Replace()
+	Buffer* m_Spare;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_TRANSMIT_QUEUE_H */
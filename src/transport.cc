@@ -1,27 +1,62 @@
 #include "transport.h"
 #include "algorithm.h"
 #include "callback.h"
-#include "dh-keyexchange.h"
+#include "cipher-factory.h"
+#include "compression.h"
 #include "exception.h"
+#include "keyexchange.h"
+#include "keyexchange-factory.h"
 #include "numbers.h"
 #include "random.h"
+#include "reactor.h"
 #include "trace.h"
 #include "types.h"
 #include <string.h>
+#include <algorithm>
+#include <functional>
 
 namespace RSSH {
 
+namespace {
+
+void Negotiate(const char* what, const Types::NameList& ours, const Types::NameList& theirs, std::string& result)
+{
+	if (!Negotiation::Choose(ours, theirs, result)) {
+		Trace::Error("no common %s algorithm; we support [%s], server supports [%s]", what, ours.ToString().c_str(), theirs.ToString().c_str());
+		throw Exception(Exception::C_Transport_No_Common_Algorithm, what);
+	}
+	Trace::Info("%s: %s", what, result.c_str());
+}
+
+//! Returns 'list' with 'first' moved to the front
+Types::NameList PutFirst(const Types::NameList& list, const std::string& first)
+{
+	std::string names = first;
+	for (const std::string& name : list.GetNames())
+		if (name != first)
+			names += "," + name;
+	return Types::NameList(names);
+}
+
+} // unnamed namespace
+
 Transport::Transport(Callback& callback)
-	: m_ServerKexPayload(NULL), m_MyKexPayload(NULL), m_DHExchange(NULL), m_Algorithm(NULL), m_PendingAlgorithm(NULL),
-	  m_C2S_SequenceNumber(0), m_S2C_SequenceNumber(0), m_BufferDecryptedPosition(0), m_Callback(callback)
+	: m_Buffer(2 * maxPacketSize), m_ServerKexPayload(NULL), m_MyKexPayload(NULL), m_KeyExchange(NULL), m_Algorithm(NULL), m_PendingAlgorithm(NULL), m_IgnoreGuessedKexPacket(false),
+	  m_KexInProgress(false), m_KexGuessed(false), m_KexGuessable(false), m_C2S_SequenceNumber(0), m_S2C_SequenceNumber(0),
+	  m_C2S_KeySequenceNumber(0), m_S2C_KeySequenceNumber(0), m_C2S_KeyBytes(0), m_S2C_KeyBytes(0), m_BufferDecryptedPosition(0), m_Authenticated(false), m_DelayedCompression_C2S(false), m_DelayedCompression_S2C(false),
+	  m_Compressor(NULL), m_Decompressor(NULL), m_Callback(callback),
+	  m_WindowAdjustCount(0)
 {
+	m_Greeter[0] = '\0';
 }
 
 Transport::~Transport()
 {
+	delete m_Decompressor;
+	delete m_Compressor;
 	delete m_PendingAlgorithm;
 	delete m_Algorithm;
-	delete m_DHExchange;
+	delete m_KeyExchange;
 	delete[] m_ServerKexPayload;
 	delete[] m_MyKexPayload;
 }
@@ -30,58 +65,132 @@ void Transport::Connect(const char* hostname, int port)
 {
 	if (!m_Socket.Connect(hostname, port))
 		throw Exception(Exception::C_Socket_Error);
+	SendGreeter();
+}
 
-	if (!m_Socket.ReceiveGreeter(m_Greeter, sizeof(m_Greeter)))
+void Transport::StartConnect(const char* hostname, int port)
+{
+	if (!m_Socket.StartConnect(hostname, port))
 		throw Exception(Exception::C_Socket_Error);
+	SendGreeter();
+}
 
-	// [SSH-TRANS, 4.2] details the greeter; it must end in CR LF
-	// XXX Do note that not all OpenSSH servers seem to do this?
-	//     We are a bit more lenient
-	{
-		int s = strlen(m_Greeter);
-		if (s < 2 || m_Greeter[s - 1] != '\n') {
-			Trace::Error("got corrupt greeter [%s]", m_Greeter);
+void Transport::Attach(int fd)
+{
+	m_Socket.Attach(fd);
+	SendGreeter();
+}
+
+void Transport::SendGreeter()
+{
+	// [SSH-TRANS, 4.2] both sides send their greeter right away; from here
+	// on, everything is driven by Process() and Flush()
+	if (!m_Socket.SetNonBlocking())
+		throw Exception(Exception::C_Socket_Error);
+
+	Buffer& b = m_TransmitQueue.Allocate();
+	b.PutBytes(reinterpret_cast<const uint8_t*>(Numbers::ourGreeter), strlen(Numbers::ourGreeter));
+	b.PutBytes(reinterpret_cast<const uint8_t*>("\r\n"), 2);
+	m_TransmitQueue.Enqueue(b);
+	Flush();
+}
+
+bool Transport::ReceiveGreeter()
+{
+	// [SSH-TRANS, 4.2] The server may send other lines of data before the
+	// greeter; these must not start with SSH-. Every line ends in LF
+	while (true) {
+		const char* line = reinterpret_cast<const char*>(m_Buffer.GetReadPointer());
+		const size_t available = m_Buffer.GetAvailableBytes();
+		const char* eol = static_cast<const char*>(memchr(line, '\n', available));
+		if (eol == NULL) {
+			if (available >= maxGreeterLength)
+				throw Exception(Exception::C_Transport_Greeter_Corrupt);
+			return false;
+		}
+		const size_t length = eol - line + 1;
+		m_Buffer.SetReadPosition(m_Buffer.GetReadPosition() + length);
+		if (length < 4 || strncmp("SSH-", line, 4) != 0)
+			continue;
+
+		// It must end in CR LF, but not all OpenSSH servers seem to do
+		// this so we are a bit more lenient
+		if (length >= maxGreeterLength) {
+			Trace::Error("got corrupt greeter");
 			throw Exception(Exception::C_Transport_Greeter_Corrupt);
 		}
-		if (m_Greeter[s - 2] == '\r')
-			m_Greeter[s - 2] = '\0'; // cut off CR LF
-		else
-			m_Greeter[s - 1] = '\0'; // cut off LF
-	}
-	// It has to start with SSH-
-	if (strncmp("SSH-", m_Greeter, 4) != 0) {
-		Trace::Error("greeter [%s] does not start with SSH-", m_Greeter);
-		throw Exception(Exception::C_Transport_Greeter_Corrupt);
+		size_t s = length - 1; // cut off LF
+		if (s > 0 && line[s - 1] == '\r')
+			s--; // and CR
+		memcpy(m_Greeter, line, s);
+		m_Greeter[s] = '\0';
+		break;
 	}
+
 	// And the protocol version must be 2.0 (XXX should we accept 1.99 as well?)
 	if (strncmp("2.0-", m_Greeter + 4, 4) != 0) {
 		Trace::Error("invalid version, got %s, expected 2.0-", m_Greeter + 4);
 		throw Exception(Exception::C_Transport_Version_Mismatch);
 	}
 
-	// XXX We should be able to process more messages here
+	// We should have moved to the binary protocol now, as outlined in [SSH-TRANS, 6]
 	Trace::Info("got greeter [%s]", m_Greeter);
 	m_Callback.OnGreeter(m_Greeter);
+	return true;
+}
 
-	// Now send our own greeter
-	if (!m_Socket.TransmitGreeter(Numbers::ourGreeter))
-		throw Exception(Exception::C_Socket_Error);
+Buffer& Transport::BeginPacket(Numbers::MessageID type)
+{
+	Buffer& b = m_TransmitQueue.Allocate();
+	b << static_cast<uint32_t>(0); // len
+	b << static_cast<uint8_t>(0); // padding len
+	b << static_cast<uint8_t>(type);
+	return b;
+}
 
-	// We should have moved to the binary protocol now, as outlined in [SSH-TRANS, 6]
+Buffer& Transport::CompressPacket(Buffer& packet)
+{
+	// [SSH-TRANS, 6.2] only the payload is compressed; it follows the length and padding length
+	const size_t headerLength = sizeof(uint32_t) + sizeof(uint8_t);
+	Buffer& compressed = m_TransmitQueue.Replace();
+	compressed.SetWritePosition(headerLength);
+	// Data we sent earlier still waiting to go out means the link is what holds us back
+	const bool linkBusy = m_Compressor->IsAdaptive() && m_Socket.GetUnsentBytes() > 0;
+	m_Compressor->Compress(packet.GetReadPointer() + headerLength, packet.GetWritePosition() - headerLength, compressed, linkBusy);
+	return compressed;
 }
 
-void Transport::TransmitPacket(Buffer& buffer)
+void Transport::TransmitPacket(Buffer& packet)
 {
+	// [SSH-TRANS, 7.1] during a key exchange, only messages 1 to 49 may be sent, save for service requests and accepts
+	const size_t headerLength = sizeof(uint32_t) + sizeof(uint8_t);
+	const uint8_t type = packet.GetReadPointer()[headerLength];
+	if (m_KexInProgress && (type >= 50 || type == static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_SERVICE_REQUEST) ||
+	    type == static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_SERVICE_ACCEPT))) {
+		m_HeldPayloads.emplace_back(reinterpret_cast<const char*>(packet.GetReadPointer()) + headerLength, packet.GetWritePosition() - headerLength);
+		packet.Clear();
+		return;
+	}
+
+	Buffer& buffer = m_Compressor != NULL ? CompressPacket(packet) : packet;
+
 	int block_size = 8;
 	if (m_Algorithm != NULL)
 		block_size = m_Algorithm->GetBlockSize_C2S();
 
-	// Determine packet length and padding to use
+	// Determine packet length and padding to use; AEAD ciphers and
+	// encrypt-then-MAC don't include the length field when aligning to
+	// the block size
 	uint32_t len = buffer.GetWritePosition();
-	uint8_t padding_len = block_size - (len % block_size);
+	size_t aligned_len = len;
+	if (m_Algorithm != NULL && m_Algorithm->IsLengthExcluded_C2S())
+		aligned_len -= sizeof(uint32_t);
+	uint8_t padding_len = block_size - (aligned_len % block_size);
 	// [SSH-TRANS] 5.3: there MUST be at least 4 bytes of padding
 	if (padding_len < 4)
 		padding_len += block_size;
+	if (len + maxPacketTail > buffer.GetSize())
+		throw Exception(Exception::C_Buffer_Full);
 	// Update header: length and padding length
 	buffer.SetWritePosition(0);
 	buffer << static_cast<uint32_t>(len + padding_len - sizeof(uint32_t) /* length field */);
@@ -92,41 +201,39 @@ void Transport::TransmitPacket(Buffer& buffer)
 	Random::GetInstance().Generate(buffer.GetWritePointer(), padding_len);
 	buffer.SetWritePosition(buffer.GetWritePosition() + padding_len);
 
-	// Perform HMAC/encryption
-	if (m_Algorithm != NULL) {
-		// Add the HMAC before encrypting
-		m_Algorithm->PerformHMAC_C2S(buffer, m_C2S_SequenceNumber);
-
-		// Now encrypt everything up to the HMAC
-		m_Algorithm->Encrypt_C2S((uint8_t*)buffer.GetReadPointer(), buffer.GetAvailableBytes() - m_Algorithm->GetHMACSize_C2S());
-	}
+	// Perform HMAC/encryption; this appends the HMAC
+	if (m_Algorithm != NULL)
+		m_Algorithm->EncryptAndMAC_C2S(buffer, m_C2S_SequenceNumber);
 	m_C2S_SequenceNumber++;
+	m_C2S_KeyBytes += buffer.GetWritePosition();
 
-	m_Socket.Transmit(buffer);
+	m_TransmitQueue.Enqueue(buffer);
 }
 
-void Transport::SendKexInitReply()
+void Transport::SendKexInit(bool guess)
 {
-	// Construct our KEXINIT reply - XXX we should look at what the server
-	// supports rather than just hardcode our own idea...
-	Buffer b;
-	b << static_cast<uint32_t>(0); // len
-	b << static_cast<uint8_t>(0); // padding len
-	b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_KEXINIT);
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_KEXINIT);
 	// Generate 16-byte random cookie
 	Random::GetInstance().Generate(b.GetWritePointer(), 16);
 	b.SetWritePosition(b.GetWritePosition() + 16);
-	b << Types::NameList("diffie-hellman-group14-sha1"); // kex algos
-	b << Types::NameList("ssh-rsa"); // hostkey
-	b << Types::NameList("aes128-cbc"); // encr-c2s
-	b << Types::NameList("aes128-cbc"); // encr-s2c
-	b << Types::NameList("hmac-sha1"); // mac-c2s
-	b << Types::NameList("hmac-sha1"); // mac-s2c
-	b << Types::NameList("none"); // compr-c2s
-	b << Types::NameList("none"); // compr-s2c
+	// [SSH-TRANS, 7] a guess is only right if both sides prefer the same methods; the server
+	// prefers what was negotiated last time, so we do as well
+	if (guess) {
+		b << PutFirst(m_Preferences.GetKexAlgorithms(), m_Negotiated.m_Kex); // kex algos
+		b << PutFirst(m_Preferences.GetHostKeyAlgorithms(), m_Negotiated.m_HostKey); // hostkey
+	} else {
+		b << m_Preferences.GetKexAlgorithms(); // kex algos
+		b << m_Preferences.GetHostKeyAlgorithms(); // hostkey
+	}
+	b << m_Preferences.GetCiphers(); // encr-c2s
+	b << m_Preferences.GetCiphers(); // encr-s2c
+	b << m_Preferences.GetMACs(); // mac-c2s
+	b << m_Preferences.GetMACs(); // mac-s2c
+	b << m_Preferences.GetCompression(); // compr-c2s
+	b << m_Preferences.GetCompression(); // compr-s2c
 	b << Types::NameList(); // lang-c2s
 	b << Types::NameList(); // lang-s2c
-	b << false; // first-kex-packt-follows
+	b << guess; // first-kex-packet-follows
 	b << static_cast<uint32_t>(0); // reserved
 
 	// Store our KEXINIT payload, it is part of what the server will sign
@@ -135,20 +242,80 @@ void Transport::SendKexInitReply()
 	m_MyKexPayload = new char[m_MyKexPayloadLength];
 	memcpy(m_MyKexPayload, b.GetReadPointer() + 5, m_MyKexPayloadLength);
 
-	// And off it goes
+	// And off it goes; from here on, anything else waits until the new keys are in effect
+	m_KexInProgress = true;
+	m_KexGuessed = guess;
+	m_KexStart = Clock::now();
 	TransmitPacket(b);
+
+	if (guess)
+		StartKeyExchange(m_Negotiated.m_Kex);
+}
+
+void Transport::StartKeyExchange(const std::string& method)
+{
+	delete m_KeyExchange;
+	m_KeyExchange = KeyExchangeFactory::Create(*this, method.c_str());
+	if (m_KeyExchange == NULL)
+		throw Exception(Exception::C_DH_Unrecognized_Algorithm, method.c_str());
+	m_KeyExchange->SendExchange();
 }
 
-void Transport::OnMessageKexInit(Buffer& buffer, size_t packetLength, size_t paddingLength)
+void Transport::Rekey()
+{
+	if (m_Algorithm == NULL || m_KexInProgress)
+		return;
+
+	// If the server will accept it, our first key exchange packet goes along; that saves a round trip
+	Trace::Info("exchanging keys again");
+	SendKexInit(m_KexGuessable);
+}
+
+bool Transport::IsRekeyDue() const
+{
+	if (m_Algorithm == NULL || m_KexInProgress)
+		return false;
+	const RekeySettings& s = m_RekeySettings;
+	if (s.m_Bytes > 0 && (m_C2S_KeyBytes >= s.m_Bytes || m_S2C_KeyBytes >= s.m_Bytes))
+		return true;
+	// Sequence numbers carry on across key exchanges, and may wrap in between
+	if (s.m_Packets > 0 && (m_C2S_SequenceNumber - m_C2S_KeySequenceNumber >= s.m_Packets ||
+	    m_S2C_SequenceNumber - m_S2C_KeySequenceNumber >= s.m_Packets))
+		return true;
+	return s.m_Interval.count() > 0 && Clock::now() - m_KeyTime >= s.m_Interval;
+}
+
+void Transport::ResumeAfterKeyExchange()
+{
+	while (!m_HeldPayloads.empty()) {
+		const std::string& payload = m_HeldPayloads.front();
+		Buffer& b = BeginPacket(static_cast<Numbers::MessageID>(payload[0]));
+		b.PutBytes(reinterpret_cast<const uint8_t*>(payload.data()) + 1, payload.size() - 1);
+		TransmitPacket(b);
+		m_HeldPayloads.pop_front();
+	}
+
+	// Channels had no room meanwhile; whoever was told so is waiting to hear otherwise
+	for (size_t n = 0; n < m_Channels.size(); n++) {
+		Channel* channel = m_Channels[n].get();
+		if (channel == NULL)
+			continue;
+		TransmitPendingChannelData(*channel);
+		if (GetSendRoom(*channel) > 0)
+			m_Callback.OnChannelWritable(n);
+	}
+}
+
+void Transport::OnMessageKexInit(Buffer& buffer, size_t payloadEnd)
 {
 	// Make a copy of the payload; we need this to verify the signature later
 	delete[] m_ServerKexPayload;
-	m_ServerKexPayloadLength = packetLength - paddingLength - 1 /* skip padding byte */;
+	m_ServerKexPayloadLength = payloadEnd - buffer.GetReadPosition() + 1 /* take command byte too */;
 	m_ServerKexPayload = new char[m_ServerKexPayloadLength];
-	memcpy(m_ServerKexPayload, m_Buffer.GetReadPointer() - 1 /* take command byte too */, m_ServerKexPayloadLength);
+	memcpy(m_ServerKexPayload, buffer.GetReadPointer() - 1, m_ServerKexPayloadLength);
 
 	// Skip the cookie; there is no need to read it as it is part of m_ServerKexPayload
-	m_Buffer.SkipBytes(16);
+	buffer.SkipBytes(16);
 
 	// Grab the packet contents
 	Types::NameList kex_algos, hostkey_algos, encr_c2s, encr_s2c, mac_c2s, mac_s2c, compr_c2s, compr_s2c, lang_c2s, lang_s2c;
@@ -168,142 +335,509 @@ void Transport::OnMessageKexInit(Buffer& buffer, size_t packetLength, size_t pad
 	Trace::Debug("follows = %d", !!follows);
 	Trace::Debug("reserved = %d", reserved);
 
-	// TODO We should negotiate our options
-	SendKexInitReply();
+	// [SSH-TRANS, 7.1] For every slot, pick the first of our algorithms the
+	// server supports as well
+	NegotiatedAlgorithms n;
+	Negotiate("kex", m_Preferences.GetKexAlgorithms(), kex_algos, n.m_Kex);
+	Negotiate("hostkey", m_Preferences.GetHostKeyAlgorithms(), hostkey_algos, n.m_HostKey);
+	Negotiate("encr-c2s", m_Preferences.GetCiphers(), encr_c2s, n.m_Cipher_C2S);
+	Negotiate("encr-s2c", m_Preferences.GetCiphers(), encr_s2c, n.m_Cipher_S2C);
+	// AEAD ciphers provide their own integrity; the MAC is not used
+	if (!CipherFactory::IsAEAD(n.m_Cipher_C2S.c_str()))
+		Negotiate("mac-c2s", m_Preferences.GetMACs(), mac_c2s, n.m_MAC_C2S);
+	if (!CipherFactory::IsAEAD(n.m_Cipher_S2C.c_str()))
+		Negotiate("mac-s2c", m_Preferences.GetMACs(), mac_s2c, n.m_MAC_S2C);
+	Negotiate("compr-c2s", m_Preferences.GetCompression(), compr_c2s, n.m_Compression_C2S);
+	Negotiate("compr-s2c", m_Preferences.GetCompression(), compr_s2c, n.m_Compression_S2C);
+
+	// [SSH-TRANS, 7] if we guessed, we put first what was negotiated last time; the server must do so too
+	const bool guessedRight = m_KexGuessed &&
+	 kex_algos.GetNames().front() == m_Negotiated.m_Kex && hostkey_algos.GetNames().front() == m_Negotiated.m_HostKey;
+	m_KexGuessed = false;
+	m_Negotiated = n;
+
+	// If the server guessed the key exchange and guessed wrong, its first
+	// key exchange packet must be ignored
+	m_IgnoreGuessedKexPacket = follows &&
+	 (kex_algos.GetNames().front() != n.m_Kex || hostkey_algos.GetNames().front() != n.m_HostKey);
 
-	// Initiate a DH key exchange
-	delete m_DHExchange;
-	m_DHExchange = new DHKeyExchange(*this, "diffie-hellman-group14-sha1"); // XXX
-	m_DHExchange->SendExchange();
+	// Unless that changes, we can guess right next time if the server prefers what we picked
+	m_KexGuessable = kex_algos.GetNames().front() == n.m_Kex && hostkey_algos.GetNames().front() == n.m_HostKey;
+
+	// Unless we started this exchange, our KEXINIT still has to go out; the server may rekey too
+	if (!m_KexInProgress)
+		SendKexInit(false);
+
+	// Initiate the key exchange, unless we did already; the server ignores a wrong guess
+	if (!guessedRight)
+		StartKeyExchange(m_Negotiated.m_Kex);
 }
 
 void Transport::SendDisconnect()
 {
-	Buffer b;
-	b << static_cast<uint32_t>(0); // len
-	b << static_cast<uint8_t>(0); // padding len
-	b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_DISCONNECT);
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_DISCONNECT);
 	b << static_cast<uint32_t>(Numbers::DisconnectReason::SSH_DISCONNECT_BY_APPLICATION);
-	b << std::string("goodbye world");
-	b << std::string();
+	b << "goodbye world";
+	b << "";
 	TransmitPacket(b);
 }
 
 void Transport::RequestService(const char* serviceName)
 {
-	Buffer b;
-	b << static_cast<uint32_t>(0); // len
-	b << static_cast<uint8_t>(0); // padding len
-	b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_SERVICE_REQUEST);
-	b << std::string(serviceName);
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_SERVICE_REQUEST);
+	b << serviceName;
 	TransmitPacket(b);
 }
 
-void Transport::RequestPty(int recipientChannel, const char* term)
+void Transport::RequestPty(int channelId, const char* term)
 {
 	// want pty
-	Buffer b;
-	b << static_cast<uint32_t>(0); // len
-	b << static_cast<uint8_t>(0); // padding len
-	b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_CHANNEL_REQUEST);
-	b << static_cast<uint32_t>(recipientChannel);
-	b << std::string(Numbers::ConnectionProtocolAssignedNames::RequestType::PtyReq);
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_REQUEST);
+	b << LookupChannel(channelId).GetRemoteId();
+	b << Numbers::ConnectionProtocolAssignedNames::RequestType::PtyReq;
 	b << true; // want reply
-	b << std::string(term);
+	b << term;
 	b << static_cast<uint32_t>(0);
 	b << static_cast<uint32_t>(0);
 	b << static_cast<uint32_t>(0);
 	b << static_cast<uint32_t>(0);
-	b << std::string();
+	b << "";
 	TransmitPacket(b);
 }
 
-void Transport::RequestChannel(int recipientChannel, const std::string& requestType)
+void Transport::RequestExec(int channelId, const std::string& command)
 {
-	Buffer b;
-	b << static_cast<uint32_t>(0); // len
-	b << static_cast<uint8_t>(0); // padding len
-	b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_CHANNEL_REQUEST);
-	b << static_cast<uint32_t>(recipientChannel);
+	// [SSH-CONNECT, 6.5]
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_REQUEST);
+	b << LookupChannel(channelId).GetRemoteId();
+	b << Numbers::ConnectionProtocolAssignedNames::RequestType::Exec;
+	b << true; // want reply
+	b << command;
+	TransmitPacket(b);
+}
+
+void Transport::RequestChannel(int channelId, const std::string& requestType)
+{
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_REQUEST);
+	b << LookupChannel(channelId).GetRemoteId();
 	b << requestType;
 	b << true; // want reply
 	TransmitPacket(b);
 }
 
-void Transport::OpenChannel(int channelId, const char* name)
+int Transport::OpenChannel(const char* name)
 {
-	Buffer b;
-	b << static_cast<uint32_t>(0); // len
-	b << static_cast<uint8_t>(0); // padding len
-	b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_CHANNEL_OPEN);
-	b << std::string(name);
-	b << static_cast<uint32_t>(channelId); // sender channel
-	b << static_cast<uint32_t>(4096); // window size
-	b << static_cast<uint32_t>(1024); // max packet size
+	int channelId;
+	Buffer& b = BeginChannelOpen(name, channelId);
+	TransmitPacket(b);
+	return channelId;
+}
+
+int Transport::OpenDirectTcpIp(const std::string& host, uint32_t port, const std::string& originatorAddress, uint32_t originatorPort)
+{
+	int channelId;
+	Buffer& b = BeginChannelOpen(Numbers::ConnectionProtocolAssignedNames::ChannelTypes::DirectTcpIp, channelId);
+	b << host;
+	b << port;
+	b << originatorAddress;
+	b << originatorPort;
+	TransmitPacket(b);
+	return channelId;
+}
+
+void Transport::RequestTcpIpForward(const std::string& address, uint32_t port)
+{
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_GLOBAL_REQUEST);
+	b << Numbers::ConnectionProtocolAssignedNames::RequestType::TcpIpForward;
+	b << true; // want reply
+	b << address;
+	b << port;
+	TransmitPacket(b);
+	m_PendingForwards.push_back(PendingForward{ address, port });
+}
+
+void Transport::CancelTcpIpForward(const std::string& address, uint32_t port)
+{
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_GLOBAL_REQUEST);
+	b << Numbers::ConnectionProtocolAssignedNames::RequestType::CancelTcpIpForward;
+	b << false; // want reply
+	b << address;
+	b << port;
+	TransmitPacket(b);
+}
+
+Channel& Transport::AllocateChannel()
+{
+	uint32_t channelId;
+	if (!m_FreeChannelIds.empty()) {
+		channelId = m_FreeChannelIds.back();
+		m_FreeChannelIds.pop_back();
+	} else {
+		channelId = m_Channels.size();
+		m_Channels.emplace_back();
+	}
+	m_Channels[channelId].reset(new Channel(channelId, m_ChannelWindowSettings));
+	return *m_Channels[channelId];
+}
+
+Buffer& Transport::BeginChannelOpen(const char* name, int& channelNumber)
+{
+	Channel& channel = AllocateChannel();
+	ChannelWindow& window = channel.GetReceiveWindow();
+
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_OPEN);
+	b << name;
+	b << channel.GetLocalId(); // sender channel
+	b << window.GetInitialSize(); // window size
+	b << window.GetMaxPacketSize(); // max packet size
+	channelNumber = channel.GetLocalId();
+	return b;
+}
+
+void Transport::AcceptChannelOpen(int channelId)
+{
+	Channel& channel = LookupChannel(channelId);
+	if (channel.GetState() != Channel::State::Opening)
+		return;
+	ChannelWindow& window = channel.GetReceiveWindow();
+
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_OPEN_CONFIRMATION);
+	b << channel.GetRemoteId(); // recipient channel
+	b << channel.GetLocalId(); // sender channel
+	b << window.GetInitialSize(); // window size
+	b << window.GetMaxPacketSize(); // max packet size
 	TransmitPacket(b);
+	channel.OnOpenAccepted();
+	TransmitPendingChannelData(channel);
+}
+
+void Transport::RejectChannelOpen(int channelId, Numbers::ChannelReason reason, const std::string& description)
+{
+	Channel& channel = LookupChannel(channelId);
+	if (channel.GetState() != Channel::State::Opening)
+		return;
+
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_OPEN_FAILURE);
+	b << channel.GetRemoteId();
+	b << static_cast<uint32_t>(reason);
+	b << description;
+	b << ""; // language tag
+	TransmitPacket(b);
+
+	// The channel never existed as far as the server is concerned; neither is it closed for the application
+	FreeChannel(channel.GetLocalId());
 }
 
 void Transport::RequestUserAuth(const std::string& serviceName, const std::string& userName)
 {
-	Buffer b;
-	b << static_cast<uint32_t>(0); // len
-	b << static_cast<uint8_t>(0); // padding len
-	b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_USERAUTH_REQUEST);
-	b << std::string(userName);
-	b << std::string(serviceName);
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_USERAUTH_REQUEST);
+	b << userName;
+	b << serviceName;
 	// XXX support 'password' too?
-	b << std::string(Numbers::AuthenticationMethodNames::KeyboardInteractive);
-	b << std::string(); // language tag
-	b << std::string(); // submethods
+	b << Numbers::AuthenticationMethodNames::KeyboardInteractive;
+	b << ""; // language tag
+	b << ""; // submethods
 	TransmitPacket(b);
 }
 
-void Transport::TransmitChannelData(int channelId, const std::string& data)
+Channel* Transport::GetChannel(int channelId)
 {
-	Buffer b;
-	b << static_cast<uint32_t>(0); // len
-	b << static_cast<uint8_t>(0); // padding len
-	b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_CHANNEL_DATA);
-	b << static_cast<uint32_t>(channelId);
-	b << data;
+	if (channelId < 0 || static_cast<size_t>(channelId) >= m_Channels.size())
+		return NULL;
+	return m_Channels[channelId].get();
+}
+
+Channel& Transport::LookupChannel(uint32_t channelId)
+{
+	Channel* channel = GetChannel(channelId);
+	if (channel == NULL)
+		throw Exception(Exception::C_Channel_Unknown);
+	return *channel;
+}
+
+void Transport::TransmitChannelData(int channelId, const uint8_t* data, size_t len)
+{
+	Channel& channel = LookupChannel(channelId);
+	if (channel.IsEOFPending() || channel.IsEOFSent() || channel.IsCloseSent())
+		return; // [SSH-CONNECT, 5.3] no more data may be sent
+
+	// Data must not overtake what is already waiting
+	if (channel.GetPendingData().empty() && channel.GetState() == Channel::State::Open && !m_KexInProgress) {
+		size_t maxPacket = channel.GetRemoteMaxPacketSize();
+		if (maxPacket > maxChannelDataLength)
+			maxPacket = maxChannelDataLength;
+		while (len > 0 && channel.GetSendWindow() > 0 && maxPacket > 0) {
+			size_t n = std::min<size_t>(std::min<size_t>(len, maxPacket), channel.GetSendWindow());
+			TransmitChannelDataPacket(channel, data, n);
+			data += n;
+			len -= n;
+		}
+	}
+	channel.GetPendingData().append((const char*)data, len);
+}
+
+size_t Transport::GetChannelPendingBytes(int channelId)
+{
+	return LookupChannel(channelId).GetPendingData().size();
+}
+
+size_t Transport::GetChannelSendRoom(int channelId)
+{
+	return GetSendRoom(LookupChannel(channelId));
+}
+
+size_t Transport::GetSendRoom(const Channel& channel) const
+{
+	if (channel.GetState() != Channel::State::Open || !channel.GetPendingData().empty() ||
+	    channel.IsEOFPending() || channel.IsEOFSent() || channel.IsCloseSent() || m_KexInProgress)
+		return 0;
+	size_t room = channel.GetRemoteMaxPacketSize();
+	if (room > maxChannelDataLength)
+		room = maxChannelDataLength;
+	return std::min<size_t>(room, channel.GetSendWindow());
+}
+
+ssize_t Transport::TransmitChannelDataFrom(int channelId, Socket& socket)
+{
+	Channel& channel = LookupChannel(channelId);
+	const size_t room = GetSendRoom(channel);
+	if (room == 0)
+		return 0;
+
+	// Reserve the string length and fill it out once we know how much we got
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_DATA);
+	b << channel.GetRemoteId();
+	const Buffer::Position lengthPosition = b.GetWritePosition();
+	b << static_cast<uint32_t>(0);
+	ssize_t n = socket.Receive(b.GetWritePointer(), room);
+	if (n <= 0)
+		return n; // the packet is simply not queued; the next BeginPacket() starts over
+	b.SetWritePosition(lengthPosition);
+	b << static_cast<uint32_t>(n);
+	b.SetWritePosition(b.GetWritePosition() + n);
+	TransmitPacket(b);
+	channel.OnSent(n);
+	return n;
+}
+
+void Transport::TransmitChannelDataPacket(Channel& channel, const uint8_t* data, size_t len)
+{
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_DATA);
+	b << channel.GetRemoteId();
+	b.PutData(data, len);
+	TransmitPacket(b);
+	channel.OnSent(len);
+}
+
+void Transport::TransmitPendingChannelData(Channel& channel)
+{
+	// Nothing may follow our close; during a key exchange, it waits
+	if (channel.GetState() != Channel::State::Open || channel.IsCloseSent() || m_KexInProgress)
+		return;
+
+	std::string& pending = channel.GetPendingData();
+	size_t maxPacket = channel.GetRemoteMaxPacketSize();
+	if (maxPacket > maxChannelDataLength)
+		maxPacket = maxChannelDataLength;
+	size_t offset = 0;
+	while (offset < pending.size() && channel.GetSendWindow() > 0 && maxPacket > 0) {
+		size_t n = std::min<size_t>(std::min<size_t>(pending.size() - offset, maxPacket), channel.GetSendWindow());
+		TransmitChannelDataPacket(channel, (const uint8_t*)pending.data() + offset, n);
+		offset += n;
+	}
+	pending.erase(0, offset);
+
+	if (pending.empty() && channel.IsEOFPending()) {
+		Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_EOF);
+		b << channel.GetRemoteId();
+		TransmitPacket(b);
+		channel.SetEOFPending(false);
+		channel.SetEOFSent();
+	}
+}
+
+void Transport::SendChannelEOF(int channelId)
+{
+	Channel& channel = LookupChannel(channelId);
+	if (channel.IsEOFPending() || channel.IsEOFSent() || channel.IsCloseSent())
+		return;
+	channel.SetEOFPending(true);
+	TransmitPendingChannelData(channel);
+}
+
+void Transport::CloseChannel(int channelId)
+{
+	Channel& channel = LookupChannel(channelId);
+	if (channel.IsCloseSent())
+		return;
+	// The server's number is unknown until the channel is confirmed
+	if (channel.GetState() == Channel::State::Opening)
+		throw Exception(Exception::C_Channel_Unknown);
+
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_CLOSE);
+	b << channel.GetRemoteId();
 	TransmitPacket(b);
+	channel.SetCloseSent();
+	ReleaseChannel(channel);
+}
+
+void Transport::ReleaseChannel(Channel& channel)
+{
+	if (!channel.IsCloseSent() || !channel.IsCloseReceived())
+		return;
+
+	uint32_t channelId = channel.GetLocalId();
+	FreeChannel(channelId);
+	m_Callback.OnChannelClosed(channelId);
+}
+
+void Transport::FreeChannel(uint32_t channelId)
+{
+	m_Channels[channelId].reset();
+	m_FreeChannelIds.insert(std::lower_bound(m_FreeChannelIds.begin(), m_FreeChannelIds.end(), channelId, std::greater<uint32_t>()), channelId);
 }
 
 void Transport::AdjustChannelWindow(int channelId, unsigned int bytesToAdd)
 {
-	Buffer b;
-	b << static_cast<uint32_t>(0); // len
-	b << static_cast<uint8_t>(0); // padding len
-	b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_CHANNEL_WINDOW_ADJUST);
-	b << static_cast<uint32_t>(channelId);
+	Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_CHANNEL_WINDOW_ADJUST);
+	b << LookupChannel(channelId).GetRemoteId();
 	b << static_cast<uint32_t>(bytesToAdd);
 	TransmitPacket(b);
+	m_WindowAdjustCount++;
+}
+
+void Transport::ChannelDataConsumed(int channelId, size_t len)
+{
+	Channel* channel = GetChannel(channelId);
+	if (channel == NULL || channel->IsCloseSent())
+		return;
+
+	uint32_t bytesToAdd = channel->GetReceiveWindow().OnConsumed(len);
+	if (bytesToAdd > 0)
+		AdjustChannelWindow(channelId, bytesToAdd);
+}
+
+void Transport::AcknowledgeChannelData(int channelId)
+{
+	Channel* channel = GetChannel(channelId);
+	if (channel == NULL || channel->IsCloseSent())
+		return;
+
+	uint32_t bytesToAdd = channel->GetReceiveWindow().Acknowledge();
+	if (bytesToAdd > 0)
+		AdjustChannelWindow(channelId, bytesToAdd);
 }
 
 void Transport::Process()
 {
-	if (!m_Socket.Fill(m_Buffer))
+	while (true) {
+		// Ensure a complete packet fits after whatever we haven't processed yet
+		if (m_Buffer.GetSize() - m_Buffer.GetReadPosition() < maxPacketSize)
+			m_Buffer.Shift();
+		const size_t room = m_Buffer.GetSize() - m_Buffer.GetWritePosition();
+		ssize_t n = m_Socket.Fill(m_Buffer);
+		if (n < 0)
+			throw Exception(Exception::C_Socket_Error);
+		if (n == 0)
+			break;
+
+		if (m_Greeter[0] != '\0' || ReceiveGreeter())
+			ProcessPackets();
+
+		// A short read means the socket is drained; anything arriving later is a new event
+		if (static_cast<size_t>(n) < room)
+			break;
+	}
+
+	// Send whatever the packets caused us to send in as few writes as possible
+	Flush();
+}
+
+void Transport::Register(Reactor& reactor, IoRing* ring)
+{
+	Register(reactor, ring, [this](unsigned int events) { HandleEvents(events); });
+}
+
+void Transport::Register(Reactor& reactor, IoRing* ring, Reactor::Handler handler)
+{
+	m_Socket.Register(reactor, ring, std::move(handler));
+
+	// The ring only reports writability once it ran out of room, so hand it what we have, i.e. the greeter
+	if (ring != NULL)
+		Flush();
+}
+
+void Transport::HandleEvents(unsigned int events)
+{
+	// Flush first: a connection in progress becomes writable once it's made
+	if (events & Reactor::Writable)
+		Flush();
+	if (events & Reactor::Readable)
+		Process();
+}
+
+bool Transport::Flush()
+{
+	if (IsRekeyDue())
+		Rekey();
+	if (!m_TransmitQueue.Flush(m_Socket))
 		throw Exception(Exception::C_Socket_Error);
+	return m_TransmitQueue.IsEmpty();
+}
+
+Buffer& Transport::DecompressPayload(size_t& payloadEnd)
+{
+	// The compressed payload is done with once it's decompressed
+	m_DecompressedPayload->Clear();
+	m_Decompressor->Decompress(m_Buffer.GetReadPointer(), payloadEnd - m_Buffer.GetReadPosition(), *m_DecompressedPayload);
+	m_Buffer.SetReadPosition(payloadEnd);
+	payloadEnd = m_DecompressedPayload->GetWritePosition();
+	return *m_DecompressedPayload;
+}
+
+void Transport::UpdateCompression()
+{
+	// [OPENSSH-PROTOCOL, 1.2] compression is delayed until the server accepted our authentication;
+	// the streams then carry on across key exchanges
+	if (!m_Authenticated)
+		return;
+	if (m_DelayedCompression_C2S && m_Compressor == NULL) {
+		Trace::Info("compressing outgoing packets");
+		m_Compressor = new Compressor(m_CompressionSettings);
+	} else if (!m_DelayedCompression_C2S) {
+		delete m_Compressor;
+		m_Compressor = NULL;
+	}
+	if (m_DelayedCompression_S2C && m_Decompressor == NULL) {
+		Trace::Info("decompressing incoming packets");
+		m_Decompressor = new Decompressor;
+		m_DecompressedPayload.reset(new Buffer(maxPacketLength));
+	} else if (!m_DelayedCompression_S2C) {
+		delete m_Decompressor;
+		m_Decompressor = NULL;
+		m_DecompressedPayload.reset();
+	}
+}
 
+void Transport::ProcessPackets()
+{
 	while(m_Buffer.GetAvailableBytes() >= sizeof(uint32_t)) {
 		if (m_Algorithm != NULL && m_BufferDecryptedPosition < sizeof(uint32_t)) {
 			// We first need to decrypt the length - note that we can't blindly jam all
 			// bytes in the decryption code because the HMAC is not encrypted
-			if (m_Buffer.GetAvailableBytes() < m_Algorithm->GetBlockSize_S2C()) {
-				Trace::Debug("not enough bytes to decrypt (have %d, need %d)", m_Buffer.GetAvailableBytes(), m_Algorithm->GetBlockSize_S2C());
+			if (m_Buffer.GetAvailableBytes() < m_Algorithm->GetLengthBlockSize_S2C()) {
+				Trace::Debug("not enough bytes to decrypt (have %d, need %d)", m_Buffer.GetAvailableBytes(), m_Algorithm->GetLengthBlockSize_S2C());
 				return;
 			}
 
 			// We can decrypt the first block now
-			m_Algorithm->Decrypt_S2C((uint8_t*)m_Buffer.GetReadPointer(), m_Algorithm->GetBlockSize_S2C());
-			m_BufferDecryptedPosition += m_Algorithm->GetBlockSize_S2C();
-
+			m_BufferDecryptedPosition += m_Algorithm->DecryptLength_S2C((uint8_t*)m_Buffer.GetReadPointer(), m_S2C_SequenceNumber);
 		}
 
 		// Process the data - front of the buffer is no longer encrypted
 		uint32_t len;
 		m_Buffer >> len;
-		if (len < 1 || len > m_Buffer.GetSize()) {
+		if (len < 1 || len > maxPacketLength) {
 			Trace::Error("got excessive length %d!", len);
 			throw Exception(Exception::C_Transport_Invalid_Length);
 		}
@@ -323,20 +857,17 @@ void Transport::Process()
 
 			// [SSH-TRANS, 6] 'The length of 'packet_length',
 			// 'padding_length', 'payload' and 'random_padding'
-			// must be a multiple of the cipher size
-			if ((len + 4) % m_Algorithm->GetBlockSize_S2C())
+			// must be a multiple of the cipher size; AEAD ciphers
+			// and encrypt-then-MAC leave the 'packet_length' out
+			size_t aligned_len = m_Algorithm->IsLengthExcluded_S2C() ? len : len + 4;
+			if (aligned_len % m_Algorithm->GetBlockSize_S2C())
 				throw Exception(Exception::C_Transport_Invalid_Length);
 
-			// Decrypt the payload; the length doesn't include the
-			// size (which we already decrypted), so skip that and
-			// decrypt the packet contents - not the HMAC
-			size_t left = (len + 4) - m_BufferDecryptedPosition;
-			uint8_t* pos = (uint8_t*)m_Buffer.GetReadPointer() + m_BufferDecryptedPosition - 4;
-			m_Algorithm->Decrypt_S2C(pos, left);
-			m_BufferDecryptedPosition += left;
-
-			// Now that we have decrypted everything, ensure the HMAC matches
-			if (!m_Algorithm->CheckHMAC_S2C(m_Buffer.GetReadPointer() - 4, len + 4, m_S2C_SequenceNumber))
+			// Decrypt the rest of the packet - not the HMAC - and
+			// ensure the HMAC matches; the packet starts at the
+			// length, which we already decrypted
+			uint8_t* packet = (uint8_t*)m_Buffer.GetReadPointer() - 4;
+			if (!m_Algorithm->DecryptAndVerify_S2C(packet, m_BufferDecryptedPosition, len + 4, m_S2C_SequenceNumber))
 				throw Exception(Exception::C_HMAC_Mismatch);
 		}
 		m_BufferDecryptedPosition = 0;
@@ -344,25 +875,36 @@ void Transport::Process()
 		// We have an entire packet, and it has been verified. Now process it
 		bool switch_algorithm = false;
 		uint8_t padding_length, msg_type;
-		m_Buffer >> padding_length >> msg_type;
+		m_Buffer >> padding_length;
+		// Everything up to the random padding; this moves along if the payload is decompressed
+		size_t payload_end = m_Buffer.GetReadPosition() + len - padding_length - 1;
+		Buffer& payload = m_Decompressor != NULL ? DecompressPayload(payload_end) : m_Buffer;
+		payload >> msg_type;
+		if (m_IgnoreGuessedKexPacket) {
+			// [SSH-TRANS, 7] The server guessed the key exchange wrong; its first packet
+			// must be ignored, which we achieve by treating it as an unsupported message
+			Trace::Debug("ignoring guessed key exchange packet, type %d", msg_type);
+			m_IgnoreGuessedKexPacket = false;
+			msg_type = 0;
+		}
 		switch(static_cast<Numbers::MessageID>(msg_type)) {
 			case Numbers::MessageID::SSH_MSG_KEXINIT: {
 				Trace::Debug("got SSH_MSG_KEXINIT");
-				OnMessageKexInit(m_Buffer, len, padding_length);
+				OnMessageKexInit(payload, payload_end);
 				break;
 			}
 			case Numbers::MessageID::SSH_MSG_KEXDH_REPLY: {
 				Trace::Debug("got SSH_MSG_KEXDH_REPLY");
-				if (m_DHExchange != NULL) {
-					m_DHExchange->OnReply(m_Buffer);
-					if (m_DHExchange->GetKeys() != NULL) {
-						// XXX store chosen algorithm names
-						m_PendingAlgorithm = new Algorithm("aes128-cbc", "aes128-cbc", "hmac-sha1", "hmac-sha1", *m_DHExchange->GetKeys());
+				if (m_KeyExchange != NULL) {
+					m_KeyExchange->OnReply(payload);
+					if (m_KeyExchange->GetKeys() != NULL) {
+						const NegotiatedAlgorithms& n = m_Negotiated;
+						m_PendingAlgorithm = new Algorithm(n.m_Cipher_C2S.c_str(), n.m_Cipher_S2C.c_str(), n.m_MAC_C2S.c_str(), n.m_MAC_S2C.c_str(), *m_KeyExchange->GetKeys());
 					} else {
 						Trace::Error("got SSH_MSG_KEXDH_REPLY but no keys?");
 					}	
-					delete m_DHExchange;
-					m_DHExchange = NULL;
+					delete m_KeyExchange;
+					m_KeyExchange = NULL;
 				} else {
 					Trace::Warning("got unexpected SSH_MSG_KEXDH_REPLY, ignoring");
 				}
@@ -371,7 +913,7 @@ void Transport::Process()
 			case Numbers::MessageID::SSH_MSG_SERVICE_ACCEPT: {
 				Trace::Debug("got SSH_MSG_SERVICE_ACCEPT");
 				std::string service_name;
-				m_Buffer >> service_name;
+				payload >> service_name;
 
 				Trace::Info("service accept [%s]", service_name.c_str());
 				m_Callback.OnServiceAccepted(service_name);
@@ -382,10 +924,7 @@ void Transport::Process()
 				if (m_PendingAlgorithm != NULL) {
 					// Acknowledge the request by sending a NEWKEYS
 					{
-						Buffer b;
-						b << static_cast<uint32_t>(0); // len
-						b << static_cast<uint8_t>(0); // padding len
-						b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_NEWKEYS);
+						Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_NEWKEYS);
 						TransmitPacket(b);
 					}
 
@@ -399,6 +938,8 @@ void Transport::Process()
 			}
 			case Numbers::MessageID::SSH_MSG_USERAUTH_SUCCESS: {
 				Trace::Debug("got SSH_MSG_USERAUTH_SUCCESS");
+				m_Authenticated = true;
+				UpdateCompression();
 
 				m_Callback.OnAuthenticationSuccess();
 				break;
@@ -408,25 +949,22 @@ void Transport::Process()
 				// [KBD-INT, 3.2]
 				std::string name, instruction, language;
 				uint32_t num_prompts;
-				m_Buffer >> name >> instruction >> language >> num_prompts;
+				payload >> name >> instruction >> language >> num_prompts;
 				Trace::Info("name '%s' instruction '%s' language '%s'", name.c_str(), instruction.c_str(), language.c_str());
 
 				std::vector<AuthenticationPrompt> prompts;
 				prompts.resize(num_prompts);
 				for (unsigned int n = 0; n < num_prompts; n++)
-					m_Buffer >> prompts[n].m_Prompt;
+					payload >> prompts[n].m_Prompt;
 				for (unsigned int n = 0; n < num_prompts; n++)
-					m_Buffer >> prompts[n].m_Echo;
+					payload >> prompts[n].m_Echo;
 
 				// If we got at least a single prompt, hand it to the application
 				if (num_prompts > 0 && !m_Callback.OnAuthenticationPrompt(prompts))
 					break; // application didn't want to reply 
 
 				// Issue the reply [KBD-INT, 3.4]
-				Buffer b;
-				b << static_cast<uint32_t>(0); // len
-				b << static_cast<uint8_t>(0); // padding len
-				b << static_cast<uint8_t>(Numbers::MessageID::SSH_MSG_USERAUTH_INFO_RESPONSE);
+				Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_USERAUTH_INFO_RESPONSE);
 				b << static_cast<uint32_t>(num_prompts);
 				for (unsigned int n = 0; n < num_prompts; n++)
 					b << prompts[n].m_Reply;
@@ -437,7 +975,7 @@ void Transport::Process()
 				Trace::Debug("got SSH_MSG_USERAUTH_FAILURE");
 				Types::NameList auths;
 				bool partial;
-				m_Buffer >> auths >> partial;
+				payload >> auths >> partial;
 
 				m_Callback.OnAuthenticationFailure(partial, auths);
 				break;
@@ -445,16 +983,70 @@ void Transport::Process()
 			case Numbers::MessageID::SSH_MSG_CHANNEL_OPEN_CONFIRMATION: {
 				Trace::Debug("got SSH_MSG_CHANNEL_OPEN_CONFIRMATION");
 				uint32_t channelNumber, senderChannel, initialWindowSize, maxPacketSize;
-				m_Buffer >> channelNumber >> senderChannel >> initialWindowSize >> maxPacketSize;
+				payload >> channelNumber >> senderChannel >> initialWindowSize >> maxPacketSize;
 				Trace::Debug("channel %d sender %d iws %d mps %d", channelNumber, senderChannel, initialWindowSize, maxPacketSize);
 
+				Channel& channel = LookupChannel(channelNumber);
+				channel.OnOpenConfirmed(senderChannel, initialWindowSize, maxPacketSize);
+				TransmitPendingChannelData(channel);
 				m_Callback.OnChannelOpened(channelNumber);
 				break;
 			}
+			case Numbers::MessageID::SSH_MSG_CHANNEL_OPEN_FAILURE: {
+				Trace::Debug("got SSH_MSG_CHANNEL_OPEN_FAILURE");
+				uint32_t channelNumber, reasonCode;
+				std::string description, language;
+				payload >> channelNumber >> reasonCode >> description >> language;
+				Trace::Info("channel %d open failure %d [%s]", channelNumber, reasonCode, description.c_str());
+
+				// The channel never existed as far as the server is concerned
+				Channel& channel = LookupChannel(channelNumber);
+				channel.SetCloseSent();
+				channel.SetCloseReceived();
+				m_Callback.OnChannelOpenFailure(channelNumber, reasonCode, description);
+				ReleaseChannel(channel);
+				break;
+			}
+			case Numbers::MessageID::SSH_MSG_CHANNEL_WINDOW_ADJUST: {
+				Trace::Debug("got SSH_MSG_CHANNEL_WINDOW_ADJUST");
+				uint32_t channelNumber, bytesToAdd;
+				payload >> channelNumber >> bytesToAdd;
+
+				Channel& channel = LookupChannel(channelNumber);
+				if (!channel.OnWindowAdjust(bytesToAdd))
+					throw Exception(Exception::C_Channel_Window_Exceeded);
+				TransmitPendingChannelData(channel);
+				if (GetSendRoom(channel) > 0)
+					m_Callback.OnChannelWritable(channelNumber);
+				break;
+			}
+			case Numbers::MessageID::SSH_MSG_CHANNEL_EOF: {
+				Trace::Debug("got SSH_MSG_CHANNEL_EOF");
+				uint32_t channelNumber;
+				payload >> channelNumber;
+
+				LookupChannel(channelNumber).SetEOFReceived();
+				m_Callback.OnChannelEOF(channelNumber);
+				break;
+			}
+			case Numbers::MessageID::SSH_MSG_CHANNEL_CLOSE: {
+				Trace::Debug("got SSH_MSG_CHANNEL_CLOSE");
+				uint32_t channelNumber;
+				payload >> channelNumber;
+
+				// [SSH-CONNECT, 5.3] reply with a close of our own, unless we already sent it
+				Channel& channel = LookupChannel(channelNumber);
+				channel.SetCloseReceived();
+				if (!channel.IsCloseSent())
+					CloseChannel(channelNumber);
+				else
+					ReleaseChannel(channel);
+				break;
+			}
 			case Numbers::MessageID::SSH_MSG_CHANNEL_SUCCESS: {
 				Trace::Debug("got SSH_MSG_CHANNEL_SUCCESS");
 				uint32_t channelNumber;
-				m_Buffer >> channelNumber;
+				payload >> channelNumber;
 				Trace::Debug("channel %d", channelNumber);
 
 				m_Callback.OnChannelRequestSuccess(channelNumber);
@@ -463,7 +1055,7 @@ void Transport::Process()
 			case Numbers::MessageID::SSH_MSG_CHANNEL_FAILURE: {
 				Trace::Debug("got SSH_MSG_CHANNEL_FAILURE");
 				uint32_t channelNumber;
-				m_Buffer >> channelNumber;
+				payload >> channelNumber;
 				Trace::Debug("channel %d", channelNumber);
 
 				m_Callback.OnChannelRequestFailure(channelNumber);
@@ -473,27 +1065,139 @@ void Transport::Process()
 				Trace::Debug("got SSH_MSG_CHANNEL_DATA");
 
 				uint32_t channelNumber;
-				std::string data;
-				m_Buffer >> channelNumber >> data;
-				Trace::Info("channel %d data length %d", channelNumber, data.length());
+				const uint8_t* data;
+				size_t data_len;
+				payload >> channelNumber;
+				payload.GetDataView(data, data_len);
+				Trace::Info("channel %d data length %d", channelNumber, (int)data_len);
+				if (!LookupChannel(channelNumber).GetReceiveWindow().OnReceived(data_len))
+					throw Exception(Exception::C_Channel_Window_Exceeded);
+
+				m_Callback.OnChannelData(channelNumber, data, data_len);
+				break;
+			}
+			case Numbers::MessageID::SSH_MSG_CHANNEL_EXTENDED_DATA: {
+				Trace::Debug("got SSH_MSG_CHANNEL_EXTENDED_DATA");
+
+				uint32_t channelNumber, dataType;
+				const uint8_t* data;
+				size_t data_len;
+				payload >> channelNumber >> dataType;
+				payload.GetDataView(data, data_len);
+				Trace::Info("channel %d extended data type %d length %d", channelNumber, dataType, (int)data_len);
+				// [SSH-CONNECT, 5.2] extended data shares the window with normal data
+				if (!LookupChannel(channelNumber).GetReceiveWindow().OnReceived(data_len))
+					throw Exception(Exception::C_Channel_Window_Exceeded);
+
+				m_Callback.OnChannelExtendedData(channelNumber, dataType, data, data_len);
+				break;
+			}
+			case Numbers::MessageID::SSH_MSG_CHANNEL_REQUEST: {
+				Trace::Debug("got SSH_MSG_CHANNEL_REQUEST");
+				uint32_t channelNumber;
+				std::string requestType;
+				bool wantReply;
+				payload >> channelNumber >> requestType >> wantReply;
+				Trace::Info("channel %d request [%s] want_reply %s", channelNumber, requestType.c_str(), wantReply ? "yes" : "no");
+
+				Channel& channel = LookupChannel(channelNumber);
+				bool handled = true;
+				if (requestType == Numbers::ConnectionProtocolAssignedNames::RequestType::ExitStatus) {
+					// [SSH-CONNECT, 6.10]
+					uint32_t exitStatus;
+					payload >> exitStatus;
+					m_Callback.OnChannelExitStatus(channelNumber, exitStatus);
+				} else if (requestType == Numbers::ConnectionProtocolAssignedNames::RequestType::ExitSignal) {
+					// [SSH-CONNECT, 6.10]
+					std::string signalName, errorMessage, language;
+					bool coreDumped;
+					payload >> signalName >> coreDumped >> errorMessage >> language;
+					m_Callback.OnChannelExitSignal(channelNumber, signalName, coreDumped, errorMessage);
+				} else {
+					handled = false;
+				}
+				payload.SetReadPosition(payload_end);
+
+				// [SSH-CONNECT, 5.4] requests we do not understand must be refused
+				if (wantReply && !channel.IsCloseSent()) {
+					Buffer& b = BeginPacket(handled ? Numbers::MessageID::SSH_MSG_CHANNEL_SUCCESS : Numbers::MessageID::SSH_MSG_CHANNEL_FAILURE);
+					b << channel.GetRemoteId();
+					TransmitPacket(b);
+				}
+				break;
+			}
+			case Numbers::MessageID::SSH_MSG_CHANNEL_OPEN: {
+				Trace::Debug("got SSH_MSG_CHANNEL_OPEN");
+				std::string channelType;
+				uint32_t senderChannel, initialWindowSize, maxPacketSize;
+				payload >> channelType >> senderChannel >> initialWindowSize >> maxPacketSize;
+				Trace::Info("channel open [%s] sender %d iws %d mps %d", channelType.c_str(), senderChannel, initialWindowSize, maxPacketSize);
+
+				Channel& channel = AllocateChannel();
+				channel.OnOpenRequested(senderChannel, initialWindowSize, maxPacketSize);
+				const int channelNumber = channel.GetLocalId();
+				bool known = false, handled = false;
+				if (channelType == Numbers::ConnectionProtocolAssignedNames::ChannelTypes::ForwardedTcpIp) {
+					// [SSH-CONNECT, 7.2]
+					std::string connectedAddress, originatorAddress;
+					uint32_t connectedPort, originatorPort;
+					payload >> connectedAddress >> connectedPort >> originatorAddress >> originatorPort;
+					known = true;
+					handled = m_Callback.OnForwardedTcpIp(channelNumber, connectedAddress, connectedPort, originatorAddress, originatorPort);
+				}
+				payload.SetReadPosition(payload_end);
 
-				m_Callback.OnChannelData(channelNumber, data);
+				// Otherwise, the application accepts or refuses the channel itself; it may be gone already
+				if (!handled)
+					RejectChannelOpen(channelNumber,
+						known ? Numbers::ChannelReason::SSH_OPEN_ADMINISTRATIVELY_PROHIBITED : Numbers::ChannelReason::SSH_OPEN_UNKNOWN_CHANNEL_TYPE,
+						known ? "not forwarded" : "unsupported channel type");
 				break;
 			}
-#if 0
 			case Numbers::MessageID::SSH_MSG_GLOBAL_REQUEST: {
 				Trace::Debug("got SSH_MSG_GLOBAL_REQUEST");
-				std::string channel;
-				bool want_reply;
-				m_Buffer >> channel >> want_reply;
-				printf("channel [%s] want_reply %s\n", channel.c_str(), want_reply ? "yes" : "no");
+				std::string requestName;
+				bool wantReply;
+				payload >> requestName >> wantReply;
+				Trace::Info("global request [%s] want_reply %s", requestName.c_str(), wantReply ? "yes" : "no");
+				payload.SetReadPosition(payload_end);
+
+				// [SSH-CONNECT, 4] we have nothing to offer, i.e. to keepalives
+				if (wantReply) {
+					Buffer& b = BeginPacket(Numbers::MessageID::SSH_MSG_REQUEST_FAILURE);
+					TransmitPacket(b);
+				}
+				break;
+			}
+			case Numbers::MessageID::SSH_MSG_REQUEST_SUCCESS:
+			case Numbers::MessageID::SSH_MSG_REQUEST_FAILURE: {
+				const bool success = static_cast<Numbers::MessageID>(msg_type) == Numbers::MessageID::SSH_MSG_REQUEST_SUCCESS;
+				Trace::Debug("got %s", success ? "SSH_MSG_REQUEST_SUCCESS" : "SSH_MSG_REQUEST_FAILURE");
+				// The only global requests we want replies to are tcpip-forward
+				if (m_PendingForwards.empty()) {
+					Trace::Warning("unexpected global request reply ignored");
+					payload.SetReadPosition(payload_end);
+					break;
+				}
+				const PendingForward forward = m_PendingForwards.front();
+				m_PendingForwards.pop_front();
+				if (success) {
+					// [SSH-CONNECT, 7.1] the port the server picked is only included if we asked it to
+					uint32_t boundPort = forward.m_Port;
+					if (forward.m_Port == 0 && payload.GetReadPosition() + sizeof(uint32_t) <= payload_end)
+						payload >> boundPort;
+					payload.SetReadPosition(payload_end);
+					m_Callback.OnTcpIpForwardSuccess(forward.m_Address, forward.m_Port, boundPort);
+				} else {
+					payload.SetReadPosition(payload_end);
+					m_Callback.OnTcpIpForwardFailure(forward.m_Address, forward.m_Port);
+				}
 				break;
 			}
-#endif
 			default: {
 				Trace::Debug("unsupported message type %d ignored", msg_type);
 				/* We just need to skip the payload of the message, not the padding/hash and msgtype/padding_len bytes */
-				m_Buffer.SetReadPosition(m_Buffer.GetReadPosition() + len - padding_length - 2);
+				payload.SetReadPosition(payload_end);
 			}
 		}
 
@@ -503,8 +1207,8 @@ void Transport::Process()
 			// Skip HMAC; it's already validated by now
 			m_Buffer.SetReadPosition(m_Buffer.GetReadPosition() + m_Algorithm->GetHMACSize_S2C());
 		}
-		m_Buffer.Shift();
 		m_S2C_SequenceNumber++;
+		m_S2C_KeyBytes += sizeof(uint32_t) + len;
 
 		// Perform sw
 		if (switch_algorithm) {
@@ -513,6 +1217,29 @@ void Transport::Process()
 			m_Algorithm = m_PendingAlgorithm;
 			m_PendingAlgorithm = NULL;
 
+			m_DelayedCompression_C2S = m_Negotiated.m_Compression_C2S == "zlib@openssh.com";
+			m_DelayedCompression_S2C = m_Negotiated.m_Compression_S2C == "zlib@openssh.com";
+			UpdateCompression();
+
+			// [SSH-TRANS, 7.3] our SSH_MSG_NEWKEYS went out, so the new keys apply to all that follows
+			const Clock::time_point now = Clock::now();
+			m_KexInProgress = false;
+			m_C2S_KeySequenceNumber = m_C2S_SequenceNumber;
+			m_S2C_KeySequenceNumber = m_S2C_SequenceNumber;
+			m_C2S_KeyBytes = 0;
+			m_S2C_KeyBytes = 0;
+			m_KeyTime = now;
+			if (!initial_algorithm_switch) {
+				RekeyStatistics& stats = m_RekeyStatistics;
+				stats.m_Count++;
+				stats.m_LastStall = now - m_KexStart;
+				stats.m_MaxStall = std::max(stats.m_MaxStall, stats.m_LastStall);
+				stats.m_TotalStall += stats.m_LastStall;
+				Trace::Info("keys exchanged again; sending was held back for %.3f ms",
+				 std::chrono::duration<double, std::milli>(stats.m_LastStall).count());
+			}
+			ResumeAfterKeyExchange();
+
 			// The initial switch to an algorithm means we have established the
 			// transport connection
 			if (initial_algorithm_switch)
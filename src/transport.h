@@ -2,28 +2,132 @@
 #define RSSH_TRANSPORT_H
 
 #include "buffer.h"
+#include "channel.h"
+#include "compression.h"
+#include "negotiation.h"
+#include "numbers.h"
 #include "socket.h"
+#include "transmit-queue.h"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace RSSH {
 
 class Algorithm;
 class Callback;
-class DHKeyExchange;
+class KeyExchange;
 
 class Transport {
 public:
+	typedef std::chrono::steady_clock Clock;
+
+	//! [SSH-TRANS, 9] When to exchange keys again; a limit of 0 means there is none
+	struct RekeySettings {
+		RekeySettings() : m_Bytes(1ULL << 30), m_Packets(1U << 31), m_Interval(3600) { }
+
+		//! Bytes sent or received with the same keys, in either direction
+		uint64_t m_Bytes;
+
+		//! [RFC4344, 3.1] Packets likewise; well before the sequence numbers wrap
+		uint32_t m_Packets;
+
+		//! Time since the keys were last exchanged
+		std::chrono::seconds m_Interval;
+	};
+
+	//! How long key exchanges after the first held back what we had to send
+	struct RekeyStatistics {
+		RekeyStatistics() : m_Count(0), m_LastStall(0), m_MaxStall(0), m_TotalStall(0) { }
+
+		unsigned int m_Count;
+		Clock::duration m_LastStall;
+		Clock::duration m_MaxStall;
+		Clock::duration m_TotalStall;
+	};
+
 	Transport(Callback& callback);
 	~Transport();
 
 	void Connect(const char* hostname, int port);
+
+	/*! Like Connect(), but does not wait for the connection to be made
+	 *
+	 *  Only name resolution blocks. The connection is complete once the
+	 *  socket is writable; Flush() throws if it could not be made.
+	 */
+	void StartConnect(const char* hostname, int port);
+
+	//! Like Connect(), but using an already connected file descriptor
+	void Attach(int fd);
+
+	/*! Handles incoming data
+	 *
+	 *  To be called once the socket is readable; this includes the server's
+	 *  greeter. Everything the socket has is read, so this is suitable for
+	 *  edge-triggered readiness. Anything sent in response is flushed
+	 *  before returning.
+	 */
 	void Process();
 
-	/*! Transmit a given buffer
+	//! Handles Reactor events for our socket
+	void HandleEvents(unsigned int events);
+
+	/*! Registers our socket, so that HandleEvents() is called for it
 	 *
-	 *  This will take care of padding, encryption and the MAC.
+	 *  If 'ring' is given, socket I/O goes through it instead. Call this
+	 *  once connected; the reactor and ring must outlive us.
+	 */
+	void Register(Reactor& reactor, IoRing* ring);
+
+	//! Like Register(), but calls 'handler' which is to call HandleEvents()
+	void Register(Reactor& reactor, IoRing* ring, Reactor::Handler handler);
+
+	/*! Starts a new packet of the given type
+	 *
+	 *  The buffer comes from the transmit queue, so only a single packet
+	 *  can be under construction at any time. The length and padding length
+	 *  are filled out by TransmitPacket().
+	 */
+	Buffer& BeginPacket(Numbers::MessageID type);
+
+	/*! Transmit a buffer obtained from BeginPacket()
+	 *
+	 *  This will take care of compression, padding, encryption and the MAC.
+	 *  All but compression is done in place; a compressed payload goes
+	 *  straight into another buffer of the transmit queue. The packet is
+	 *  queued; it is sent by Flush().
 	 */
 	void TransmitPacket(Buffer& buffer);
 
+	/*! Writes queued packets to the socket
+	 *
+	 *  Returns true if everything was written; if not, this must be called
+	 *  again once the socket is writable. A key exchange is started first
+	 *  if any of the rekey limits is reached, so an idle connection does
+	 *  so once it's used again.
+	 */
+	bool Flush();
+
+	/*! Starts exchanging keys again, unless that is already in progress
+	 *
+	 *  [SSH-TRANS, 7.1] until our SSH_MSG_NEWKEYS is sent, only key exchange
+	 *  messages may be: other packets are kept until then, and channels
+	 *  have no send room, so their data waits as pending. Does nothing
+	 *  before the transport is established.
+	 */
+	void Rekey();
+
+	//! When Flush() starts a key exchange
+	RekeySettings& GetRekeySettings() { return m_RekeySettings; }
+
+	const RekeyStatistics& GetRekeyStatistics() const { return m_RekeyStatistics; }
+
+	//! Are there queued packets waiting for the socket to become writable?
+	bool HasPendingOutput() const { return !m_TransmitQueue.IsEmpty(); }
+
 	const char* GetGreeter() const { return m_Greeter; }
 	char* GetServerKexPayload() const { return m_ServerKexPayload; }
 	size_t GetServerKexPayloadLength() const { return m_ServerKexPayloadLength; }
@@ -35,29 +139,218 @@ public:
 
 	Callback& GetCallback() { return m_Callback; }
 
+	//! Algorithm preferences; these must be set before connecting
+	Preferences& GetPreferences() { return m_Preferences; }
+
+	//! Algorithms chosen during the most recent key exchange
+	const NegotiatedAlgorithms& GetNegotiatedAlgorithms() const { return m_Negotiated; }
+
 	//! Requests a service
 	void RequestService(const char* serviceName);
-	void RequestPty(int recipientChannel, const char* term);
-	void OpenChannel(int channelId, const char* name);
-
 	void RequestUserAuth(const std::string& serviceName, const std::string& userName);
-	void RequestChannel(int recipientChannel, const std::string& requestType);
 
-	void TransmitChannelData(int channelId, const std::string& data);
+	/*! Opens a channel of the given type
+	 *
+	 *  Returns our number for the channel, which identifies it in all
+	 *  channel functions and callbacks. Channel requests can be made once
+	 *  OnChannelOpened() is called; data can be transmitted right away.
+	 */
+	int OpenChannel(const char* name);
+
+	/*! [SSH-CONNECT, 7.2] Opens a channel to 'host' and 'port', as seen from the server
+	 *
+	 *  The originator is the peer of the connection being forwarded. Like
+	 *  OpenChannel(), this returns our number for the channel.
+	 */
+	int OpenDirectTcpIp(const std::string& host, uint32_t port, const std::string& originatorAddress, uint32_t originatorPort);
+
+	/*! [SSH-CONNECT, 7.1] Asks the server to listen on 'address' and 'port'
+	 *
+	 *  Connections made to it arrive as forwarded-tcpip channels; see
+	 *  Callback::OnForwardedTcpIp(). The server's answer is passed to
+	 *  OnTcpIpForwardSuccess() or OnTcpIpForwardFailure(); if 'port' is 0,
+	 *  the server picks one and the former tells which.
+	 */
+	void RequestTcpIpForward(const std::string& address, uint32_t port);
+
+	//! [SSH-CONNECT, 7.1] Asks the server to stop listening; no reply is requested
+	void CancelTcpIpForward(const std::string& address, uint32_t port);
+
+	/*! [SSH-CONNECT, 5.1] Confirms a channel opened by the server
+	 *
+	 *  Until then, the channel is Opening: data transmitted on it is kept
+	 *  and sent once it's confirmed.
+	 */
+	void AcceptChannelOpen(int channelId);
+
+	//! [SSH-CONNECT, 5.1] Refuses a channel opened by the server; its number is released right away, without OnChannelClosed()
+	void RejectChannelOpen(int channelId, Numbers::ChannelReason reason, const std::string& description);
+
+	//! Requests a pseudo-terminal on an open channel
+	void RequestPty(int channelId, const char* term);
+
+	//! Requests execution of a command on an open channel
+	void RequestExec(int channelId, const std::string& command);
+
+	//! Makes a channel request without any arguments, such as 'shell'
+	void RequestChannel(int channelId, const std::string& requestType);
+
+	//! Largest amount of channel data sent in a single packet
+	static const size_t maxChannelDataLength = 32768;
+
+	/*! Transmits channel data
+	 *
+	 *  Whatever does not fit in the server's window is kept and sent once
+	 *  the server adjusts it; use GetChannelPendingBytes() to avoid
+	 *  piling up data.
+	 */
+	void TransmitChannelData(int channelId, const uint8_t* data, size_t len);
+
+	//! Bytes given to TransmitChannelData() that still await window
+	size_t GetChannelPendingBytes(int channelId);
+
+	/*! Bytes that can be sent on a channel right away, in a single packet
+	 *
+	 *  This is 0 until the channel is open, while data is pending and once
+	 *  the server's window is used up; OnChannelWritable() follows once it
+	 *  is not anymore.
+	 */
+	size_t GetChannelSendRoom(int channelId);
+
+	/*! Reads channel data from 'socket' straight into a packet
+	 *
+	 *  At most GetChannelSendRoom() bytes are read, so the data is never
+	 *  copied or kept around. Returns what TransmitChannelData() would
+	 *  have been given: the number of bytes, 0 if the socket has nothing or
+	 *  there is no room, -1 on errors or end-of-file.
+	 */
+	ssize_t TransmitChannelDataFrom(int channelId, Socket& socket);
+
+	//! [SSH-CONNECT, 5.3] Signals we will send no more data; sent after any pending data
+	void SendChannelEOF(int channelId);
+
+	//! [SSH-CONNECT, 5.3] Closes a channel; OnChannelClosed() follows once the server agrees
+	void CloseChannel(int channelId);
+
+	//! Returns the channel with the given number, or NULL if there is none
+	Channel* GetChannel(int channelId);
+
+	//! Number of channels currently in use
+	size_t GetChannelCount() const { return m_Channels.size() - m_FreeChannelIds.size(); }
+
 	void AdjustChannelWindow(int channelId, unsigned int bytesToAdd);
 
+	/*! Informs us that the application is done with channel data
+	 *
+	 *  This hands the window back to the server, growing it if the channel
+	 *  turns out to be limited by it. Call this rather than
+	 *  AdjustChannelWindow() for data passed to OnChannelData().
+	 */
+	void ChannelDataConsumed(int channelId, size_t len);
+
+	/*! Hands all consumed channel data back to the server right away
+	 *
+	 *  ChannelDataConsumed() holds back window adjusts until half the window
+	 *  is used up; call this if the server must not wait for that, e.g.
+	 *  when the application is about to idle.
+	 */
+	void AcknowledgeChannelData(int channelId);
+
+	//! Number of SSH_MSG_CHANNEL_WINDOW_ADJUST packets sent
+	uint64_t GetWindowAdjustCount() const { return m_WindowAdjustCount; }
+
+	//! Window settings for channels opened from now on
+	ChannelWindow::Settings& GetChannelWindowSettings() { return m_ChannelWindowSettings; }
+
+	//! Settings for compressing outgoing packets, once that starts
+	Compressor::Settings& GetCompressionSettings() { return m_CompressionSettings; }
+
+	//! Compressor of outgoing packets, i.e. for its statistics; NULL if they aren't compressed
+	const Compressor* GetCompressor() const { return m_Compressor; }
+
 	const Socket& GetSocket() const { return m_Socket; }
 
 private:
-	void SendKexInitReply();
-	void OnMessageKexInit(Buffer& buffer, size_t packetLength, size_t paddingLength);
+	//! Queues our greeter and switches the socket to non-blocking mode
+	void SendGreeter();
+
+	//! Looks for the server's greeter in the receive buffer; returns false if it is incomplete
+	bool ReceiveGreeter();
+	void ProcessPackets();
+
+	//! Sends our SSH_MSG_KEXINIT; if 'guess' is set, our first key exchange packet follows right away
+	void SendKexInit(bool guess);
+	void OnMessageKexInit(Buffer& buffer, size_t payloadEnd);
+
+	//! Creates m_KeyExchange for the given method and sends its first packet
+	void StartKeyExchange(const std::string& method);
+
+	//! Is any of the rekey limits reached?
+	bool IsRekeyDue() const;
+
+	//! Sends what a key exchange held back, once the new keys are in effect
+	void ResumeAfterKeyExchange();
+
+	//! Compresses the payload of a packet under construction into a new one, which is returned
+	Buffer& CompressPacket(Buffer& packet);
+
+	//! Decompresses the payload of the packet being processed; returns the buffer holding it and where it ends
+	Buffer& DecompressPayload(size_t& payloadEnd);
+
+	//! Starts or stops compression, as negotiated and once we are authenticated
+	void UpdateCompression();
+
+	//! Like GetChannel(), but throws if there is no such channel
+	Channel& LookupChannel(uint32_t channelId);
+
+	//! Creates a channel using the lowest free channel number
+	Channel& AllocateChannel();
+
+	//! Allocates a channel and queues SSH_MSG_CHANNEL_OPEN; the caller adds type-specific data and transmits it
+	Buffer& BeginChannelOpen(const char* name, int& channelNumber);
+
+	//! See GetChannelSendRoom()
+	size_t GetSendRoom(const Channel& channel) const;
+
+	//! Sends as much pending data as the window allows, followed by a pending EOF
+	void TransmitPendingChannelData(Channel& channel);
+
+	//! Sends data that is known to fit in the window
+	void TransmitChannelDataPacket(Channel& channel, const uint8_t* data, size_t len);
+
+	//! Releases the channel number once both sides have closed the channel
+	void ReleaseChannel(Channel& channel);
+
+	//! Destroys a channel and makes its number available again
+	void FreeChannel(uint32_t channelId);
 
 	//! Socket in use
 	Socket m_Socket;
 
-	//! Buffer
+	//! [SSH-TRANS, 6.1] Largest packet we must be able to process
+	static const size_t maxPacketLength = 35000;
+
+	//! Room for the MAC following a packet
+	static const size_t maxMACLength = 64;
+
+	//! Most a single packet occupies as received: length field, packet and MAC
+	static const size_t maxPacketSize = sizeof(uint32_t) + maxPacketLength + maxMACLength;
+
+	/*! Received data
+	 *
+	 *  Packets are processed in place; the buffer is only compacted once a
+	 *  packet starting at the read position may not fit anymore. Making it
+	 *  twice maxPacketSize ensures this happens at most once per
+	 *  maxPacketLength bytes received.
+	 */
 	Buffer m_Buffer;
 
+	//! Outgoing packets are built, encrypted and queued here
+	TransmitQueue m_TransmitQueue;
+
+	//! Room that must be left after the payload: random padding and the MAC
+	static const size_t maxPacketTail = 255 + 64;
+
 	Callback& m_Callback;
 
 	static const size_t maxGreeterLength = 256; // [SSH-TRANS, 4.2] and +1 for \0
@@ -71,14 +364,83 @@ private:
 
 	std::string m_SessionID;
 
-	DHKeyExchange* m_DHExchange;
+	Preferences m_Preferences;
+	NegotiatedAlgorithms m_Negotiated;
+
+	KeyExchange* m_KeyExchange;
 	Algorithm* m_Algorithm;
 	Algorithm* m_PendingAlgorithm;
 
+	//! Set if the server's guessed first key exchange packet must be skipped
+	bool m_IgnoreGuessedKexPacket;
+
+	//! Set from sending our SSH_MSG_KEXINIT until our SSH_MSG_NEWKEYS is sent
+	bool m_KexInProgress;
+
+	//! Set if our first key exchange packet followed our SSH_MSG_KEXINIT, until the server's arrives
+	bool m_KexGuessed;
+
+	//! [SSH-TRANS, 7] Set if the server preferred the key exchange and host key algorithms we picked last time, so a guess can be right
+	bool m_KexGuessable;
+
+	//! Payloads of packets held back while m_KexInProgress is set
+	std::deque<std::string> m_HeldPayloads;
+
 	uint32_t m_C2S_SequenceNumber;
 	uint32_t m_S2C_SequenceNumber;
 
+	//! Sequence numbers and bytes sent and received since the keys last changed, and when that was
+	uint32_t m_C2S_KeySequenceNumber;
+	uint32_t m_S2C_KeySequenceNumber;
+	uint64_t m_C2S_KeyBytes;
+	uint64_t m_S2C_KeyBytes;
+	Clock::time_point m_KeyTime;
+
+	//! When our latest SSH_MSG_KEXINIT was sent
+	Clock::time_point m_KexStart;
+
+	RekeySettings m_RekeySettings;
+	RekeyStatistics m_RekeyStatistics;
+
 	size_t m_BufferDecryptedPosition;
+
+	//! Set once the server accepted our authentication
+	bool m_Authenticated;
+
+	//! [OPENSSH-PROTOCOL, 1.2] zlib@openssh.com is in effect, and will be used once we are authenticated
+	bool m_DelayedCompression_C2S;
+	bool m_DelayedCompression_S2C;
+
+	//! Compression streams, if compression is in use; they last until it is turned off
+	Compressor* m_Compressor;
+	Decompressor* m_Decompressor;
+
+	//! Payload of the packet being processed, if it was compressed; only allocated along with m_Decompressor
+	std::unique_ptr<Buffer> m_DecompressedPayload;
+
+	Compressor::Settings m_CompressionSettings;
+
+	ChannelWindow::Settings m_ChannelWindowSettings;
+
+	/*! Channels, indexed by our channel number
+	 *
+	 *  Channel numbers are reused, lowest first, so the table stays dense.
+	 */
+	std::vector<std::unique_ptr<Channel>> m_Channels;
+
+	//! Unused entries in m_Channels, highest first
+	std::vector<uint32_t> m_FreeChannelIds;
+
+	uint64_t m_WindowAdjustCount;
+
+	//! A tcpip-forward request awaiting its reply
+	struct PendingForward {
+		std::string m_Address;
+		uint32_t m_Port;
+	};
+
+	//! [SSH-CONNECT, 4] global requests are answered in the order they are made
+	std::deque<PendingForward> m_PendingForwards;
 };
 
 } // namespace RSSH
@@ -28,6 +28,15 @@ std::string NameList::ToString() const
 	return s;
 }
 
+bool NameList::Contains(const std::string& name) const
+{
+	for(auto& n: m_Names) {
+		if (n == name)
+			return true;
+	}
+	return false;
+}
+
 Buffer& operator>>(Buffer& b, NameList& nl)
 {
 	std::string s;
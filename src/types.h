@@ -18,10 +18,12 @@ public:
 
 	std::string ToString() const;
 
-	const std::vector<std::string>& GetNames() {
+	const std::vector<std::string>& GetNames() const {
 		return m_Names;
 	}
 
+	bool Contains(const std::string& name) const;
+
 private:
 	std::vector<std::string> m_Names;
 };
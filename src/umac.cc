@@ -0,0 +1,370 @@
+#include "umac.h"
+#include <string.h>
+#include <algorithm>
+
+#include "cryptopp/aes.h"
+#include "cryptopp/misc.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RSSH_UMAC_SSE2
+#endif
+
+// AVX2 code is compiled using a function attribute and only used if the CPU supports it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RSSH_UMAC_AVX2
+#endif
+
+namespace RSSH {
+
+namespace {
+
+// [RFC4418, 5.3.2] POLY with 64-bit words: prime(64) = 2^64 - 59, and words
+// from 2^64 - 2^32 on are split up
+const uint64_t p64 = 0xffffffffffffffc5ULL;
+const uint64_t polyOffset = 59;
+const uint64_t polyMaxWord = 0xffffffff00000000ULL;
+const uint64_t polyKeyMask = 0x01ffffff01ffffffULL;
+
+// [RFC4418, 5.4] prime(36) = 2^36 - 5
+const uint64_t p36 = 0xffffffffbULL;
+const uint64_t mask36 = 0xfffffffffULL;
+
+inline uint32_t Load32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+inline uint32_t Load32BE(const uint8_t* p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+inline uint64_t Load64BE(const uint8_t* p)
+{
+	return (uint64_t)Load32BE(p) << 32 | Load32BE(&p[4]);
+}
+
+inline void Store32BE(uint8_t* p, uint32_t v)
+{
+	p[0] = (v >> 24) & 0xff;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+inline void Store64BE(uint8_t* p, uint64_t v)
+{
+	Store32BE(p, static_cast<uint32_t>(v >> 32));
+	Store32BE(&p[4], static_cast<uint32_t>(v));
+}
+
+//! [RFC4418, 3] Derives 'len' bytes of key material for 'index' using AES keyed with the key given
+void KDF(CryptoPP::BlockCipher& aes, uint64_t index, uint8_t* out, size_t len)
+{
+	for (uint64_t i = 1; len > 0; i++) {
+		uint8_t in[16], block[16];
+		Store64BE(&in[0], index);
+		Store64BE(&in[8], i);
+		aes.ProcessBlock(in, block);
+		const size_t n = std::min(len, sizeof(block));
+		memcpy(out, block, n);
+		out += n;
+		len -= n;
+	}
+}
+
+/*! [RFC4418, 5.2.2] NH of 'len' bytes, a multiple of 32, for each stream
+ *
+ *  Message words are little-endian, which ENDIAN-SWAP amounts to; stream
+ *  's' uses the key from word 4 * s on.
+ */
+template<unsigned int streams> void NH(const uint32_t* key, const uint8_t* data, size_t len, uint64_t* out)
+{
+	uint64_t sum[streams] = { 0 };
+	for (size_t i = 0; i < len / 4; i += 8, data += 32) {
+		uint32_t m[8];
+		for (int n = 0; n < 8; n++)
+			m[n] = Load32(&data[n * 4]);
+		for (unsigned int s = 0; s < streams; s++) {
+			const uint32_t* k = &key[i + 4 * s];
+			sum[s] += (uint64_t)(m[0] + k[0]) * (m[4] + k[4]) + (uint64_t)(m[1] + k[1]) * (m[5] + k[5]) +
+			          (uint64_t)(m[2] + k[2]) * (m[6] + k[6]) + (uint64_t)(m[3] + k[3]) * (m[7] + k[7]);
+		}
+	}
+	for (unsigned int s = 0; s < streams; s++)
+		out[s] = sum[s];
+}
+
+#ifdef RSSH_UMAC_SSE2
+/*! Like NH(), but a group of eight words at a time
+ *
+ *  Words 0-3 and 4-7 of the group go in a vector each, so multiplying
+ *  the even and the odd lanes yields the four products.
+ */
+template<unsigned int streams> void NH_SSE2(const uint32_t* key, const uint8_t* data, size_t len, uint64_t* out)
+{
+	__m128i sum[streams];
+	for (unsigned int s = 0; s < streams; s++)
+		sum[s] = _mm_setzero_si128();
+	for (size_t i = 0; i < len / 4; i += 8) {
+		const __m128i m0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&data[i * 4]));
+		const __m128i m1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&data[i * 4 + 16]));
+		for (unsigned int s = 0; s < streams; s++) {
+			const __m128i a = _mm_add_epi32(m0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&key[i + 4 * s])));
+			const __m128i b = _mm_add_epi32(m1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&key[i + 4 * s + 4])));
+			sum[s] = _mm_add_epi64(sum[s], _mm_mul_epu32(a, b));
+			sum[s] = _mm_add_epi64(sum[s], _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)));
+		}
+	}
+	for (unsigned int s = 0; s < streams; s++) {
+		uint64_t v[2];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(v), sum[s]);
+		out[s] = v[0] + v[1];
+	}
+}
+#endif /* RSSH_UMAC_SSE2 */
+
+#ifdef RSSH_UMAC_AVX2
+//! Like NH_SSE2(), but two groups at a time; the halves of both are swapped so each vector holds one half of each
+template<unsigned int streams> __attribute__((target("avx2"))) void NH_AVX2(const uint32_t* key, const uint8_t* data, size_t len, uint64_t* out)
+{
+	__m256i sum[streams];
+	for (unsigned int s = 0; s < streams; s++)
+		sum[s] = _mm256_setzero_si256();
+	const size_t words = len / 4;
+	size_t i = 0;
+	for (/* nothing */; i + 16 <= words; i += 16) {
+		const __m256i m0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&data[i * 4]));
+		const __m256i m1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&data[i * 4 + 32]));
+		for (unsigned int s = 0; s < streams; s++) {
+			const __m256i x0 = _mm256_add_epi32(m0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&key[i + 4 * s])));
+			const __m256i x1 = _mm256_add_epi32(m1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&key[i + 4 * s + 8])));
+			const __m256i a = _mm256_permute2x128_si256(x0, x1, 0x20);
+			const __m256i b = _mm256_permute2x128_si256(x0, x1, 0x31);
+			sum[s] = _mm256_add_epi64(sum[s], _mm256_mul_epu32(a, b));
+			sum[s] = _mm256_add_epi64(sum[s], _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)));
+		}
+	}
+
+	// A last group of eight words only occurs at the end of a message
+	uint64_t last[streams] = { 0 };
+	if (i < words)
+		NH<streams>(&key[i], &data[i * 4], len - i * 4, last);
+	for (unsigned int s = 0; s < streams; s++) {
+		uint64_t v[4];
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(v), sum[s]);
+		out[s] = v[0] + v[1] + v[2] + v[3] + last[s];
+	}
+}
+
+bool HasAVX2()
+{
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2;
+}
+#endif /* RSSH_UMAC_AVX2 */
+
+//! Picks the fastest NH the compiler and CPU support
+template<unsigned int streams> void HashNH(const uint32_t* key, const uint8_t* data, size_t len, uint64_t* out)
+{
+#ifdef RSSH_UMAC_AVX2
+	if (HasAVX2()) {
+		NH_AVX2<streams>(key, data, len, out);
+		return;
+	}
+#endif
+#ifdef RSSH_UMAC_SSE2
+	NH_SSE2<streams>(key, data, len, out);
+#else
+	NH<streams>(key, data, len, out);
+#endif
+}
+
+//! Returns k * y + m mod p64, for y below p64 and k below 2^57 (as masked)
+uint64_t MultiplyAdd(uint64_t k, uint64_t y, uint64_t m)
+{
+	// 2^64 = 59 (mod p64), so the high half is folded into the low one; twice is enough to fit in 64 bits
+	unsigned __int128 t = (unsigned __int128)k * y + m;
+	t = (t >> 64) * polyOffset + static_cast<uint64_t>(t);
+	t = (t >> 64) * polyOffset + static_cast<uint64_t>(t);
+	const uint64_t r = static_cast<uint64_t>(t);
+	return r >= p64 ? r - p64 : r;
+}
+
+//! [RFC4418, 5.3.2] Adds word 'm' to POLY accumulator 'y'
+void Poly(uint64_t& y, uint64_t k, uint64_t m)
+{
+	if (m >= polyMaxWord) {
+		y = MultiplyAdd(k, y, p64 - 1);
+		m -= polyOffset;
+	}
+	y = MultiplyAdd(k, y, m);
+}
+
+/*! [RFC4418, 5.4] L3-HASH
+ *
+ *  The input is 16 bytes of which the first 8 are always zero, as L2
+ *  only yields a 64-bit value; 'v' holds the other 8. 'key1' holds the
+ *  last four of the eight key words, already reduced modulo p36.
+ */
+uint32_t L3(const uint64_t* key1, uint32_t key2, uint64_t v)
+{
+	uint64_t t = key1[0] * static_cast<uint16_t>(v >> 48) + key1[1] * static_cast<uint16_t>(v >> 32) +
+	             key1[2] * static_cast<uint16_t>(v >> 16) + key1[3] * static_cast<uint16_t>(v);
+	t = (t & mask36) + 5 * (t >> 36);
+	if (t >= p36)
+		t -= p36;
+	return static_cast<uint32_t>(t) ^ key2;
+}
+
+} // unnamed namespace
+
+UMAC::UMAC(const uint8_t* key, size_t tagLength)
+	: m_TagLength(tagLength), m_Streams(tagLength / 4), m_PadNonce(0), m_PadValid(false), m_Nonce(0), m_MultipleChunks(false), m_ChunkLength(0)
+{
+	// [RFC4418, 5.1] Key material for fewer streams is a prefix of that for more
+	CryptoPP::AES::Encryption aes(key, keyLength);
+	uint8_t buf[nhKeyWords * 4];
+	KDF(aes, 1, buf, nhKeyWords * 4);
+	for (size_t n = 0; n < nhKeyWords; n++)
+		m_NHKey[n] = Load32BE(&buf[n * 4]);
+	KDF(aes, 2, buf, maxStreams * 24);
+	for (unsigned int s = 0; s < maxStreams; s++)
+		m_PolyKey[s] = Load64BE(&buf[s * 24]) & polyKeyMask;
+	KDF(aes, 3, buf, maxStreams * 64);
+	for (unsigned int s = 0; s < maxStreams; s++)
+		for (int n = 0; n < 4; n++)
+			m_L3Key1[s][n] = Load64BE(&buf[s * 64 + (4 + n) * 8]) % p36;
+	KDF(aes, 4, buf, maxStreams * 4);
+	for (unsigned int s = 0; s < maxStreams; s++)
+		m_L3Key2[s] = Load32BE(&buf[s * 4]);
+
+	// [RFC4418, 4]
+	KDF(aes, 0, buf, keyLength);
+	m_PadCipher = new CryptoPP::AES::Encryption(buf, keyLength);
+	memset(buf, 0, sizeof(buf));
+}
+
+UMAC::~UMAC()
+{
+	delete m_PadCipher;
+	memset(m_NHKey, 0, sizeof(m_NHKey));
+	memset(m_PolyKey, 0, sizeof(m_PolyKey));
+	memset(m_L3Key1, 0, sizeof(m_L3Key1));
+	memset(m_L3Key2, 0, sizeof(m_L3Key2));
+	memset(m_Pad, 0, sizeof(m_Pad));
+}
+
+void UMAC::Calculate(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, uint8_t* out)
+{
+	Begin(sequenceNumber);
+	Update(buffer, len);
+	Final(out);
+}
+
+bool UMAC::Verify(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, const uint8_t* hmac)
+{
+	Begin(sequenceNumber);
+	Update(buffer, len);
+	return VerifyFinal(hmac);
+}
+
+size_t UMAC::GetLength() const
+{
+	return m_TagLength;
+}
+
+void UMAC::Begin(uint32_t sequenceNumber)
+{
+	m_Nonce = sequenceNumber;
+	for (unsigned int s = 0; s < m_Streams; s++)
+		m_Poly[s] = 1;
+	m_MultipleChunks = false;
+	m_ChunkLength = 0;
+}
+
+void UMAC::Update(const uint8_t* buffer, size_t len)
+{
+	// A full chunk is only hashed once more follows: if it's the only one, L2 is skipped
+	if (m_ChunkLength > 0) {
+		const size_t n = std::min(len, chunkSize - m_ChunkLength);
+		memcpy(&m_Chunk[m_ChunkLength], buffer, n);
+		m_ChunkLength += n;
+		buffer += n;
+		len -= n;
+		if (len == 0)
+			return;
+		HashChunk(m_Chunk);
+		m_ChunkLength = 0;
+	}
+	for (/* nothing */; len > chunkSize; buffer += chunkSize, len -= chunkSize)
+		HashChunk(buffer);
+	memcpy(m_Chunk, buffer, len);
+	m_ChunkLength = len;
+}
+
+void UMAC::Final(uint8_t* out)
+{
+	// [RFC4418, 5.2.1] The last chunk is zero-padded to a positive multiple of 32 bytes
+	const size_t padded = std::max<size_t>((m_ChunkLength + 31) & ~static_cast<size_t>(31), 32);
+	memset(&m_Chunk[m_ChunkLength], 0, padded - m_ChunkLength);
+	uint64_t hash[maxStreams];
+	L1(m_Chunk, padded, m_ChunkLength, hash);
+
+	// [RFC4418, 5.1] L2 is only used for messages over a chunk
+	if (m_MultipleChunks) {
+		for (unsigned int s = 0; s < m_Streams; s++) {
+			Poly(m_Poly[s], m_PolyKey[s], hash[s]);
+			hash[s] = m_Poly[s];
+		}
+	}
+
+	// [RFC4418, 4] The pad is an AES block of the nonce; UMAC-64 uses the
+	// half picked by its lowest bit, so two nonces in a row share a block
+	const uint8_t* pad = m_Pad;
+	const uint64_t padNonce = m_TagLength == 8 ? m_Nonce & ~static_cast<uint64_t>(1) : m_Nonce;
+	if (!m_PadValid || m_PadNonce != padNonce) {
+		uint8_t block[16] = { 0 };
+		Store64BE(block, padNonce);
+		m_PadCipher->ProcessBlock(block, m_Pad);
+		m_PadNonce = padNonce;
+		m_PadValid = true;
+	}
+	if (m_TagLength == 8)
+		pad += (m_Nonce & 1) * 8;
+
+	for (unsigned int s = 0; s < m_Streams; s++)
+		Store32BE(&out[s * 4], L3(m_L3Key1[s], m_L3Key2[s], hash[s]) ^ Load32BE(&pad[s * 4]));
+}
+
+bool UMAC::VerifyFinal(const uint8_t* hmac)
+{
+	uint8_t tag[maxStreams * 4];
+	Final(tag);
+	return CryptoPP::VerifyBufsEqual(tag, hmac, m_TagLength);
+}
+
+void UMAC::L1(const uint8_t* chunk, size_t padded, size_t len, uint64_t* out) const
+{
+	if (m_Streams == 2)
+		HashNH<2>(m_NHKey, chunk, padded, out);
+	else
+		HashNH<4>(m_NHKey, chunk, padded, out);
+
+	// [RFC4418, 5.2.1] NH is followed by adding the length in bits
+	for (unsigned int s = 0; s < m_Streams; s++)
+		out[s] += static_cast<uint64_t>(len) * 8;
+}
+
+void UMAC::HashChunk(const uint8_t* chunk)
+{
+	uint64_t hash[maxStreams];
+	L1(chunk, chunkSize, chunkSize, hash);
+	for (unsigned int s = 0; s < m_Streams; s++)
+		Poly(m_Poly[s], m_PolyKey[s], hash[s]);
+	m_MultipleChunks = true;
+}
+
+} // namespace RSSH
@@ -0,0 +1,92 @@
+#ifndef RSSH_UMAC_H
+#define RSSH_UMAC_H
+
+#include "ihmac.h"
+
+namespace CryptoPP {
+class BlockCipher;
+} // namespace CryptoPP
+
+namespace RSSH {
+
+/*! UMAC [RFC4418] with AES-128, as umac-64@openssh.com and umac-128@openssh.com
+ *
+ *  The sequence number is the nonce, as an 8-byte big-endian integer; it
+ *  is not part of the message [OPENSSH-PROTOCOL, 1.1]. Nearly all the work
+ *  is NH, which hashes every 1 KB of the message with a multiply-add per
+ *  two words; this uses SSE2 or AVX2 when the compiler and CPU support it,
+ *  falling back to plain C++. Everything after NH happens once per 1 KB,
+ *  and an AES block once per packet (UMAC-64 gets two packets out of one).
+ *
+ *  Messages longer than 16 MB would need the second stage of L2 hashing,
+ *  which isn't implemented: SSH packets are nowhere near that large.
+ */
+class UMAC final : public IHMAC {
+public:
+	static const size_t keyLength = 16;
+
+	//! 'tagLength' is 8 for UMAC-64 and 16 for UMAC-128
+	UMAC(const uint8_t* key, size_t tagLength);
+	~UMAC();
+
+	UMAC(const UMAC&) = delete;
+	UMAC& operator=(const UMAC&) = delete;
+
+	void Calculate(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, uint8_t* out) override;
+	bool Verify(const uint8_t* buffer, size_t len, uint32_t sequenceNumber, const uint8_t* hmac) override;
+	size_t GetLength() const override;
+
+	void Begin(uint32_t sequenceNumber) override;
+	void Update(const uint8_t* buffer, size_t len) override;
+	void Final(uint8_t* out) override;
+	bool VerifyFinal(const uint8_t* hmac) override;
+
+private:
+	//! [RFC4418, 5.2.1] L1 hashes the message in chunks of this size
+	static const size_t chunkSize = 1024;
+
+	//! One stream per 4 bytes of tag
+	static const unsigned int maxStreams = 4;
+
+	//! NH key in words; each stream uses 256 of them, 4 further along than the previous
+	static const size_t nhKeyWords = chunkSize / 4 + 4 * (maxStreams - 1);
+
+	/*! [RFC4418, 5.2.1] L1-HASH of a single chunk, for every stream
+	 *
+	 *  'padded' is the length of the chunk as hashed by NH, a multiple of
+	 *  32; 'len' is what it was before padding.
+	 */
+	void L1(const uint8_t* chunk, size_t padded, size_t len, uint64_t* out) const;
+
+	//! Hashes a full chunk that is not the last of the message, and adds it to the L2 hash of every stream
+	void HashChunk(const uint8_t* chunk);
+
+	//! Tag length in bytes, and the number of streams that implies
+	const size_t m_TagLength;
+	const unsigned int m_Streams;
+
+	//! [RFC4418, 5.1] Per-stream keys, derived from the key given
+	uint32_t m_NHKey[nhKeyWords];
+	uint64_t m_PolyKey[maxStreams];
+	uint64_t m_L3Key1[maxStreams][4];
+	uint32_t m_L3Key2[maxStreams];
+
+	//! AES keyed with the pad-derivation key [RFC4418, 4]
+	CryptoPP::BlockCipher* m_PadCipher;
+
+	//! UMAC-64 uses half an AES block per nonce; the block of the last even nonce is kept
+	uint64_t m_PadNonce;
+	uint8_t m_Pad[16];
+	bool m_PadValid;
+
+	//! Current message: its nonce, the L2 hash of each stream and the part of a chunk not hashed yet
+	uint64_t m_Nonce;
+	uint64_t m_Poly[maxStreams];
+	bool m_MultipleChunks;
+	uint8_t m_Chunk[chunkSize];
+	size_t m_ChunkLength;
+};
+
+} // namespace RSSH
+
+#endif /* RSSH_UMAC_H */